@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+
+using namespace std;
+
+
+//アリーナのチャンク(まとめて確保してから先頭から順に切り出すメモリ領域)一つあたりの大きさ
+//チャンクはこの大きさでアラインして確保するため、オブジェクトのアドレスからチャンクの先頭(ヘッダ)を求めることができる
+#define ARENA_CHUNK_SIZE (256 * 1024)
+
+//アリーナから確保する最大のオブジェクトの大きさ
+//これより大きいオブジェクトはアリーナのスコープ内でも通常の経路(malloc/free かスラブアロケータ)で確保、解放する
+#define ARENA_MAX_OBJECT_SIZE (16 * 1024)
+
+//スレッドごとに再利用のため保持しておく空のチャンクの数の上限
+//これを超えた場合は free で返す
+#define ARENA_CHUNK_CACHE_LIMIT 64
+
+
+/**
+ * 領域(リージョン)単位でまとめて解放するアリーナ
+ *
+ * スレッドの中だけで一時的な木構造等を作成し、最後にまとめて破棄する処理では、
+ * オブジェクトごとの malloc/free が作成と解放の大部分を占める。
+ * Arena のスコープ(Arena 型の変数の生存期間)の中では、そのスレッドの alloc_heap_object はアリーナのチャンクの先頭から順に切り出す(バンプアロケーション)。
+ * 参照カウントが0になったアリーナのオブジェクトはフィールドの参照カウントを減らす処理だけを行い、メモリは個別には解放しない。
+ * スコープを抜けた時点で全てのオブジェクトが解放済みのチャンクは、まとめて再利用される。
+ *
+ * >>> スコープを抜けた後も生存しているオブジェクト
+ * アリーナのオブジェクトはスコープの外へ持ち出すことができ、to_mutex() により複数のスレッドへ公開することもできる。
+ * オブジェクトを移動する(evacuate)にはそれを指す全てのフィールドとハンドルを書き換える必要があるが、それらを列挙する手段はない。
+ * そのため、スコープを抜けた時点で生存しているオブジェクトを含むチャンクはその場で固定(pin)し、
+ * 最後のオブジェクトが解放されるまでチャンクを解放しない。
+ *  + 各チャンクは確保したオブジェクト数と、所有者のスレッドで解放したオブジェクト数を通常の変数で数える
+ *  + 所有者以外のスレッド(公開された後で他のスレッドが解放した場合や、非同期解放のスレッド)と、
+ *    スコープを抜けた後の解放は live_count を atomic に一つ減らす(スコープ内では0以下の値になる)
+ *  + スコープを抜ける時に、まだ解放されていない数(確保した数 - 所有者が解放した数)を live_count に atomic に加える
+ *    結果が0であれば全て解放済みであり、そうでなければ以降の解放で live_count を0にしたスレッドがチャンクを解放する
+ * スコープの中で live_count が1から0になることはないため、チャンクを解放するのはスコープを抜けたスレッドか最後に解放したスレッドのどちらか一つだけである。
+ * 公開されたオブジェクトは参照カウントの規則に従って解放されるまで生存するため、is_mutex に関わらず安全である。
+ *
+ * スコープ内では解放したオブジェクトの領域を再利用しないため、スコープの中で確保と解放を長く繰り返す処理には向かない。
+ * 入れ子にしたスコープでは最も内側のアリーナから確保する。
+ * スコープはスタック上の変数として作成し、作成したスレッドで作成と逆の順に抜ける必要がある。
+ */
+
+
+/**
+ * チャンクの先頭に置くヘッダ
+ */
+struct alignas(64) ArenaChunk {
+    //このチャンクを所有するスレッドの印(arena_thread_mark のアドレス)
+    //所有者のアリーナのスコープを抜けた後は nullptr
+    atomic<void*> owner;
+    //同じアリーナが確保したチャンクのリスト
+    ArenaChunk* next;
+    //このチャンクから切り出したオブジェクト数(スコープを抜ける時か、次のチャンクへ移る時に設定される)
+    size_t allocated_count;
+    //所有者のスレッドがスコープ内で解放したオブジェクト数
+    size_t local_freed_count;
+    //所有者以外(スコープを抜けた後を含む)の解放で減らし、スコープを抜ける時にまだ解放されていない数を加える
+    atomic<int64_t> live_count;
+};
+
+
+#if RC_VALIDATION
+    //スコープを抜けた後も生存しているオブジェクトがあるため、固定されているチャンクの数
+    atomic_size_t arena_pinned_chunk_count(0);
+#endif
+
+
+class Arena;
+
+/**
+ * スレッドごとの最も内側のアリーナ(スコープ外では nullptr)
+ * 定数初期化されるため、アクセスの度に初期化済みかどうかの確認は行われない
+ */
+inline thread_local Arena* arena_current = nullptr;
+
+/**
+ * スレッドごとの印
+ * アドレスだけを使用し、チャンクの所有者がこのスレッドであるかどうかを比較する
+ */
+inline thread_local char arena_thread_mark;
+
+
+/**
+ * このスレッドのチャンクのキャッシュが既に破棄されたかどうか
+ * スレッドの終了時に他のスレッドローカルな変数の破棄(遅延参照カウントのバッファの反映等)から解放される場合に使用する
+ */
+inline thread_local bool arena_chunk_cache_is_destroyed = false;
+
+/**
+ * スレッドごとに再利用のため保持しておく空のチャンク
+ * スレッドの終了時に残っているチャンクを free で返す
+ */
+struct ArenaChunkCache {
+    ArenaChunk* chunks = nullptr;
+    size_t chunk_count = 0;
+
+    inline ~ArenaChunkCache() {
+        arena_chunk_cache_is_destroyed = true;
+        while (this->chunks != nullptr) {
+            auto* chunk = this->chunks;
+            this->chunks = chunk->next;
+            free(chunk);
+        }
+    }
+};
+
+inline thread_local ArenaChunkCache arena_chunk_cache;
+
+
+/**
+ * オブジェクトが属するチャンクのヘッダを取得
+ */
+inline ArenaChunk* arena_chunk_of(void* ptr) {
+    return (ArenaChunk*) ((uintptr_t) ptr & ~((uintptr_t) ARENA_CHUNK_SIZE - 1));
+}
+
+/**
+ * 全てのオブジェクトが解放されたチャンクを、このスレッドで再利用できるように保持する
+ */
+inline void arena_recycle_chunk(ArenaChunk* chunk) {
+    if (arena_chunk_cache_is_destroyed) {
+        free(chunk);
+        return;
+    }
+    auto& cache = arena_chunk_cache;
+    if (cache.chunk_count >= ARENA_CHUNK_CACHE_LIMIT) {
+        free(chunk);
+        return;
+    }
+    chunk->next = cache.chunks;
+    cache.chunks = chunk;
+    cache.chunk_count++;
+}
+
+/**
+ * このスレッドが所有する新しいチャンクを取得する
+ */
+inline ArenaChunk* arena_new_chunk() {
+    auto& cache = arena_chunk_cache;
+    auto* chunk = cache.chunks;
+    if (chunk != nullptr) {
+        cache.chunks = chunk->next;
+        cache.chunk_count--;
+    } else {
+        chunk = (ArenaChunk*) aligned_alloc(ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE);
+    }
+
+    chunk->owner.store(&arena_thread_mark, memory_order_relaxed);
+    chunk->next = nullptr;
+    chunk->allocated_count = 0;
+    chunk->local_freed_count = 0;
+    chunk->live_count.store(0, memory_order_relaxed);
+    return chunk;
+}
+
+
+/**
+ * アリーナのスコープ
+ * 作成したスレッドで、生存している間に確保されたオブジェクトをこのアリーナのチャンクから切り出す
+ */
+class Arena {
+
+private:
+    //一つ外側のアリーナ
+    Arena* outer;
+    //このアリーナが確保したチャンクのリスト(先頭が現在切り出しているチャンク)
+    ArenaChunk* chunks = nullptr;
+    //現在のチャンクの未使用領域
+    char* cursor = nullptr;
+    char* end = nullptr;
+    //現在のチャンクから切り出したオブジェクト数
+    size_t allocated_count = 0;
+
+    /**
+     * 新しいチャンクへ移ってから size バイトを切り出す
+     */
+    inline void* allocate_slow(size_t size) {
+        if (this->chunks != nullptr) {
+            this->chunks->allocated_count = this->allocated_count;
+        }
+
+        auto* chunk = arena_new_chunk();
+        chunk->next = this->chunks;
+        this->chunks = chunk;
+        this->cursor = (char*) (chunk + 1);
+        this->end = (char*) chunk + ARENA_CHUNK_SIZE;
+        this->allocated_count = 0;
+
+        auto* ptr = this->cursor;
+        this->cursor += size;
+        this->allocated_count++;
+        return ptr;
+    }
+
+public:
+    inline Arena() : outer(arena_current) {
+        arena_current = this;
+    }
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    /**
+     * スコープを抜け、全てのオブジェクトが解放済みのチャンクをまとめて再利用する
+     * 生存しているオブジェクトを含むチャンクは、最後のオブジェクトが解放されるまで固定する
+     */
+    inline ~Arena() {
+        arena_current = this->outer;
+        if (this->chunks != nullptr) {
+            this->chunks->allocated_count = this->allocated_count;
+        }
+
+        auto* chunk = this->chunks;
+        while (chunk != nullptr) {
+            auto* next = chunk->next;
+
+            //以降のこのスレッドでの解放も、他のスレッドと同じく live_count を減らす
+            chunk->owner.store(nullptr, memory_order_relaxed);
+            auto remaining_count = (int64_t) (chunk->allocated_count - chunk->local_freed_count);
+            //acq_rel により、他のスレッドがオブジェクトを解放するまでの書き込みを取得し、このスレッドの書き込みを最後に解放するスレッドへ公開する
+            if (chunk->live_count.fetch_add(remaining_count, memory_order_acq_rel) + remaining_count == 0) {
+                arena_recycle_chunk(chunk);
+            } else {
+#if RC_VALIDATION
+                arena_pinned_chunk_count.fetch_add(1, memory_order_relaxed);
+#endif
+            }
+
+            chunk = next;
+        }
+    }
+
+    /**
+     * size バイトの領域を切り出す
+     */
+    inline void* allocate(size_t size) {
+        //HeapObject のアラインメントに合わせる
+        size = (size + 7) & ~((size_t) 7);
+        if ((size_t) (this->end - this->cursor) < size) {
+            return this->allocate_slow(size);
+        }
+
+        auto* ptr = this->cursor;
+        this->cursor += size;
+        this->allocated_count++;
+        return ptr;
+    }
+
+};
+
+
+/**
+ * このスレッドがアリーナのスコープ内であれば、最も内側のアリーナから size バイトの領域を切り出す
+ * スコープ外であるか、ARENA_MAX_OBJECT_SIZE より大きい場合は nullptr を返す
+ */
+inline void* arena_alloc(size_t size) {
+    auto* arena = arena_current;
+    if (arena == nullptr || size > ARENA_MAX_OBJECT_SIZE) {
+        return nullptr;
+    }
+    return arena->allocate(size);
+}
+
+/**
+ * アリーナから切り出したオブジェクトを解放する
+ * メモリは個別には解放せず、チャンクの生存しているオブジェクト数を減らすだけにする
+ */
+inline void arena_free(void* ptr) {
+    auto* chunk = arena_chunk_of(ptr);
+
+    //所有者のスレッドのスコープ内であれば、通常の命令で数える
+    //他のスレッドは自身の印と一致しないことだけを確かめるため、所有者の書き換えと競合しても結果は変わらない
+    if (chunk->owner.load(memory_order_relaxed) == &arena_thread_mark) {
+        chunk->local_freed_count++;
+        return;
+    }
+
+    if (chunk->live_count.fetch_sub(1, memory_order_acq_rel) == 1) {
+        //スコープを抜けた後に最後のオブジェクトが解放された
+#if RC_VALIDATION
+        arena_pinned_chunk_count.fetch_sub(1, memory_order_relaxed);
+#endif
+        arena_recycle_chunk(chunk);
+    }
+}
@@ -0,0 +1,340 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "heap_object.hpp"
+
+using namespace std;
+
+
+/**
+ * 専用スレッドによるオブジェクトの非同期解放(BACKGROUND_RECLAMATION が true の場合に DynamicRC と ThreadSafeRC が使用する)
+ *
+ * 並列解放("parallel_teardown.hpp")は大きなオブジェクトの解放を分割するが、小さなオブジェクトでも
+ * フィールド以下の解放と free の分だけ最後の参照を手放したスレッドは止まる。
+ * 応答時間を重視するスレッドのために、参照カウントが0になったオブジェクトをキューへ入れるだけにして、
+ * フィールド以下の参照カウントの減少と解放は専用のスレッド(回収スレッド)が行う。
+ *
+ * >>> キュー
+ * 固定長のリングバッファで、各要素に書き込み済みかどうかを表す番号を持たせたロックフリーなキュー。
+ *  + 追加は複数のスレッドから compare-and-swap で書き込む位置を確保して行う
+ *  + 取り出しは回収スレッドのみが行うため、位置は通常の変数で持つ
+ * キューが一杯の場合(回収が追い付いていない場合)は追加せず、手放したスレッドでそのまま解放する(背圧)。
+ * そのため、解放が追い付かずにメモリ使用量が際限なく増えることはない。
+ *
+ * >>> 回収スレッドの待機
+ * キューが空の場合、回収スレッドは is_sleeping を立ててから条件変数で待機する。
+ * 追加したスレッドは is_sleeping が立っており、かつキューに BACKGROUND_RECLAMATION_WAKE_THRESHOLD 個以上溜まった場合にのみ
+ * ロックを取得して起こす。起こすとその場で回収スレッドへ切り替わり、手放したスレッドが解放と同じだけ待たされることがあるため、
+ * 少数の場合は回収スレッドが BACKGROUND_RECLAMATION_SLEEP_MICROSECONDS ごとに自ら起きて取り出すのに任せる。
+ * そのため、キューへの追加には通常システムコールもロックも発生しない。
+ *
+ * >>> 対象となるオブジェクト
+ * 並列解放と同じく、参照カウントを atomic に増減するオブジェクトのみが対象となる。
+ * DynamicRC では is_mutex が true のオブジェクトのみを渡し、is_mutex が false のオブジェクトはその場で解放する。
+ *
+ * 解放は非同期に行われるため、全ての解放を待つ場合は background_reclamation_wait() を呼び出す。
+ */
+
+
+#if BACKGROUND_RECLAMATION
+
+//キューに入れられるオブジェクトの数(2の累乗)
+#ifndef BACKGROUND_RECLAMATION_QUEUE_CAPACITY
+#define BACKGROUND_RECLAMATION_QUEUE_CAPACITY 4096
+#endif
+
+//キューにこの数以上溜まった場合に、待機している回収スレッドを起こす
+#define BACKGROUND_RECLAMATION_WAKE_THRESHOLD 64
+
+//回収スレッドが待機する最長の時間(マイクロ秒)
+#define BACKGROUND_RECLAMATION_SLEEP_MICROSECONDS 1000
+
+static_assert((BACKGROUND_RECLAMATION_QUEUE_CAPACITY & (BACKGROUND_RECLAMATION_QUEUE_CAPACITY - 1)) == 0,
+              "BACKGROUND_RECLAMATION_QUEUE_CAPACITY must be a power of two.");
+
+
+/**
+ * フィールドのオブジェクトの参照カウントを一つ減らし、0になった場合に true を返す関数
+ * atomic に減らす関数でなければならない
+ */
+typedef bool (*ReclaimReleaseFunction)(HeapObject*);
+
+
+/**
+ * 参照カウントが0になり、まだフィールドを処理していないオブジェクト
+ */
+struct ReclaimTask {
+    HeapObject* object;
+    ReclaimReleaseFunction release_field;
+};
+
+
+/**
+ * キューの要素
+ * sequence がその位置に書き込める番号であれば空、番号 + 1 であれば書き込み済みを表す
+ */
+struct ReclaimCell {
+    atomic_size_t sequence;
+    ReclaimTask task;
+};
+
+
+/**
+ * 回収スレッドと、参照カウントが0になったオブジェクトのキュー
+ * 回収スレッドは最初にオブジェクトが渡された時に起動する
+ */
+class BackgroundReclaimer {
+
+private:
+    ReclaimCell cells[BACKGROUND_RECLAMATION_QUEUE_CAPACITY];
+    //次に追加する位置(追加するスレッド間で共有する)
+    alignas(64) atomic_size_t enqueue_position = 0;
+    //次に取り出す位置(回収スレッドのみが使用する)
+    alignas(64) size_t dequeue_position = 0;
+    //追加するスレッドが溜まっている数を見積もるための dequeue_position の写し
+    atomic_size_t dequeue_position_hint = 0;
+
+    //キューに入っているか、回収スレッドが処理中のオブジェクトの数
+    alignas(64) atomic_size_t outstanding_count = 0;
+    //回収スレッドが待機しているかどうか
+    atomic_bool is_sleeping = false;
+
+    //回収スレッドの起動と停止を保護する
+    mutex control_mutex;
+    //キューへ渡すかどうか(false の場合はその場で解放する)
+    atomic_bool is_enabled = true;
+    atomic_bool is_started = false;
+    thread reclaimer;
+
+    //待機している回収スレッドと background_reclamation_wait() を起こすために使用する
+    mutex sleep_mutex;
+    condition_variable work_available;
+    condition_variable work_finished;
+    bool is_stopping = false;
+
+public:
+    inline BackgroundReclaimer() {
+        for (size_t i = 0; i < BACKGROUND_RECLAMATION_QUEUE_CAPACITY; i++) {
+            this->cells[i].sequence.store(i, memory_order_relaxed);
+        }
+    }
+
+    inline ~BackgroundReclaimer() {
+        this->stop();
+    }
+
+    /**
+     * キューへ渡すかどうかを変更する
+     * 無効にする場合は、キューに入っているオブジェクトを全て解放してから回収スレッドを停止する
+     * 他のスレッドがオブジェクトを解放していない時に呼び出す必要がある
+     */
+    inline void set_enabled(bool is_enabled) {
+        if (!is_enabled) {
+            this->stop();
+        }
+        this->is_enabled.store(is_enabled, memory_order_relaxed);
+    }
+
+    /**
+     * 参照カウントが0になったオブジェクトをキューへ追加する
+     * キューが一杯であるか無効である場合は追加せずに false を返す(呼び出し元で解放する)
+     */
+    inline bool enqueue(HeapObject* object, ReclaimReleaseFunction release_field) {
+        if (!this->is_enabled.load(memory_order_relaxed)) {
+            return false;
+        }
+        if (!this->is_started.load(memory_order_acquire)) {
+            this->start();
+        }
+
+        //回収スレッドが処理を終えて減らすより先に増やしておく
+        this->outstanding_count.fetch_add(1, memory_order_relaxed);
+
+        auto position = this->enqueue_position.load(memory_order_relaxed);
+        ReclaimCell* cell;
+        while (true) {
+            cell = &this->cells[position & (BACKGROUND_RECLAMATION_QUEUE_CAPACITY - 1)];
+            auto sequence = cell->sequence.load(memory_order_acquire);
+            auto difference = (intptr_t) sequence - (intptr_t) position;
+
+            if (difference == 0) {
+                //空いているため、書き込む位置を確保する
+                if (this->enqueue_position.compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                //一周前のオブジェクトがまだ取り出されていない(一杯)
+                this->outstanding_count.fetch_sub(1, memory_order_relaxed);
+                return false;
+            } else {
+                //他のスレッドに先に確保された
+                position = this->enqueue_position.load(memory_order_relaxed);
+            }
+        }
+
+        cell->task = { object, release_field };
+        //この release により、オブジェクトのフィールドへの変更も含めて回収スレッドへ公開される
+        cell->sequence.store(position + 1, memory_order_release);
+
+        //回収スレッドの is_sleeping の書き込みとの間で、どちらかが必ず相手の書き込みを観測するようにする
+        atomic_thread_fence(memory_order_seq_cst);
+        if (this->is_sleeping.load(memory_order_relaxed)
+            && position + 1 - this->dequeue_position_hint.load(memory_order_relaxed) >= BACKGROUND_RECLAMATION_WAKE_THRESHOLD) {
+            this->wake_reclaimer();
+        }
+        return true;
+    }
+
+    /**
+     * キューへ渡した全てのオブジェクトの解放が終わるまで待機する
+     */
+    inline void wait() {
+        //溜まっている数が少なくても待たずに取り出させる
+        this->wake_reclaimer();
+        unique_lock<mutex> lock(this->sleep_mutex);
+        this->work_finished.wait(lock, [this]() { return this->outstanding_count.load(memory_order_acquire) == 0; });
+    }
+
+private:
+    inline void wake_reclaimer() {
+        lock_guard<mutex> lock(this->sleep_mutex);
+        this->work_available.notify_one();
+    }
+
+    inline void start() {
+        lock_guard<mutex> guard(this->control_mutex);
+        if (this->is_started.load(memory_order_relaxed)) {
+            return;
+        }
+
+        this->is_stopping = false;
+        this->reclaimer = thread([this]() { this->run_reclaimer(); });
+        this->is_started.store(true, memory_order_release);
+    }
+
+    inline void stop() {
+        lock_guard<mutex> guard(this->control_mutex);
+        if (!this->is_started.load(memory_order_relaxed)) {
+            return;
+        }
+
+        this->wait();
+        {
+            lock_guard<mutex> lock(this->sleep_mutex);
+            this->is_stopping = true;
+        }
+        this->work_available.notify_all();
+        this->reclaimer.join();
+        this->is_started.store(false, memory_order_relaxed);
+    }
+
+    /**
+     * キューの先頭のオブジェクトを取り出す
+     * 空であれば false を返す
+     */
+    inline bool dequeue(ReclaimTask& task) {
+        auto position = this->dequeue_position;
+        auto& cell = this->cells[position & (BACKGROUND_RECLAMATION_QUEUE_CAPACITY - 1)];
+        if (cell.sequence.load(memory_order_acquire) != position + 1) {
+            return false;
+        }
+
+        task = cell.task;
+        //一周後に追加するスレッドがこの位置へ書き込めるようにする
+        cell.sequence.store(position + BACKGROUND_RECLAMATION_QUEUE_CAPACITY, memory_order_release);
+        this->dequeue_position = position + 1;
+        this->dequeue_position_hint.store(position + 1, memory_order_relaxed);
+        return true;
+    }
+
+    /**
+     * キューが空でないかどうか(回収スレッドのみが呼び出す)
+     */
+    inline bool has_task() {
+        auto position = this->dequeue_position;
+        auto& cell = this->cells[position & (BACKGROUND_RECLAMATION_QUEUE_CAPACITY - 1)];
+        return cell.sequence.load(memory_order_acquire) == position + 1;
+    }
+
+    inline void run_reclaimer() {
+        while (true) {
+            ReclaimTask task;
+            if (this->dequeue(task)) {
+                //フィールド以下のオブジェクトの参照カウントを減らしながら解放する
+                free_heap_object_graph(task.object, task.release_field);
+
+                if (this->outstanding_count.fetch_sub(1, memory_order_acq_rel) == 1) {
+                    //全ての解放が終わったことを background_reclamation_wait() へ伝える
+                    lock_guard<mutex> lock(this->sleep_mutex);
+                    this->work_finished.notify_all();
+                }
+                continue;
+            }
+
+            this->is_sleeping.store(true, memory_order_relaxed);
+            //追加したスレッドの fence と対になる
+            atomic_thread_fence(memory_order_seq_cst);
+            bool is_stopping;
+            {
+                unique_lock<mutex> lock(this->sleep_mutex);
+                this->work_available.wait_for(lock, chrono::microseconds(BACKGROUND_RECLAMATION_SLEEP_MICROSECONDS),
+                                              [this]() { return this->is_stopping || this->has_task(); });
+                is_stopping = this->is_stopping;
+            }
+            this->is_sleeping.store(false, memory_order_relaxed);
+
+            if (is_stopping && !this->has_task()) {
+                //停止する(キューは stop() で空になるまで待ってから停止されるため、残っているオブジェクトはない)
+                return;
+            }
+        }
+    }
+
+};
+
+
+/**
+ * 全てのスレッドで共有する回収スレッド
+ * グローバル変数のハンドルの破棄時にも使用できるように、それらより先に構築されるヘッダ内で定義する
+ */
+inline BackgroundReclaimer background_reclaimer;
+
+
+/**
+ * 参照カウントが0になったオブジェクトを回収スレッドへ渡す
+ * キューが一杯の場合は false を返し、呼び出し元でそのまま解放する
+ * release_field は atomic に参照カウントを減らす関数でなければならない
+ */
+inline bool background_reclaim(HeapObject* dead_object, ReclaimReleaseFunction release_field) {
+    return background_reclaimer.enqueue(dead_object, release_field);
+}
+
+/**
+ * 回収スレッドへ渡すかどうかを変更する(false の場合はその場で解放する)
+ * 他のスレッドがオブジェクトを解放していない時に呼び出す必要がある
+ */
+inline void background_reclamation_set_enabled(bool is_enabled) {
+    background_reclaimer.set_enabled(is_enabled);
+}
+
+/**
+ * 回収スレッドへ渡した全ての解放が終わるまで待機する
+ */
+inline void background_reclamation_wait() {
+    background_reclaimer.wait();
+}
+
+#else
+
+/**
+ * 回収スレッドを使用しない場合は何もしない
+ */
+inline void background_reclamation_wait() {}
+
+#endif
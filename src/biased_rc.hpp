@@ -0,0 +1,603 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <optional>
+#include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+
+using namespace std;
+
+
+#if COMPACT_HEAP_OBJECT_HEADER
+    #error "BiasedRC requires the default HeapObject header (COMPACT_HEAP_OBJECT_HEADER must be false)"
+#endif
+
+
+/**
+ * 偏り参照カウント(Biased Reference Counting)による動的切り替え参照カウント
+ *
+ * DynamicRC は is_mutex が true になったオブジェクトの参照カウントを、それ以降常に atomic-read-modify-write で増減させる。
+ * しかし、複数のスレッドからアクセスされうるオブジェクトであっても、実際の参照カウントの増減の大半は
+ * そのオブジェクトを作成したスレッドから行われることが多い。
+ * そこで、オブジェクトごとに所有者のスレッドを記録し、参照カウントを二つのカウンタに分ける。
+ *  + biased カウンタ : 所有者のスレッドだけが通常の命令で増減させる
+ *  + shared カウンタ : 所有者以外のスレッドが atomic-read-modify-write で増減させる
+ * 実際の参照カウントは二つのカウンタの和であり、shared カウンタは負になることもある。
+ * is_mutex が false の間は DynamicRC と同じく biased カウンタだけを通常の命令で増減させる。
+ *
+ * >>> 所有者
+ * オブジェクトの所有者は、そのオブジェクトを作成したスレッドとする。
+ * is_mutex が false のオブジェクトは作成したスレッドからしかアクセスできないため、
+ * to_mutex() で is_mutex を true にするのも必ず作成したスレッドであり、所有者と一致する。
+ * 所有者はヘッダに16bitのスレッドの番号(BiasedThreadRecord の番号)として記録する。
+ *
+ * >>> 二つのカウンタの併合(merge)
+ * shared カウンタのワードは、下位2bitをフラグとして使用し、残りを符号付きのカウンタとして使用する。
+ *  + BIASED_MERGED_BIT : 二つのカウンタが併合され、以降は全てのスレッドが shared カウンタを使用する
+ *  + BIASED_QUEUED_BIT : 所有者のキューに入れられている
+ *
+ *  1. 所有者が biased カウンタを0にした場合、所有者の記録を消してから BIASED_MERGED_BIT を立てる(暗黙的な併合)
+ *     その時点の shared カウンタが実際の参照カウントであり、0であればその場で解放する
+ *  2. 所有者以外のスレッドが shared カウンタを負にしようとした場合、biased カウンタを読めないため解放すべきか判断できない
+ *     そこで、減らす代わりにその参照をオブジェクトごと所有者のキューへ入れ、BIASED_QUEUED_BIT を立てる
+ *     所有者は後でキューを処理し、biased カウンタを shared カウンタへ加えて併合してから、キューが持っていた参照を減らす(明示的な併合)
+ * 併合されていない間は biased カウンタが1以上であるため、所有者以外のスレッドが減らした結果で解放されることはない。
+ * また、キューに入っているオブジェクトはキューが参照を一つ持っているため、キューを処理するまで解放されない。
+ *
+ * >>> スレッドの終了
+ * スレッドの番号と BiasedThreadRecord は終了したスレッドのものを新しいスレッドが再利用し、
+ * 終了したスレッドが所有していたオブジェクトの所有権もそのまま引き継ぐ。
+ * 終了したスレッドのキューにオブジェクトを入れたスレッドは、BiasedThreadRecord を一時的に取得してキューを処理する。
+ *
+ * 参考
+ *  + Jiho Choi, Thomas Shull, Josep Torrellas, "Biased Reference Counting: Minimizing Atomic Operations in Garbage Collection" (PACT 2018)
+ */
+
+
+//所有者のスレッドを持たない(併合済み若しくは作成直後の)オブジェクトの所有者の番号
+#define BIASED_NO_OWNER 0
+
+//まだ BiasedThreadRecord を持たないスレッドの番号
+//オブジェクトの所有者の番号とは一致しない
+#define BIASED_UNREGISTERED_THREAD 0xFFFF
+
+//同時に存在できるスレッドの最大数(番号 1 ~ BIASED_MAX_THREADS - 1 を使用する)
+#define BIASED_MAX_THREADS 0xFFFF
+
+//shared カウンタのワードにおける、二つのカウンタが併合されたことを表すビット
+#define BIASED_MERGED_BIT 1
+
+//shared カウンタのワードにおける、所有者のキューに入れられていることを表すビット
+#define BIASED_QUEUED_BIT 2
+
+//shared カウンタのワードにおける、カウンタの1にあたる値
+#define BIASED_SHARED_ONE 4
+
+
+/**
+ * スレッドごとの所有者としての状態
+ * 所有しているオブジェクトがスレッドの終了後も残るため破棄せず、新しく起動したスレッドが再利用する。
+ */
+struct BiasedThreadRecord {
+    //いずれかのスレッドが使用しているかどうか
+    atomic_bool is_in_use = true;
+    //キューにオブジェクトが入っているかどうか
+    atomic_bool has_queued = false;
+    //所有者以外のスレッドが shared カウンタを負にしようとしたオブジェクトのキュー
+    //所有者以外のスレッドが参照カウントを0にすることは稀であるため、単純に mutex で保護する
+    mutex queue_mutex;
+    vector<HeapObject*> queue;
+};
+
+
+/**
+ * スレッドの番号から BiasedThreadRecord を引く表
+ */
+inline atomic<BiasedThreadRecord*> biased_thread_records[BIASED_MAX_THREADS];
+
+/**
+ * 次に割り当てるスレッドの番号
+ */
+inline atomic_size_t biased_thread_record_count = 1;
+
+/**
+ * このスレッドの番号
+ */
+inline thread_local uint16_t biased_thread_index = BIASED_UNREGISTERED_THREAD;
+
+
+/**
+ * shared カウンタのワードからカウンタの値を取り出す
+ */
+inline int32_t biased_shared_count(uint32_t shared_word) {
+    return ((int32_t) shared_word) >> 2;
+}
+
+
+inline void biased_enqueue(HeapObject* object_ref, uint16_t owner_index);
+inline void biased_collect();
+
+
+/**
+ * 偏り参照カウントのハンドル
+ * 参照カウントの増減以外は DynamicRC と同じである
+ */
+class BiasedRC {
+
+private:
+    //オブジェクト本体へのポインタ
+    HeapObject* object_ref;
+
+public:
+    /**
+     * オブジェクトを受け取る
+     * 作成直後のオブジェクトであれば、このスレッドを所有者として biased カウンタを初期化する
+     */
+    inline explicit BiasedRC(HeapObject* object_ref) {
+        if (!object_ref->get_is_mutex() && object_ref->biased_owner_index()->load(memory_order_relaxed) == BIASED_NO_OWNER) {
+            init_biased_reference_count(object_ref);
+        }
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * オブジェクトの is_mutex の値を変更して初期化
+     */
+    inline BiasedRC(HeapObject* object_ref, bool is_mutex) : BiasedRC(object_ref) {
+        object_ref->set_is_mutex(is_mutex);
+    }
+
+    /**
+     * コピーコンストラクタ
+     * コピー時に参照カウントを一つ増やす
+     */
+    inline BiasedRC(const BiasedRC& rc) {
+        this->object_ref = rc.object_ref;
+        //ムーブ済みであれば空のハンドルとなる
+        if (rc.object_ref == nullptr) {
+            return;
+        }
+        retain_reference(rc.object_ref);
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空のハンドルとなり、以降はコピー、代入、破棄のみ行える(get_object、set_object、get_payload 等は呼び出してはならない)
+     */
+    inline BiasedRC(BiasedRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline BiasedRC& operator=(const BiasedRC& rc) {
+        BiasedRC copied(rc);
+        swap(this->object_ref, copied.object_ref);
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     */
+    inline BiasedRC& operator=(BiasedRC&& rc) noexcept {
+        BiasedRC moved(move(rc));
+        swap(this->object_ref, moved.object_ref);
+        return *this;
+    }
+
+    /**
+     * デストラクタ
+     * 呼び出される度に参照カウントを一つ減らす
+     */
+    inline ~BiasedRC() {
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
+        if (release_reference(this->object_ref)) {
+            free_heap_object_graph(this->object_ref, release_reference);
+        }
+    }
+
+
+    /**
+     * 作成直後のオブジェクトの所有者をこのスレッドにし、biased カウンタを1、shared カウンタを0にする
+     */
+    static inline void init_biased_reference_count(HeapObject* object_ref) {
+        auto thread_index = biased_thread_index;
+        if (thread_index == BIASED_UNREGISTERED_THREAD) {
+            thread_index = biased_register_thread();
+        }
+
+        *object_ref->biased_reference_count() = 1;
+        object_ref->shared_reference_word()->store(0, memory_order_relaxed);
+        object_ref->biased_owner_index()->store(thread_index, memory_order_relaxed);
+    }
+
+    /**
+     * オブジェクトの参照カウントを一つ増やす
+     */
+    static inline void retain_reference(HeapObject* object_ref) {
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (!object_ref->get_is_mutex()) {
+            //可能性がない場合は、通常の命令で biased カウンタを一つ増やす
+            (*object_ref->biased_reference_count())++;
+            return;
+        }
+
+        //可能性がある場合でも、このスレッドが所有者であれば通常の命令で biased カウンタを一つ増やす
+        //所有者の番号は所有者自身しか書き換えないため、所有者であるかどうかの判定は正しい
+        if (object_ref->biased_owner_index()->load(memory_order_relaxed) == biased_thread_index) {
+            (*object_ref->biased_reference_count())++;
+        } else {
+            object_ref->shared_reference_word()->fetch_add(BIASED_SHARED_ONE, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * オブジェクトの参照カウントを一つ減らし、減らした後の参照カウントが0であれば true を返す
+     */
+    static inline bool release_reference(HeapObject* object_ref) {
+        auto* biased_reference_count = object_ref->biased_reference_count();
+
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (!object_ref->get_is_mutex()) {
+            //可能性がない場合は、通常の命令で biased カウンタを一つ減らす
+            return --(*biased_reference_count) == 0;
+        }
+
+        auto* owner_index = object_ref->biased_owner_index();
+        if (owner_index->load(memory_order_relaxed) == biased_thread_index) {
+            //所有者である場合は、通常の命令で biased カウンタを一つ減らす
+            if (--(*biased_reference_count) != 0) {
+                return false;
+            }
+            return merge_on_zero(object_ref);
+        }
+
+        return release_shared_reference(object_ref);
+    }
+
+
+private:
+    /**
+     * 所有者が biased カウンタを0にした場合に、二つのカウンタを併合する(暗黙的な併合)
+     * 併合した時点で shared カウンタが0であれば true を返す
+     */
+    static __attribute__((noinline)) bool merge_on_zero(HeapObject* object_ref) {
+        //以降は所有者も shared カウンタを使用する
+        object_ref->biased_owner_index()->store(BIASED_NO_OWNER, memory_order_relaxed);
+        //acquire により、他のスレッドが shared カウンタを減らす前に行った変更を取得する
+        auto shared_word = object_ref->shared_reference_word()->fetch_or(BIASED_MERGED_BIT, memory_order_acq_rel);
+
+        //キューに入っている場合は shared カウンタにキューの持つ参照が含まれているため、ここでは0にならない
+        return biased_shared_count(shared_word) == 0;
+    }
+
+    /**
+     * 所有者以外のスレッドから shared カウンタを一つ減らす
+     * 減らした後の参照カウントが0であれば true を返す
+     */
+    static __attribute__((noinline)) bool release_shared_reference(HeapObject* object_ref) {
+        auto* shared_reference_word = object_ref->shared_reference_word();
+        auto shared_word = shared_reference_word->load(memory_order_relaxed);
+
+        while (true) {
+            if ((shared_word & BIASED_MERGED_BIT) != 0) {
+                //併合済みであれば shared カウンタが実際の参照カウントである
+                auto previous_word = shared_reference_word->fetch_sub(BIASED_SHARED_ONE, memory_order_release);
+                if (biased_shared_count(previous_word) == 1) {
+                    //減らした後の参照カウントが0である場合は他のスレッド上での変更を取得
+                    atomic_thread_fence(memory_order_acquire);
+                    return true;
+                }
+                return false;
+            }
+
+            if (biased_shared_count(shared_word) <= 0 && (shared_word & BIASED_QUEUED_BIT) == 0) {
+                //shared カウンタが負になる場合は、参照カウントが0になったかどうかを所有者にしか判断できない
+                //減らす代わりに、この参照をオブジェクトごと所有者のキューへ入れる
+                if (shared_reference_word->compare_exchange_weak(shared_word, shared_word | BIASED_QUEUED_BIT, memory_order_relaxed)) {
+                    //併合されていないので所有者の番号は変わっていない
+                    biased_enqueue(object_ref, object_ref->biased_owner_index()->load(memory_order_relaxed));
+                    return false;
+                }
+                continue;
+            }
+
+            //併合されていない間は biased カウンタが1以上あるため、ここで参照カウントが0になることはない
+            if (shared_reference_word->compare_exchange_weak(shared_word, shared_word - BIASED_SHARED_ONE, memory_order_release, memory_order_relaxed)) {
+                return false;
+            }
+        }
+    }
+
+public:
+    /**
+     * キューに入っていたオブジェクトの二つのカウンタを併合し、キューが持っていた参照を減らす(明示的な併合)
+     * そのオブジェクトの所有者の BiasedThreadRecord を持つスレッドから呼び出す
+     */
+    static inline void merge_queued_reference(HeapObject* object_ref) {
+        auto* owner_index = object_ref->biased_owner_index();
+
+        //所有者が暗黙的に併合していなければ、biased カウンタを shared カウンタへ加えて併合する
+        //BIASED_MERGED_BIT はまだ立っていないため、加算によって同時に立てられる
+        if (owner_index->load(memory_order_relaxed) != BIASED_NO_OWNER) {
+            owner_index->store(BIASED_NO_OWNER, memory_order_relaxed);
+            auto biased_reference_count = *object_ref->biased_reference_count();
+            object_ref->shared_reference_word()->fetch_add(biased_reference_count * BIASED_SHARED_ONE + BIASED_MERGED_BIT, memory_order_release);
+        }
+
+        //キューが持っていた参照を減らす
+        BiasedRC rc(object_ref);
+    }
+
+    /**
+     * フィールドから取り除かれた後、参照カウントを減らすのを遅らせていたオブジェクトの参照カウントを一つ減らす
+     */
+    static inline void release_retired_reference(HeapObject* object_ref) {
+        BiasedRC rc(object_ref);
+    }
+
+    /**
+     * このスレッドの番号を割り当てる
+     */
+    static inline uint16_t biased_register_thread();
+
+
+    /**
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(lock)
+     */
+    inline void lock() {
+        this->object_ref->spin_lock();
+    }
+
+    /**
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(unlock)
+     */
+    inline void unlock() {
+        this->object_ref->spin_unlock();
+    }
+
+
+    /**
+     * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc の所有権はフィールドへ移る(ムーブして渡せば参照カウントの増減は発生しない)
+     */
+    inline void set_object(size_t field_index, optional<BiasedRC> rc) {
+        HeapObject* object = nullptr;
+        if (rc.has_value()) {
+            object = rc.value().object_ref;
+            rc.value().object_ref = nullptr;
+        }
+
+        //対象となるフィールドのポインタ
+        auto** field_ptr = (HeapObject**) (this->object_ref + 1) + field_index;
+
+        if (this->object_ref->get_is_mutex()) {
+            if (object != nullptr) {
+                //挿入対象のオブジェクト以下の is_mutex を true に伝搬させる
+                object->to_mutex();
+            }
+
+            auto* field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
+
+            if (field_old_object != nullptr) {
+                //詳細は"epoch_reclamation.hpp"を参照
+                epoch_retire(field_old_object, release_retired_reference);
+            }
+
+            //他のスレッドから入れられたオブジェクトがあれば併合する
+            biased_collect();
+        } else {
+            auto* field_old_object = *field_ptr;
+            *field_ptr = object;
+
+            if (field_old_object != nullptr) {
+                BiasedRC rc(field_old_object);
+            }
+        }
+    }
+
+
+    /**
+     * 指定された番号のフィールドにあるオブジェクトを取得
+     */
+    inline optional<BiasedRC> get_object(size_t field_index) {
+        //対象となるフィールドのポインタ
+        auto** field_ptr = (HeapObject**) (this->object_ref + 1) + field_index;
+
+        HeapObject* field_object;
+
+        if (this->object_ref->get_is_mutex()) {
+            //詳細は"epoch_reclamation.hpp"を参照
+            auto* record = epoch_enter();
+            field_object = ((atomic<HeapObject*>*) field_ptr)->load(memory_order_acquire);
+            if (field_object != nullptr) {
+                retain_reference(field_object);
+            }
+            epoch_exit(record);
+        } else {
+            field_object = *field_ptr;
+            if (field_object != nullptr) {
+                retain_reference(field_object);
+            }
+        }
+
+        if (field_object == nullptr) {
+            return nullopt;
+        } else {
+            return BiasedRC(field_object);
+        }
+    }
+
+    /**
+     * このオブジェクト以下の is_mutex を true に伝搬させる
+     */
+    template<size_t FIELD_LENGTH_HINT = 0>
+    inline void to_mutex() {
+        this->object_ref->to_mutex<FIELD_LENGTH_HINT>();
+    }
+
+    /**
+     * オブジェクトのペイロード(ポインタでない値を格納する領域)の開始ポインタを取得
+     * ペイロードへの読み書きは同期されないため、複数のスレッドから書き換える場合は lock() 等で保護する必要がある
+     */
+    inline void* get_payload() {
+        return this->object_ref->get_payload();
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+    /**
+     * 参照カウントを変更せずに所有権を手放し、オブジェクト本体へのポインタを返す
+     * 返したポインタの参照カウントは呼び出し元が責任を持って減らす必要がある
+     */
+    inline HeapObject* release_heap_object() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
+
+};
+
+
+/**
+ * キュー内の全てのオブジェクトを併合する
+ * record を持つスレッドから呼び出す
+ */
+inline void biased_merge_queue(BiasedThreadRecord* record) {
+    vector<HeapObject*> queue;
+    {
+        lock_guard<mutex> guard(record->queue_mutex);
+        swap(queue, record->queue);
+        record->has_queued.store(false, memory_order_relaxed);
+    }
+
+    for (auto* object_ref : queue) {
+        BiasedRC::merge_queued_reference(object_ref);
+    }
+}
+
+/**
+ * どのスレッドも使用していない record を一時的に取得し、キューを処理する
+ */
+inline void biased_merge_unowned_queue(BiasedThreadRecord* record) {
+    while (record->has_queued.load(memory_order_seq_cst)) {
+        bool is_in_use = false;
+        if (!record->is_in_use.compare_exchange_strong(is_in_use, true, memory_order_seq_cst)) {
+            //使用しているスレッドが処理する
+            return;
+        }
+        biased_merge_queue(record);
+        //手放した後にキューへ入れられたものは、再びループで処理する
+        record->is_in_use.store(false, memory_order_seq_cst);
+    }
+}
+
+/**
+ * オブジェクトの参照を所有者のキューへ入れる
+ */
+inline void biased_enqueue(HeapObject* object_ref, uint16_t owner_index) {
+    auto* record = biased_thread_records[owner_index].load(memory_order_acquire);
+    {
+        lock_guard<mutex> guard(record->queue_mutex);
+        record->queue.push_back(object_ref);
+    }
+    record->has_queued.store(true, memory_order_seq_cst);
+
+    //所有者が既に終了している場合はこのスレッドが処理する
+    if (!record->is_in_use.load(memory_order_seq_cst)) {
+        biased_merge_unowned_queue(record);
+    }
+}
+
+
+/**
+ * スレッドの終了時に、キューを処理してから BiasedThreadRecord を手放す
+ */
+struct BiasedThreadState {
+    inline ~BiasedThreadState() {
+        auto thread_index = biased_thread_index;
+        if (thread_index == BIASED_UNREGISTERED_THREAD) {
+            return;
+        }
+
+        auto* record = biased_thread_records[thread_index].load(memory_order_acquire);
+        biased_merge_queue(record);
+
+        //所有していたオブジェクトは、次にこの BiasedThreadRecord を使用するスレッドが引き継ぐ
+        biased_thread_index = BIASED_UNREGISTERED_THREAD;
+        record->is_in_use.store(false, memory_order_seq_cst);
+        biased_merge_unowned_queue(record);
+    }
+};
+
+/**
+ * このスレッドの BiasedThreadState を取得
+ */
+inline BiasedThreadState& biased_thread_state() {
+    static thread_local BiasedThreadState state;
+    return state;
+}
+
+
+inline uint16_t BiasedRC::biased_register_thread() {
+    //スレッドの終了時に BiasedThreadRecord を手放すように、状態を構築しておく
+    biased_thread_state();
+
+    //終了したスレッドの BiasedThreadRecord があれば、所有していたオブジェクトごと再利用する
+    auto record_count = biased_thread_record_count.load(memory_order_acquire);
+    for (size_t thread_index = 1; thread_index < record_count && thread_index < BIASED_MAX_THREADS; thread_index++) {
+        auto* record = biased_thread_records[thread_index].load(memory_order_acquire);
+        bool is_in_use = false;
+        if (record != nullptr && !record->is_in_use.load(memory_order_relaxed)
+            && record->is_in_use.compare_exchange_strong(is_in_use, true, memory_order_seq_cst)) {
+            biased_thread_index = (uint16_t) thread_index;
+            biased_merge_queue(record);
+            return (uint16_t) thread_index;
+        }
+    }
+
+    auto thread_index = biased_thread_record_count.fetch_add(1, memory_order_acq_rel);
+    if (thread_index >= BIASED_MAX_THREADS) {
+        //所有者の番号に格納できない数のスレッドが同時に存在する
+        abort();
+    }
+    biased_thread_records[thread_index].store(new BiasedThreadRecord(), memory_order_release);
+
+    biased_thread_index = (uint16_t) thread_index;
+    return (uint16_t) thread_index;
+}
+
+
+/**
+ * 他のスレッドがこのスレッドのキューへ入れたオブジェクトを併合する
+ * 所有者がキューを処理するまで、キューに入っているオブジェクトは解放されない
+ */
+inline void biased_collect() {
+    auto thread_index = biased_thread_index;
+    if (thread_index == BIASED_UNREGISTERED_THREAD) {
+        return;
+    }
+
+    auto* record = biased_thread_records[thread_index].load(memory_order_relaxed);
+    if (record->has_queued.load(memory_order_relaxed)) {
+        biased_merge_queue(record);
+    }
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include "heap_object.hpp"
+#include "dynamic_rc.hpp"
+#include "thread_safe_rc.hpp"
+
+using namespace std;
+
+
+//Channel の容量の既定値(2の累乗)
+#define CHANNEL_DEFAULT_CAPACITY 64
+
+
+/**
+ * 複数の生産者と消費者の間でオブジェクトを受け渡す容量付きのチャネル
+ *
+ * 根のオブジェクト : 容量の数のフィールドがそれぞれ要素を入れるスロット、
+ *                    ペイロードが送信位置、受信位置、スロットごとのシーケンス番号(それぞれ size_t)
+ * スロットの確保はシーケンス番号による容量付きのキュー(Dmitry Vyukov の bounded MPMC queue)と同じ方法で行う。
+ * 送信側は確保したスロットへ要素を入れてからシーケンス番号を release で進め、受信側はシーケンス番号を acquire で読んでから取り出すため、
+ * 一つのスロットに同時にアクセスするのは常に一つのスレッドだけである。
+ *
+ * RC が DynamicRC の場合、スロットへの挿入は transfer_object、取り出しは take_transferred_object で行う。
+ * 送るオブジェクト以下で送ったスレッドから参照されていない部分は is_mutex が false のまま受信したスレッドへ渡り、
+ * 受信したスレッドはそのオブジェクトをシングルスレッドモードで操作できる(詳細は"unique_transfer.hpp"を参照)。
+ * スロットは受信側が take_transferred_object で取り出す以外には読まれないため、受け渡し中のフィールドの条件を満たす。
+ * RC が ThreadSafeRC の場合は set_object と get_object で受け渡す(比較用)。
+ *
+ * 根のオブジェクトは作成時から複数のスレッドからアクセスされうるものとしてマークする。
+ * Channel のコピーは同じチャネルを指すハンドルとなる。
+ *
+ * 参考
+ *  + https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+ */
+template<typename RC = DynamicRC>
+class Channel {
+
+private:
+    //根のオブジェクト
+    RC rc;
+    //容量 - 1
+    size_t mask;
+
+    static inline RC create_root(size_t capacity) {
+        //容量は2の累乗でなければならない
+        if (capacity == 0 || (capacity & (capacity - 1)) != 0) {
+            abort();
+        }
+        auto* object = alloc_heap_object(ObjectLayout { capacity, (2 + capacity) * sizeof(size_t) });
+        auto* positions = (size_t*) object->get_payload();
+        for (size_t i = 0; i < capacity; i++) {
+            positions[2 + i] = i;
+        }
+        if constexpr (is_same_v<RC, DynamicRC>) {
+            return RC(object, true);
+        } else {
+            return RC(object);
+        }
+    }
+
+    inline atomic_size_t& send_position() {
+        return ((atomic_size_t*) this->rc.get_payload())[0];
+    }
+
+    inline atomic_size_t& receive_position() {
+        return ((atomic_size_t*) this->rc.get_payload())[1];
+    }
+
+    inline atomic_size_t& sequence(size_t position) {
+        return ((atomic_size_t*) this->rc.get_payload())[2 + (position & this->mask)];
+    }
+
+public:
+    /**
+     * capacity 個の要素を入れられるチャネルを作成
+     */
+    inline explicit Channel(size_t capacity = CHANNEL_DEFAULT_CAPACITY) : rc(create_root(capacity)), mask(capacity - 1) {}
+
+    /**
+     * 既存のチャネルのハンドルを包む
+     */
+    inline explicit Channel(RC rc) : rc(move(rc)), mask(this->rc.get_heap_object()->get_field_length() - 1) {}
+
+    /**
+     * rc を送信する
+     * チャネルが一杯であれば空くまで待つ
+     * DynamicRC の場合、rc は呼び出し元の唯一のハンドルをムーブして渡すことで、ローカルのまま受信したスレッドへ渡る
+     */
+    inline void send(RC rc) {
+        auto position = this->send_position().load(memory_order_relaxed);
+        while (true) {
+            auto difference = (intptr_t) this->sequence(position).load(memory_order_acquire) - (intptr_t) position;
+            if (difference == 0) {
+                //このスロットが空いているため、送信位置を進めて確保する
+                if (this->send_position().compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                //一杯であるため、受信されるまで待つ
+                this_thread::yield();
+                position = this->send_position().load(memory_order_relaxed);
+            } else {
+                //他のスレッドが先に確保した
+                position = this->send_position().load(memory_order_relaxed);
+            }
+        }
+
+        if constexpr (is_same_v<RC, DynamicRC>) {
+            this->rc.transfer_object(position & this->mask, move(rc));
+        } else {
+            this->rc.set_object(position & this->mask, move(rc));
+        }
+        //この release により、スロットへの挿入が受信側へ公開される
+        this->sequence(position).store(position + 1, memory_order_release);
+    }
+
+    /**
+     * 要素を一つ受信する
+     * チャネルが空であれば nullopt を返す
+     */
+    inline optional<RC> try_receive() {
+        auto position = this->receive_position().load(memory_order_relaxed);
+        while (true) {
+            auto difference = (intptr_t) this->sequence(position).load(memory_order_acquire) - (intptr_t) (position + 1);
+            if (difference == 0) {
+                //このスロットに要素があるため、受信位置を進めて確保する
+                if (this->receive_position().compare_exchange_weak(position, position + 1, memory_order_relaxed)) {
+                    break;
+                }
+            } else if (difference < 0) {
+                //空である
+                return nullopt;
+            } else {
+                //他のスレッドが先に確保した
+                position = this->receive_position().load(memory_order_relaxed);
+            }
+        }
+
+        optional<RC> received;
+        if constexpr (is_same_v<RC, DynamicRC>) {
+            received = this->rc.take_transferred_object(position & this->mask);
+        } else {
+            received = this->rc.get_object(position & this->mask);
+            this->rc.set_object(position & this->mask, nullopt);
+        }
+        //この release により、スロットが空いたことを一周後の送信側へ公開する
+        this->sequence(position).store(position + this->mask + 1, memory_order_release);
+        return received;
+    }
+
+    /**
+     * 要素を一つ受信する
+     * チャネルが空であれば送信されるまで待つ
+     */
+    inline RC receive() {
+        while (true) {
+            auto received = this->try_receive();
+            if (received.has_value()) {
+                return move(received.value());
+            }
+            this_thread::yield();
+        }
+    }
+
+    /**
+     * 包んでいるハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+};
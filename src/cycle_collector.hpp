@@ -0,0 +1,632 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <mutex>
+#include <unordered_map>
+#include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+
+using namespace std;
+
+
+/**
+ * 循環参照の回収(CYCLE_COLLECTION が true の場合に DynamicRC が使用する)
+ *
+ * 参照カウントだけでは、a.set_object(0, b); b.set_object(0, a); のような循環参照は参照カウントが0にならず解放されない。
+ * そこで、Bacon と Rajan の同期的な循環参照の回収(試行削除)を用いて回収する。
+ *
+ * >>> 候補の記録
+ * 参照カウントを減らして0にならなかったオブジェクトは、循環参照のゴミの一部になった可能性がある。
+ * そこで、減らす代わりにその参照を候補のバッファへ移し(参照カウントは減らさない)、後でまとめて調べる。
+ * バッファが参照を持っているため、候補のオブジェクトが調べる前に解放されることはない。
+ * 既にバッファに入っているオブジェクトは、色を紫にしてから通常通り減らす。
+ * また、参照カウントを増やしたオブジェクトの色は黒に戻す(紫のまま調べる時まで残ったものだけを調べる)。
+ *
+ * オブジェクトごとの状態(HeapObject の cycle_state)
+ *  + 0 ~ 1 bit : 色(黒 : 使用中、灰 : 調査中、白 : ゴミ、紫 : 候補)
+ *  + 2 bit     : 候補のバッファに入っているかどうか
+ *
+ * >>> is_mutex による分割
+ * is_mutex が true のオブジェクトは is_mutex が false のオブジェクトを参照しないため("dynamic_rc.hpp"を参照)、
+ * 循環参照は必ずどちらか一方だけで構成される。そこで、それぞれ異なる方法で回収する。
+ *
+ *  1. is_mutex が false のオブジェクト(スレッドローカル)
+ *     候補はスレッドごとのバッファへ入れ、そのスレッドだけで回収する。
+ *     他のスレッドから触れられることはないため、元の手法と同じく実際の参照カウントを書き換えながら調べ、ロックも atomic な命令も使用しない。
+ *     is_mutex が true のフィールドは外部への参照として扱い、辿らない。
+ *
+ *  2. is_mutex が true のオブジェクト(共有)
+ *     候補は全てのスレッドで共有するバッファへ入れ、一度に一つのスレッドだけが回収する。
+ *     他のスレッドは回収中も参照カウントを増減するため、実際の参照カウントは書き換えず、以下の手順で調べる。
+ *      (a) エポックのクリティカルセクション内で、候補から辿れるオブジェクトの色を灰にしてから、参照カウントとフィールドを読み込む
+ *      (b) 読み込んだフィールドから内部の参照の数を数え、参照カウントがそれと一致しないオブジェクトとそこから辿れるものを使用中とし、
+ *          残りをゴミ(白)とする
+ *      (c) 白としたオブジェクトの色が灰のままで、参照カウントも変わっていないことを確かめる
+ *     増やす側は参照カウントを増やした後で色を黒に戻すため、(a) の後に参照カウントを増やしたスレッドがあれば (c) で分かる。
+ *     (a) より前に増やしていれば、その分は (a) で読み込んだ参照カウントに含まれる。
+ *     外部から参照されていないオブジェクトへの参照を新しく得るには、必ずどこかで参照カウントを増やす必要があるため、
+ *     (c) を満たすオブジェクトは(a) から (c) の間も外部から参照されておらず、解放しても良い。
+ *     (c) を満たさない場合は何も解放せず、候補は次の回収で調べ直す。
+ *
+ * DEFERRED_REFERENCE_COUNT とは併用できない(増やすのを遅らせている参照が (a) の参照カウントに含まれないため)。
+ * WEAK_REFERENCE とも併用できない(弱参照の upgrade() は参照を持たずに参照カウントを増やせるため、(c) の後に白のオブジェクトが復活しうる)。
+ *
+ * 参考
+ *  + Bacon and Rajan, "Concurrent Cycle Collection in Reference Counted Systems" (2001)
+ */
+
+
+#if CYCLE_COLLECTION
+
+#if DEFERRED_REFERENCE_COUNT
+    #error "CYCLE_COLLECTION cannot be used with DEFERRED_REFERENCE_COUNT"
+#endif
+
+#if WEAK_REFERENCE
+    #error "CYCLE_COLLECTION cannot be used with WEAK_REFERENCE"
+#endif
+
+//オブジェクトの色のビット
+#define CYCLE_COLOR_MASK 3
+//使用中
+#define CYCLE_BLACK 0
+//調査中
+#define CYCLE_GRAY 1
+//ゴミ
+#define CYCLE_WHITE 2
+//候補
+#define CYCLE_PURPLE 3
+//候補のバッファに入っているかどうかのビット
+#define CYCLE_BUFFERED 4
+
+//候補の数がこれに達したら回収する
+#define CYCLE_ROOT_BUFFER_THRESHOLD 4096
+
+
+/**
+ * フィールドのオブジェクトの参照カウントを一つ減らし、0になった場合に true を返す関数(DynamicRC::release_reference)
+ */
+typedef bool (*CycleReleaseFunction)(HeapObject*);
+
+
+/**
+ * このスレッドで回収中かどうか
+ * 回収中に参照カウントを減らして候補が増えても、回収を入れ子にしない
+ */
+inline thread_local bool cycle_is_collecting = false;
+
+/**
+ * このスレッドの候補のバッファが既に破棄されたかどうか
+ * 破棄された後は候補を記録せず、通常通り参照カウントを減らす
+ */
+inline thread_local bool cycle_local_roots_is_destroyed = false;
+
+
+/**
+ * 共有の候補のバッファ
+ */
+inline mutex cycle_shared_roots_mutex;
+inline vector<HeapObject*> cycle_shared_roots;
+inline atomic_size_t cycle_shared_root_count = 0;
+
+/**
+ * 共有の候補の回収は一度に一つのスレッドだけが行う
+ */
+inline mutex cycle_shared_collect_mutex;
+
+
+inline void cycle_collect_local(vector<HeapObject*>& buffer, CycleReleaseFunction release_field);
+
+
+/**
+ * スレッドごとの候補のバッファ
+ * スレッドの終了時に残っている候補を回収する
+ */
+struct CycleLocalRoots {
+    vector<HeapObject*> roots;
+    CycleReleaseFunction release_field = nullptr;
+
+    inline ~CycleLocalRoots() {
+        if (!this->roots.empty()) {
+            cycle_is_collecting = true;
+            cycle_collect_local(this->roots, this->release_field);
+            cycle_is_collecting = false;
+        }
+        cycle_local_roots_is_destroyed = true;
+    }
+};
+
+/**
+ * このスレッドの候補のバッファを取得
+ */
+inline CycleLocalRoots& cycle_local_roots() {
+    static thread_local CycleLocalRoots roots;
+    return roots;
+}
+
+
+/**
+ * オブジェクトの色を書き換える(候補のバッファに入っているかどうかは変更しない)
+ * is_mutex が false のオブジェクトにのみ使用できる
+ */
+inline void cycle_set_color(HeapObject* object, uint8_t color) {
+    object->store_cycle_state((object->load_cycle_state(memory_order_relaxed) & ~CYCLE_COLOR_MASK) | color);
+}
+
+/**
+ * オブジェクトの色を取得
+ */
+inline uint8_t cycle_get_color(HeapObject* object) {
+    return object->load_cycle_state(memory_order_relaxed) & CYCLE_COLOR_MASK;
+}
+
+
+/**
+ * 共有の候補のバッファへ入れる
+ * 呼び出し元が持っていた参照はバッファへ移る
+ */
+inline void cycle_push_shared_root(HeapObject* object) {
+    lock_guard<mutex> guard(cycle_shared_roots_mutex);
+    cycle_shared_roots.push_back(object);
+    cycle_shared_root_count.store(cycle_shared_roots.size(), memory_order_relaxed);
+}
+
+
+inline void cycle_collect_shared(CycleReleaseFunction release_field, bool wait);
+
+
+/**
+ * 参照カウントを一つ増やした後に呼び出し、色を黒に戻す
+ */
+inline void cycle_mark_black_local(HeapObject* object) {
+    auto state = object->load_cycle_state(memory_order_relaxed);
+    if ((state & CYCLE_COLOR_MASK) != CYCLE_BLACK) {
+        object->store_cycle_state(state & ~CYCLE_COLOR_MASK);
+    }
+}
+
+/**
+ * 参照カウントを seq_cst で一つ増やした後に呼び出し、色を黒に戻す(is_mutex が true のオブジェクト)
+ * 回収中のスレッドはこれにより、灰にした後で参照カウントが増やされたことを知る
+ */
+inline void cycle_mark_black_shared(HeapObject* object) {
+    auto state = object->load_cycle_state(memory_order_seq_cst);
+    while ((state & CYCLE_COLOR_MASK) != CYCLE_BLACK) {
+        if (object->compare_exchange_cycle_state(state, state & ~CYCLE_COLOR_MASK)) {
+            return;
+        }
+    }
+}
+
+
+/**
+ * 参照カウントを減らす前に呼び出し、減らしても0にならない場合はオブジェクトを候補として記録する
+ * 候補のバッファへ参照を移した場合は true を返し、その場合は参照カウントを減らしてはならない
+ */
+inline bool cycle_buffer_possible_root(HeapObject* object, CycleReleaseFunction release_field) {
+    if (cycle_local_roots_is_destroyed) {
+        return false;
+    }
+
+    if (!object->get_is_mutex()) {
+        //参照カウントが0になる場合はそのまま解放する
+        if (object->get_reference_count() == 1) {
+            return false;
+        }
+
+        auto state = object->load_cycle_state(memory_order_relaxed);
+        if ((state & CYCLE_BUFFERED) != 0) {
+            //既にバッファに入っている場合は紫にして通常通り減らす
+            object->store_cycle_state(state | CYCLE_PURPLE);
+            return false;
+        }
+        object->store_cycle_state(CYCLE_BUFFERED | CYCLE_PURPLE);
+
+        auto& local_roots = cycle_local_roots();
+        local_roots.release_field = release_field;
+        local_roots.roots.push_back(object);
+        if (local_roots.roots.size() >= CYCLE_ROOT_BUFFER_THRESHOLD && !cycle_is_collecting) {
+            cycle_is_collecting = true;
+            cycle_collect_local(local_roots.roots, release_field);
+            cycle_is_collecting = false;
+        }
+        return true;
+    }
+
+    //参照カウントが1であれば、このスレッドが最後の参照を持っている(他に参照があれば、それは参照カウントに含まれている)
+    if (object->atomic_load_reference_count() == 1) {
+        return false;
+    }
+
+    //回収中のスレッドがバッファから取り除くのと競合するため、状態は必ず compare-and-swap で書き換える
+    auto state = object->load_cycle_state(memory_order_relaxed);
+    while (true) {
+        if ((state & CYCLE_BUFFERED) == 0) {
+            if (object->compare_exchange_cycle_state(state, CYCLE_BUFFERED | CYCLE_PURPLE)) {
+                cycle_push_shared_root(object);
+                if (cycle_shared_root_count.load(memory_order_relaxed) >= CYCLE_ROOT_BUFFER_THRESHOLD && !cycle_is_collecting) {
+                    cycle_is_collecting = true;
+                    cycle_collect_shared(release_field, false);
+                    cycle_is_collecting = false;
+                }
+                return true;
+            }
+        } else if ((state & CYCLE_COLOR_MASK) == CYCLE_PURPLE
+            || object->compare_exchange_cycle_state(state, state | CYCLE_PURPLE)) {
+            //既にバッファに入っている場合は紫にして通常通り減らす
+            return false;
+        }
+    }
+}
+
+
+/**
+ * オブジェクトのフィールドのうち、is_mutex が false のものに func を適用する
+ */
+template<typename Function>
+inline void cycle_for_each_local_field(HeapObject* object, Function func) {
+    auto** field_start_ptr = (HeapObject**) (object + 1);
+    auto field_length = object->get_field_length();
+    for (size_t field_index = 0; field_index < field_length; field_index++) {
+        auto* field_object = *(field_start_ptr + field_index);
+        if (field_object != nullptr && !field_object->get_is_mutex()) {
+            func(field_object);
+        }
+    }
+}
+
+
+/**
+ * スレッドローカルな候補を回収する
+ * 元の手法(MarkRoots, ScanRoots, CollectRoots)と同じだが、深いオブジェクトでもスタックが溢れないように明示的なスタックを用いる
+ */
+inline void cycle_collect_local(vector<HeapObject*>& buffer, CycleReleaseFunction release_field) {
+    vector<HeapObject*> roots;
+    roots.swap(buffer);
+
+    vector<HeapObject*> stack;
+    vector<HeapObject*> black_stack;
+
+    //MarkRoots
+    //紫のまま残っている候補から辿れるオブジェクトを灰にし、内部の参照の分だけ参照カウントを減らす
+    size_t root_count = 0;
+    for (auto* root : roots) {
+        if (root->get_is_mutex()) {
+            //バッファに入った後で複数のスレッドに公開されたものは、共有の候補として扱う
+            cycle_push_shared_root(root);
+            continue;
+        }
+
+        //バッファが持っていた参照を手放す
+        root->decrement_reference_count();
+
+        auto state = root->load_cycle_state(memory_order_relaxed);
+        if ((state & CYCLE_COLOR_MASK) != CYCLE_PURPLE && root->get_reference_count() != 0) {
+            //増やされた後のもの(黒)はバッファから取り除く
+            root->store_cycle_state(state & ~CYCLE_BUFFERED);
+            continue;
+        }
+        roots[root_count++] = root;
+
+        if ((state & CYCLE_COLOR_MASK) == CYCLE_GRAY) {
+            continue;
+        }
+        cycle_set_color(root, CYCLE_GRAY);
+        stack.push_back(root);
+        while (!stack.empty()) {
+            auto* object = stack.back();
+            stack.pop_back();
+
+            cycle_for_each_local_field(object, [&](HeapObject* field_object) {
+                field_object->decrement_reference_count();
+                if (cycle_get_color(field_object) != CYCLE_GRAY) {
+                    cycle_set_color(field_object, CYCLE_GRAY);
+                    stack.push_back(field_object);
+                }
+            });
+        }
+    }
+    roots.resize(root_count);
+
+    //ScanRoots
+    //参照カウントが残っている灰のオブジェクトは外部から参照されているため、そこから辿れるものを黒に戻して参照カウントも戻す
+    //残りは白にする
+    for (auto* root : roots) {
+        stack.push_back(root);
+        while (!stack.empty()) {
+            auto* object = stack.back();
+            stack.pop_back();
+
+            if (cycle_get_color(object) != CYCLE_GRAY) {
+                continue;
+            }
+
+            if (object->get_reference_count() == 0) {
+                cycle_set_color(object, CYCLE_WHITE);
+                cycle_for_each_local_field(object, [&](HeapObject* field_object) {
+                    stack.push_back(field_object);
+                });
+                continue;
+            }
+
+            //ScanBlack
+            cycle_set_color(object, CYCLE_BLACK);
+            black_stack.push_back(object);
+            while (!black_stack.empty()) {
+                auto* black_object = black_stack.back();
+                black_stack.pop_back();
+
+                cycle_for_each_local_field(black_object, [&](HeapObject* field_object) {
+                    field_object->increment_reference_count();
+                    if (cycle_get_color(field_object) != CYCLE_BLACK) {
+                        cycle_set_color(field_object, CYCLE_BLACK);
+                        black_stack.push_back(field_object);
+                    }
+                });
+            }
+        }
+    }
+
+    //CollectRoots
+    //白のオブジェクトを集める(他の候補は、その候補の番になってから集める)
+    vector<HeapObject*> white_objects;
+    for (auto* root : roots) {
+        auto state = root->load_cycle_state(memory_order_relaxed) & ~CYCLE_BUFFERED;
+        root->store_cycle_state(state);
+        if (state != CYCLE_WHITE) {
+            continue;
+        }
+
+        cycle_set_color(root, CYCLE_BLACK);
+        stack.push_back(root);
+        while (!stack.empty()) {
+            auto* object = stack.back();
+            stack.pop_back();
+            white_objects.push_back(object);
+
+            cycle_for_each_local_field(object, [&](HeapObject* field_object) {
+                if (field_object->load_cycle_state(memory_order_relaxed) == CYCLE_WHITE) {
+                    cycle_set_color(field_object, CYCLE_BLACK);
+                    stack.push_back(field_object);
+                }
+            });
+        }
+    }
+
+    //白のオブジェクトから is_mutex が true のオブジェクトへの参照は辿っていないため、ここで減らす
+    //(is_mutex が false のオブジェクトへの参照は MarkRoots で既に減らしてある)
+    for (auto* object : white_objects) {
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        auto field_length = object->get_field_length();
+        for (size_t field_index = 0; field_index < field_length; field_index++) {
+            auto* field_object = *(field_start_ptr + field_index);
+            if (field_object != nullptr && field_object->get_is_mutex() && release_field(field_object)) {
+                free_heap_object_graph(field_object, release_field);
+            }
+        }
+    }
+    for (auto* object : white_objects) {
+        free_heap_object(object);
+    }
+}
+
+
+/**
+ * 共有の候補を回収する
+ * wait が false の場合、他のスレッドが回収中であれば何もしない
+ */
+inline void cycle_collect_shared(CycleReleaseFunction release_field, bool wait) {
+    unique_lock<mutex> collect_guard(cycle_shared_collect_mutex, defer_lock);
+    if (wait) {
+        collect_guard.lock();
+    } else if (!collect_guard.try_lock()) {
+        return;
+    }
+
+    vector<HeapObject*> roots;
+    {
+        lock_guard<mutex> guard(cycle_shared_roots_mutex);
+        roots.swap(cycle_shared_roots);
+        cycle_shared_root_count.store(0, memory_order_relaxed);
+    }
+    if (roots.empty()) {
+        return;
+    }
+
+    //候補から辿れるオブジェクトの、(a) の時点の状態
+    struct CycleNode {
+        HeapObject* object;
+        //読み込んだ参照カウント
+        size_t reference_count;
+        //辿ったオブジェクトからの参照の数(候補のバッファからの参照を含む)
+        size_t internal_count;
+        //灰にする前の色
+        uint8_t original_color;
+        //候補のバッファに入れられていたものかどうか
+        bool is_root;
+        bool is_white;
+        //edges 内のフィールドの範囲
+        size_t edge_begin;
+        size_t edge_end;
+    };
+    vector<CycleNode> nodes;
+    //読み込んだフィールド(nodes の番号)
+    vector<size_t> edges;
+    unordered_map<HeapObject*, size_t> node_indices;
+    vector<size_t> stack;
+
+    //(a) の間に辿っているオブジェクトが解放されないように、クリティカルセクションに入っておく
+    auto* record = epoch_enter();
+
+    auto discover = [&](HeapObject* object) {
+        auto [iterator, is_inserted] = node_indices.try_emplace(object, nodes.size());
+        if (!is_inserted) {
+            return iterator->second;
+        }
+
+        //灰にしてから参照カウントを読み込む
+        auto state = object->load_cycle_state();
+        while (!object->compare_exchange_cycle_state(state, (state & ~CYCLE_COLOR_MASK) | CYCLE_GRAY)) {}
+
+        nodes.push_back({ object, object->atomic_load_reference_count(), 0, (uint8_t) (state & CYCLE_COLOR_MASK), false, true, 0, 0 });
+        stack.push_back(nodes.size() - 1);
+        return nodes.size() - 1;
+    };
+
+    //(a)
+    for (auto* root : roots) {
+        auto& node = nodes[discover(root)];
+        node.internal_count++;
+        node.is_root = true;
+    }
+    while (!stack.empty()) {
+        auto index = stack.back();
+        stack.pop_back();
+
+        auto* object = nodes[index].object;
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        auto field_length = object->get_field_length();
+
+        nodes[index].edge_begin = edges.size();
+        for (size_t field_index = 0; field_index < field_length; field_index++) {
+            auto* field_object = ((atomic<HeapObject*>*) (field_start_ptr + field_index))->load(memory_order_acquire);
+            if (field_object != nullptr) {
+                auto field_node = discover(field_object);
+                nodes[field_node].internal_count++;
+                edges.push_back(field_node);
+            }
+        }
+        nodes[index].edge_end = edges.size();
+    }
+
+    //(b)
+    //内部の参照だけでは参照カウントが説明できないオブジェクトから辿れるものは使用中
+    for (size_t index = 0; index < nodes.size(); index++) {
+        if (nodes[index].reference_count != nodes[index].internal_count && nodes[index].is_white) {
+            nodes[index].is_white = false;
+            stack.push_back(index);
+            while (!stack.empty()) {
+                auto& node = nodes[stack.back()];
+                stack.pop_back();
+                for (auto edge = node.edge_begin; edge < node.edge_end; edge++) {
+                    if (nodes[edges[edge]].is_white) {
+                        nodes[edges[edge]].is_white = false;
+                        stack.push_back(edges[edge]);
+                    }
+                }
+            }
+        }
+    }
+
+    //(c)
+    atomic_thread_fence(memory_order_seq_cst);
+    bool has_white = false;
+    bool is_aborted = false;
+    for (auto& node : nodes) {
+        if (!node.is_white) {
+            continue;
+        }
+        has_white = true;
+        if ((node.object->load_cycle_state() & CYCLE_COLOR_MASK) != CYCLE_GRAY
+            || node.object->atomic_load_reference_count() != node.reference_count) {
+            is_aborted = true;
+            break;
+        }
+    }
+
+    //灰のままであれば色を戻す
+    //候補は今回の回収で調べ終えたため黒に、それ以外は元の色に戻す(他のバッファに入っている可能性がある)
+    for (auto& node : nodes) {
+        if (node.is_white && !is_aborted) {
+            continue;
+        }
+
+        auto color = node.is_root ? CYCLE_BLACK : node.original_color;
+        auto state = node.object->load_cycle_state();
+        while ((state & CYCLE_COLOR_MASK) == CYCLE_GRAY) {
+            if (node.object->compare_exchange_cycle_state(state, (state & ~CYCLE_COLOR_MASK) | color)) {
+                break;
+            }
+        }
+    }
+
+    epoch_exit(record);
+
+    if (is_aborted) {
+        //他のスレッドが参照カウントを変更したため、次の回収で調べ直す
+        lock_guard<mutex> guard(cycle_shared_roots_mutex);
+        cycle_shared_roots.insert(cycle_shared_roots.end(), roots.begin(), roots.end());
+        cycle_shared_root_count.store(cycle_shared_roots.size(), memory_order_relaxed);
+        return;
+    }
+
+    //使用中の候補はバッファから取り除き、バッファが持っていた参照を手放す
+    //その後で参照カウントが減らされていた(紫になった)場合は、次の回収で調べ直す
+    vector<HeapObject*> remaining_roots;
+    for (auto* root : roots) {
+        if (nodes[node_indices[root]].is_white) {
+            continue;
+        }
+
+        auto state = root->load_cycle_state();
+        while (true) {
+            if ((state & CYCLE_COLOR_MASK) == CYCLE_PURPLE) {
+                remaining_roots.push_back(root);
+                break;
+            }
+            if (root->compare_exchange_cycle_state(state, state & ~CYCLE_BUFFERED)) {
+                if (root->atomic_decrement_reference_count() == 1) {
+                    atomic_thread_fence(memory_order_acquire);
+                    free_heap_object_graph(root, release_field);
+                }
+                break;
+            }
+        }
+    }
+
+    if (has_white) {
+        //白のオブジェクトから使用中のオブジェクトへの参照を減らしてから、白のオブジェクトを解放する
+        for (auto& node : nodes) {
+            if (!node.is_white) {
+                continue;
+            }
+            for (auto edge = node.edge_begin; edge < node.edge_end; edge++) {
+                auto& field_node = nodes[edges[edge]];
+                if (!field_node.is_white && release_field(field_node.object)) {
+                    free_heap_object_graph(field_node.object, release_field);
+                }
+            }
+        }
+        for (auto& node : nodes) {
+            if (node.is_white) {
+                free_heap_object(node.object);
+            }
+        }
+    }
+
+    if (!remaining_roots.empty()) {
+        lock_guard<mutex> guard(cycle_shared_roots_mutex);
+        cycle_shared_roots.insert(cycle_shared_roots.end(), remaining_roots.begin(), remaining_roots.end());
+        cycle_shared_root_count.store(cycle_shared_roots.size(), memory_order_relaxed);
+    }
+}
+
+
+/**
+ * このスレッドの候補と共有の候補から、循環参照によって参照カウントが0にならないオブジェクトを回収する
+ */
+inline void cycle_collect(CycleReleaseFunction release_field) {
+    if (cycle_is_collecting || cycle_local_roots_is_destroyed) {
+        return;
+    }
+
+    cycle_is_collecting = true;
+    cycle_collect_local(cycle_local_roots().roots, release_field);
+    cycle_collect_shared(release_field, true);
+    cycle_is_collecting = false;
+}
+
+#endif
@@ -0,0 +1,277 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+
+using namespace std;
+
+
+/**
+ * 遅延参照カウント(DEFERRED_REFERENCE_COUNT が true の場合に DynamicRC と ThreadSafeRC が使用する)
+ *
+ * 複数のスレッドからアクセスされうるオブジェクトの参照カウントの増減を、その場で atomic-read-modify-write により行う代わりに
+ * スレッドごとのバッファへ記録してオブジェクトごとにまとめておき、rc_flush() の呼び出し時(セーフポイント)か
+ * バッファが一杯になった時に一括で反映する。
+ * 同じオブジェクトのハンドルのコピーと破棄を繰り返す場合は増減が打ち消し合うため、共有されたキャッシュラインへの書き込みは発生しない。
+ *
+ * >>> 安全性
+ * 他のスレッドが増やすのを遅らせている間に、参照カウントを0にして解放してはならない。
+ * そこで、最初に記録した時点から反映し終えるまでの間(遅延区間)をエポックのクリティカルセクションとしてアナウンスしておく。
+ *  + 増やす方は、遅延区間を閉じる前に atomic に加算して反映する
+ *  + 減らす方は、遅延区間を閉じた後で epoch_retire と同じリンボへ入れ、遅延区間にいた全てのスレッドが反映し終えてから減らす
+ * こうすると、他のスレッドが増やすのを遅らせている参照は、そのスレッドが反映するまで減らされることはない。
+ * また、get_object のロードから参照カウントを増やすまでの間も遅延区間に含まれるため、個別にクリティカルセクションへ入る必要はない。
+ * 詳細は"epoch_reclamation.hpp"を参照。
+ *
+ * >>> 注意
+ *  + 遅延区間を開いたままのスレッドがあるとエポックは進まず、他のスレッドがフィールドから取り除いたオブジェクトも解放されない
+ *    そのため、長時間走るスレッドは適宜 rc_flush() を呼び出す必要がある
+ *  + epoch_reclaim_all() の前には rc_flush() を呼び出す必要がある
+ *  + スレッドの終了時にはバッファは自動的に反映される
+ *
+ * 参考
+ *  + Deutsch and Bobrow, "An efficient, incremental, automatic garbage collector" (1976)
+ *  + Levanoni and Petrank, "An on-the-fly reference-counting garbage collector for Java" (2001)
+ */
+
+
+#if DEFERRED_REFERENCE_COUNT
+
+//バッファの大きさ(オブジェクトの種類数)の2の対数
+#define DEFERRED_BUFFER_INDEX_BITS 8
+
+//バッファの大きさ(オープンアドレス法のハッシュテーブル)
+#define DEFERRED_BUFFER_CAPACITY (1 << DEFERRED_BUFFER_INDEX_BITS)
+
+//記録したオブジェクトの種類数がこれに達したら反映する
+#define DEFERRED_BUFFER_FLUSH_THRESHOLD (DEFERRED_BUFFER_CAPACITY / 4 * 3)
+
+
+/**
+ * オブジェクトごとにまとめた参照カウントの増減
+ */
+struct DeferredUpdate {
+    HeapObject* object;
+    //反映されていない増減の合計
+    int64_t delta;
+    //参照カウントを一つ減らす関数(ハンドルの種類ごとに異なる)
+    //遅らせずに減らす関数でなければならない
+    void (*release)(HeapObject*);
+};
+
+
+/**
+ * スレッドごとの参照カウントの増減のバッファ
+ */
+struct DeferredBuffer {
+    DeferredUpdate updates[DEFERRED_BUFFER_CAPACITY] = {};
+    //使用している updates の番号(記録した順)
+    uint16_t used_indices[DEFERRED_BUFFER_FLUSH_THRESHOLD];
+    size_t used_count = 0;
+    //最後に記録した updates の番号(同じオブジェクトが続く場合にハッシュの計算を省く)
+    size_t last_index = 0;
+    //遅延区間のアナウンスに使用する EpochRecord(get_object 等で使用するものとは別)
+    EpochRecord* record = nullptr;
+    bool is_window_open = false;
+
+    inline DeferredBuffer() {
+        //このバッファの破棄時にリンボへ入れられるように、リンボを先に構築しておく
+        epoch_thread_state();
+    }
+
+    inline ~DeferredBuffer();
+};
+
+
+/**
+ * このスレッドのバッファが既に破棄されたかどうか
+ * 定数初期化されるため、スレッドローカルな変数の破棄後(グローバル変数の破棄時等)も参照できる
+ */
+inline thread_local bool deferred_buffer_is_destroyed = false;
+
+/**
+ * このスレッドのバッファを取得
+ */
+inline DeferredBuffer& deferred_buffer() {
+    static thread_local DeferredBuffer buffer;
+    return buffer;
+}
+
+
+/**
+ * バッファの内容を反映する(セーフポイント)
+ *  1. 増やす方を atomic に加算して反映する
+ *  2. 遅延区間を閉じる
+ *  3. 減らす方を、遅延区間にいる全てのスレッドが反映し終えた後で減らせるようにリンボへ入れる
+ */
+inline void rc_flush() {
+    if (deferred_buffer_is_destroyed) {
+        return;
+    }
+
+    auto& buffer = deferred_buffer();
+    if (!buffer.is_window_open) {
+        return;
+    }
+
+    for (size_t i = 0; i < buffer.used_count; i++) {
+        auto& update = buffer.updates[buffer.used_indices[i]];
+        if (update.delta > 0) {
+            update.object->atomic_add_reference_count((size_t) update.delta);
+        }
+    }
+
+    //この release により、加算した結果は遅延区間を閉じたことを確認したスレッドから見える
+    epoch_exit(buffer.record);
+    buffer.is_window_open = false;
+
+    bool has_retired = false;
+    for (size_t i = 0; i < buffer.used_count; i++) {
+        auto& update = buffer.updates[buffer.used_indices[i]];
+        for (auto delta = update.delta; delta < 0; delta++) {
+            epoch_push_retired(update.object, update.release);
+            has_retired = true;
+        }
+        update = {};
+    }
+    buffer.used_count = 0;
+    buffer.last_index = 0;
+
+    if (has_retired) {
+        //エポックを一括で進め、減らせるものは減らす
+        epoch_advance_and_collect();
+    }
+}
+
+
+inline DeferredBuffer::~DeferredBuffer() {
+    rc_flush();
+    //以降はこのスレッドの増減を遅らせない
+    deferred_buffer_is_destroyed = true;
+
+    if (this->record != nullptr) {
+        //EpochRecord を再利用できるようにする
+        this->record->is_in_use.store(false, memory_order_release);
+    }
+}
+
+
+/**
+ * 遅延区間を開く(アナウンスする)
+ */
+inline void deferred_buffer_open_window(DeferredBuffer& buffer) {
+    if (buffer.record == nullptr) {
+        buffer.record = epoch_acquire_record();
+    }
+    epoch_enter_with(buffer.record);
+    buffer.is_window_open = true;
+}
+
+
+/**
+ * 遅らせずに増減する
+ * このスレッドのバッファが破棄された後に使用する
+ */
+inline void deferred_apply_immediately(HeapObject* object, int64_t delta, void (*release)(HeapObject*)) {
+    if (delta > 0) {
+        object->atomic_add_reference_count((size_t) delta);
+    } else {
+        release(object);
+    }
+}
+
+
+/**
+ * オブジェクトの増減をバッファへ記録する(ハッシュテーブルを探索する)
+ */
+__attribute__((noinline)) inline void deferred_buffer_record_slow(HeapObject* object, int64_t delta, void (*release)(HeapObject*)) {
+    if (deferred_buffer_is_destroyed) {
+        deferred_apply_immediately(object, delta, release);
+        return;
+    }
+
+    auto& buffer = deferred_buffer();
+    if (!buffer.is_window_open) {
+        deferred_buffer_open_window(buffer);
+    }
+
+    //アドレスの下位ビットはアラインメントにより偏るため、乗算して上位ビットを使用する
+    size_t index = (size_t) (((uintptr_t) object * 0x9E3779B97F4A7C15ull) >> (64 - DEFERRED_BUFFER_INDEX_BITS));
+    while (true) {
+        auto& update = buffer.updates[index];
+        if (update.object == object) {
+            update.delta += delta;
+            buffer.last_index = index;
+            return;
+        }
+        if (update.object == nullptr) {
+            update = { object, delta, release };
+            buffer.used_indices[buffer.used_count++] = (uint16_t) index;
+            buffer.last_index = index;
+            break;
+        }
+        index = (index + 1) & (DEFERRED_BUFFER_CAPACITY - 1);
+    }
+
+    if (buffer.used_count >= DEFERRED_BUFFER_FLUSH_THRESHOLD) {
+        rc_flush();
+    }
+}
+
+
+/**
+ * オブジェクトの参照カウントの増減をバッファへ記録する
+ * release は反映時に参照カウントを一つ減らす関数
+ */
+inline void deferred_buffer_record(HeapObject* object, int64_t delta, void (*release)(HeapObject*)) {
+    if (!deferred_buffer_is_destroyed) {
+        //同じオブジェクトが続く場合は、ハッシュテーブルを探索せずにまとめる
+        auto& buffer = deferred_buffer();
+        auto& update = buffer.updates[buffer.last_index];
+        if (update.object == object) {
+            update.delta += delta;
+            return;
+        }
+    }
+    deferred_buffer_record_slow(object, delta, release);
+}
+
+
+/**
+ * フィールドからロードするために遅延区間を開く
+ * このスレッドのバッファが破棄された後は通常のクリティカルセクションへ入り、その EpochRecord を返す
+ * 返した値は deferred_window_exit に渡す
+ */
+inline EpochRecord* deferred_window_enter() {
+    if (deferred_buffer_is_destroyed) {
+        return epoch_enter();
+    }
+
+    auto& buffer = deferred_buffer();
+    if (!buffer.is_window_open) {
+        deferred_buffer_open_window(buffer);
+    }
+    return nullptr;
+}
+
+/**
+ * deferred_window_enter で通常のクリティカルセクションへ入った場合は抜ける
+ * 遅延区間は rc_flush() まで開いたままにする
+ */
+inline void deferred_window_exit(EpochRecord* record) {
+    if (record != nullptr) {
+        epoch_exit(record);
+    }
+}
+
+#else
+
+/**
+ * 遅延参照カウントを使用しない場合は何もしない
+ */
+inline void rc_flush() {}
+
+#endif
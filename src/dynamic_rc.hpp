@@ -1,6 +1,16 @@
 #pragma once
 
+#include <span>
+#include <algorithm>
 #include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+#include "deferred_rc.hpp"
+#include "parallel_teardown.hpp"
+#include "background_reclamation.hpp"
+#include "cycle_collector.hpp"
+#include "lazy_promotion.hpp"
+#include "mutex_demotion.hpp"
+#include "unique_transfer.hpp"
 
 
 /**
@@ -85,9 +95,14 @@
  * 
  *  2. 次に事柄2.のオブジェクトは、is_mutex が true に変更される前と後で場合分けして考えるのが良い
  *     is_mutex が true に変更される前は、一つのスレッド内でしか操作できないため、この場合に限り同期処理は必要ない。
- *     is_mutex が true にされた後、つまり複数のスレッドからアクセスされうるオブジェクトのフィールドへの挿入処理には排他制御を必要とする[^1]。
- *     この排他制御のうち、オブジェクトを共有する側の unlock の release と読み取る側の lock の acquire により is_mutex の
+ *     is_mutex が true にされた後、つまり複数のスレッドからアクセスされうるオブジェクトのフィールドへの挿入は、
+ *     set_object の中で to_mutex() により伝搬させてから seq_cst の exchange でフィールドへ書き込み、
+ *     読み取る側は get_object の中で acquire load によりフィールドからロードする[^1]。
+ *     オブジェクトを共有する側の exchange(release を含む)と読み取る側の acquire load により is_mutex の
  *     happens-before-relationship が成立する。
+ *     また、読み取る側がロードしてから参照カウントを増やすまでの間に、他のスレッドが取り除いたオブジェクトの参照カウントが0にならないように、
+ *     フィールドから取り除いた参照の減少はエポックベースの遅延デクリメントにより、その間にいる全てのスレッドが抜けるまで遅らせる
+ *     (詳細は"epoch_reclamation.hpp"を参照)。
  *     加えてアプローチ4.より、is_mutex はそれ以降書き込まれることはない。
  * 
  * よって、is_mutex が true に変更される前と後、つまりオブジェクトが複数のスレッドからアクセス可能になる前と後で、
@@ -97,8 +112,20 @@
  * 特に、シングルスレッドモードでは一切の同期処理を必要としない。
  * 
  * 
+ * DEFERRED_REFERENCE_COUNT が true の場合、is_mutex が true のオブジェクトの参照カウントの増減はスレッドごとのバッファへ記録し、
+ * まとめて反映する。詳細は"deferred_rc.hpp"を参照。
+ * CYCLE_COLLECTION が true の場合、参照カウントを減らして0にならなかったオブジェクトを候補として記録し、
+ * collect_cycles() で循環参照を回収する。詳細は"cycle_collector.hpp"を参照。
+ * LAZY_MUTEX_PROMOTION が true の場合、publish_object() で挿入したオブジェクト以下の is_mutex は挿入時には伝搬させず、
+ * get_object で取り出された時に一つずつ true にする。アプローチ2.を緩めた場合の安全性は"lazy_promotion.hpp"を参照。
+ * MUTEX_DEMOTION が true の場合、try_demote() により、他のスレッドから到達できなくなったことを確かめられたオブジェクトに限り
+ * アプローチ4.の例外として is_mutex を false に戻す。詳細は"mutex_demotion.hpp"を参照。
+ * transfer_object() は、唯一の参照を手放して一つのスレッドへ受け渡すオブジェクトに限り、アプローチ2.の例外として
+ * is_mutex を伝搬させずに mutex なオブジェクトのフィールドへ挿入する。詳細は"unique_transfer.hpp"を参照。
+ * 
  * [^1]: スレッドセーフな参照カウントは『ガベージコレクション 自動的メモリ管理を構成する理論と実装』の
- *       18章「並行参照カウント法」にて取り上げられているロックを用いた単純な並行即時参照カウント法を参考に実装している
+ *       18章「並行参照カウント法」にて取り上げられているロックを用いた単純な並行即時参照カウント法を出発点としているが、
+ *       現在はフィールドの読み書きにロックを使わず、exchange と acquire load にエポックベースの遅延デクリメントを組み合わせている
  * 
  */
 class DynamicRC {
@@ -116,7 +143,7 @@ public:
      * オブジェクトの is_mutex の値を変更して初期化
      */
     inline DynamicRC(HeapObject* object_ref, bool is_mutex) {
-        object_ref->is_mutex = is_mutex;
+        object_ref->set_is_mutex(is_mutex);
         this->object_ref = object_ref;
     }
 
@@ -126,15 +153,64 @@ public:
      */
     inline DynamicRC(const DynamicRC& rc) {
         auto* object_ref = rc.object_ref;
+        this->object_ref = object_ref;
+        //ムーブ済みであれば空のハンドルとなる
+        if (object_ref == nullptr) {
+            return;
+        }
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (object_ref->is_mutex) {
+        if (object_ref->get_is_mutex()) {
+#if DEFERRED_REFERENCE_COUNT
+            //可能性がある場合、バッファへ記録して増やすのを遅らせる
+            deferred_buffer_record(object_ref, 1, release_retired_reference);
+#elif CYCLE_COLLECTION
+            //回収中のスレッドが増やしたことを知れるように、増やしてから色を黒に戻す
+            object_ref->atomic_increment_reference_count(memory_order_seq_cst);
+            cycle_mark_black_shared(object_ref);
+#else
             //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-            ((atomic_size_t*) &object_ref->reference_count)->fetch_add(1, memory_order_relaxed);
+            object_ref->atomic_increment_reference_count();
+#endif
         } else {
             //そうでない場合は、通常の命令で参照カウントを一つ増やす
-            object_ref->reference_count++;
+            object_ref->increment_reference_count();
+#if CYCLE_COLLECTION
+            cycle_mark_black_local(object_ref);
+#endif
         }
-        this->object_ref = object_ref;
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空のハンドルとなり、以降はコピー、代入、破棄のみ行える(get_object、set_object、get_payload 等は呼び出してはならない)
+     */
+    inline DynamicRC(DynamicRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     * 代入するオブジェクトの参照カウントを一つ増やし、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline DynamicRC& operator=(const DynamicRC& rc) {
+        DynamicRC copied(rc);
+        swap(this->object_ref, copied.object_ref);
+        //元のオブジェクトは copied のデストラクタで参照カウントが一つ減らされる
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * 代入するオブジェクトの参照カウントは変更せず、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline DynamicRC& operator=(DynamicRC&& rc) noexcept {
+        DynamicRC moved(move(rc));
+        swap(this->object_ref, moved.object_ref);
+        //元のオブジェクトは moved のデストラクタで参照カウントが一つ減らされる
+        return *this;
     }
 
     /**
@@ -142,74 +218,152 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~DynamicRC() {
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
+#if DEFERRED_REFERENCE_COUNT
+        if (this->object_ref->get_is_mutex()) {
+            //複数のスレッドからアクセスされうる場合は、バッファへ記録して減らすのを遅らせる
+            deferred_buffer_record(this->object_ref, -1, release_retired_reference);
+            return;
+        }
+#endif
+
+        release_retired_reference(this->object_ref);
+    }
+
+
+    /**
+     * オブジェクトの参照カウントを一つ減らし、減らした後の参照カウントが0であれば true を返す
+     */
+    static inline bool release_reference(HeapObject* object_ref) {
+#if CYCLE_COLLECTION
+        //0にならない場合は、減らす代わりに参照を候補のバッファへ移す
+        if (cycle_buffer_possible_root(object_ref, release_reference)) {
+            return false;
+        }
+#endif
+
         size_t previous_ref_count;
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (object_ref->get_is_mutex()) {
             //可能性がある場合、atomic-read-modify-write により参照カウントを一つ減らす
-            previous_ref_count = ((atomic_size_t*) &this->object_ref->reference_count)->fetch_sub(1, memory_order_release);
+            previous_ref_count = object_ref->atomic_decrement_reference_count();
 
             if (previous_ref_count == 1) {
                 //減らした後の参照カウントが0である場合は他のスレッド上での変更を取得
                 atomic_thread_fence(memory_order_acquire);
+#if LAZY_MUTEX_PROMOTION
+                //フィールド以下には昇格していない公開中のオブジェクトがありうるため、呼び出し元で辿らせずに
+                //ここから先は is_mutex に関わらず atomic に減らしながら解放する("lazy_promotion.hpp"を参照)
+                free_dead_object(object_ref, release_shared_reference);
+                return false;
+#endif
             }
         } else {
             //そうでない場合は、通常の命令で参照カウントを一つ減らす
-            previous_ref_count = this->object_ref->reference_count--;
+            previous_ref_count = object_ref->decrement_reference_count();
         }
 
-        if (previous_ref_count != 1) {
-            //減らした後の参照カウントが0でない場合は何もしない
-            return;
-        }
+        return previous_ref_count == 1;
+    }
 
-        auto field_length = this->object_ref->field_length;
-        //フィールドの開始ポインタ
-        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
 
-        //フィールドに格納されている全オブジェクトの参照カウントを一つ減らす
-        for (size_t field_index = 0; field_index < field_length; field_index++) {
-            //対象となるフィールドのポインタ
-            auto** field_ptr = field_start_ptr + field_index;
-            //フィールドの内容をロード
-            auto* field_object = *field_ptr;
+    /**
+     * フィールドから取り除かれた後、参照カウントを減らすのを遅らせていたオブジェクトの参照カウントを一つ減らす
+     * 遅延参照カウントのバッファを経由せずにその場で減らす
+     */
+    static inline void release_retired_reference(HeapObject* object_ref) {
+        if (release_reference(object_ref)) {
+            free_dead_object(object_ref, release_reference);
+        }
+    }
 
-            if (field_object != nullptr) {
-                //デストラクタを呼び出し、参照カウントを一つ減らす
-                DynamicRC rc(field_object);
-            }
+#if LAZY_MUTEX_PROMOTION
+    /**
+     * is_mutex に関わらず atomic に参照カウントを一つ減らし、減らした後の参照カウントが0であれば true を返す
+     * 共有か公開中のオブジェクトのフィールドにあったオブジェクトに使用する("lazy_promotion.hpp"を参照)
+     */
+    static inline bool release_shared_reference(HeapObject* object_ref) {
+        if (object_ref->atomic_decrement_reference_count() != 1) {
+            return false;
         }
+        //他のスレッド上での変更を取得
+        atomic_thread_fence(memory_order_acquire);
+        return true;
+    }
 
-        free(this->object_ref);
+    /**
+     * 共有のオブジェクトのフィールドから取り除かれた後、参照カウントを減らすのを遅らせていたオブジェクトの参照カウントを一つ減らす
+     * 公開中のオブジェクトである可能性があるため、is_mutex に関わらず atomic に減らす
+     */
+    static inline void release_retired_shared_reference(HeapObject* object_ref) {
+        if (release_shared_reference(object_ref)) {
+            free_dead_object(object_ref, release_shared_reference);
+        }
+    }
+#endif
 
+    /**
+     * 参照カウントが0になったオブジェクトと、それによって参照カウントが0になるフィールド以下のオブジェクトを全て解放する
+     */
+    static inline void free_dead_object(HeapObject* object_ref, bool (*release_field)(HeapObject*)) {
+#if BACKGROUND_RECLAMATION
+        //フィールド以下のオブジェクトも全て is_mutex が true であるため、回収スレッドへ渡せる
+        //キューが一杯の場合はここで解放する(詳細は"background_reclamation.hpp"を参照)
+        if (object_ref->get_is_mutex() && background_reclaim(object_ref, release_field)) {
+            return;
+        }
+#endif
+#if PARALLEL_TEARDOWN
+        if (object_ref->get_is_mutex()) {
+            //フィールド以下のオブジェクトも全て is_mutex が true であるため、大きい場合はワーカーで並列に解放する
+            //詳細は"parallel_teardown.hpp"を参照
+            free_heap_object_graph_parallel(object_ref, release_field);
+            return;
+        }
+#endif
+        //フィールド以下のオブジェクトの参照カウントを減らしながら解放する
+        //再帰呼び出しを行わないため、深いオブジェクトでもスタックは溢れない
+        free_heap_object_graph(object_ref, release_field);
+    }
 
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+    /**
+     * オブジェクトの参照カウントの増減を遅らせるかどうか
+     * 遅らせる場合、参照カウントはハンドルを通してのみ減らさなければならない
+     */
+    static inline bool is_deferred(HeapObject* object_ref) {
+#if DEFERRED_REFERENCE_COUNT
+        return object_ref->get_is_mutex();
+#else
+        return false;
+#endif
     }
 
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(lock)
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(lock)
+     * 競合時の待機方法については HeapObject::spin_lock_slow を参照
      */
     inline void lock() {
-        while (this->object_ref->spin_lock_flag.test_and_set(memory_order_acquire)) {
-            //spin
-        }
+        this->object_ref->spin_lock();
     }
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(unlock)
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(unlock)
      */
     inline void unlock() {
-        this->object_ref->spin_lock_flag.clear(memory_order_release);
+        this->object_ref->spin_unlock();
     }
 
 
 
     /**
      * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc の所有権はフィールドへ移る(ムーブして渡せば参照カウントの増減は発生しない)
      */
     inline void set_object(size_t field_index, optional<DynamicRC> rc) {
         //rc が nullopt であれば nullptr
@@ -217,6 +371,9 @@ public:
         HeapObject* object = nullptr;
         if (rc.has_value()) {
             object = rc.value().object_ref;
+            //rc から所有権を受け取る
+            //参照カウントは rc の作成時(コピー時)に既に増えているため、ここでは変更しない
+            rc.value().object_ref = nullptr;
         }
 
         //フィールドの開始ポインタ
@@ -224,22 +381,10 @@ public:
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //挿入するオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-            if (object->is_mutex) {
-                //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-                ((atomic_size_t*) &object->reference_count)->fetch_add(1, memory_order_relaxed);
-            } else {
-                //そうでない場合は、通常の命令で参照カウントを一つ増やす
-                object->reference_count++;
-            }
-        }
-        
-
         HeapObject* field_old_object;
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (this->object_ref->get_is_mutex()) {
             //可能性がある場合
 
             if (object != nullptr) {
@@ -247,25 +392,70 @@ public:
                 object->to_mutex();
             }
             
-            //スピンロックを使って安全に入れ替える
-            //この lock によりL252の to_mutex() の結果を acquire できる 
-            this->lock();
-            field_old_object = *field_ptr;
-            *field_ptr = object;
-            //この unlock によりL252の to_mutex() の結果が release される 
-            this->unlock();
+            //exchange により不可分的に入れ替える
+            //この release によりset_object 内の to_mutex() の結果が get_object 側へ公開される
+            field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
+
+            if (field_old_object != nullptr) {
+                //他のスレッドが get_object でロードしたまま参照カウントを増やしていない可能性があるため、
+                //既に挿入されていたオブジェクトの参照カウントはそのスレッドが抜けた後で減らす
+                //詳細は"epoch_reclamation.hpp"を参照
+#if LAZY_MUTEX_PROMOTION
+                //取り除いたオブジェクトは公開中である可能性がある("lazy_promotion.hpp"を参照)
+                epoch_retire(field_old_object, release_retired_shared_reference);
+#else
+                epoch_retire(field_old_object, release_retired_reference);
+#endif
+            }
         } else {
             //そうでない場合
             //通常の命令で入れ替える
             field_old_object = *field_ptr;
             *field_ptr = object;
+
+            if (field_old_object != nullptr) {
+                //デストラクタを呼び出し、既に挿入されていたオブジェクトの参照カウントを一つ減らす
+                DynamicRC rc(field_old_object);
+            }
+        }
+    }
+
+
+#if LAZY_MUTEX_PROMOTION
+    /**
+     * 指定された番号のフィールドにオブジェクトを挿入し、rc 以下の is_mutex は伝搬させずに公開する
+     * 他のスレッドが get_object で取り出した時に一つずつ昇格させる(詳細は"lazy_promotion.hpp"を参照)
+     * rc のハンドルは一意でなければならない
+     * (rc 以下の is_mutex が false のオブジェクトは、rc 以下のオブジェクトのフィールドと rc 以外から参照されていてはならない)
+     */
+    inline void publish_object(size_t field_index, DynamicRC rc) {
+        //このオブジェクトがローカルであれば、通常の挿入と同じ
+        if (!this->object_ref->get_is_mutex()) {
+            this->set_object(field_index, move(rc));
+            return;
         }
 
+#if RC_VALIDATION
+        lazy_publish_check_unique(rc.object_ref);
+#endif
+
+        //rc から所有権を受け取る
+        auto* object = rc.object_ref;
+        rc.object_ref = nullptr;
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        //対象となるフィールドのポインタ
+        auto** field_ptr = field_start_ptr + field_index;
+
+        //この release により、rc 以下のオブジェクトの作成時の書き込みが get_object 側へ公開される
+        auto* field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
         if (field_old_object != nullptr) {
-            //デストラクタを呼び出し、既に挿入されていたオブジェクトの参照カウントを一つ減らす
-            DynamicRC rc(field_old_object);
+            //取り除いたオブジェクトは公開中である可能性があるため、atomic に減らす
+            epoch_retire(field_old_object, release_retired_shared_reference);
         }
     }
+#endif
 
 
     /**
@@ -281,32 +471,64 @@ public:
         HeapObject* field_object;
 
         //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-        if (this->object_ref->is_mutex) {
+        if (this->object_ref->get_is_mutex()) {
             //可能性がある場合
-            //スピンロックを使用して以下の操作を不可分的に行う
+            //エポックのクリティカルセクション内で以下の操作を行う
             // 1. フィールドからロード
             // 2. ロードしたオブジェクトの参照カウントを一つ増やす
-            //この lock によりL252の to_mutex() の結果を acquire できる 
-            this->lock();
-            field_object = *field_ptr;
+            //他のスレッドの set_object で取り除かれたとしても、参照カウントはこのスレッドが抜けるまで減らされない
+#if DEFERRED_REFERENCE_COUNT
+            //遅延区間はそのままクリティカルセクションとなる
+            auto* record = deferred_window_enter();
+#else
+            auto* record = epoch_enter();
+#endif
+            //この acquire によりset_object 内の to_mutex() の結果を取得できる
+            field_object = ((atomic<HeapObject*>*) field_ptr)->load(memory_order_acquire);
             if (field_object != nullptr) {
                 //this->object_ref の is_mutex が true であり、
                 //アプローチ2.より field_object の is_mutex が true であることがわかるためチェックする必要はない
-                ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
+#if DEFERRED_REFERENCE_COUNT
+                deferred_buffer_record(field_object, 1, release_retired_reference);
+#elif CYCLE_COLLECTION
+                field_object->atomic_increment_reference_count(memory_order_seq_cst);
+                cycle_mark_black_shared(field_object);
+#elif LAZY_MUTEX_PROMOTION
+                //is_mutex が false であれば publish_object で挿入された公開中のオブジェクトであるため、
+                //ハンドルを作る前に共有へ昇格させる("lazy_promotion.hpp"を参照)
+                if (!field_object->get_is_mutex()) {
+                    field_object->try_set_is_mutex();
+                }
+                field_object->atomic_increment_reference_count();
+#else
+                field_object->atomic_increment_reference_count();
+#endif
             }
-            this->unlock();
+#if DEFERRED_REFERENCE_COUNT
+            deferred_window_exit(record);
+#else
+            epoch_exit(record);
+#endif
         } else {
             //そうでない場合
             //通常の命令で取得する
             field_object = *field_ptr;
             if (field_object != nullptr) {
                 //取得したオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
-                if (field_object->is_mutex) {
+                if (field_object->get_is_mutex()) {
                     //可能性がある場合、atomic-read-modify-write により参照カウントを一つ増やす
-                    ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
+#if CYCLE_COLLECTION
+                    field_object->atomic_increment_reference_count(memory_order_seq_cst);
+                    cycle_mark_black_shared(field_object);
+#else
+                    field_object->atomic_increment_reference_count();
+#endif
                 } else {
                     //そうでない場合は、通常の命令で参照カウントを一つ増やす
-                    field_object->reference_count++;
+                    field_object->increment_reference_count();
+#if CYCLE_COLLECTION
+                    cycle_mark_black_local(field_object);
+#endif
                 }
             }
         }
@@ -318,8 +540,456 @@ public:
         }
     }
 
+    /**
+     * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入し、元のオブジェクトを返す
+     * rc の所有権はフィールドへ移り、フィールドが持っていた参照は返すハンドルへ移る
+     * このオブジェクトが mutex であっても、クリティカルセクションにいるスレッドがなければ参照カウントは変更しない
+     */
+    inline optional<DynamicRC> exchange_object(size_t field_index, optional<DynamicRC> rc) {
+        HeapObject* object = nullptr;
+        if (rc.has_value()) {
+            object = rc.value().object_ref;
+            rc.value().object_ref = nullptr;
+        }
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        //対象となるフィールドのポインタ
+        auto** field_ptr = field_start_ptr + field_index;
+
+        HeapObject* field_old_object;
+
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (this->object_ref->get_is_mutex()) {
+            //可能性がある場合、set_object と同じく伝搬させてから exchange により不可分的に入れ替える
+            if (object != nullptr) {
+                object->to_mutex();
+            }
+            field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
+
+            if (field_old_object == nullptr) {
+                return nullopt;
+            }
+            return adopt_removed_shared_object(field_old_object);
+        }
+
+        //そうでない場合
+        //通常の命令で入れ替える
+        field_old_object = *field_ptr;
+        *field_ptr = object;
+
+        if (field_old_object == nullptr) {
+            return nullopt;
+        }
+#if CYCLE_COLLECTION
+        //ハンドルから参照されるようになったため、回収の候補であっても生存していることを伝える
+        if (field_old_object->get_is_mutex()) {
+            cycle_mark_black_shared(field_old_object);
+        } else {
+            cycle_mark_black_local(field_old_object);
+        }
+#endif
+        return DynamicRC(field_old_object);
+    }
+
+    /**
+     * 指定された番号のフィールドにあるオブジェクトを取り除いて返す
+     * exchange_object(field_index, nullopt) と同じ
+     */
+    inline optional<DynamicRC> take_object(size_t field_index) {
+        return this->exchange_object(field_index, nullopt);
+    }
+
+    /**
+     * 指定された番号のフィールドにあるオブジェクトが expected と同じであれば desired に入れ替えて true を返す
+     * 異なる場合は何もせずに false を返す
+     * desired のハンドルは入れ替えた場合にのみコピーされるため、失敗しても呼び出し元のハンドルはそのまま使用できる
+     * expected は呼び出し元がハンドルを持っているため、比較中に解放されて同じアドレスが再利用されること(ABA)はない
+     */
+    inline bool compare_and_set_object(size_t field_index, const optional<DynamicRC>& expected, const optional<DynamicRC>& desired) {
+        auto* expected_object = expected.has_value() ? expected.value().object_ref : nullptr;
+        auto* desired_object = desired.has_value() ? desired.value().object_ref : nullptr;
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        //対象となるフィールドのポインタ
+        auto** field_ptr = field_start_ptr + field_index;
+
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (!this->object_ref->get_is_mutex()) {
+            //そうでない場合
+            //通常の命令で比較して入れ替える
+            if (*field_ptr != expected_object) {
+                return false;
+            }
+            this->set_object(field_index, desired);
+            return true;
+        }
+
+        //可能性がある場合
+        //挿入する前に伝搬させる(失敗した場合も is_mutex は true のまま残るが、安全である)
+        if (desired_object != nullptr) {
+            desired_object->to_mutex();
+        }
+        //この release により、set_object と同じく伝搬の結果が get_object 側へ公開される
+        if (!((atomic<HeapObject*>*) field_ptr)->compare_exchange_strong(expected_object, desired_object, memory_order_seq_cst)) {
+            return false;
+        }
+
+        if (desired_object != nullptr) {
+            //フィールドの分の参照カウントを増やす
+            //呼び出し元が desired のハンドルを持っているため、他のスレッドが先に取り出して減らしても0にはならない
+            //desired_object は挿入前に伝搬させたため、mutex として増やす
+#if DEFERRED_REFERENCE_COUNT
+            deferred_buffer_record(desired_object, 1, release_retired_reference);
+#elif CYCLE_COLLECTION
+            desired_object->atomic_increment_reference_count(memory_order_seq_cst);
+            cycle_mark_black_shared(desired_object);
+#else
+            desired_object->atomic_increment_reference_count();
+#endif
+        }
+        if (expected_object != nullptr) {
+            //他のスレッドが get_object でロードしたまま参照カウントを増やしていない可能性があるため、抜けた後で減らす
+#if LAZY_MUTEX_PROMOTION
+            epoch_retire(expected_object, release_retired_shared_reference);
+#else
+            epoch_retire(expected_object, release_retired_reference);
+#endif
+        }
+        return true;
+    }
+
+    /**
+     * 指定された番号のフィールドへ、一つのスレッドが take_transferred_object で受け取るためのオブジェクトを挿入
+     * rc は呼び出し元の唯一のハンドルをムーブして渡す
+     * このオブジェクトが mutex であっても、rc 以下で他から参照されていない部分は is_mutex を false のまま挿入する
+     * 挿入したフィールドは take_transferred_object でのみ取り出す必要がある(詳細は"unique_transfer.hpp"を参照)
+     */
+    inline void transfer_object(size_t field_index, DynamicRC&& rc) {
+#if CYCLE_COLLECTION
+        //回収中のスレッドと競合するため、通常の挿入と同じ
+        this->set_object(field_index, move(rc));
+#else
+        //このオブジェクトがローカルであれば、通常の挿入と同じ
+        if (!this->object_ref->get_is_mutex()) {
+            this->set_object(field_index, move(rc));
+            return;
+        }
+
+        //他から参照されている部分のみ伝搬させる
+        auto* object = rc.object_ref;
+        transfer_prepare_heap_object_graph(object);
+        //rc から所有権を受け取る
+        rc.object_ref = nullptr;
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        //この release により、渡すスレッドの書き込みが take_transferred_object 側へ公開される
+        auto* field_old_object = ((atomic<HeapObject*>*) (field_start_ptr + field_index))->exchange(object, memory_order_seq_cst);
+
+        if (field_old_object != nullptr) {
+            //受け渡し中のまま上書きされた場合は、ローカルなオブジェクトであっても他のスレッドがハンドルを持っていないため、
+            //set_object と同じく抜けた後で減らす
+#if LAZY_MUTEX_PROMOTION
+            epoch_retire(field_old_object, release_retired_shared_reference);
+#else
+            epoch_retire(field_old_object, release_retired_reference);
+#endif
+        }
+#endif
+    }
+
+    /**
+     * transfer_object で挿入されたオブジェクトを取り除いて返す
+     * フィールドの参照をそのままハンドルとして受け取るため、参照カウントは変更しない
+     */
+    inline optional<DynamicRC> take_transferred_object(size_t field_index) {
+#if CYCLE_COLLECTION
+        return this->take_object(field_index);
+#else
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+        //対象となるフィールドのポインタ
+        auto** field_ptr = field_start_ptr + field_index;
+
+        HeapObject* field_object;
+        if (this->object_ref->get_is_mutex()) {
+            //この acquire により、渡したスレッドの書き込みを取得できる
+            field_object = ((atomic<HeapObject*>*) field_ptr)->exchange(nullptr, memory_order_seq_cst);
+        } else {
+            field_object = *field_ptr;
+            *field_ptr = nullptr;
+        }
+
+        if (field_object == nullptr) {
+            return nullopt;
+        }
+        return DynamicRC(field_object);
+#endif
+    }
+
+
+    /**
+     * field_indices で指定された番号のフィールドに、objects の同じ位置のオブジェクト若くは nullptr をまとめて挿入
+     * objects のハンドルはコピーされ、同じオブジェクトを複数のフィールドへ挿入する場合は参照カウントをまとめて増やす
+     * このオブジェクトが mutex であれば、挿入するオブジェクトごとの is_mutex の伝搬と、
+     * 取り除いたオブジェクトのエポックの処理(リンボの回収)もまとめて一度だけ行う
+     * field_indices と objects は同じ長さでなければならない(RC_VALIDATION が true の場合は確かめ、異なれば異常終了する)
+     */
+    inline void set_fields(span<const size_t> field_indices, span<const optional<DynamicRC>> objects) {
+#if RC_VALIDATION
+        if (field_indices.size() != objects.size()) {
+            abort();
+        }
+#endif
+        //このオブジェクトがローカルであれば、一つずつ挿入しても同期処理は発生しない
+        if (!this->object_ref->get_is_mutex()) {
+            for (size_t i = 0; i < field_indices.size(); i++) {
+                this->set_object(field_indices[i], objects[i]);
+            }
+            return;
+        }
+
+        //挿入するオブジェクトごとに、以下のオブジェクトの is_mutex を true に伝搬させてから参照カウントをまとめて増やす
+        static thread_local vector<HeapObject*> inserted_objects;
+        inserted_objects.clear();
+        for (auto& rc : objects) {
+            inserted_objects.push_back(rc.has_value() ? rc.value().object_ref : nullptr);
+        }
+        for_each_coalesced(inserted_objects, [](HeapObject* object, size_t count) {
+            object->to_mutex();
+#if CYCLE_COLLECTION
+            object->atomic_add_reference_count(count, memory_order_seq_cst);
+            cycle_mark_black_shared(object);
+#else
+            object->atomic_add_reference_count(count);
+#endif
+        });
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+
+        bool has_retired = false;
+        for (size_t i = 0; i < field_indices.size(); i++) {
+            auto* object = inserted_objects[i];
+            //set_object と同じく、この release により伝搬の結果が get_object 側へ公開される
+            auto* field_old_object = ((atomic<HeapObject*>*) (field_start_ptr + field_indices[i]))->exchange(object, memory_order_seq_cst);
+            if (field_old_object != nullptr) {
+#if LAZY_MUTEX_PROMOTION
+                epoch_push_retired(field_old_object, release_retired_shared_reference);
+#else
+                epoch_push_retired(field_old_object, release_retired_reference);
+#endif
+                has_retired = true;
+            }
+        }
+
+        if (has_retired) {
+            //エポックを一括で進め、減らせるものは減らす
+            epoch_advance_and_collect();
+        }
+    }
+
+    /**
+     * field_indices で指定された番号のフィールドにあるオブジェクトをまとめて取得し、objects の同じ位置へ書き込む
+     * このオブジェクトが mutex であれば、クリティカルセクションへの出入りは一度だけ行い、
+     * 複数のフィールドにある同じオブジェクトの参照カウントはまとめて増やす
+     * field_indices と objects は同じ長さでなければならない(RC_VALIDATION が true の場合は確かめ、異なれば異常終了する)
+     */
+    inline void get_fields(span<const size_t> field_indices, span<optional<DynamicRC>> objects) {
+#if RC_VALIDATION
+        if (field_indices.size() != objects.size()) {
+            abort();
+        }
+#endif
+        //このオブジェクトがローカルであれば、一つずつ取得しても同期処理は発生しない
+        if (!this->object_ref->get_is_mutex()) {
+            for (size_t i = 0; i < field_indices.size(); i++) {
+                objects[i] = this->get_object(field_indices[i]);
+            }
+            return;
+        }
+
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
+
+        static thread_local vector<HeapObject*> loaded_objects;
+        loaded_objects.clear();
+
+        //get_object と同じく、ロードから参照カウントを増やすまでをクリティカルセクション内で行う
+#if DEFERRED_REFERENCE_COUNT
+        auto* record = deferred_window_enter();
+#else
+        auto* record = epoch_enter();
+#endif
+        for (auto field_index : field_indices) {
+            auto* field_object = ((atomic<HeapObject*>*) (field_start_ptr + field_index))->load(memory_order_acquire);
+            loaded_objects.push_back(field_object);
+        }
+        for_each_coalesced(loaded_objects, [](HeapObject* object, size_t count) {
+#if DEFERRED_REFERENCE_COUNT
+            deferred_buffer_record(object, (int64_t) count, release_retired_reference);
+#elif CYCLE_COLLECTION
+            object->atomic_add_reference_count(count, memory_order_seq_cst);
+            cycle_mark_black_shared(object);
+#elif LAZY_MUTEX_PROMOTION
+            //公開中のオブジェクトはハンドルを作る前に共有へ昇格させる("lazy_promotion.hpp"を参照)
+            if (!object->get_is_mutex()) {
+                object->try_set_is_mutex();
+            }
+            object->atomic_add_reference_count(count);
+#else
+            object->atomic_add_reference_count(count);
+#endif
+        });
+#if DEFERRED_REFERENCE_COUNT
+        deferred_window_exit(record);
+#else
+        epoch_exit(record);
+#endif
+
+        for (size_t i = 0; i < loaded_objects.size(); i++) {
+            if (loaded_objects[i] == nullptr) {
+                objects[i] = nullopt;
+            } else {
+                objects[i] = DynamicRC(loaded_objects[i]);
+            }
+        }
+    }
+
+private:
+    /**
+     * mutex なオブジェクトのフィールドから atomic に取り除いたオブジェクトについて、フィールドが持っていた参照をハンドルとして受け取る
+     * 他のスレッドが get_object でロードしたまま参照カウントを増やしていない可能性がある場合は、
+     * ハンドルの分を増やし、フィールドの分はそのスレッドがクリティカルセクションを抜けた後で減らす(set_object と同じ)
+     * クリティカルセクションにいるスレッドがなければ、増減せずにそのまま受け取る
+     */
+    static inline DynamicRC adopt_removed_shared_object(HeapObject* object) {
+#if LAZY_MUTEX_PROMOTION
+        //公開中であったオブジェクトは、ハンドルを作る前に共有へ昇格させる("lazy_promotion.hpp"を参照)
+        if (!object->get_is_mutex()) {
+            object->try_set_is_mutex();
+        }
+#endif
+
+#if DEFERRED_REFERENCE_COUNT
+        //遅延区間を開いたままのスレッドがあるため、常に増やしてから取り除いた分を遅らせて減らす
+        deferred_buffer_record(object, 1, release_retired_reference);
+        epoch_retire(object, release_retired_reference);
+#else
+        if (!epoch_is_quiescent()) {
+#if CYCLE_COLLECTION
+            object->atomic_increment_reference_count(memory_order_seq_cst);
+#else
+            object->atomic_increment_reference_count();
+#endif
+            //LAZY_MUTEX_PROMOTION が true の場合も昇格させた後であるため、release_retired_reference で減らせる
+            epoch_retire(object, release_retired_reference);
+        }
+#endif
+
+#if CYCLE_COLLECTION
+        //ハンドルから参照されるようになったため、回収の候補であっても生存していることを伝える
+        cycle_mark_black_shared(object);
+#endif
+        return DynamicRC(object);
+    }
+
+    /**
+     * objects に含まれる同じオブジェクトをまとめて、acquire(オブジェクト, 出現した数) を呼び出す(nullptr は除く)
+     * 数え上げには、オブジェクトのアドレスで位置を決める小さな表を使用する
+     * 同じ位置に異なるオブジェクトが来た場合は先にあった方の acquire を呼び出して入れ替えるため、
+     * 同じオブジェクトに対して複数回呼び出すことはあるが、数え上げのためにメモリを確保したり並べ替えたりはしない
+     */
+    template<typename F>
+    static inline void for_each_coalesced(const vector<HeapObject*>& objects, F acquire) {
+        constexpr size_t table_size = 16;
+        HeapObject* table_objects[table_size] = {};
+        size_t table_counts[table_size];
+
+        for (auto* object : objects) {
+            if (object == nullptr) {
+                continue;
+            }
+            //オブジェクトは8バイト境界に揃っているため、下位ビットを捨ててから混ぜる
+            auto index = (((((size_t) object) >> 3) * 0x9E3779B97F4A7C15ull) >> 60) & (table_size - 1);
+            if (table_objects[index] == object) {
+                table_counts[index]++;
+                continue;
+            }
+            if (table_objects[index] != nullptr) {
+                acquire(table_objects[index], table_counts[index]);
+            }
+            table_objects[index] = object;
+            table_counts[index] = 1;
+        }
+
+        for (size_t index = 0; index < table_size; index++) {
+            if (table_objects[index] != nullptr) {
+                acquire(table_objects[index], table_counts[index]);
+            }
+        }
+    }
+
+public:
+    /**
+     * このオブジェクト以下の is_mutex を true に伝搬させる
+     * FIELD_LENGTH_HINT については HeapObject::to_mutex を参照
+     */
+    template<size_t FIELD_LENGTH_HINT = 0>
     inline void to_mutex() {
-        this->object_ref->to_mutex();
+        this->object_ref->to_mutex<FIELD_LENGTH_HINT>();
+    }
+
+#if MUTEX_DEMOTION
+    /**
+     * このオブジェクト以下で、このハンドルからしか到達できなくなった is_mutex が true のオブジェクトを
+     * シングルスレッドモードへ戻す(詳細は"mutex_demotion.hpp"を参照)
+     * このオブジェクトの is_mutex が false であれば true を返す
+     * 他のスレッドがハンドルを持っている場合や、フィールドから取り除いた分がまだリンボに残っている場合は false を返す
+     */
+    inline bool try_demote() {
+        return demote_heap_object_graph(this->object_ref);
+    }
+#endif
+
+    /**
+     * オブジェクトのペイロード(ポインタでない値を格納する領域)の開始ポインタを取得
+     * ペイロードへの読み書きは同期されないため、複数のスレッドから書き換える場合は lock() 等で保護する必要がある
+     */
+    inline void* get_payload() {
+        return this->object_ref->get_payload();
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+    /**
+     * 参照カウントを変更せずに所有権を手放し、オブジェクト本体へのポインタを返す
+     * 返したポインタの参照カウントは呼び出し元が責任を持って減らす必要がある
+     */
+    inline HeapObject* release_heap_object() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
     }
 
 };
+
+
+#if CYCLE_COLLECTION
+
+/**
+ * このスレッドで記録した候補と、全てのスレッドで共有する候補から循環参照を回収する
+ * 共有の候補は、他のスレッドが回収中であればそれを待ってから回収する
+ */
+inline void collect_cycles() {
+    cycle_collect(DynamicRC::release_reference);
+}
+
+#endif
@@ -2,13 +2,96 @@
 //true に設定するとオブジェクトの作成時と破棄時にカウンタを増減させて、正しく動作しているかどうかを確かめることができる
 #define RC_VALIDATION false
 
+//オブジェクトの確保にスラブアロケータ(slab_allocator.hpp)を使用するかどうか
+//false の場合は malloc/free を使用する
+//CMake の dynamic_rc_benchmark_slab ターゲットでは true としてビルドされる
+#ifndef USE_SLAB_ALLOCATOR
+#define USE_SLAB_ALLOCATOR false
+#endif
+
+//オブジェクトのヘッダを8バイトに詰めたレイアウト(heap_object.hpp)を使用するかどうか
+//CMake の dynamic_rc_benchmark_compact ターゲットでは true としてビルドされる
+#ifndef COMPACT_HEAP_OBJECT_HEADER
+#define COMPACT_HEAP_OBJECT_HEADER false
+#endif
+
+//複数のスレッドからアクセスされうるオブジェクトの参照カウントの増減を、スレッドごとのバッファでまとめてから反映する(deferred_rc.hpp)かどうか
+//CMake の dynamic_rc_benchmark_deferred ターゲットでは true としてビルドされる
+#ifndef DEFERRED_REFERENCE_COUNT
+#define DEFERRED_REFERENCE_COUNT false
+#endif
+
+//動的切り替え参照カウントで循環参照を回収する(cycle_collector.hpp)かどうか
+//CMake の dynamic_rc_benchmark_cycle ターゲットでは true としてビルドされる
+#ifndef CYCLE_COLLECTION
+#define CYCLE_COLLECTION false
+#endif
+
+//オブジェクトのヘッダに弱参照の数を持たせ、弱参照(weak_rc.hpp)を使用できるようにするかどうか
+//CMake の dynamic_rc_benchmark_weak ターゲットでは true としてビルドされる
+#ifndef WEAK_REFERENCE
+#define WEAK_REFERENCE false
+#endif
+
+//大きなオブジェクトの解放をワーカースレッドで並列に行う(parallel_teardown.hpp)かどうか
+//CMake の dynamic_rc_benchmark_parallel_teardown ターゲットでは true としてビルドされる
+#ifndef PARALLEL_TEARDOWN
+#define PARALLEL_TEARDOWN false
+#endif
+
+//参照カウントが0になったオブジェクトの解放を専用のスレッドで行う(background_reclamation.hpp)かどうか
+//CMake の dynamic_rc_benchmark_background_reclamation ターゲットでは true としてビルドされる
+#ifndef BACKGROUND_RECLAMATION
+#define BACKGROUND_RECLAMATION false
+#endif
+
+//巨大なオブジェクトの is_mutex の伝搬をワーカースレッドと並列に行う(parallel_mark.hpp)かどうか
+//CMake の dynamic_rc_benchmark_parallel_to_mutex ターゲットでは true としてビルドされる
+#ifndef PARALLEL_TO_MUTEX
+#define PARALLEL_TO_MUTEX false
+#endif
+
+//mutex なオブジェクトへ挿入したオブジェクト以下の is_mutex を、他のスレッドが取り出した時に遅延して伝搬させる(lazy_promotion.hpp)かどうか
+//CMake の dynamic_rc_benchmark_lazy_promotion ターゲットでは true としてビルドされる
+#ifndef LAZY_MUTEX_PROMOTION
+#define LAZY_MUTEX_PROMOTION false
+#endif
+
+//他のスレッドから到達できなくなったオブジェクトの is_mutex を false に戻せるようにする(mutex_demotion.hpp)かどうか
+//CMake の dynamic_rc_benchmark_mutex_demotion ターゲットでは true としてビルドされる
+#ifndef MUTEX_DEMOTION
+#define MUTEX_DEMOTION false
+#endif
+
+//Arena のスコープ内で確保したオブジェクトをアリーナのチャンクから切り出し、チャンクごとにまとめて解放する(arena_allocator.hpp)かどうか
+//CMake の dynamic_rc_benchmark_arena ターゲットでは true としてビルドされる
+#ifndef ARENA_ALLOCATION
+#define ARENA_ALLOCATION false
+#endif
+
 #include "manual_object.hpp"
 #include "dynamic_rc.hpp"
 #include "single_thread_rc.hpp"
 #include "thread_safe_rc.hpp"
+#include "typed_object.hpp"
+#include "weak_rc.hpp"
+#include "shared_containers.hpp"
+#include "thread_spawn.hpp"
+#include "channel.hpp"
+#if !COMPACT_HEAP_OBJECT_HEADER
+    //偏り参照カウントはコンパクトなヘッダでは使用できない
+    #include "biased_rc.hpp"
+#endif
 #include <iostream>
 #include <vector>
 #include <thread>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <algorithm>
+#include <array>
+#include <malloc.h>
 #include <benchmark/benchmark.h>
 
 //全オブジェクトのフィールドの長さ
@@ -17,261 +100,3611 @@
 //マルチスレッドベンチマークに使用するスレッド数
 #define NUMBER_OF_THREADS 8
 
+//削除ベンチマークに使用する連結リストの長さ
+#define TEARDOWN_LINKED_LIST_LENGTH 10000000
+
+//削除ベンチマークに使用する木構造の深さ
+#define TEARDOWN_TREE_DEPTH 25
+
+//mutex化ベンチマークに使用する木構造の深さ(約100万オブジェクト)
+#define TO_MUTEX_TREE_DEPTH 19
+
+//mutex化ベンチマークに使用する連結リストの長さ
+#define TO_MUTEX_LINKED_LIST_LENGTH 1000000
+
+//オブジェクト一つあたりのメモリ使用量を計測するベンチマークで作成する木構造オブジェクトの深さ
+#define NODE_FOOTPRINT_TREE_DEPTH 16
+
+//ペイロードを持つ木構造オブジェクトのベンチマークで作成する木構造オブジェクトの深さ
+#define PAYLOAD_TREE_DEPTH 14
+
+//読み込み中心のベンチマークで、何回の操作につき一回フィールドへ書き込むか
+#define READ_HEAVY_WRITE_INTERVAL 64
+
+//オブジェクトの形を固定したベンチマーク(TypedObject)で作成する木構造オブジェクトのおおよそのオブジェクト数
+#define SHAPE_TREE_OBJECT_COUNT 100000
+
+//作成したスレッドが公開済みの木構造オブジェクトを書き換えるベンチマークで使用する木構造の深さ
+#define OWNER_MUTATION_TREE_DEPTH 12
+
+//生産者・消費者ベンチマークで生産者スレッド一つあたりが作成する木構造オブジェクトの数
+#define PRODUCER_CONSUMER_TREE_COUNT 50
+
+//生産者・消費者ベンチマークで作成する木構造オブジェクトの深さ
+#define PRODUCER_CONSUMER_TREE_DEPTH 12
+
+//共有されたオブジェクトのハンドルをコピーし続けるベンチマークで、rc_flush() を呼び出す(セーフポイントに到達する)間隔
+#define HOT_SHARED_COPY_FLUSH_INTERVAL 1024
+
+//共有コンテナのベンチマークで、rc_flush() を呼び出す(セーフポイントに到達する)間隔
+#define SHARED_CONTAINER_FLUSH_INTERVAL 1024
+
+//共有コンテナのベンチマークで、ハッシュマップに使用するキーの数(最初にその半分を挿入しておく)
+#define SHARED_MAP_KEY_COUNT 4096
+
+//共有コンテナのベンチマークで、配列に最初に追加しておく要素の数
+#define SHARED_VECTOR_LENGTH 512
+
+//パイプラインのベンチマークで使用するスレッド(段)の数
+#define PIPELINE_STAGE_COUNT 4
+
+//パイプラインのベンチマークで流す木構造オブジェクトの数
+#define PIPELINE_TREE_COUNT 64
+
+//パイプラインのベンチマークで流す木構造オブジェクトの深さ
+#define PIPELINE_TREE_DEPTH 12
+
+//親への参照を辿るベンチマークで使用する木構造オブジェクトの深さ
+#define PARENT_POINTER_TREE_DEPTH 12
+
+//並列解放のベンチマークで解放する木構造オブジェクトの深さ
+#define PARALLEL_TEARDOWN_TREE_DEPTH 20
+
+//遅延伝搬のベンチマークで公開する木構造オブジェクトの深さ
+#define LAZY_PUBLISH_TREE_DEPTH 20
+
+//遅延伝搬のベンチマークで、公開した木構造オブジェクトを各スレッドが根から辿る回数
+#define LAZY_PUBLISH_READ_COUNT 1000
+
+//遅延伝搬のベンチマークで、公開した木構造オブジェクトを各スレッドが根から辿る深さ
+#define LAZY_PUBLISH_READ_DEPTH 3
+
+//降格のベンチマークで、公開してから取り除いた後に書き換え続ける木構造オブジェクトの深さ
+#define MUTEX_DEMOTION_TREE_DEPTH 12
+
+//非同期解放のベンチマークで、set_object により取り除く木構造オブジェクトの深さ
+#define BACKGROUND_RECLAMATION_TREE_DEPTH 10
+
+//非同期解放のベンチマークで set_object を呼び出す回数
+#define BACKGROUND_RECLAMATION_ITERATIONS 10000
+
+//アリーナのベンチマークで作成して破棄する木構造オブジェクトの深さ
+#define ARENA_TREE_DEPTH 16
+
+
+/**
+ * ペイロードを持つ木構造オブジェクトの各オブジェクトが持つ値
+ */
+struct NodePayload {
+    int64_t id;
+    double weight;
+};
+
+
+/**
+ * 指定された型で木構造オブジェクトを作成
+ */
+template<typename T> T create_tree(size_t count, size_t tree_depth);
+
+/**
+ * 指定された型で、各オブジェクトが NodePayload をペイロードとして持つ木構造オブジェクトを作成
+ */
+template<typename T> T create_payload_tree(size_t count, size_t tree_depth);
+
+/**
+ * 指定された型で、各オブジェクトが NodePayload の各値をそれぞれ別のオブジェクトに包んで(ボックス化して)持つ木構造オブジェクトを作成
+ * フィールドの OBJECT_FIELD_LENGTH 番目に id を、OBJECT_FIELD_LENGTH + 1 番目に weight を包んだオブジェクトを持つ
+ */
+template<typename T> T create_boxed_tree(size_t count, size_t tree_depth);
+
+/**
+ * create_payload_tree で作成した木構造オブジェクトの weight の合計を求める
+ */
+template<typename T> double sum_payload_tree(T& object);
+
+/**
+ * create_boxed_tree で作成した木構造オブジェクトの weight の合計を求める
+ */
+template<typename T> double sum_boxed_tree(T& object);
+
+/**
+ * 指定された型で連結リストオブジェクトを作成
+ */
+template<typename T> T create_linked_list(size_t length);
+
+/**
+ * 通常のハンドルで、各オブジェクトがフィールドを field_length 個持つ木構造オブジェクトを作成
+ */
+template<typename T> T create_tree_with_field_length(size_t count, size_t tree_depth, size_t field_length);
+
+/**
+ * TypedObject で、各オブジェクトがフィールドを N 個持つ木構造オブジェクトを作成
+ */
+template<size_t N> TypedObject<N> create_typed_tree(size_t count, size_t tree_depth);
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造で、オブジェクト数が SHAPE_TREE_OBJECT_COUNT を超えない最大の深さ
+ */
+constexpr size_t shape_tree_depth(size_t N);
+
+/**
+ * オブジェクトを削除
+ * 手動メモリ管理の場合は明示的に削除し、参照カウントの場合は所有権を手放す
+ */
+template<typename T> void delete_object(T object);
+
+/**
+ * ハンドルを介さずに木構造オブジェクトを作成
+ */
+HeapObject* create_raw_tree(size_t count, size_t tree_depth);
+
+/**
+ * ハンドルを介さずに連結リストオブジェクトを作成
+ */
+HeapObject* create_raw_linked_list(size_t length);
+
+/**
+ * フィールドの長さが field_length であるオブジェクト一つあたりに、アロケータが実際に消費するバイト数
+ */
+size_t allocated_bytes_per_object(size_t field_length, size_t payload_size = 0);
+
+/**
+ * オブジェクト以下の is_mutex を全て false に戻す
+ */
+void reset_mutex(HeapObject* object);
+
+/**
+ * 比較用に、再帰呼び出しでオブジェクト以下の is_mutex を true に伝搬させる
+ */
+void to_mutex_recursive(HeapObject* object);
+
+/**
+ * Treiber スタックの先頭へ node を積む
+ * stack の0番目のフィールドが先頭の要素を、各要素の0番目のフィールドが次の要素を指す
+ * 取り出した要素を再び積むと ABA により壊れるため、積む要素は毎回新しく作成する
+ */
+void treiber_stack_push(DynamicRC& stack, DynamicRC node);
+
+/**
+ * Treiber スタックの先頭から要素を取り出す(空であれば nullopt)
+ */
+optional<DynamicRC> treiber_stack_pop(DynamicRC& stack);
+
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 手動
+ */
+static void benchmark_single_thread_manual_object(benchmark::State& state);
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : シングススレッド専用参照カウント
+ */
+static void benchmark_single_thread_single_thread_rc(benchmark::State& state);
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : スレッドセーフな参照カウント
+ */
+static void benchmark_single_thread_thread_safe_rc(benchmark::State& state);
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_single_thread_dynamic_rc(benchmark::State& state);
+
+/**
+ * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : スレッドセーフな参照カウント
+ */
+static void benchmark_multi_thread_thread_safe_rc(benchmark::State& state);
+
+/**
+ * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_multi_thread_dynamic_rc(benchmark::State& state);
+
+/**
+ * 木構造オブジェクトの作成と削除にかかるオブジェクト一つあたりの時間と、オブジェクト一つあたりのメモリ使用量を計測するベンチマーク用関数
+ * ヘッダのレイアウト(COMPACT_HEAP_OBJECT_HEADER)による違いを比較するために使用する
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_node_footprint(benchmark::State& state);
+
+/**
+ * 長い連結リストオブジェクトの削除にかかる時間を計測するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_teardown_linked_list(benchmark::State& state);
+
+/**
+ * スカラー値をペイロードとして持つ木構造オブジェクトを作成し、値を読み取ってから削除するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_payload_tree_inline(benchmark::State& state);
+
+/**
+ * スカラー値をそれぞれ別のオブジェクトに包んで持つ木構造オブジェクトを作成し、値を読み取ってから削除するベンチマーク用関数(比較用)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_payload_tree_boxed(benchmark::State& state);
+
+/**
+ * 深い木構造オブジェクトの削除にかかる時間を計測するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_teardown_deep_tree(benchmark::State& state);
+
+/**
+ * 約100万オブジェクトの木構造の is_mutex を再帰呼び出しで伝搬させるベンチマーク用関数(比較用)
+ */
+static void benchmark_to_mutex_recursive_tree(benchmark::State& state);
+
+/**
+ * 約100万オブジェクトの木構造の is_mutex を HeapObject::to_mutex() で伝搬させるベンチマーク用関数
+ */
+static void benchmark_to_mutex_tree(benchmark::State& state);
+
+/**
+ * 100万要素の連結リストの is_mutex を HeapObject::to_mutex() で伝搬させるベンチマーク用関数
+ * 再帰呼び出しではスタックが溢れるため比較対象はない
+ */
+static void benchmark_to_mutex_linked_list(benchmark::State& state);
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の削除にかかる時間を計測するベンチマーク用関数
+ * フィールドの長さを実行時に読み取る通常のハンドル(DynamicRC)を使用する(比較用)
+ */
+template<size_t N> static void benchmark_shape_teardown_runtime(benchmark::State& state);
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の削除にかかる時間を計測するベンチマーク用関数
+ * 形を固定した TypedObject<N> を使用する
+ */
+template<size_t N> static void benchmark_shape_teardown_typed(benchmark::State& state);
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の is_mutex を伝搬させるベンチマーク用関数
+ * フィールドの長さを実行時に読み取る通常のハンドル(DynamicRC)を使用する(比較用)
+ */
+template<size_t N> static void benchmark_shape_to_mutex_runtime(benchmark::State& state);
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の is_mutex を伝搬させるベンチマーク用関数
+ * 形を固定した TypedObject<N> を使用する
+ */
+template<size_t N> static void benchmark_shape_to_mutex_typed(benchmark::State& state);
+
+/**
+ * 生産者スレッドが木構造オブジェクトを作成し、消費者スレッドが削除するベンチマーク用関数
+ * オブジェクトは確保したスレッドとは異なるスレッドで解放される
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_producer_consumer_dynamic_rc(benchmark::State& state);
+
+/**
+ * 複数のスレッドに公開した(is_mutex が true の)オブジェクトのハンドルを、作成したスレッドでコピーして破棄し続けるベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_owner_copy(benchmark::State& state);
+
+/**
+ * 複数のスレッドに公開した木構造オブジェクトを、作成したスレッドが根から辿って葉を書き換え続けるベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_owner_mutation(benchmark::State& state);
+
+/**
+ * 複数のスレッドから同じオブジェクトのフィールドを読み込み続けるベンチマーク用関数
+ * READ_HEAVY_WRITE_INTERVAL 回に一回はフィールドへ新しいオブジェクトを書き込む
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_read_heavy(benchmark::State& state);
+
+/**
+ * 複数のスレッドから同じオブジェクトのスピンロックを取得し続けるベンチマーク用関数
+ * ロックの内側では共有されたカウンタを一つ増やすだけの短い処理を行う
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_lock_contention(benchmark::State& state);
+
+/**
+ * 複数のスレッドから同じオブジェクトのハンドルをコピーして破棄し続けるベンチマーク用関数
+ * HOT_SHARED_COPY_FLUSH_INTERVAL 回に一回は rc_flush() を呼び出す
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_hot_shared_copy(benchmark::State& state);
+
+/**
+ * mutex なオブジェクトの N 個のフィールドへ set_object で一つずつ、若しくは set_fields でまとめて挿入し続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は set_fields を使用する
+ * state.range(1) が 1 の場合は全てのフィールドへ同じオブジェクトを、0 の場合はフィールドごとに異なるオブジェクトを挿入する
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+template<size_t N> static void benchmark_set_fields(benchmark::State& state);
+
+/**
+ * mutex なオブジェクトの N 個のフィールドから get_object で一つずつ、若しくは get_fields でまとめて取得し続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は get_fields を使用する
+ * state.range(1) が 1 の場合は全てのフィールドに同じオブジェクトを、0 の場合はフィールドごとに異なるオブジェクトを入れておく
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+template<size_t N> static void benchmark_get_fields(benchmark::State& state);
+
+/**
+ * 複数のスレッドから同じスタックへ新しい要素を積んで取り出し続けるベンチマーク用関数
+ * IS_LOCK_FREE が true の場合は compare_and_set_object による Treiber スタックを、
+ * false の場合はスタックのオブジェクトのスピンロックで保護したスタックを使用する
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+template<bool IS_LOCK_FREE> static void benchmark_stack(benchmark::State& state);
+
+/**
+ * キュー(SharedQueue)の末尾へ新しい要素を追加して先頭から取り出し続けるベンチマーク用関数
+ * state.range(0) が 0 の場合はスレッドごとに作成したキューを、1 の場合は全てのスレッドで共有したキューを使用する
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_shared_queue(benchmark::State& state);
+
+/**
+ * ハッシュマップ(ShardedMap)を検索し続けるベンチマーク用関数
+ * 10回に一回は挿入を、10回に一回は削除を行う
+ * state.range(0) が 0 の場合はスレッドごとに作成したハッシュマップを、1 の場合は全てのスレッドで共有したハッシュマップを使用する
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_sharded_map(benchmark::State& state);
+
+/**
+ * 配列(SharedVector)の要素を読み込み続けるベンチマーク用関数
+ * 10回に一回は要素へ新しいオブジェクトを書き込む
+ * state.range(0) が 0 の場合はスレッドごとに作成した配列を、1 の場合は全てのスレッドで共有した配列を使用する
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_shared_vector(benchmark::State& state);
+
+/**
+ * PIPELINE_STAGE_COUNT 個のスレッドを spawn で起動し、最初のスレッドが作成した木構造オブジェクトを順に渡していくベンチマーク用関数
+ * 各スレッドは受け取った木構造オブジェクトを全て辿ってから次のスレッドへ渡し、最後のスレッドが解放する
+ * state.range(0) が 0 の場合は渡す前に to_mutex() し、1 の場合は send() でローカルのまま渡す
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_pipeline(benchmark::State& state);
+
+/**
+ * NUMBER_OF_THREADS / 2 個の生産者スレッドが作成した木構造オブジェクトを、Channel を経由して NUMBER_OF_THREADS / 2 個の消費者スレッドへ渡すベンチマーク用関数
+ * 消費者スレッドは受け取った木構造オブジェクトを全て辿ってから解放する
+ * state.range(0) が 0 の場合は送信する前に to_mutex() し、1 の場合は transfer_object でローカルのまま渡す(DynamicRC のみ)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_channel(benchmark::State& state);
+
+/**
+ * 木構造オブジェクトの各オブジェクトの親への参照を表に持ち、葉から根まで親を辿り続けるベンチマーク用関数
+ * 親への参照を強参照で持つ(Parent が T)場合と、弱参照で持つ場合を比較する
+ * state.range(0) が 1 の場合は、木構造オブジェクトを複数のスレッドに公開してから辿る
+ * メモリ管理方法 : T (親への参照 : Parent)
+ */
+template<typename T, typename Parent> static void benchmark_parent_pointer(benchmark::State& state);
+
+#if PARALLEL_TEARDOWN
+/**
+ * 複数のスレッドに公開した巨大な木構造オブジェクトへの最後の参照を手放し、
+ * 手放したスレッドが止まっていた時間(pause_ms)と、全て解放し終えるまでの時間を計測するベンチマーク用関数
+ * state.range(0) はワーカースレッドの数(0 の場合は手放したスレッドで全て解放する)
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_parallel_teardown(benchmark::State& state);
+#endif
+
+#if BACKGROUND_RECLAMATION
+/**
+ * 複数のスレッドに公開したオブジェクトのフィールドの木構造オブジェクトを set_object で入れ替え続け、
+ * 取り除いた木構造オブジェクトの解放が発生する set_object の呼び出し一回ごとの時間の分布(p50/p99/p999)を計測するベンチマーク用関数
+ * state.range(0) が 1 の場合は回収スレッドで解放し、0 の場合は呼び出したスレッドで解放する
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_background_reclamation(benchmark::State& state);
+#endif
+
+#if PARALLEL_TO_MUTEX
+/**
+ * 深さ state.range(0) の木構造オブジェクトを mutex なオブジェクトのフィールドへ set_object で挿入(公開)する時間を計測するベンチマーク用関数
+ * 挿入する木構造オブジェクト以下の全てのオブジェクトの is_mutex の伝搬を含む
+ * state.range(1) はワーカースレッドの数(0 の場合は挿入したスレッドで全て辿る)
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_parallel_to_mutex(benchmark::State& state);
+#endif
+
+#if LAZY_MUTEX_PROMOTION
+/**
+ * 巨大な木構造オブジェクトをグローバル変数へ挿入(公開)し、複数のスレッドが根に近い部分だけを読むベンチマーク用関数
+ * 公開にかかった時間(publish_ms)と、全てのスレッドが読み終えるまでの時間を計測する
+ * state.range(0) が 0 の場合は set_object でその場で is_mutex を伝搬させ、1 の場合は publish_object で遅延して伝搬させる
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_lazy_publish(benchmark::State& state);
+#endif
+
+#if MUTEX_DEMOTION
+/**
+ * 木構造オブジェクトをグローバル変数へ挿入(公開)してから取り除き、その後作成したスレッドが根から辿って葉を書き換え続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は取り除いた後に try_demote() で降格させ、0 の場合は is_mutex が true のまま書き換える
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_mutex_demotion(benchmark::State& state);
+#endif
+
+#if ARENA_ALLOCATION
+/**
+ * 木構造オブジェクトを作成して破棄し続けるベンチマーク用関数
+ * 破棄にかかった時間(teardown_ms)も計測する
+ * state.range(0) が 1 の場合は Arena のスコープ内で作成し、破棄した後にスコープを抜ける(0 の場合は malloc/free)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_arena(benchmark::State& state);
+#endif
+
+
+//各種ベンチマーク関数の登録
+//詳細は以下を参照
+//https://github.com/google/benchmark
+BENCHMARK(benchmark_single_thread_manual_object);
+BENCHMARK(benchmark_single_thread_single_thread_rc);
+BENCHMARK(benchmark_single_thread_thread_safe_rc);
+BENCHMARK(benchmark_single_thread_dynamic_rc);
+BENCHMARK(benchmark_multi_thread_thread_safe_rc);
+BENCHMARK(benchmark_multi_thread_dynamic_rc);
+BENCHMARK_TEMPLATE(benchmark_node_footprint, ManualObject)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_node_footprint, SingleThreadRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_node_footprint, ThreadSafeRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_node_footprint, DynamicRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_payload_tree_inline, SingleThreadRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_payload_tree_boxed, SingleThreadRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_payload_tree_inline, DynamicRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_payload_tree_boxed, DynamicRC)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_teardown_linked_list, ManualObject)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_linked_list, SingleThreadRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_linked_list, ThreadSafeRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_linked_list, DynamicRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_deep_tree, ManualObject)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_deep_tree, SingleThreadRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_deep_tree, ThreadSafeRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK_TEMPLATE(benchmark_teardown_deep_tree, DynamicRC)->Unit(benchmark::kMillisecond)->Iterations(3);
+BENCHMARK(benchmark_to_mutex_recursive_tree)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchmark_to_mutex_tree)->Unit(benchmark::kMillisecond);
+BENCHMARK(benchmark_to_mutex_linked_list)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_runtime, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_typed, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_runtime, 4)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_typed, 4)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_runtime, 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_teardown_typed, 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_runtime, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_typed, 2)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_runtime, 4)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_typed, 4)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_runtime, 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK_TEMPLATE(benchmark_shape_to_mutex_typed, 16)->Unit(benchmark::kMicrosecond);
+BENCHMARK(benchmark_producer_consumer_dynamic_rc)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_owner_copy, ThreadSafeRC);
+BENCHMARK_TEMPLATE(benchmark_owner_copy, DynamicRC);
+#if !COMPACT_HEAP_OBJECT_HEADER
+BENCHMARK_TEMPLATE(benchmark_owner_copy, BiasedRC);
+#endif
+BENCHMARK_TEMPLATE(benchmark_owner_mutation, ThreadSafeRC);
+BENCHMARK_TEMPLATE(benchmark_owner_mutation, DynamicRC);
+#if !COMPACT_HEAP_OBJECT_HEADER
+BENCHMARK_TEMPLATE(benchmark_owner_mutation, BiasedRC);
+#endif
+BENCHMARK_TEMPLATE(benchmark_read_heavy, ThreadSafeRC)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_read_heavy, DynamicRC)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_lock_contention, ThreadSafeRC)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_lock_contention, DynamicRC)->ThreadRange(1, 64)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_hot_shared_copy, ThreadSafeRC)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_hot_shared_copy, DynamicRC)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_set_fields, 16)->ArgsProduct({ { 0, 1 }, { 0, 1 } });
+BENCHMARK_TEMPLATE(benchmark_set_fields, 64)->ArgsProduct({ { 0, 1 }, { 0, 1 } });
+BENCHMARK_TEMPLATE(benchmark_get_fields, 16)->ArgsProduct({ { 0, 1 }, { 0, 1 } });
+BENCHMARK_TEMPLATE(benchmark_get_fields, 64)->ArgsProduct({ { 0, 1 }, { 0, 1 } });
+BENCHMARK_TEMPLATE(benchmark_stack, false)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_stack, true)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_shared_queue, ThreadSafeRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_shared_queue, DynamicRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_sharded_map, ThreadSafeRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_sharded_map, DynamicRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_shared_vector, ThreadSafeRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_shared_vector, DynamicRC)->Arg(0)->Arg(1)->ThreadRange(1, NUMBER_OF_THREADS)->UseRealTime();
+BENCHMARK(benchmark_pipeline)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_channel, ThreadSafeRC)->Arg(0)->Unit(benchmark::kMillisecond)->UseRealTime();
+BENCHMARK_TEMPLATE(benchmark_channel, DynamicRC)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseRealTime();
+#if WEAK_REFERENCE
+BENCHMARK_TEMPLATE(benchmark_parent_pointer, ThreadSafeRC, ThreadSafeRC)->Arg(1);
+BENCHMARK_TEMPLATE(benchmark_parent_pointer, ThreadSafeRC, WeakThreadSafeRC)->Arg(1);
+BENCHMARK_TEMPLATE(benchmark_parent_pointer, DynamicRC, DynamicRC)->Arg(0)->Arg(1);
+BENCHMARK_TEMPLATE(benchmark_parent_pointer, DynamicRC, WeakDynamicRC)->Arg(0)->Arg(1);
+#endif
+#if PARALLEL_TEARDOWN
+BENCHMARK(benchmark_parallel_teardown)->Arg(0)->Arg(1)->Arg(2)->Arg(4)->Arg(8)->Unit(benchmark::kMillisecond)->UseManualTime()->Iterations(3);
+#endif
+#if BACKGROUND_RECLAMATION
+BENCHMARK(benchmark_background_reclamation)->Arg(0)->Arg(1)->Unit(benchmark::kMicrosecond)->UseManualTime()->Iterations(BACKGROUND_RECLAMATION_ITERATIONS);
+#endif
+#if LAZY_MUTEX_PROMOTION
+BENCHMARK(benchmark_lazy_publish)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond)->UseManualTime()->Iterations(5);
+#endif
+#if MUTEX_DEMOTION
+BENCHMARK(benchmark_mutex_demotion)->Arg(0)->Arg(1);
+#endif
+#if ARENA_ALLOCATION
+BENCHMARK_TEMPLATE(benchmark_arena, SingleThreadRC)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+BENCHMARK_TEMPLATE(benchmark_arena, DynamicRC)->Arg(0)->Arg(1)->Unit(benchmark::kMillisecond);
+#endif
+#if PARALLEL_TO_MUTEX
+BENCHMARK(benchmark_parallel_to_mutex)->ArgsProduct({ { 18, 20, 22, 24 }, { 0, 1, 2, 4, 8 } })->Unit(benchmark::kMillisecond)->Iterations(3);
+#endif
+
+//複数のスレッドから直接アクセス可能なオブジェクト
+ThreadSafeRC global_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
+DynamicRC global_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+
+//読み込み中心のベンチマークで、複数のスレッドから読み込まれるオブジェクト
+ThreadSafeRC read_heavy_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
+DynamicRC read_heavy_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+
+//ロックの競合ベンチマークで、複数のスレッドからロックされるオブジェクト
+ThreadSafeRC lock_contention_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
+DynamicRC lock_contention_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+//ロックの競合ベンチマークで、ロックの内側で増やすカウンタ
+size_t lock_contention_counter = 0;
+
+//ハンドルのコピーのベンチマークで、複数のスレッドからコピーされるオブジェクト
+ThreadSafeRC hot_shared_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
+DynamicRC hot_shared_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+
+//スタックのベンチマークで、複数のスレッドから積まれるスタック
+DynamicRC stack_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+
+#if !COMPACT_HEAP_OBJECT_HEADER
+//複数のスレッドから直接アクセス可能なオブジェクト(偏り参照カウント)
+BiasedRC global_variable_with_biased_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+#endif
+
+
+#if RC_VALIDATION
+int main() {
+    //グローバル変数として作成したオブジェクトのカウントをリセット
+    global_object_count.store(0, memory_order_relaxed);
+
+    //木構造オブジェクトの作成と削除(手動)
+    { create_tree<ManualObject>(0, 25).detele_object(); }
+
+    //木構造オブジェクトの作成と削除(シングルスレッド専用参照カウント)
+    { create_tree<SingleThreadRC>(0, 25); }
+
+    //木構造オブジェクトの作成と削除(スレッドセーフな参照カウント)
+    { create_tree<ThreadSafeRC>(0, 25); }
+    //遅延参照カウントでは破棄を反映するまで解放されないため、次の作成の前にセーフポイントに到達しておく
+    rc_flush();
+
+    //木構造オブジェクトの作成と削除(動的切り替え参照カウント)
+    { create_tree<DynamicRC>(0, 25); }
+
+    //ムーブ済みのハンドルのコピーとコピー代入は空のハンドルとなる
+    {
+        auto tree = create_tree<SingleThreadRC>(0, 3);
+        auto moved = move(tree);
+        SingleThreadRC copied(tree);
+        moved = tree;
+        if (copied.get_heap_object() != nullptr || moved.get_heap_object() != nullptr) {
+            cout << "Copied a moved-from SingleThreadRC as a non-empty handle" << endl;
+        }
+    }
+    {
+        auto tree = create_tree<ThreadSafeRC>(0, 3);
+        auto moved = move(tree);
+        ThreadSafeRC copied(tree);
+        moved = tree;
+        if (copied.get_heap_object() != nullptr || moved.get_heap_object() != nullptr) {
+            cout << "Copied a moved-from ThreadSafeRC as a non-empty handle" << endl;
+        }
+    }
+    rc_flush();
+    for (bool is_mutex : { false, true }) {
+        auto tree = create_tree<DynamicRC>(0, 3);
+        if (is_mutex) {
+            tree.to_mutex();
+        }
+        auto moved = move(tree);
+        DynamicRC copied(tree);
+        moved = tree;
+        if (copied.get_heap_object() != nullptr || moved.get_heap_object() != nullptr) {
+            cout << "Copied a moved-from DynamicRC as a non-empty handle" << endl;
+        }
+    }
+
+    //ペイロードを持つオブジェクトの作成と削除
+    { auto tree = create_payload_tree<ManualObject>(0, 10); sum_payload_tree(tree); tree.detele_object(); }
+    { auto tree = create_payload_tree<SingleThreadRC>(0, 10); sum_payload_tree(tree); }
+    { auto tree = create_payload_tree<ThreadSafeRC>(0, 10); sum_payload_tree(tree); }
+    { auto tree = create_payload_tree<DynamicRC>(0, 10); tree.to_mutex(); sum_payload_tree(tree); }
+    { auto tree = create_boxed_tree<DynamicRC>(0, 10); sum_boxed_tree(tree); }
+    #if !COMPACT_HEAP_OBJECT_HEADER
+    { auto tree = create_payload_tree<BiasedRC>(0, 10); tree.to_mutex(); sum_payload_tree(tree); }
+    { create_linked_list<BiasedRC>(TEARDOWN_LINKED_LIST_LENGTH); }
+    #endif
+
+    //形を固定したオブジェクトの作成と削除
+    { create_typed_tree<2>(0, 10); }
+    { auto tree = create_typed_tree<16>(0, 3); tree.to_mutex(); }
+    {//形の異なるオブジェクトがフィールドに混在する場合
+        TypedObject<4, NodePayload> object;
+        object.payload().weight = 1.0;
+        object.set<0>(create_typed_tree<2>(0, 5));
+        object.set<1>(create_tree<DynamicRC>(0, 5));
+        object.set<2>(object.get<1>());
+        object.to_mutex();
+        object.set<3>(create_typed_tree<16>(0, 2));
+        TypedObject<2> copied(object.get<0>().value());
+    }
+
+    {//フィールドへのまとめての挿入と取得
+        array<size_t, 8> field_indices = { 7, 6, 5, 4, 3, 2, 1, 0 };
+        DynamicRC same_object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        vector<optional<DynamicRC>> objects;
+        for (size_t i = 0; i < field_indices.size(); i++) {
+            //同じオブジェクトと、異なるオブジェクトと nullopt を混ぜる
+            switch (i % 3) {
+                case 0: objects.push_back(same_object); break;
+                case 1: objects.push_back(create_tree<DynamicRC>(0, 3)); break;
+                default: objects.push_back(nullopt); break;
+            }
+        }
+
+        for (bool is_mutex : { false, true }) {
+            DynamicRC object(alloc_heap_object(field_indices.size()), is_mutex);
+            //二回挿入して、一回目に挿入したオブジェクトを取り除く
+            object.set_fields(field_indices, objects);
+            object.set_fields(field_indices, objects);
+            vector<optional<DynamicRC>> loaded(field_indices.size());
+            object.get_fields(field_indices, loaded);
+            for (size_t i = 0; i < field_indices.size(); i++) {
+                if (loaded[i].has_value() != objects[i].has_value()
+                    || (loaded[i].has_value() && loaded[i].value().get_heap_object() != objects[i].value().get_heap_object())) {
+                    cout << "Bulk field operation loaded a wrong object" << endl;
+                }
+            }
+            #if !CYCLE_COLLECTION
+            //循環参照の回収では、0にならない参照カウントの減少は候補として記録されて遅れる
+            rc_flush();
+            //same_object と objects の3つ、フィールドの3つ、loaded の3つ
+            if (same_object.get_heap_object()->atomic_load_reference_count() != 1 + 3 * 3) {
+                cout << "Bulk field operation miscounted a repeated object" << endl;
+            }
+            #endif
+            if (same_object.get_heap_object()->get_is_mutex() != is_mutex) {
+                cout << "Bulk field operation did not propagate is_mutex" << endl;
+            }
+        }
+
+        //複数のスレッドが同じオブジェクトのフィールドへまとめて挿入しながら、まとめて取得する
+        DynamicRC shared_object(alloc_heap_object(field_indices.size()), true);
+        auto func = [&](size_t thread_id) {
+            vector<optional<DynamicRC>> loaded(field_indices.size());
+            for (size_t i = 0; i < 2000; i++) {
+                if ((i + thread_id) % 2 == 0) {
+                    vector<optional<DynamicRC>> inserted;
+                    DynamicRC repeated(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                    for (size_t j = 0; j < field_indices.size(); j++) {
+                        if (j % 2 == 0) {
+                            inserted.push_back(repeated);
+                        } else {
+                            inserted.push_back(create_tree<DynamicRC>(0, 2));
+                        }
+                    }
+                    shared_object.set_fields(field_indices, inserted);
+                } else {
+                    shared_object.get_fields(field_indices, loaded);
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+    }
+    //遅延参照カウントと取り除いたオブジェクトの解放を反映する
+    rc_flush();
+    epoch_reclaim_all();
+
+    {//フィールドの不可分な入れ替え、比較と入れ替え、取り出し
+        for (bool is_mutex : { false, true }) {
+            DynamicRC object(alloc_heap_object(OBJECT_FIELD_LENGTH), is_mutex);
+            DynamicRC first(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            DynamicRC second(alloc_heap_object(OBJECT_FIELD_LENGTH));
+
+            if (object.exchange_object(0, first).has_value()) {
+                cout << "exchange_object returned an object from an empty field" << endl;
+            }
+            auto old = object.exchange_object(0, second);
+            if (!old.has_value() || old.value().get_heap_object() != first.get_heap_object()) {
+                cout << "exchange_object returned a wrong object" << endl;
+            }
+            old = nullopt;
+
+            //期待する値と異なれば入れ替えず、desired のハンドルもそのまま使用できる
+            if (object.compare_and_set_object(0, first, first)) {
+                cout << "compare_and_set_object succeeded with a wrong expected object" << endl;
+            }
+            if (!object.compare_and_set_object(0, second, first)) {
+                cout << "compare_and_set_object failed with a correct expected object" << endl;
+            }
+            if (!object.compare_and_set_object(1, nullopt, second)) {
+                cout << "compare_and_set_object failed on an empty field" << endl;
+            }
+
+            auto taken = object.take_object(0);
+            if (!taken.has_value() || taken.value().get_heap_object() != first.get_heap_object() || object.get_object(0).has_value()) {
+                cout << "take_object returned a wrong object" << endl;
+            }
+            taken = nullopt;
+            #if !CYCLE_COLLECTION
+            rc_flush();
+            epoch_reclaim_all();
+            //first はハンドルだけから、second はハンドルと1番目のフィールドから参照されている
+            if (first.get_heap_object()->atomic_load_reference_count() != 1
+                || second.get_heap_object()->atomic_load_reference_count() != 2) {
+                cout << "Atomic field operation miscounted an object" << endl;
+            }
+            #endif
+            if (second.get_heap_object()->get_is_mutex() != is_mutex) {
+                cout << "Atomic field operation did not propagate is_mutex" << endl;
+            }
+        }
+
+        //複数のスレッドから同じ Treiber スタックへ積んで取り出す
+        DynamicRC stack(alloc_heap_object(OBJECT_FIELD_LENGTH), true);
+        atomic_size_t popped_count = 0;
+        auto func = [&]() {
+            for (size_t i = 0; i < 5000; i++) {
+                DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                //要素ごとに小さな木構造オブジェクトを持たせる
+                node.set_object(1, create_tree<DynamicRC>(0, 2));
+                treiber_stack_push(stack, move(node));
+                if (i % 2 == 1) {
+                    for (size_t j = 0; j < 2; j++) {
+                        if (treiber_stack_pop(stack).has_value()) {
+                            popped_count.fetch_add(1, memory_order_relaxed);
+                        }
+                    }
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        while (treiber_stack_pop(stack).has_value()) {
+            popped_count.fetch_add(1, memory_order_relaxed);
+        }
+        if (popped_count.load() != NUMBER_OF_THREADS * 5000) {
+            cout << "Treiber stack lost an element" << endl;
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    {//共有コンテナ(キュー、ハッシュマップ、配列)
+        //番号をペイロードに持つ要素を作成
+        auto create_element = [](size_t id) {
+            DynamicRC element(alloc_heap_object(ObjectLayout { OBJECT_FIELD_LENGTH, sizeof(size_t) }));
+            *(size_t*) element.get_payload() = id;
+            return element;
+        };
+        auto element_id = [](optional<DynamicRC>& element) {
+            return *(size_t*) element.value().get_payload();
+        };
+
+        //一つのスレッドから使用する(公開しないためロックは取得されない)
+        {
+            SharedQueue<> queue;
+            for (size_t i = 0; i < 100; i++) {
+                queue.push(create_element(i));
+            }
+            optional<DynamicRC> value;
+            for (size_t i = 0; i < 100; i++) {
+                if (!queue.pop(value) || element_id(value) != i) {
+                    cout << "Shared queue popped a wrong element" << endl;
+                }
+            }
+            if (queue.pop(value)) {
+                cout << "Shared queue popped from an empty queue" << endl;
+            }
+
+            ShardedMap<> map;
+            for (uint64_t key = 0; key < 1000; key++) {
+                map.insert_or_assign(key, create_element(key));
+            }
+            for (uint64_t key = 0; key < 1000; key += 2) {
+                map.erase(key);
+            }
+            map.insert_or_assign(1, create_element(1001));
+            if (map.size() != 500 || map.erase(0)) {
+                cout << "Sharded map miscounted elements" << endl;
+            }
+            for (uint64_t key = 0; key < 1000; key++) {
+                bool is_found = map.find(key, value);
+                if (is_found != (key % 2 == 1) || (is_found && element_id(value) != (key == 1 ? 1001 : key))) {
+                    cout << "Sharded map found a wrong element" << endl;
+                }
+            }
+
+            SharedVector<> shared_vector;
+            for (size_t i = 0; i < 100; i++) {
+                shared_vector.push_back(create_element(i));
+            }
+            shared_vector.set(50, create_element(1050));
+            for (size_t i = 0; i < 100; i++) {
+                auto element = shared_vector.get(i);
+                if (!element.has_value() || element_id(element) != (i == 50 ? 1050 : i)) {
+                    cout << "Shared vector returned a wrong element" << endl;
+                }
+            }
+            if (shared_vector.get(100).has_value() || shared_vector.set(100, nullopt)) {
+                cout << "Shared vector accessed out of range" << endl;
+            }
+#if COMPACT_HEAP_OBJECT_HEADER
+            //ストレージの最大の容量を超えた分はセグメントへ格納される
+            SharedVector<> segmented_vector;
+            size_t segmented_length = HEAP_OBJECT_MAX_FIELD_LENGTH * 2 + 5;
+            for (size_t i = 0; i < segmented_length; i++) {
+                if (!segmented_vector.push_back(create_element(i))) {
+                    cout << "Shared vector rejected an element below its limit" << endl;
+                }
+            }
+            segmented_vector.set(HEAP_OBJECT_MAX_FIELD_LENGTH + 1, create_element(1050));
+            for (size_t i = 0; i < segmented_length; i++) {
+                auto element = segmented_vector.get(i);
+                if (!element.has_value() || element_id(element) != (i == HEAP_OBJECT_MAX_FIELD_LENGTH + 1 ? 1050 : i)) {
+                    cout << "Segmented shared vector returned a wrong element" << endl;
+                }
+            }
+            if (segmented_vector.get(segmented_length).has_value()) {
+                cout << "Segmented shared vector accessed out of range" << endl;
+            }
+#endif
+
+            if (queue.handle().get_heap_object()->get_is_mutex()
+                || map.handle().get_heap_object()->get_is_mutex()
+                || shared_vector.handle().get_heap_object()->get_is_mutex()) {
+                cout << "Shared container became mutex without being published" << endl;
+            }
+        }
+
+        //mutex なオブジェクトへ挿入して公開し、複数のスレッドから使用する
+        {
+            SharedQueue<> queue;
+            ShardedMap<> map;
+            SharedVector<> shared_vector;
+            DynamicRC published(alloc_heap_object(3), true);
+            published.set_object(0, queue.handle());
+            published.set_object(1, map.handle());
+            published.set_object(2, shared_vector.handle());
+
+            atomic_size_t popped_id_sum = 0;
+            atomic_bool is_wrong = false;
+            auto func = [&](size_t thread_index) {
+                //他のスレッドから追加された要素の順番を確かめるため、スレッドごとに最後に取り出した番号を持つ
+                vector<size_t> last_popped(NUMBER_OF_THREADS, 0);
+                optional<DynamicRC> value;
+                for (size_t i = 0; i < 2000; i++) {
+                    auto id = thread_index * 2000 + i;
+                    queue.push(create_element(id + 1));
+                    while (!queue.pop(value)) {}
+                    auto popped_id = element_id(value);
+                    auto& last = last_popped[(popped_id - 1) / 2000];
+                    if (popped_id <= last) {
+                        is_wrong.store(true);
+                    }
+                    last = popped_id;
+                    popped_id_sum.fetch_add(popped_id, memory_order_relaxed);
+                }
+
+                for (uint64_t key = thread_index * 1000; key < (thread_index + 1) * 1000; key++) {
+                    map.insert_or_assign(key, create_element(key));
+                    //他のスレッドのキーは見つからないか、正しい要素が見つかる
+                    auto other_key = (key + 1000) % (NUMBER_OF_THREADS * 1000);
+                    if (map.find(other_key, value) && element_id(value) != other_key) {
+                        is_wrong.store(true);
+                    }
+                    if (key % 2 == 1 && !map.erase(key)) {
+                        is_wrong.store(true);
+                    }
+                }
+
+                for (size_t i = 0; i < 100; i++) {
+                    shared_vector.push_back(create_element(thread_index * 100 + i));
+                    //同じ番号の要素で書き換えても、全ての要素の番号は変わらない
+                    auto index = (thread_index * 7 + i * 13) % shared_vector.size();
+                    auto element = shared_vector.get(index);
+                    if (!element.has_value()) {
+                        is_wrong.store(true);
+                        continue;
+                    }
+                    shared_vector.set(index, create_element(element_id(element)));
+                }
+            };
+            vector<thread> threads;
+            //スレッド起動
+            for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+                threads.push_back(thread(func, i));
+            }
+            //スレッド終了待機
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                it->join();
+            }
+
+            optional<DynamicRC> value;
+            size_t id_count = NUMBER_OF_THREADS * 2000;
+            if (is_wrong.load() || queue.pop(value) || popped_id_sum.load() != id_count * (id_count + 1) / 2) {
+                cout << "Shared queue lost an element" << endl;
+            }
+            if (map.size() != NUMBER_OF_THREADS * 500) {
+                cout << "Sharded map lost an element" << endl;
+            }
+            for (uint64_t key = 0; key < NUMBER_OF_THREADS * 1000; key++) {
+                if (map.find(key, value) != (key % 2 == 0)) {
+                    cout << "Sharded map lost an element" << endl;
+                    break;
+                }
+            }
+            vector<bool> is_seen(NUMBER_OF_THREADS * 100, false);
+            for (size_t i = 0; i < shared_vector.size(); i++) {
+                auto element = shared_vector.get(i);
+                is_seen[element_id(element)] = true;
+            }
+            if (shared_vector.size() != NUMBER_OF_THREADS * 100 || find(is_seen.begin(), is_seen.end(), false) != is_seen.end()) {
+                cout << "Shared vector lost an element" << endl;
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    {//スレッドの起動、グローバル変数オブジェクト、所有権の受け渡し
+        //spawn の引数は起動前に mutex としてマークされる
+        auto tree = create_tree<DynamicRC>(0, 4);
+        optional<DynamicRC> optional_tree = create_tree<DynamicRC>(0, 4);
+        TypedObject<2> typed_object;
+        auto referenced_tree = create_tree<DynamicRC>(0, 4);
+        atomic_bool is_marked = true;
+        auto spawned = spawn([&](DynamicRC tree, optional<DynamicRC> optional_tree, TypedObject<2> typed_object, DynamicRC& referenced_tree, size_t value) {
+            if (!tree.get_heap_object()->get_is_mutex()
+                || !tree.get_object(0).value().get_heap_object()->get_is_mutex()
+                || !optional_tree.value().get_heap_object()->get_is_mutex()
+                || !typed_object.handle().get_heap_object()->get_is_mutex()
+                || !referenced_tree.get_object(1).value().get_heap_object()->get_is_mutex()
+                || value != 7) {
+                is_marked.store(false);
+            }
+        }, tree, optional_tree, typed_object, ref(referenced_tree), (size_t) 7);
+        spawned.join();
+        if (!is_marked.load()) {
+            cout << "spawn did not mark an argument as mutex" << endl;
+        }
+
+        //グローバル変数オブジェクトは作成時から mutex であり、代入したオブジェクト以下にも伝搬する
+        SharedGlobal<> global(2);
+        auto assigned = create_tree<DynamicRC>(0, 4);
+        global.set_object(1, assigned);
+        if (!global.handle().get_heap_object()->get_is_mutex()
+            || !assigned.get_object(0).value().get_heap_object()->get_is_mutex()
+            || global.get_object(1).value().get_heap_object() != assigned.get_heap_object()) {
+            cout << "SharedGlobal did not mark an object as mutex" << endl;
+        }
+        global.set_object(1, nullopt);
+
+        //他から参照されていない木構造オブジェクトはローカルのまま送られる
+        auto sent_tree = create_tree<DynamicRC>(0, 10);
+        //一部の部分木を送るスレッドからも参照しておく
+        auto kept_subtree = create_tree<DynamicRC>(0, 3);
+        sent_tree.get_object(0).value().get_object(1).value().set_object(0, kept_subtree);
+        #if CYCLE_COLLECTION
+        //上の get_object で候補のバッファに入ったオブジェクトを送る前に取り除く
+        collect_cycles();
+        #endif
+        auto sendable = send(move(sent_tree));
+
+        atomic_bool is_correct = true;
+        auto receiver = thread([&](Sendable<DynamicRC> sendable) {
+            auto received = move(sendable).into_handle();
+            auto left = received.get_object(0).value();
+            auto right = received.get_object(1).value();
+            //送るスレッドから参照されている部分木以下だけが mutex になる
+            if (received.get_heap_object()->get_is_mutex()
+                || left.get_heap_object()->get_is_mutex()
+                || right.get_object(0).value().get_heap_object()->get_is_mutex()
+                || !left.get_object(1).value().get_object(0).value().get_heap_object()->get_is_mutex()
+                || left.get_object(1).value().get_heap_object()->get_is_mutex()) {
+                is_correct.store(false);
+            }
+            //受け取ったスレッドでローカルなオブジェクトとして書き換えて解放する
+            received.set_object(1, nullopt);
+        }, move(sendable));
+        receiver.join();
+        if (!is_correct.load() || !kept_subtree.get_heap_object()->get_is_mutex()) {
+            cout << "send marked a wrong object as mutex" << endl;
+        }
+        #if !CYCLE_COLLECTION
+        rc_flush();
+        epoch_reclaim_all();
+        if (kept_subtree.get_heap_object()->atomic_load_reference_count() != 1) {
+            cout << "send miscounted a kept object" << endl;
+        }
+        #endif
+
+        //他のスレッドから参照されている場合は、根から mutex にして送る
+        auto shared_tree = create_tree<DynamicRC>(0, 4);
+        DynamicRC copied_tree(shared_tree);
+        auto shared_sendable = send(move(shared_tree));
+        if (!copied_tree.get_heap_object()->get_is_mutex() || !copied_tree.get_object(0).value().get_heap_object()->get_is_mutex()) {
+            cout << "send did not mark a shared object as mutex" << endl;
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    {//mutex なオブジェクトのフィールドを経由した所有権の受け渡し(transfer_object)とチャネル
+        //番号をペイロードに持ち、フィールド0に小さな木構造オブジェクトを持つ要素を作成
+        auto create_element = [](size_t id) {
+            DynamicRC element(alloc_heap_object(ObjectLayout { OBJECT_FIELD_LENGTH, sizeof(size_t) }));
+            *(size_t*) element.get_payload() = id;
+            element.set_object(0, create_tree<DynamicRC>(0, 3));
+            return element;
+        };
+
+        //他から参照されていない部分はローカルのまま受け取れる
+        DynamicRC slot_owner(alloc_heap_object(2), true);
+        auto transferred_tree = create_tree<DynamicRC>(0, 10);
+        //一部の部分木を渡すスレッドからも参照しておく
+        auto kept_subtree = create_tree<DynamicRC>(0, 3);
+        transferred_tree.get_object(1).value().set_object(0, kept_subtree);
+        #if CYCLE_COLLECTION
+        collect_cycles();
+        #endif
+        slot_owner.transfer_object(0, move(transferred_tree));
+
+        atomic_bool is_correct = true;
+        auto receiver = spawn([&](DynamicRC slot_owner) {
+            auto received = slot_owner.take_transferred_object(0);
+            if (!received.has_value() || slot_owner.take_transferred_object(0).has_value()) {
+                is_correct.store(false);
+                return;
+            }
+            #if !CYCLE_COLLECTION
+            //渡すスレッドから参照されている部分木以下だけが mutex になる
+            auto right = received.value().get_object(1).value();
+            if (received.value().get_heap_object()->get_is_mutex()
+                || received.value().get_object(0).value().get_heap_object()->get_is_mutex()
+                || right.get_heap_object()->get_is_mutex()
+                || !right.get_object(0).value().get_heap_object()->get_is_mutex()) {
+                is_correct.store(false);
+            }
+            #endif
+            //受け取ったスレッドでローカルなオブジェクトとして書き換えて解放する
+            received.value().set_object(0, nullopt);
+        }, slot_owner);
+        receiver.join();
+        if (!is_correct.load() || !kept_subtree.get_heap_object()->get_is_mutex()) {
+            cout << "transfer_object marked a wrong object as mutex" << endl;
+        }
+
+        //受け渡し中のまま上書きされたオブジェクトと、受け渡し中のまま残ったオブジェクトは解放される
+        slot_owner.transfer_object(1, create_element(0));
+        slot_owner.transfer_object(1, create_element(1));
+        slot_owner = DynamicRC(alloc_heap_object(1));
+
+        //一つのスレッドから使用する
+        {
+            Channel<> channel(4);
+            for (size_t i = 0; i < 3; i++) {
+                channel.send(create_element(i));
+            }
+            for (size_t i = 0; i < 3; i++) {
+                auto element = channel.try_receive();
+                if (!element.has_value() || *(size_t*) element.value().get_payload() != i) {
+                    cout << "Channel received a wrong element" << endl;
+                }
+            }
+            if (channel.try_receive().has_value()) {
+                cout << "Channel received from an empty channel" << endl;
+            }
+            //受信されないまま残った要素はチャネルと共に解放される
+            channel.send(create_element(3));
+
+            Channel<ThreadSafeRC> thread_safe_channel(4);
+            thread_safe_channel.send(ThreadSafeRC(alloc_heap_object(1)));
+            if (!thread_safe_channel.try_receive().has_value() || thread_safe_channel.try_receive().has_value()) {
+                cout << "Channel received a wrong element" << endl;
+            }
+        }
+
+        //複数の生産者と消費者の間で受け渡す(容量を小さくして一杯になる状態を含める)
+        {
+            Channel<> channel(8);
+            size_t element_count = (NUMBER_OF_THREADS / 2) * 2000;
+            atomic<int64_t> remaining_count = element_count;
+            atomic_size_t received_id_sum = 0;
+            atomic_bool is_local = true;
+
+            auto producer = [&](size_t thread_index) {
+                for (size_t i = 0; i < 2000; i++) {
+                    channel.send(create_element(thread_index * 2000 + i + 1));
+                }
+            };
+            auto consumer = [&]() {
+                while (remaining_count.fetch_sub(1, memory_order_relaxed) > 0) {
+                    auto element = channel.receive();
+                    #if !CYCLE_COLLECTION
+                    if (element.get_heap_object()->get_is_mutex() || element.get_object(0).value().get_heap_object()->get_is_mutex()) {
+                        is_local.store(false);
+                    }
+                    #endif
+                    received_id_sum.fetch_add(*(size_t*) element.get_payload(), memory_order_relaxed);
+                }
+            };
+            vector<thread> threads;
+            //スレッド起動
+            for (size_t i = 0; i < NUMBER_OF_THREADS / 2; i++) {
+                threads.push_back(thread(producer, i));
+                threads.push_back(thread(consumer));
+            }
+            //スレッド終了待機
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                it->join();
+            }
+            if (received_id_sum.load() != element_count * (element_count + 1) / 2 || channel.try_receive().has_value()) {
+                cout << "Channel lost an element" << endl;
+            }
+            if (!is_local.load()) {
+                cout << "Channel marked a unique element as mutex" << endl;
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    //長い連結リストオブジェクトの作成と削除(スタックが溢れないことの確認を兼ねる)
+    { create_linked_list<ManualObject>(TEARDOWN_LINKED_LIST_LENGTH).detele_object(); }
+    { create_linked_list<SingleThreadRC>(TEARDOWN_LINKED_LIST_LENGTH); }
+    { create_linked_list<ThreadSafeRC>(TEARDOWN_LINKED_LIST_LENGTH); }
+    //同様にセーフポイントに到達しておく
+    rc_flush();
+    { create_linked_list<DynamicRC>(TEARDOWN_LINKED_LIST_LENGTH); }
+
+    {//マルチスレッドで木構造オブジェクトを作成する(スレッドセーフな参照カウント)
+        auto func = []() {
+            for (size_t i = 0; i < 100; i++) {
+                //木構造オブジェクトを作成
+                auto tree = create_tree<ThreadSafeRC>(0, 10);
+                //グローバル変数へ渡す
+                global_variable_with_thread_safe_rc.set_object(0, move(tree));
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+    }
+
+    {//マルチスレッドで木構造オブジェクトを作成する(動的切り替え参照カウント)
+        auto func = []() {
+            for (size_t i = 0; i < 100; i++) {
+                //木構造オブジェクトを作成
+                auto tree = create_tree<DynamicRC>(0, 10);
+                //グローバル変数へ渡す
+                global_variable_with_dynamic_rc.set_object(0, move(tree));
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+
+    {//複数のスレッドから同じオブジェクトのフィールドを読み書きする(スレッドセーフな参照カウント)
+        auto func = []() {
+            for (size_t i = 0; i < 100000; i++) {
+                if (i % READ_HEAVY_WRITE_INTERVAL == 0) {
+                    global_variable_with_thread_safe_rc.set_object(0, create_tree<ThreadSafeRC>(0, 2));
+                } else {
+                    auto tree = global_variable_with_thread_safe_rc.get_object(0);
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+    }
+
+    {//複数のスレッドから同じオブジェクトのフィールドを読み書きする(動的切り替え参照カウント)
+        auto func = []() {
+            for (size_t i = 0; i < 100000; i++) {
+                if (i % READ_HEAVY_WRITE_INTERVAL == 0) {
+                    global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 2));
+                } else {
+                    auto tree = global_variable_with_dynamic_rc.get_object(0);
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+
+    {//複数のスレッドから同じオブジェクトのハンドルをコピーしながら、フィールドのオブジェクトを入れ替える
+        //(遅延参照カウントでは、反映せずに終了したスレッドの増減もスレッドの終了時に反映される)
+        auto func = [](size_t thread_index) {
+            for (size_t i = 0; i < 10000; i++) {
+                DynamicRC object(global_variable_with_dynamic_rc);
+                auto field_object = object.get_object(1);
+                if (i % READ_HEAVY_WRITE_INTERVAL == thread_index) {
+                    object.set_object(1, create_tree<DynamicRC>(0, 2));
+                }
+                if (field_object.has_value() && i % 1000 == 0) {
+                    rc_flush();
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(1, nullopt);
+    }
+
+    #if !COMPACT_HEAP_OBJECT_HEADER
+    {//複数のスレッドから同じオブジェクトのフィールドを読み書きする(偏り参照カウント)
+        auto func = []() {
+            for (size_t i = 0; i < 100000; i++) {
+                if (i % READ_HEAVY_WRITE_INTERVAL == 0) {
+                    global_variable_with_biased_rc.set_object(i % 2, create_tree<BiasedRC>(0, 2));
+                } else {
+                    //他のスレッドが作成したオブジェクトのハンドルをコピーして破棄する
+                    auto tree = global_variable_with_biased_rc.get_object(i % 2);
+                    if (tree.has_value()) {
+                        auto copied = tree.value().get_object(0);
+                    }
+                }
+            }
+            //このスレッドが所有するオブジェクトを残したまま終了し、他のスレッドに引き継がせる
+            global_variable_with_biased_rc.set_object(0, create_tree<BiasedRC>(0, 2));
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //作成したスレッドが終了したオブジェクトを、作成したスレッド以外から削除する
+        global_variable_with_biased_rc.set_object(0, nullopt);
+        global_variable_with_biased_rc.set_object(1, nullopt);
+    }
+    #endif
+
+    {//複数のスレッドから同じオブジェクトのスピンロックを取得し、ロックの内側でカウンタを増やす
+        auto func = []() {
+            for (size_t i = 0; i < 1000000; i++) {
+                lock_contention_variable_with_dynamic_rc.lock();
+                lock_contention_counter++;
+                lock_contention_variable_with_dynamic_rc.unlock();
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //カウンタを表示(NUMBER_OF_THREADS * 1000000 以外は不正)
+        cout << "Lock counter : " << lock_contention_counter << endl;
+    }
+
+    #if WEAK_REFERENCE
+    {//弱参照
+        auto object_count = global_object_count.load(memory_order_relaxed);
+        optional<WeakDynamicRC> weak_root;
+        optional<WeakDynamicRC> weak_child;
+        optional<WeakDynamicRC> weak_typed;
+        {
+            auto tree = create_tree<DynamicRC>(0, 5);
+            weak_root.emplace(tree);
+            weak_child.emplace(tree.get_object(0).value());
+            auto typed_tree = create_typed_tree<OBJECT_FIELD_LENGTH>(0, 5);
+            weak_typed.emplace(typed_tree.handle());
+            //生存している間は強参照を得られる
+            if (!weak_root->upgrade().has_value() || !weak_child->upgrade().has_value() || !weak_typed->upgrade().has_value()) {
+                cout << "Weak reference failed to upgrade a live object" << endl;
+            }
+        }
+        //参照カウントが0になった時点でフィールド以下のオブジェクトは解放され、ヘッダのメモリだけが弱参照の破棄まで残る
+        if (weak_root->upgrade().has_value() || weak_child->upgrade().has_value() || weak_typed->upgrade().has_value()
+            || global_object_count.load(memory_order_relaxed) != object_count + 3) {
+            cout << "Weak reference kept a dead object alive" << endl;
+        }
+        weak_root.reset();
+        weak_child.reset();
+        weak_typed.reset();
+    }
+
+    {//複数のスレッドから、他のスレッドが入れ替えるオブジェクトの弱参照を upgrade する
+        auto func = [](size_t thread_index) {
+            optional<WeakDynamicRC> weak_dynamic;
+            optional<WeakThreadSafeRC> weak_thread_safe;
+            for (size_t i = 0; i < 10000; i++) {
+                if (i % READ_HEAVY_WRITE_INTERVAL == thread_index) {
+                    global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 2));
+                    global_variable_with_thread_safe_rc.set_object(0, create_tree<ThreadSafeRC>(0, 2));
+                }
+
+                //解放されていれば、フィールドにある新しいオブジェクトの弱参照に取り替える
+                auto upgraded_dynamic = weak_dynamic.has_value() ? weak_dynamic->upgrade() : nullopt;
+                if (upgraded_dynamic.has_value()) {
+                    auto child = upgraded_dynamic->get_object(0);
+                } else if (auto object = global_variable_with_dynamic_rc.get_object(0); object.has_value()) {
+                    weak_dynamic.emplace(object.value());
+                }
+                auto upgraded_thread_safe = weak_thread_safe.has_value() ? weak_thread_safe->upgrade() : nullopt;
+                if (upgraded_thread_safe.has_value()) {
+                    auto child = upgraded_thread_safe->get_object(0);
+                } else if (auto object = global_variable_with_thread_safe_rc.get_object(0); object.has_value()) {
+                    weak_thread_safe.emplace(object.value());
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+    }
+    #endif
+
+    #if PARALLEL_TEARDOWN
+    {//巨大な木構造オブジェクトをワーカースレッドで並列に解放する
+        for (size_t worker_count : { 1, NUMBER_OF_THREADS }) {
+            parallel_teardown_set_worker_count(worker_count);
+            global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 20));
+            global_variable_with_thread_safe_rc.set_object(0, create_tree<ThreadSafeRC>(0, 20));
+            //フィールドから取り除き、参照カウントが0になったものをワーカーへ渡す
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+            global_variable_with_thread_safe_rc.set_object(0, nullopt);
+            epoch_reclaim_all();
+            parallel_teardown_wait();
+        }
+
+        //複数のスレッドから同時に手放す
+        auto func = []() {
+            for (size_t i = 0; i < 10; i++) {
+                auto tree = create_tree<DynamicRC>(0, 14);
+                tree.to_mutex();
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        parallel_teardown_set_worker_count(PARALLEL_TEARDOWN_WORKER_COUNT);
+    }
+    #endif
+
+    #if BACKGROUND_RECLAMATION
+    {//参照カウントが0になったオブジェクトを回収スレッドで解放する
+        global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 16));
+        global_variable_with_thread_safe_rc.set_object(0, create_tree<ThreadSafeRC>(0, 16));
+        //フィールドから取り除き、参照カウントが0になったものを回収スレッドへ渡す
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+        epoch_reclaim_all();
+        background_reclamation_wait();
+
+        //キューの容量を超える数のオブジェクトを複数のスレッドから同時に手放す(一杯の場合はその場で解放される)
+        auto func = []() {
+            for (size_t i = 0; i < 20000; i++) {
+                auto tree = create_tree<DynamicRC>(0, 2);
+                tree.to_mutex();
+                ThreadSafeRC object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        background_reclamation_wait();
+
+        //無効にした場合はその場で解放する
+        background_reclamation_set_enabled(false);
+        func();
+        background_reclamation_set_enabled(true);
+    }
+    #endif
+
+    #if PARALLEL_TO_MUTEX
+    {//巨大なオブジェクトの is_mutex をワーカースレッドと並列に伝搬させる
+        //オブジェクト以下で is_mutex が false のオブジェクトの数
+        auto count_local_objects = [](HeapObject* object) {
+            size_t count = 0;
+            vector<HeapObject*> stack = { object };
+            while (!stack.empty()) {
+                auto* current = stack.back();
+                stack.pop_back();
+                if (!current->get_is_mutex()) {
+                    count++;
+                }
+                auto** field_start_ptr = (HeapObject**) (current + 1);
+                for (size_t i = 0; i < current->get_field_length(); i++) {
+                    if (*(field_start_ptr + i) != nullptr) {
+                        stack.push_back(*(field_start_ptr + i));
+                    }
+                }
+            }
+            return count;
+        };
+
+        for (size_t worker_count : { 1, NUMBER_OF_THREADS }) {
+            parallel_to_mutex_set_worker_count(worker_count);
+            auto tree = create_tree<DynamicRC>(0, 18);
+            global_variable_with_dynamic_rc.set_object(0, tree);
+            if (count_local_objects(tree.get_heap_object()) != 0) {
+                cout << "Parallel to_mutex left a local object" << endl;
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+
+        {//複数のフィールドから参照されるオブジェクト(全ての要素の1番目のフィールドが同じ木構造オブジェクトを指す連結リスト)
+            auto shared = create_tree<DynamicRC>(0, 10);
+            DynamicRC list(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            for (size_t i = 0; i < 100000; i++) {
+                DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                node.set_object(0, move(list));
+                node.set_object(1, shared);
+                list = move(node);
+            }
+            //木構造オブジェクトは連結リストからだけ参照されるようにする
+            auto* shared_ref = shared.get_heap_object();
+            { auto dropped = move(shared); }
+
+            global_variable_with_dynamic_rc.set_object(0, list);
+            if (count_local_objects(list.get_heap_object()) != 0 || count_local_objects(shared_ref) != 0) {
+                cout << "Parallel to_mutex left a local object" << endl;
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+
+        //複数のスレッドから同時に公開する
+        auto func = []() {
+            for (size_t i = 0; i < 10; i++) {
+                auto tree = create_tree<DynamicRC>(0, 14);
+                tree.to_mutex();
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        parallel_to_mutex_set_worker_count(PARALLEL_TO_MUTEX_WORKER_COUNT);
+    }
+    #endif
+
+    #if LAZY_MUTEX_PROMOTION
+    {//公開したオブジェクトの is_mutex を取り出された時に遅延して伝搬させる
+        //オブジェクト以下で is_mutex が true のオブジェクトの数
+        auto count_mutex_objects = [](HeapObject* object) {
+            size_t count = 0;
+            vector<HeapObject*> stack = { object };
+            while (!stack.empty()) {
+                auto* current = stack.back();
+                stack.pop_back();
+                if (current->get_is_mutex()) {
+                    count++;
+                }
+                auto** field_start_ptr = (HeapObject**) (current + 1);
+                for (size_t i = 0; i < current->get_field_length(); i++) {
+                    if (*(field_start_ptr + i) != nullptr) {
+                        stack.push_back(*(field_start_ptr + i));
+                    }
+                }
+            }
+            return count;
+        };
+
+        {//根に近い部分だけを読んだ場合は、読んだオブジェクトだけが昇格する
+            global_variable_with_dynamic_rc.publish_object(0, create_tree<DynamicRC>(0, 16));
+            auto root = global_variable_with_dynamic_rc.get_object(0).value();
+            auto child = root.get_object(1).value();
+            auto grandchild = child.get_object(0).value();
+            if (count_mutex_objects(root.get_heap_object()) != 3) {
+                cout << "Lazy promotion promoted an unread object" << endl;
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+
+        //複数のスレッドが同時に辿りながら昇格させ、部分木を入れ替える
+        global_variable_with_dynamic_rc.publish_object(0, create_tree<DynamicRC>(0, 14));
+        auto func = [](size_t thread_id) {
+            for (size_t i = 0; i < 2000; i++) {
+                auto node = global_variable_with_dynamic_rc.get_object(0);
+                vector<DynamicRC> path;
+                for (size_t depth = 0; depth < 14 && node.has_value(); depth++) {
+                    auto next = node.value().get_object((i * 7 + thread_id + depth) % OBJECT_FIELD_LENGTH);
+                    path.push_back(move(node.value()));
+                    node = move(next);
+                }
+                if (path.empty()) {
+                    continue;
+                }
+                //辿った途中のオブジェクトの部分木を入れ替える
+                auto& target = path[(i + thread_id) % path.size()];
+                switch (i % 3) {
+                    case 0: target.publish_object(i % OBJECT_FIELD_LENGTH, create_tree<DynamicRC>(0, 3)); break;
+                    case 1: target.set_object(i % OBJECT_FIELD_LENGTH, create_tree<DynamicRC>(0, 3)); break;
+                    default: target.set_object(i % OBJECT_FIELD_LENGTH, nullopt); break;
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+
+        {//複数のフィールドから参照される公開中のオブジェクト(全ての要素の1番目のフィールドが同じ木構造オブジェクトを指す連結リスト)
+            DynamicRC list(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            {
+                auto shared = create_tree<DynamicRC>(0, 8);
+                for (size_t i = 0; i < 1000; i++) {
+                    DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                    node.set_object(0, move(list));
+                    node.set_object(1, shared);
+                    list = move(node);
+                }
+            }
+            global_variable_with_dynamic_rc.publish_object(0, move(list));
+
+            //異なる要素から同じ木構造オブジェクトへ到達して昇格させながら、連結リストを先頭から切り離していく
+            auto reader = [](size_t thread_id) {
+                auto node = global_variable_with_dynamic_rc.get_object(0);
+                for (size_t i = 0; node.has_value(); i++) {
+                    if (i % NUMBER_OF_THREADS == thread_id) {
+                        auto shared = node.value().get_object(1);
+                        for (size_t depth = 0; depth < 8 && shared.has_value(); depth++) {
+                            shared = shared.value().get_object((i + depth) % OBJECT_FIELD_LENGTH);
+                        }
+                    }
+                    node = node.value().get_object(0);
+                }
+            };
+            auto detacher = []() {
+                for (size_t i = 0; i < 1000; i++) {
+                    auto head = global_variable_with_dynamic_rc.get_object(0);
+                    if (!head.has_value()) {
+                        break;
+                    }
+                    global_variable_with_dynamic_rc.set_object(0, head.value().get_object(0));
+                }
+            };
+            vector<thread> threads;
+            //スレッド起動
+            for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+                threads.push_back(thread(reader, i));
+            }
+            threads.push_back(thread(detacher));
+            //スレッド終了待機
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                it->join();
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+        epoch_reclaim_all();
+    }
+    #endif
+
+    #if MUTEX_DEMOTION
+    {//他のスレッドから到達できなくなったオブジェクトの降格
+        //オブジェクト以下で is_mutex が true のオブジェクトの数
+        auto count_mutex_objects = [](HeapObject* object) {
+            size_t count = 0;
+            vector<HeapObject*> stack = { object };
+            while (!stack.empty()) {
+                auto* current = stack.back();
+                stack.pop_back();
+                if (current->get_is_mutex()) {
+                    count++;
+                }
+                auto** field_start_ptr = (HeapObject**) (current + 1);
+                for (size_t i = 0; i < current->get_field_length(); i++) {
+                    if (*(field_start_ptr + i) != nullptr) {
+                        stack.push_back(*(field_start_ptr + i));
+                    }
+                }
+            }
+            return count;
+        };
+
+        {//公開中は降格できず、取り除いた後は全て降格する
+            auto tree = create_tree<DynamicRC>(0, 10);
+            global_variable_with_dynamic_rc.set_object(0, tree);
+            if (tree.try_demote()) {
+                cout << "Demoted a published object" << endl;
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+            if (!tree.try_demote() || count_mutex_objects(tree.get_heap_object()) != 0) {
+                cout << "Failed to demote an unpublished object" << endl;
+            }
+            //降格後はローカルなオブジェクトとして書き換え、もう一度公開できる
+            tree.get_object(0).value().set_object(1, create_tree<DynamicRC>(0, 3));
+            global_variable_with_dynamic_rc.set_object(0, tree);
+            if (count_mutex_objects(tree.get_heap_object()) != (((size_t) 1) << 11) - 1 - ((((size_t) 1) << 9) - 1) + 15) {
+                cout << "Failed to republish a demoted object" << endl;
+            }
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+        }
+
+        {//他からも参照されている部分木は is_mutex が true のまま残る
+            auto tree = create_tree<DynamicRC>(0, 4);
+            auto subtree = tree.get_object(1).value();
+            tree.to_mutex();
+            if (!tree.try_demote() || count_mutex_objects(tree.get_heap_object()) != 15) {
+                cout << "Demoted an object referenced from elsewhere" << endl;
+            }
+            #if WEAK_REFERENCE
+            auto weak_tree = create_tree<DynamicRC>(0, 4);
+            WeakDynamicRC weak(weak_tree.get_object(0).value());
+            weak_tree.to_mutex();
+            if (!weak_tree.try_demote() || count_mutex_objects(weak_tree.get_heap_object()) != 15) {
+                cout << "Demoted an object referenced by a weak reference" << endl;
+            }
+            #endif
+        }
+
+        #if LAZY_MUTEX_PROMOTION
+        {//降格させたオブジェクトのフィールドにある公開中のオブジェクトは、他からも参照されていれば共有へ昇格する
+            //根の0番目と1番目のフィールドが指すオブジェクトが、どちらも0番目のフィールドで同じ木構造オブジェクトを指す
+            DynamicRC root(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            {
+                auto shared = create_tree<DynamicRC>(0, 3);
+                for (size_t i = 0; i < 2; i++) {
+                    DynamicRC branch(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                    branch.set_object(0, shared);
+                    root.set_object(i, move(branch));
+                }
+            }
+            global_variable_with_dynamic_rc.publish_object(0, move(root));
+            //根と0番目の子だけが昇格し、1番目の子と共有している木構造オブジェクトは公開中のまま残る
+            auto read_branch = global_variable_with_dynamic_rc.get_object(0).value().get_object(0).value();
+            root = global_variable_with_dynamic_rc.get_object(0).value();
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+
+            if (!root.try_demote() || root.get_heap_object()->get_is_mutex()) {
+                cout << "Failed to demote an unpublished object" << endl;
+            }
+            auto unread_branch = root.get_object(1).value();
+            if (unread_branch.get_heap_object()->get_is_mutex()) {
+                cout << "Failed to demote a unique published object" << endl;
+            }
+            //0番目の子からも参照されているため、ローカルなオブジェクトのフィールドから辿っても共有である
+            if (!unread_branch.get_object(0).value().get_heap_object()->get_is_mutex()) {
+                cout << "Demoted a published object referenced from elsewhere" << endl;
+            }
+        }
+        #endif
+
+        //複数のスレッドがグローバル変数から取り出し、降格できた場合はローカルに書き換えてから戻す
+        global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 8));
+        auto func = [](size_t thread_id) {
+            for (size_t i = 0; i < 2000; i++) {
+                auto tree = global_variable_with_dynamic_rc.get_object(0);
+                if (!tree.has_value()) {
+                    continue;
+                }
+                //他のスレッドが入れ替えている途中でも読み続ける
+                auto node = tree.value().get_object((i + thread_id) % OBJECT_FIELD_LENGTH);
+                node = nullopt;
+
+                global_variable_with_dynamic_rc.set_object(0, nullopt);
+                if (tree.value().try_demote()) {
+                    auto leaf = tree.value();
+                    for (size_t depth = 0; depth < 6; depth++) {
+                        leaf = leaf.get_object((i >> depth) % OBJECT_FIELD_LENGTH).value();
+                    }
+                    leaf.set_object(i % OBJECT_FIELD_LENGTH, create_tree<DynamicRC>(0, 2));
+                }
+                global_variable_with_dynamic_rc.set_object(0, move(tree.value()));
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        epoch_reclaim_all();
+    }
+    #endif
+
+    #if CYCLE_COLLECTION
+    {//循環参照の回収
+        //length 個のオブジェクトを0番目のフィールドで繋いだ環を作成する
+        auto create_ring = [](size_t length) {
+            DynamicRC head(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            DynamicRC current = head;
+            for (size_t i = 1; i < length; i++) {
+                DynamicRC next(alloc_heap_object(OBJECT_FIELD_LENGTH));
+                current.set_object(0, next);
+                current = move(next);
+            }
+            current.set_object(0, head);
+            return head;
+        };
+
+        //自己参照
+        { create_ring(1); }
+        //二つのオブジェクトの循環参照
+        { create_ring(2); }
+        //長い環(回収時にスタックが溢れないこと)
+        { create_ring(100000); }
+        //環から外部への参照を持つ場合は、環だけが回収される
+        {
+            DynamicRC outside(alloc_heap_object(OBJECT_FIELD_LENGTH));
+            {
+                auto ring = create_ring(100);
+                ring.set_object(1, outside);
+            }
+            collect_cycles();
+            //外部のオブジェクトは生存しており、環から受け取った参照カウントは減らされている
+            if (outside.get_heap_object()->get_reference_count() != 1) {
+                cout << "Cycle collection released a live object" << endl;
+            }
+        }
+        //外部から参照されている環は回収されない
+        {
+            auto ring = create_ring(100);
+            auto second = ring.get_object(0);
+            { second.value().get_object(0); }
+            collect_cycles();
+            second.value().set_object(0, nullopt);
+        }
+        //スレッドローカルな環から、複数のスレッドからアクセスされうるオブジェクトを参照する
+        {
+            auto ring = create_ring(10);
+            ring.set_object(1, create_ring(10));
+            ring.get_object(1).value().to_mutex();
+        }
+        collect_cycles();
+
+        //複数のスレッドで共有された環を、複数のスレッドから読み書きしながら手放す
+        auto func = [&](size_t thread_index) {
+            for (size_t i = 0; i < 10000; i++) {
+                if (i % READ_HEAVY_WRITE_INTERVAL == thread_index) {
+                    global_variable_with_dynamic_rc.set_object(0, create_ring(i % 16 + 1));
+                } else {
+                    auto ring = global_variable_with_dynamic_rc.get_object(0);
+                    if (ring.has_value()) {
+                        auto next = ring.value().get_object(0);
+                    }
+                }
+                if (i % 1000 == 0) {
+                    collect_cycles();
+                }
+            }
+        };
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func, i));
+        }
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+    #endif
+
+    #if ARENA_ALLOCATION
+    {//アリーナのスコープ内で確保したオブジェクト
+        //オブジェクト以下のオブジェクト数
+        auto count_objects = [](HeapObject* object) {
+            size_t count = 0;
+            vector<HeapObject*> stack = { object };
+            while (!stack.empty()) {
+                auto* current = stack.back();
+                stack.pop_back();
+                count++;
+                auto** field_start_ptr = (HeapObject**) (current + 1);
+                for (size_t i = 0; i < current->get_field_length(); i++) {
+                    if (*(field_start_ptr + i) != nullptr) {
+                        stack.push_back(*(field_start_ptr + i));
+                    }
+                }
+            }
+            return count;
+        };
+        //スコープを抜けた後の解放を全て反映してから、固定されているチャンクがあるかどうかを確かめる
+        auto check_pinned_chunks = [](bool is_pinned, const char* message) {
+            rc_flush();
+            epoch_reclaim_all();
+            #if CYCLE_COLLECTION
+            collect_cycles();
+            #endif
+            parallel_teardown_wait();
+            background_reclamation_wait();
+            if ((arena_pinned_chunk_count.load() != 0) != is_pinned) {
+                cout << message << endl;
+            }
+        };
+
+        //スコープ内で破棄したオブジェクトのチャンクは、スコープを抜けた時点で再利用される
+        {
+            Arena arena;
+            auto tree = create_tree<DynamicRC>(0, 14);
+            DynamicRC large(alloc_heap_object(ObjectLayout { 0, ARENA_MAX_OBJECT_SIZE }));
+            if (!tree.get_heap_object()->get_is_arena() || large.get_heap_object()->get_is_arena()) {
+                cout << "Arena allocated an object from a wrong place" << endl;
+            }
+        }
+        check_pinned_chunks(false, "Arena pinned a chunk without live objects");
+        if (DynamicRC(alloc_heap_object(1)).get_heap_object()->get_is_arena()) {
+            cout << "Arena allocated an object outside its scope" << endl;
+        }
+
+        //スコープの外へ持ち出したオブジェクトのチャンクは、最後のオブジェクトが解放されるまで固定される
+        {
+            optional<DynamicRC> escaped;
+            {
+                Arena arena;
+                escaped = create_tree<DynamicRC>(0, 12);
+                //持ち出したオブジェクトと同じチャンクで、スコープ内で破棄されるオブジェクト
+                auto temporary = create_tree<DynamicRC>(0, 12);
+            }
+            check_pinned_chunks(true, "Arena did not pin a chunk with a live object");
+            //固定されたチャンクのオブジェクトはそのまま使用でき、書き換えられる
+            escaped.value().get_object(0).value().set_object(1, create_tree<DynamicRC>(0, 3));
+            if (count_objects(escaped.value().get_heap_object()) != (((size_t) 1) << 13) - 1 - ((((size_t) 1) << 11) - 1) + 15) {
+                cout << "Arena lost an object in a pinned chunk" << endl;
+            }
+        }
+        check_pinned_chunks(false, "Arena did not release a pinned chunk");
+
+        //入れ子にしたスコープでは内側のアリーナから確保し、外側のオブジェクトを内側のスコープで解放できる
+        {
+            Arena outer_arena;
+            optional<DynamicRC> outer_tree = create_tree<DynamicRC>(0, 8);
+            {
+                Arena inner_arena;
+                auto inner_tree = create_tree<DynamicRC>(0, 8);
+                if (arena_chunk_of(inner_tree.get_heap_object()) == arena_chunk_of(outer_tree.value().get_heap_object())) {
+                    cout << "Nested arena allocated from an outer chunk" << endl;
+                }
+                outer_tree = nullopt;
+            }
+        }
+        check_pinned_chunks(false, "Nested arena pinned a chunk without live objects");
+
+        //公開したオブジェクトは、スコープ内外に関わらず他のスレッドが解放できる
+        {
+            Arena arena;
+            global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 10));
+            auto func = [](size_t thread_id) {
+                for (size_t i = 0; i < 200; i++) {
+                    auto tree = global_variable_with_dynamic_rc.get_object(0);
+                    if (tree.has_value()) {
+                        auto node = tree.value().get_object((i + thread_id) % OBJECT_FIELD_LENGTH);
+                    }
+                    //このスレッドで確保したオブジェクトへ置き換える(アリーナのオブジェクトは他のスレッドで解放される)
+                    if (i % 50 == 0) {
+                        global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 6));
+                    }
+                }
+            };
+            vector<thread> threads;
+            //スレッド起動
+            for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+                threads.push_back(thread(func, i));
+            }
+            //スレッド終了待機
+            for (auto it = threads.begin(); it != threads.end(); ++it) {
+                it->join();
+            }
+            //スコープを抜ける時も公開したままにしておく
+            global_variable_with_dynamic_rc.set_object(0, create_tree<DynamicRC>(0, 10));
+        }
+        check_pinned_chunks(true, "Arena did not pin a chunk with a published object");
+        auto releaser = thread([]() {
+            global_variable_with_dynamic_rc.set_object(0, nullopt);
+            rc_flush();
+            epoch_reclaim_all();
+        });
+        releaser.join();
+        check_pinned_chunks(false, "Arena did not release a chunk freed by another thread");
+    }
+    #endif
+
+    //このスレッドのバッファに記録した参照カウントの増減を反映
+    rc_flush();
+
+    //フィールドから取り除かれ、参照カウントを減らすのを遅らせているオブジェクトを全て解放
+    //(終了したスレッドの分も引き継がれている)
+    epoch_reclaim_all();
+
+    #if CYCLE_COLLECTION
+    //循環参照によって参照カウントが0にならないオブジェクトを全て回収
+    collect_cycles();
+    #endif
+
+    //ワーカースレッドと回収スレッドへ渡した解放を全て待つ
+    parallel_teardown_wait();
+    background_reclamation_wait();
+
+    //現在生存しているオブジェクト数を表示(0以外は不正)
+    cout << "Global object count : " << global_object_count.load(memory_order_relaxed) << endl;
+
+    return 0;
+}
+#else
+//ベンチマークを走らせる
+//詳細は以下を参照
+//https://github.com/google/benchmark
+BENCHMARK_MAIN();
+#endif
+
+
+
+/**
+ * 指定された型で木構造オブジェクトを作成
+ */
+template<typename T> T create_tree(size_t count, size_t tree_depth) {
+    auto* object_ref = alloc_heap_object(OBJECT_FIELD_LENGTH);
+
+    T object(object_ref);
+
+    if (count == tree_depth) {
+        return object;
+    }
+
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        auto child = create_tree<T>(count + 1, tree_depth);
+        //ムーブして渡すことで参照カウントの余計な増減を避ける
+        object.set_object(i, move(child));
+    }
+
+    return object;
+}
+
+/**
+ * 指定された型で、各オブジェクトが NodePayload をペイロードとして持つ木構造オブジェクトを作成
+ */
+template<typename T> T create_payload_tree(size_t count, size_t tree_depth) {
+    auto* object_ref = alloc_heap_object(ObjectLayout { OBJECT_FIELD_LENGTH, sizeof(NodePayload) });
+
+    T object(object_ref);
+
+    //スカラー値はペイロードへそのまま書き込む
+    auto* payload = (NodePayload*) object.get_payload();
+    payload->id = (int64_t) count;
+    payload->weight = (double) count * 0.5;
+
+    if (count == tree_depth) {
+        return object;
+    }
+
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        object.set_object(i, create_payload_tree<T>(count + 1, tree_depth));
+    }
+
+    return object;
+}
+
+/**
+ * 指定された型で、各オブジェクトが NodePayload の各値をそれぞれ別のオブジェクトに包んで(ボックス化して)持つ木構造オブジェクトを作成
+ * フィールドの OBJECT_FIELD_LENGTH 番目に id を、OBJECT_FIELD_LENGTH + 1 番目に weight を包んだオブジェクトを持つ
+ */
+template<typename T> T create_boxed_tree(size_t count, size_t tree_depth) {
+    T object(alloc_heap_object(OBJECT_FIELD_LENGTH + 2));
+
+    //スカラー値ごとに参照カウントを持つオブジェクトを作成する
+    T id_box(alloc_heap_object(ObjectLayout { 0, sizeof(int64_t) }));
+    *(int64_t*) id_box.get_payload() = (int64_t) count;
+    T weight_box(alloc_heap_object(ObjectLayout { 0, sizeof(double) }));
+    *(double*) weight_box.get_payload() = (double) count * 0.5;
+
+    object.set_object(OBJECT_FIELD_LENGTH, move(id_box));
+    object.set_object(OBJECT_FIELD_LENGTH + 1, move(weight_box));
+
+    if (count == tree_depth) {
+        return object;
+    }
+
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        object.set_object(i, create_boxed_tree<T>(count + 1, tree_depth));
+    }
+
+    return object;
+}
+
+/**
+ * create_payload_tree で作成した木構造オブジェクトの weight の合計を求める
+ */
+template<typename T> double sum_payload_tree(T& object) {
+    double sum = ((NodePayload*) object.get_payload())->weight;
+
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        auto child = object.get_object(i);
+        if (child.has_value()) {
+            sum += sum_payload_tree(child.value());
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * create_boxed_tree で作成した木構造オブジェクトの weight の合計を求める
+ */
+template<typename T> double sum_boxed_tree(T& object) {
+    //包まれた値を取り出すために、包んでいるオブジェクトを取得する
+    double sum = *(double*) object.get_object(OBJECT_FIELD_LENGTH + 1).value().get_payload();
+
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        auto child = object.get_object(i);
+        if (child.has_value()) {
+            sum += sum_boxed_tree(child.value());
+        }
+    }
+
+    return sum;
+}
+
+/**
+ * 指定された型で連結リストオブジェクトを作成
+ */
+template<typename T> T create_linked_list(size_t length) {
+    T head(alloc_heap_object(OBJECT_FIELD_LENGTH));
+
+    for (size_t i = 1; i < length; i++) {
+        T node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        //0番目のフィールドを次の要素とする
+        node.set_object(0, move(head));
+        head = move(node);
+    }
+
+    return head;
+}
+
+/**
+ * 通常のハンドルで、各オブジェクトがフィールドを field_length 個持つ木構造オブジェクトを作成
+ */
+template<typename T> T create_tree_with_field_length(size_t count, size_t tree_depth, size_t field_length) {
+    T object(alloc_heap_object(field_length));
+
+    if (count == tree_depth) {
+        return object;
+    }
+
+    for (size_t i = 0; i < field_length; i++) {
+        object.set_object(i, create_tree_with_field_length<T>(count + 1, tree_depth, field_length));
+    }
+
+    return object;
+}
+
+/**
+ * TypedObject で、各オブジェクトがフィールドを N 個持つ木構造オブジェクトを作成
+ */
+template<size_t N> TypedObject<N> create_typed_tree(size_t count, size_t tree_depth) {
+    TypedObject<N> object;
+
+    if (count == tree_depth) {
+        return object;
+    }
+
+    //フィールドの番号をコンパイル時の定数として展開する
+    [&]<size_t... I>(index_sequence<I...>) {
+        (object.template set<I>(create_typed_tree<N>(count + 1, tree_depth)), ...);
+    }(make_index_sequence<N>());
+
+    return object;
+}
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造で、オブジェクト数が SHAPE_TREE_OBJECT_COUNT を超えない最大の深さ
+ */
+constexpr size_t shape_tree_depth(size_t N) {
+    size_t depth = 0;
+    //深さ depth の木構造のオブジェクト数
+    size_t object_count = 1;
+    //深さ depth の段のオブジェクト数
+    size_t level_count = 1;
+
+    while (object_count + level_count * N <= SHAPE_TREE_OBJECT_COUNT) {
+        level_count *= N;
+        object_count += level_count;
+        depth++;
+    }
+
+    return depth;
+}
+
+/**
+ * オブジェクトを削除
+ * 手動メモリ管理の場合は明示的に削除し、参照カウントの場合は所有権を手放す
+ */
+template<typename T> void delete_object(T object) {
+    if constexpr (is_same_v<T, ManualObject>) {
+        object.detele_object();
+    } else {
+        //参照カウントの場合は所有権を手放して削除する
+        { T dropped(move(object)); }
+        //並列に解放している、若くは回収スレッドで解放している場合は、全て解放し終えるまで待つ
+        parallel_teardown_wait();
+        background_reclamation_wait();
+    }
+}
+
+/**
+ * ハンドルを介さずに木構造オブジェクトを作成
+ */
+HeapObject* create_raw_tree(size_t count, size_t tree_depth) {
+    auto* object_ref = alloc_heap_object(OBJECT_FIELD_LENGTH);
+
+    if (count == tree_depth) {
+        return object_ref;
+    }
+
+    //フィールドの開始ポインタ
+    auto** field_start_ptr = (HeapObject**) (object_ref + 1);
+    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
+        *(field_start_ptr + i) = create_raw_tree(count + 1, tree_depth);
+    }
+
+    return object_ref;
+}
+
+/**
+ * ハンドルを介さずに連結リストオブジェクトを作成
+ */
+HeapObject* create_raw_linked_list(size_t length) {
+    auto* head = alloc_heap_object(OBJECT_FIELD_LENGTH);
+
+    for (size_t i = 1; i < length; i++) {
+        auto* node = alloc_heap_object(OBJECT_FIELD_LENGTH);
+        //0番目のフィールドを次の要素とする
+        *((HeapObject**) (node + 1)) = head;
+        head = node;
+    }
+
+    return head;
+}
+
+/**
+ * フィールドの長さが field_length であるオブジェクト一つあたりに、アロケータが実際に消費するバイト数
+ */
+size_t allocated_bytes_per_object(size_t field_length, size_t payload_size) {
+    auto allocate_size = heap_object_size(field_length, payload_size);
+
+    #if USE_SLAB_ALLOCATOR
+        //サイズクラスの大きさに切り上げられる
+        if (allocate_size <= SLAB_MAX_OBJECT_SIZE) {
+            return slab_size_class(allocate_size) * 8;
+        }
+    #endif
+
+    //malloc は使用可能な領域の前にチャンクの大きさ(8バイト)を置く
+    auto* probe = malloc(allocate_size);
+    auto allocated_bytes = malloc_usable_size(probe) + sizeof(size_t);
+    free(probe);
+
+    return allocated_bytes;
+}
+
+/**
+ * オブジェクト以下の is_mutex を全て false に戻す
+ */
+void reset_mutex(HeapObject* object) {
+    vector<HeapObject*> stack = { object };
+
+    while (!stack.empty()) {
+        auto* current = stack.back();
+        stack.pop_back();
+
+        if (!current->get_is_mutex()) {
+            continue;
+        }
+        current->set_is_mutex(false);
+
+        auto** field_start_ptr = (HeapObject**) (current + 1);
+        for (size_t i = 0; i < current->get_field_length(); i++) {
+            if (*(field_start_ptr + i) != nullptr) {
+                stack.push_back(*(field_start_ptr + i));
+            }
+        }
+    }
+}
+
+/**
+ * 比較用に、再帰呼び出しでオブジェクト以下の is_mutex を true に伝搬させる
+ */
+void to_mutex_recursive(HeapObject* object) {
+    if (!object->get_is_mutex()) {
+        object->set_is_mutex(true);
+
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        for (size_t i = 0; i < object->get_field_length(); i++) {
+            if (*(field_start_ptr + i) != nullptr) {
+                to_mutex_recursive(*(field_start_ptr + i));
+            }
+        }
+    }
+}
+
+/**
+ * Treiber スタックの先頭へ node を積む
+ * stack の0番目のフィールドが先頭の要素を、各要素の0番目のフィールドが次の要素を指す
+ * 取り出した要素を再び積むと ABA により壊れるため、積む要素は毎回新しく作成する
+ */
+void treiber_stack_push(DynamicRC& stack, DynamicRC node) {
+    while (true) {
+        auto head = stack.get_object(0);
+        node.set_object(0, head);
+        if (stack.compare_and_set_object(0, head, node)) {
+            return;
+        }
+    }
+}
+
+/**
+ * Treiber スタックの先頭から要素を取り出す(空であれば nullopt)
+ */
+optional<DynamicRC> treiber_stack_pop(DynamicRC& stack) {
+    while (true) {
+        auto head = stack.get_object(0);
+        if (!head.has_value()) {
+            return nullopt;
+        }
+        auto next = head.value().get_object(0);
+        if (stack.compare_and_set_object(0, head, next)) {
+            return head;
+        }
+    }
+}
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 手動
+ */
+static void benchmark_single_thread_manual_object(benchmark::State& state) {
+    for (auto _ : state) {
+        create_tree<ManualObject>(0, 10).detele_object();
+    }
+}
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : シングススレッド専用参照カウント
+ */
+static void benchmark_single_thread_single_thread_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        create_tree<SingleThreadRC>(0, 10);
+    }
+}
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : スレッドセーフな参照カウント
+ */
+static void benchmark_single_thread_thread_safe_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        create_tree<ThreadSafeRC>(0, 10);
+    }
+}
+
+/**
+ * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_single_thread_dynamic_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        create_tree<DynamicRC>(0, 10);
+    }
+}
+
+
+/**
+ * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : スレッドセーフな参照カウント
+ */
+static void benchmark_multi_thread_thread_safe_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        auto func = []() {
+            for (size_t i = 0; i < 5; i++) {
+                //木構造オブジェクトを作成
+                auto tree = create_tree<ThreadSafeRC>(0, 20);
+                //グローバル変数へ渡す
+                global_variable_with_thread_safe_rc.set_object(0, move(tree));
+            }
+        };
+
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+    }
+}
+
+/**
+ * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_multi_thread_dynamic_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        auto func = []() {
+            for (size_t i = 0; i < 5; i++) {
+                //木構造オブジェクトを作成
+                auto tree = create_tree<DynamicRC>(0, 20);
+                //グローバル変数へ渡す
+                //この時mutex化が起こる
+                //詳細については"dynamic_rc.hpp"を参照
+                global_variable_with_dynamic_rc.set_object(0, move(tree));
+            }
+        };
+
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
+            threads.push_back(thread(func));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+
+        //グローバル変数へ挿入されているオブジェクトを削除
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+    }
+}
+
+
+/**
+ * 木構造オブジェクトの作成と削除にかかるオブジェクト一つあたりの時間と、オブジェクト一つあたりのメモリ使用量を計測するベンチマーク用関数
+ * ヘッダのレイアウト(COMPACT_HEAP_OBJECT_HEADER)による違いを比較するために使用する
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_node_footprint(benchmark::State& state) {
+    //木構造オブジェクトに含まれるオブジェクトの数
+    size_t object_count = (((size_t) 1) << (NODE_FOOTPRINT_TREE_DEPTH + 1)) - 1;
+
+    for (auto _ : state) {
+        delete_object(create_tree<T>(0, NODE_FOOTPRINT_TREE_DEPTH));
+    }
+
+    //ヘッダの大きさ
+    state.counters["header_bytes"] = sizeof(HeapObject);
+    //ヘッダとフィールドを合わせたオブジェクトの大きさ
+    state.counters["object_bytes"] = heap_object_size(OBJECT_FIELD_LENGTH);
+    //アロケータの管理領域や切り上げを含めた、オブジェクト一つあたりのメモリ使用量
+    state.counters["bytes_per_node"] = allocated_bytes_per_object(OBJECT_FIELD_LENGTH);
+    //オブジェクト一つあたりの作成と削除にかかる時間
+    state.counters["ns_per_node"] = benchmark::Counter((double) object_count * state.iterations(), benchmark::Counter::kIsRate | benchmark::Counter::kInvert);
+}
+
+
+/**
+ * スカラー値をペイロードとして持つ木構造オブジェクトを作成し、値を読み取ってから削除するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_payload_tree_inline(benchmark::State& state) {
+    for (auto _ : state) {
+        auto tree = create_payload_tree<T>(0, PAYLOAD_TREE_DEPTH);
+        benchmark::DoNotOptimize(sum_payload_tree(tree));
+    }
+
+    //木構造の一つのオブジェクトあたりのメモリ使用量
+    state.counters["bytes_per_node"] = allocated_bytes_per_object(OBJECT_FIELD_LENGTH, sizeof(NodePayload));
+}
+
+/**
+ * スカラー値をそれぞれ別のオブジェクトに包んで持つ木構造オブジェクトを作成し、値を読み取ってから削除するベンチマーク用関数(比較用)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_payload_tree_boxed(benchmark::State& state) {
+    for (auto _ : state) {
+        auto tree = create_boxed_tree<T>(0, PAYLOAD_TREE_DEPTH);
+        benchmark::DoNotOptimize(sum_boxed_tree(tree));
+    }
+
+    //木構造の一つのオブジェクトあたりのメモリ使用量(包んでいるオブジェクトを含む)
+    state.counters["bytes_per_node"] = allocated_bytes_per_object(OBJECT_FIELD_LENGTH + 2)
+        + allocated_bytes_per_object(0, sizeof(int64_t)) + allocated_bytes_per_object(0, sizeof(double));
+}
+
+
+/**
+ * 長い連結リストオブジェクトの削除にかかる時間を計測するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_teardown_linked_list(benchmark::State& state) {
+    for (auto _ : state) {
+        //作成にかかる時間は計測しない
+        state.PauseTiming();
+        auto list = create_linked_list<T>(TEARDOWN_LINKED_LIST_LENGTH);
+        state.ResumeTiming();
+
+        delete_object(move(list));
+    }
+}
+
+/**
+ * 深い木構造オブジェクトの削除にかかる時間を計測するベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_teardown_deep_tree(benchmark::State& state) {
+    for (auto _ : state) {
+        //作成にかかる時間は計測しない
+        state.PauseTiming();
+        auto tree = create_tree<T>(0, TEARDOWN_TREE_DEPTH);
+        state.ResumeTiming();
+
+        delete_object(move(tree));
+    }
+}
+
+
+/**
+ * 約100万オブジェクトの木構造の is_mutex を再帰呼び出しで伝搬させるベンチマーク用関数(比較用)
+ */
+static void benchmark_to_mutex_recursive_tree(benchmark::State& state) {
+    auto* tree = create_raw_tree(0, TO_MUTEX_TREE_DEPTH);
+
+    for (auto _ : state) {
+        to_mutex_recursive(tree);
+
+        //is_mutex を元に戻す時間は計測しない
+        state.PauseTiming();
+        reset_mutex(tree);
+        state.ResumeTiming();
+    }
+
+    ManualObject(tree).detele_object();
+}
+
+/**
+ * 約100万オブジェクトの木構造の is_mutex を HeapObject::to_mutex() で伝搬させるベンチマーク用関数
+ */
+static void benchmark_to_mutex_tree(benchmark::State& state) {
+    auto* tree = create_raw_tree(0, TO_MUTEX_TREE_DEPTH);
+
+    for (auto _ : state) {
+        tree->to_mutex();
+
+        //is_mutex を元に戻す時間は計測しない
+        state.PauseTiming();
+        reset_mutex(tree);
+        state.ResumeTiming();
+    }
+
+    ManualObject(tree).detele_object();
+}
+
+/**
+ * 100万要素の連結リストの is_mutex を HeapObject::to_mutex() で伝搬させるベンチマーク用関数
+ * 再帰呼び出しではスタックが溢れるため比較対象はない
+ */
+static void benchmark_to_mutex_linked_list(benchmark::State& state) {
+    auto* list = create_raw_linked_list(TO_MUTEX_LINKED_LIST_LENGTH);
+
+    for (auto _ : state) {
+        list->to_mutex();
+
+        //is_mutex を元に戻す時間は計測しない
+        state.PauseTiming();
+        reset_mutex(list);
+        state.ResumeTiming();
+    }
+
+    ManualObject(list).detele_object();
+}
+
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の削除にかかる時間を計測するベンチマーク用関数
+ * フィールドの長さを実行時に読み取る通常のハンドル(DynamicRC)を使用する(比較用)
+ */
+template<size_t N> static void benchmark_shape_teardown_runtime(benchmark::State& state) {
+    for (auto _ : state) {
+        //作成にかかる時間は計測しない
+        state.PauseTiming();
+        auto tree = create_tree_with_field_length<DynamicRC>(0, shape_tree_depth(N), N);
+        state.ResumeTiming();
+
+        delete_object(move(tree));
+    }
+}
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の削除にかかる時間を計測するベンチマーク用関数
+ * 形を固定した TypedObject<N> を使用する
+ */
+template<size_t N> static void benchmark_shape_teardown_typed(benchmark::State& state) {
+    for (auto _ : state) {
+        //作成にかかる時間は計測しない
+        state.PauseTiming();
+        auto tree = create_typed_tree<N>(0, shape_tree_depth(N));
+        state.ResumeTiming();
+
+        delete_object(move(tree));
+    }
+}
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の is_mutex を伝搬させるベンチマーク用関数
+ * フィールドの長さを実行時に読み取る通常のハンドル(DynamicRC)を使用する(比較用)
+ */
+template<size_t N> static void benchmark_shape_to_mutex_runtime(benchmark::State& state) {
+    auto tree = create_tree_with_field_length<DynamicRC>(0, shape_tree_depth(N), N);
+
+    for (auto _ : state) {
+        tree.to_mutex();
+
+        //is_mutex を元に戻す時間は計測しない
+        state.PauseTiming();
+        reset_mutex(tree.get_heap_object());
+        state.ResumeTiming();
+    }
+}
+
+/**
+ * フィールドを N 個持つオブジェクトの木構造の is_mutex を伝搬させるベンチマーク用関数
+ * 形を固定した TypedObject<N> を使用する
+ */
+template<size_t N> static void benchmark_shape_to_mutex_typed(benchmark::State& state) {
+    auto tree = create_typed_tree<N>(0, shape_tree_depth(N));
+
+    for (auto _ : state) {
+        tree.to_mutex();
+
+        //is_mutex を元に戻す時間は計測しない
+        state.PauseTiming();
+        reset_mutex(tree.handle().get_heap_object());
+        state.ResumeTiming();
+    }
+}
+
+
+/**
+ * 生産者スレッドが木構造オブジェクトを作成し、消費者スレッドが削除するベンチマーク用関数
+ * オブジェクトは確保したスレッドとは異なるスレッドで解放される
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_producer_consumer_dynamic_rc(benchmark::State& state) {
+    for (auto _ : state) {
+        mutex queue_mutex;
+        condition_variable queue_condition;
+        //生産者スレッドから消費者スレッドへ木構造オブジェクトを渡すキュー
+        deque<DynamicRC> queue;
+        //まだ消費されていない木構造オブジェクトの数
+        size_t remaining_count = (NUMBER_OF_THREADS / 2) * PRODUCER_CONSUMER_TREE_COUNT;
+
+        auto producer = [&]() {
+            for (size_t i = 0; i < PRODUCER_CONSUMER_TREE_COUNT; i++) {
+                //木構造オブジェクトを作成
+                auto tree = create_tree<DynamicRC>(0, PRODUCER_CONSUMER_TREE_DEPTH);
+                //他のスレッドへ渡すため、予め mutex としてマーク
+                tree.to_mutex();
+
+                {
+                    lock_guard<mutex> guard(queue_mutex);
+                    queue.push_back(move(tree));
+                }
+                queue_condition.notify_one();
+            }
+        };
+
+        auto consumer = [&]() {
+            while (true) {
+                optional<DynamicRC> tree;
+                {
+                    unique_lock<mutex> lock(queue_mutex);
+                    queue_condition.wait(lock, [&]() { return !queue.empty() || remaining_count == 0; });
+                    if (queue.empty()) {
+                        //全て消費し終えた
+                        return;
+                    }
+
+                    tree = move(queue.front());
+                    queue.pop_front();
+                    if (--remaining_count == 0) {
+                        queue_condition.notify_all();
+                    }
+                }
+                //ロックの外で、確保したスレッドとは異なるスレッド上で削除される
+            }
+        };
+
+        vector<thread> threads;
+        //スレッド起動
+        for (size_t i = 0; i < NUMBER_OF_THREADS / 2; i++) {
+            threads.push_back(thread(producer));
+            threads.push_back(thread(consumer));
+        }
+
+        //スレッド終了待機
+        for (auto it = threads.begin(); it != threads.end(); ++it) {
+            it->join();
+        }
+    }
+}
+
+
+/**
+ * 読み込み中心のベンチマークで、複数のスレッドから読み込まれるオブジェクトを取得
+ */
+template<typename T> T& read_heavy_variable() {
+    if constexpr (is_same_v<T, ThreadSafeRC>) {
+        return read_heavy_variable_with_thread_safe_rc;
+    } else {
+        return read_heavy_variable_with_dynamic_rc;
+    }
+}
+
+/**
+ * 複数のスレッドから同じオブジェクトのフィールドを読み込み続けるベンチマーク用関数
+ * READ_HEAVY_WRITE_INTERVAL 回に一回はフィールドへ新しいオブジェクトを書き込む
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_read_heavy(benchmark::State& state) {
+    auto& variable = read_heavy_variable<T>();
+    if (state.thread_index() == 0) {
+        variable.set_object(0, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+    }
+
+    size_t operation_count = 0;
+    for (auto _ : state) {
+        if (++operation_count % READ_HEAVY_WRITE_INTERVAL == 0) {
+            //新しいオブジェクトを書き込む
+            variable.set_object(0, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            //取り除いたオブジェクトが解放されるように、書き込みの度にセーフポイントに到達する
+            rc_flush();
+        } else {
+            //フィールドのオブジェクトを読み込む
+            auto object = variable.get_object(0);
+            benchmark::DoNotOptimize(object);
+        }
+    }
+    rc_flush();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+/**
+ * ロックの競合ベンチマークで、複数のスレッドからロックされるオブジェクトを取得
+ */
+template<typename T> T& lock_contention_variable() {
+    if constexpr (is_same_v<T, ThreadSafeRC>) {
+        return lock_contention_variable_with_thread_safe_rc;
+    } else {
+        return lock_contention_variable_with_dynamic_rc;
+    }
+}
+
+/**
+ * 複数のスレッドから同じオブジェクトのスピンロックを取得し続けるベンチマーク用関数
+ * ロックの内側では共有されたカウンタを一つ増やすだけの短い処理を行う
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_lock_contention(benchmark::State& state) {
+    auto& variable = lock_contention_variable<T>();
+
+    for (auto _ : state) {
+        variable.lock();
+        lock_contention_counter++;
+        variable.unlock();
+    }
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+/**
+ * 複数のスレッドに公開した(is_mutex が true の)オブジェクトのハンドルを、作成したスレッドでコピーして破棄し続けるベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_owner_copy(benchmark::State& state) {
+    {
+        T object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        //複数のスレッドに公開する
+        if constexpr (!is_same_v<T, ThreadSafeRC>) {
+            object.to_mutex();
+        }
+
+        for (auto _ : state) {
+            T copied(object);
+            benchmark::DoNotOptimize(copied);
+        }
+    }
+    //オブジェクトの破棄を含めて反映する
+    rc_flush();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * 複数のスレッドに公開した木構造オブジェクトを、作成したスレッドが根から辿って葉を書き換え続けるベンチマーク用関数
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_owner_mutation(benchmark::State& state) {
+    {
+        auto tree = create_tree<T>(0, OWNER_MUTATION_TREE_DEPTH);
+        //複数のスレッドに公開する
+        if constexpr (!is_same_v<T, ThreadSafeRC>) {
+            tree.to_mutex();
+        }
+
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            //根から葉の一つ上のオブジェクトまで、操作ごとに異なる経路で辿る
+            auto node = tree;
+            for (size_t depth = 0; depth < OWNER_MUTATION_TREE_DEPTH - 1; depth++) {
+                node = node.get_object((operation_count >> depth) % OBJECT_FIELD_LENGTH).value();
+            }
+            //葉を新しいオブジェクトに置き換える
+            node.set_object(operation_count % OBJECT_FIELD_LENGTH, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            //取り除いた葉が解放されるように、操作の度にセーフポイントに到達する
+            rc_flush();
+
+            operation_count++;
+        }
+    }
+    //オブジェクトの破棄を含めて反映する
+    rc_flush();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+
+/**
+ * ハンドルのコピーのベンチマークで、複数のスレッドからコピーされるオブジェクトを取得
+ */
+template<typename T> T& hot_shared_variable() {
+    if constexpr (is_same_v<T, ThreadSafeRC>) {
+        return hot_shared_variable_with_thread_safe_rc;
+    } else {
+        return hot_shared_variable_with_dynamic_rc;
+    }
+}
+
+/**
+ * 複数のスレッドから同じオブジェクトのハンドルをコピーして破棄し続けるベンチマーク用関数
+ * HOT_SHARED_COPY_FLUSH_INTERVAL 回に一回は rc_flush() を呼び出す
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_hot_shared_copy(benchmark::State& state) {
+    {
+        T object(hot_shared_variable<T>());
+
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            T copied(object);
+            benchmark::DoNotOptimize(copied);
+
+            if (++operation_count % HOT_SHARED_COPY_FLUSH_INTERVAL == 0) {
+                rc_flush();
+            }
+        }
+    }
+    //オブジェクトの破棄を含めて反映する
+    rc_flush();
+
+    state.SetItemsProcessed(state.iterations());
+}
+
+/**
+ * フィールドのベンチマークで、N 個のフィールドへ入れるオブジェクトを作成
+ * is_same が true の場合は全て同じオブジェクトにする
+ */
+template<size_t N> static vector<optional<DynamicRC>> create_field_objects(bool is_same) {
+    vector<optional<DynamicRC>> objects;
+    DynamicRC same_object(alloc_heap_object(OBJECT_FIELD_LENGTH));
+    for (size_t i = 0; i < N; i++) {
+        if (is_same) {
+            objects.push_back(same_object);
+        } else {
+            objects.push_back(DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+        }
+    }
+    return objects;
+}
+
+/**
+ * mutex なオブジェクトの N 個のフィールドへ set_object で一つずつ、若しくは set_fields でまとめて挿入し続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は set_fields を使用する
+ * state.range(1) が 1 の場合は全てのフィールドへ同じオブジェクトを、0 の場合はフィールドごとに異なるオブジェクトを挿入する
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+template<size_t N> static void benchmark_set_fields(benchmark::State& state) {
+    {
+        DynamicRC object(alloc_heap_object(N), true);
+        auto objects = create_field_objects<N>(state.range(1) == 1);
+        array<size_t, N> field_indices;
+        for (size_t i = 0; i < N; i++) {
+            field_indices[i] = i;
+        }
+
+        for (auto _ : state) {
+            if (state.range(0) == 1) {
+                object.set_fields(field_indices, objects);
+            } else {
+                for (size_t i = 0; i < N; i++) {
+                    object.set_object(i, objects[i]);
+                }
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    state.SetItemsProcessed(state.iterations() * N);
+}
+
+/**
+ * mutex なオブジェクトの N 個のフィールドから get_object で一つずつ、若しくは get_fields でまとめて取得し続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は get_fields を使用する
+ * state.range(1) が 1 の場合は全てのフィールドに同じオブジェクトを、0 の場合はフィールドごとに異なるオブジェクトを入れておく
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+template<size_t N> static void benchmark_get_fields(benchmark::State& state) {
+    {
+        DynamicRC object(alloc_heap_object(N), true);
+        auto objects = create_field_objects<N>(state.range(1) == 1);
+        array<size_t, N> field_indices;
+        for (size_t i = 0; i < N; i++) {
+            field_indices[i] = i;
+        }
+        object.set_fields(field_indices, objects);
+
+        vector<optional<DynamicRC>> loaded(N);
+        for (auto _ : state) {
+            if (state.range(0) == 1) {
+                object.get_fields(field_indices, loaded);
+            } else {
+                for (size_t i = 0; i < N; i++) {
+                    loaded[i] = object.get_object(i);
+                }
+            }
+            benchmark::DoNotOptimize(loaded.data());
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    state.SetItemsProcessed(state.iterations() * N);
+}
 
 /**
- * 指定された型で木構造オブジェクトを作成
+ * 複数のスレッドから同じスタックへ新しい要素を積んで取り出し続けるベンチマーク用関数
+ * IS_LOCK_FREE が true の場合は compare_and_set_object による Treiber スタックを、
+ * false の場合はスタックのオブジェクトのスピンロックで保護したスタックを使用する
+ * メモリ管理方法 : 動的切り替え参照カウント
  */
-template<typename T> T create_tree(size_t count, size_t tree_depth);
+template<bool IS_LOCK_FREE> static void benchmark_stack(benchmark::State& state) {
+    auto& stack = stack_variable_with_dynamic_rc;
+    for (auto _ : state) {
+        DynamicRC node(alloc_heap_object(OBJECT_FIELD_LENGTH));
+        if constexpr (IS_LOCK_FREE) {
+            treiber_stack_push(stack, move(node));
+            auto popped = treiber_stack_pop(stack);
+            benchmark::DoNotOptimize(popped);
+        } else {
+            stack.lock();
+            node.set_object(0, stack.get_object(0));
+            stack.set_object(0, move(node));
+            stack.unlock();
 
+            stack.lock();
+            auto popped = stack.get_object(0);
+            if (popped.has_value()) {
+                stack.set_object(0, popped.value().get_object(0));
+            }
+            stack.unlock();
+            benchmark::DoNotOptimize(popped);
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
 
-/**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : 手動
- */
-static void benchmark_single_thread_manual_object(benchmark::State& state);
+    state.SetItemsProcessed(state.iterations());
+}
 
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : シングススレッド専用参照カウント
+ * 共有コンテナのベンチマークで、全てのスレッドで共有するコンテナを取得
+ * 最初に呼び出したスレッドが作成して prepare で最初の要素を入れ、DynamicRC の場合は mutex としてマークしてから返す
  */
-static void benchmark_single_thread_single_thread_rc(benchmark::State& state);
+template<typename Container, typename Prepare> Container& shared_container(Prepare prepare) {
+    static Container container = [&]() {
+        Container created;
+        prepare(created);
+        if constexpr (is_same_v<remove_reference_t<decltype(created.handle())>, DynamicRC>) {
+            created.handle().to_mutex();
+        }
+        return created;
+    }();
+    return container;
+}
 
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : スレッドセーフな参照カウント
+ * 共有コンテナのベンチマークで使用する乱数(xorshift)
  */
-static void benchmark_single_thread_thread_safe_rc(benchmark::State& state);
+inline uint64_t shared_container_random(uint64_t& state) {
+    state ^= state << 13;
+    state ^= state >> 7;
+    state ^= state << 17;
+    return state;
+}
 
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : 動的切り替え参照カウント
+ * キュー(SharedQueue)の末尾へ新しい要素を追加して先頭から取り出し続けるベンチマーク用関数
+ * state.range(0) が 0 の場合はスレッドごとに作成したキューを、1 の場合は全てのスレッドで共有したキューを使用する
+ * メモリ管理方法 : T
  */
-static void benchmark_single_thread_dynamic_rc(benchmark::State& state);
+template<typename T> static void benchmark_shared_queue(benchmark::State& state) {
+    {
+        auto prepare = [](SharedQueue<T>&) {};
+        optional<SharedQueue<T>> local_queue;
+        if (state.range(0) == 0) {
+            local_queue.emplace();
+        }
+        auto& queue = state.range(0) == 0 ? local_queue.value() : shared_container<SharedQueue<T>>(prepare);
+
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            queue.push(T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            optional<T> value;
+            benchmark::DoNotOptimize(queue.pop(value));
+
+            if (++operation_count % SHARED_CONTAINER_FLUSH_INTERVAL == 0) {
+                rc_flush();
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    state.SetItemsProcessed(state.iterations());
+}
 
 /**
- * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : スレッドセーフな参照カウント
+ * ハッシュマップ(ShardedMap)を検索し続けるベンチマーク用関数
+ * 10回に一回は挿入を、10回に一回は削除を行う
+ * state.range(0) が 0 の場合はスレッドごとに作成したハッシュマップを、1 の場合は全てのスレッドで共有したハッシュマップを使用する
+ * メモリ管理方法 : T
  */
-static void benchmark_multi_thread_thread_safe_rc(benchmark::State& state);
+template<typename T> static void benchmark_sharded_map(benchmark::State& state) {
+    {
+        //偶数のキーを挿入しておく
+        auto prepare = [](ShardedMap<T>& map) {
+            for (uint64_t key = 0; key < SHARED_MAP_KEY_COUNT; key += 2) {
+                map.insert_or_assign(key, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            }
+        };
+        optional<ShardedMap<T>> local_map;
+        if (state.range(0) == 0) {
+            local_map.emplace();
+            prepare(local_map.value());
+        }
+        auto& map = state.range(0) == 0 ? local_map.value() : shared_container<ShardedMap<T>>(prepare);
+
+        uint64_t random_state = 88172645463325252ull + state.thread_index();
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            auto random = shared_container_random(random_state);
+            auto key = (random >> 8) % SHARED_MAP_KEY_COUNT;
+            switch (random % 10) {
+                case 0:
+                    map.insert_or_assign(key, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+                    break;
+                case 1:
+                    benchmark::DoNotOptimize(map.erase(key));
+                    break;
+                default: {
+                    optional<T> value;
+                    benchmark::DoNotOptimize(map.find(key, value));
+                    break;
+                }
+            }
+
+            if (++operation_count % SHARED_CONTAINER_FLUSH_INTERVAL == 0) {
+                rc_flush();
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
+
+    state.SetItemsProcessed(state.iterations());
+}
 
 /**
- * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : 動的切り替え参照カウント
+ * 配列(SharedVector)の要素を読み込み続けるベンチマーク用関数
+ * 10回に一回は要素へ新しいオブジェクトを書き込む
+ * state.range(0) が 0 の場合はスレッドごとに作成した配列を、1 の場合は全てのスレッドで共有した配列を使用する
+ * メモリ管理方法 : T
  */
-static void benchmark_multi_thread_dynamic_rc(benchmark::State& state);
+template<typename T> static void benchmark_shared_vector(benchmark::State& state) {
+    {
+        auto prepare = [](SharedVector<T>& vector) {
+            for (size_t i = 0; i < SHARED_VECTOR_LENGTH; i++) {
+                vector.push_back(T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            }
+        };
+        optional<SharedVector<T>> local_vector;
+        if (state.range(0) == 0) {
+            local_vector.emplace();
+            prepare(local_vector.value());
+        }
+        auto& vector = state.range(0) == 0 ? local_vector.value() : shared_container<SharedVector<T>>(prepare);
 
+        uint64_t random_state = 88172645463325252ull + state.thread_index();
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            auto random = shared_container_random(random_state);
+            auto index = (random >> 8) % SHARED_VECTOR_LENGTH;
+            if (random % 10 == 0) {
+                vector.set(index, T(alloc_heap_object(OBJECT_FIELD_LENGTH)));
+            } else {
+                auto element = vector.get(index);
+                benchmark::DoNotOptimize(element);
+            }
 
-//各種ベンチマーク関数の登録
-//詳細は以下を参照
-//https://github.com/google/benchmark
-BENCHMARK(benchmark_single_thread_manual_object);
-BENCHMARK(benchmark_single_thread_single_thread_rc);
-BENCHMARK(benchmark_single_thread_thread_safe_rc);
-BENCHMARK(benchmark_single_thread_dynamic_rc);
-BENCHMARK(benchmark_multi_thread_thread_safe_rc);
-BENCHMARK(benchmark_multi_thread_dynamic_rc);
+            if (++operation_count % SHARED_CONTAINER_FLUSH_INTERVAL == 0) {
+                rc_flush();
+            }
+        }
+    }
+    rc_flush();
+    epoch_reclaim_all();
 
-//複数のスレッドから直接アクセス可能なオブジェクト
-ThreadSafeRC global_variable_with_thread_safe_rc(alloc_heap_object(OBJECT_FIELD_LENGTH));
-DynamicRC global_variable_with_dynamic_rc(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+    state.SetItemsProcessed(state.iterations());
+}
 
+/**
+ * パイプラインのベンチマークで、隣り合う段(スレッド)の間で木構造オブジェクトを渡すキュー
+ * nullopt はそれ以上渡すものがないことを表す
+ */
+struct PipelineQueue {
+    mutex queue_mutex;
+    condition_variable queue_condition;
+    deque<optional<Sendable<DynamicRC>>> queue;
 
-#if RC_VALIDATION
-int main() {
-    //L74 - L75で作成したオブジェクトのカウントをリセット
-    global_object_count.store(0, memory_order_relaxed);
+    void push(optional<Sendable<DynamicRC>> tree) {
+        {
+            lock_guard<mutex> guard(this->queue_mutex);
+            this->queue.push_back(move(tree));
+        }
+        this->queue_condition.notify_one();
+    }
 
-    //木構造オブジェクトの作成と削除(手動)
-    { create_tree<ManualObject>(0, 25).detele_object(); }
+    optional<Sendable<DynamicRC>> pop() {
+        unique_lock<mutex> lock(this->queue_mutex);
+        this->queue_condition.wait(lock, [&]() { return !this->queue.empty(); });
+        auto tree = move(this->queue.front());
+        this->queue.pop_front();
+        return tree;
+    }
+};
 
-    //木構造オブジェクトの作成と削除(シングルスレッド専用参照カウント)
-    { create_tree<SingleThreadRC>(0, 25); }
+/**
+ * PIPELINE_STAGE_COUNT 個のスレッドを spawn で起動し、最初のスレッドが作成した木構造オブジェクトを順に渡していくベンチマーク用関数
+ * 各スレッドは受け取った木構造オブジェクトを全て辿ってから次のスレッドへ渡し、最後のスレッドが解放する
+ * state.range(0) が 0 の場合は渡す前に to_mutex() し、1 の場合は send() でローカルのまま渡す
+ * メモリ管理方法 : 動的切り替え参照カウント
+ */
+static void benchmark_pipeline(benchmark::State& state) {
+    bool is_send = state.range(0) == 1;
 
-    //木構造オブジェクトの作成と削除(スレッドセーフな参照カウント)
-    { create_tree<ThreadSafeRC>(0, 25); }
+    for (auto _ : state) {
+        array<PipelineQueue, PIPELINE_STAGE_COUNT - 1> queues;
 
-    //木構造オブジェクトの作成と削除(動的切り替え参照カウント)
-    { create_tree<DynamicRC>(0, 25); }
+        auto stage = [&](size_t stage_index) {
+            for (size_t i = 0; ; i++) {
+                optional<DynamicRC> tree;
+                if (stage_index == 0) {
+                    if (i == PIPELINE_TREE_COUNT) {
+                        break;
+                    }
+                    tree = create_payload_tree<DynamicRC>(0, PIPELINE_TREE_DEPTH);
+                } else {
+                    auto received = queues[stage_index - 1].pop();
+                    if (!received.has_value()) {
+                        break;
+                    }
+                    tree = move(received.value()).into_handle();
+                }
 
-    {//マルチスレッドで木構造オブジェクトを作成する(スレッドセーフな参照カウント)
-        auto func = []() {
-            for (size_t i = 0; i < 100; i++) {
-                //木構造オブジェクトを作成
-                auto tree = create_tree<ThreadSafeRC>(0, 10);
-                //グローバル変数へ渡す
-                global_variable_with_thread_safe_rc.set_object(0, tree);
+                benchmark::DoNotOptimize(sum_payload_tree(tree.value()));
+
+                if (stage_index + 1 < PIPELINE_STAGE_COUNT) {
+                    if (!is_send) {
+                        //他のスレッドへ渡すため、予め mutex としてマーク(send は何もしない)
+                        tree.value().to_mutex();
+                    }
+                    queues[stage_index].push(send(move(tree.value())));
+                }
+            }
+            if (stage_index + 1 < PIPELINE_STAGE_COUNT) {
+                queues[stage_index].push(nullopt);
             }
         };
+
         vector<thread> threads;
         //スレッド起動
-        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
-            threads.push_back(thread(func));
+        for (size_t i = 0; i < PIPELINE_STAGE_COUNT; i++) {
+            threads.push_back(spawn(stage, i));
         }
         //スレッド終了待機
         for (auto it = threads.begin(); it != threads.end(); ++it) {
             it->join();
         }
-        //グローバル変数へ挿入されているオブジェクトを削除
-        global_variable_with_thread_safe_rc.set_object(0, nullopt);
     }
 
-    {//マルチスレッドで木構造オブジェクトを作成する(動的切り替え参照カウント)
-        auto func = []() {
-            for (size_t i = 0; i < 100; i++) {
-                //木構造オブジェクトを作成
-                auto tree = create_tree<DynamicRC>(0, 10);
-                //グローバル変数へ渡す
-                global_variable_with_dynamic_rc.set_object(0, tree);
+    state.SetItemsProcessed(state.iterations() * PIPELINE_TREE_COUNT);
+}
+
+/**
+ * NUMBER_OF_THREADS / 2 個の生産者スレッドが作成した木構造オブジェクトを、Channel を経由して NUMBER_OF_THREADS / 2 個の消費者スレッドへ渡すベンチマーク用関数
+ * 消費者スレッドは受け取った木構造オブジェクトを全て辿ってから解放する
+ * state.range(0) が 0 の場合は送信する前に to_mutex() し、1 の場合は transfer_object でローカルのまま渡す(DynamicRC のみ)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_channel(benchmark::State& state) {
+    bool is_transfer = state.range(0) == 1;
+
+    for (auto _ : state) {
+        Channel<T> channel;
+        //まだ受信する消費者スレッドが決まっていない木構造オブジェクトの数
+        atomic<int64_t> remaining_count = (NUMBER_OF_THREADS / 2) * PRODUCER_CONSUMER_TREE_COUNT;
+
+        auto producer = [&]() {
+            for (size_t i = 0; i < PRODUCER_CONSUMER_TREE_COUNT; i++) {
+                auto tree = create_payload_tree<T>(0, PRODUCER_CONSUMER_TREE_DEPTH);
+                if constexpr (is_same_v<T, DynamicRC>) {
+                    if (!is_transfer) {
+                        //他のスレッドへ渡すため、予め mutex としてマーク
+                        tree.to_mutex();
+                    }
+                }
+                channel.send(move(tree));
+            }
+        };
+
+        auto consumer = [&]() {
+            //受信する権利を一つ得てから受信する
+            while (remaining_count.fetch_sub(1, memory_order_relaxed) > 0) {
+                auto tree = channel.receive();
+                benchmark::DoNotOptimize(sum_payload_tree(tree));
             }
         };
+
         vector<thread> threads;
         //スレッド起動
-        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
-            threads.push_back(thread(func));
+        for (size_t i = 0; i < NUMBER_OF_THREADS / 2; i++) {
+            threads.push_back(thread(producer));
+            threads.push_back(thread(consumer));
         }
         //スレッド終了待機
         for (auto it = threads.begin(); it != threads.end(); ++it) {
             it->join();
         }
-        //グローバル変数へ挿入されているオブジェクトを削除
-        global_variable_with_dynamic_rc.set_object(0, nullopt);
     }
+    rc_flush();
+    epoch_reclaim_all();
 
-    //現在生存しているオブジェクト数を表示(0以外は不正)
-    cout << "Global object count : " << global_object_count.load(memory_order_relaxed) << endl;
-
-    return 0;
+    state.SetItemsProcessed(state.iterations() * (NUMBER_OF_THREADS / 2) * PRODUCER_CONSUMER_TREE_COUNT);
 }
-#else
-//ベンチマークを走らせる
-//詳細は以下を参照
-//https://github.com/google/benchmark
-BENCHMARK_MAIN();
-#endif
-
-
 
 /**
- * 指定された型で木構造オブジェクトを作成
+ * 木構造オブジェクトの各オブジェクトの親への参照を表に持ち、葉から根まで親を辿り続けるベンチマーク用関数
+ * 親への参照を強参照で持つ(Parent が T)場合と、弱参照で持つ場合を比較する
+ * state.range(0) が 1 の場合は、木構造オブジェクトを複数のスレッドに公開してから辿る
+ * メモリ管理方法 : T (親への参照 : Parent)
  */
-template<typename T> T create_tree(size_t count, size_t tree_depth) {
-    auto* object_ref = alloc_heap_object(OBJECT_FIELD_LENGTH);
+template<typename T, typename Parent> static void benchmark_parent_pointer(benchmark::State& state) {
+    {
+        auto tree = create_tree<T>(0, PARENT_POINTER_TREE_DEPTH);
+        //複数のスレッドに公開する
+        if constexpr (!is_same_v<T, ThreadSafeRC>) {
+            if (state.range(0) != 0) {
+                tree.to_mutex();
+            }
+        }
 
-    T object(object_ref);
+        //幅優先で並べたオブジェクト(i 番目のオブジェクトの親は (i - 1) / 2 番目)
+        vector<T> nodes;
+        nodes.push_back(tree);
+        for (size_t i = 0; i < nodes.size(); i++) {
+            for (size_t field_index = 0; field_index < OBJECT_FIELD_LENGTH; field_index++) {
+                auto child = nodes[i].get_object(field_index);
+                if (child.has_value()) {
+                    nodes.push_back(move(child.value()));
+                }
+            }
+        }
 
-    if (count == tree_depth) {
-        return object;
-    }
+        //各オブジェクトの親への参照の表(根は自身を指す)
+        vector<Parent> parents;
+        for (size_t i = 0; i < nodes.size(); i++) {
+            parents.push_back(Parent(nodes[i == 0 ? 0 : (i - 1) / 2]));
+        }
+        //木構造オブジェクトは tree と(強参照の場合は)親への参照の表だけが所有する
+        nodes.clear();
 
-    for (size_t i = 0; i < OBJECT_FIELD_LENGTH; i++) {
-        auto child = create_tree<T>(count + 1, tree_depth);
-        object.set_object(i, child);
+        //葉の番号の範囲
+        size_t leaf_begin = parents.size() / 2;
+        size_t leaf = leaf_begin;
+
+        for (auto _ : state) {
+            for (size_t i = leaf; i != 0; i = (i - 1) / 2) {
+                if constexpr (is_same_v<T, Parent>) {
+                    T parent(parents[i]);
+                    benchmark::DoNotOptimize(parent);
+                } else {
+                    auto parent = parents[i].upgrade();
+                    benchmark::DoNotOptimize(parent);
+                }
+            }
+            //操作ごとに異なる葉から辿る
+            leaf = leaf + 1 < parents.size() ? leaf + 1 : leaf_begin;
+        }
     }
+    //オブジェクトの破棄を含めて反映する
+    rc_flush();
 
-    return object;
+    state.SetItemsProcessed(state.iterations() * PARENT_POINTER_TREE_DEPTH);
 }
 
+#if PARALLEL_TEARDOWN
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : 手動
+ * 複数のスレッドに公開した巨大な木構造オブジェクトへの最後の参照を手放し、
+ * 手放したスレッドが止まっていた時間(pause_ms)と、全て解放し終えるまでの時間を計測するベンチマーク用関数
+ * state.range(0) はワーカースレッドの数(0 の場合は手放したスレッドで全て解放する)
+ * メモリ管理方法 : 動的切り替え参照カウント
  */
-static void benchmark_single_thread_manual_object(benchmark::State& state) {
-    for (auto _ : state) {
-        create_tree<ManualObject>(0, 10).detele_object();
-    }
-}
+static void benchmark_parallel_teardown(benchmark::State& state) {
+    parallel_teardown_set_worker_count(state.range(0));
 
-/**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : シングススレッド専用参照カウント
- */
-static void benchmark_single_thread_single_thread_rc(benchmark::State& state) {
+    double pause_seconds = 0;
     for (auto _ : state) {
-        create_tree<SingleThreadRC>(0, 10);
+        //作成にかかる時間は計測しない
+        auto tree = create_tree<DynamicRC>(0, PARALLEL_TEARDOWN_TREE_DEPTH);
+        tree.to_mutex();
+
+        auto start = chrono::steady_clock::now();
+        //global_variable_with_dynamic_rc.set_object(0, nullopt) で取り除かれた場合と同じく release_retired_reference で解放される
+        { auto dropped = move(tree); }
+        auto released = chrono::steady_clock::now();
+        parallel_teardown_wait();
+        auto finished = chrono::steady_clock::now();
+
+        state.SetIterationTime(chrono::duration<double>(finished - start).count());
+        pause_seconds += chrono::duration<double>(released - start).count();
     }
+
+    state.counters["pause_ms"] = pause_seconds * 1000 / state.iterations();
+    state.SetItemsProcessed(state.iterations() * ((((size_t) 1) << (PARALLEL_TEARDOWN_TREE_DEPTH + 1)) - 1));
+    parallel_teardown_set_worker_count(PARALLEL_TEARDOWN_WORKER_COUNT);
 }
+#endif
 
+#if BACKGROUND_RECLAMATION
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : スレッドセーフな参照カウント
+ * 複数のスレッドに公開したオブジェクトのフィールドの木構造オブジェクトを set_object で入れ替え続け、
+ * 取り除いた木構造オブジェクトの解放が発生する set_object の呼び出し一回ごとの時間の分布(p50/p99/p999)を計測するベンチマーク用関数
+ * state.range(0) が 1 の場合は回収スレッドで解放し、0 の場合は呼び出したスレッドで解放する
+ * メモリ管理方法 : 動的切り替え参照カウント
  */
-static void benchmark_single_thread_thread_safe_rc(benchmark::State& state) {
-    for (auto _ : state) {
-        create_tree<ThreadSafeRC>(0, 10);
+static void benchmark_background_reclamation(benchmark::State& state) {
+    background_reclamation_set_enabled(state.range(0) != 0);
+
+    vector<double> latencies;
+    latencies.reserve(BACKGROUND_RECLAMATION_ITERATIONS);
+    {
+        DynamicRC holder(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+        holder.set_object(0, create_tree<DynamicRC>(0, BACKGROUND_RECLAMATION_TREE_DEPTH));
+
+        for (auto _ : state) {
+            //作成と mutex 化にかかる時間は計測しない
+            auto tree = create_tree<DynamicRC>(0, BACKGROUND_RECLAMATION_TREE_DEPTH);
+            tree.to_mutex();
+
+            auto start = chrono::steady_clock::now();
+            //既に挿入されていた木構造オブジェクトの参照カウントが0になる
+            holder.set_object(0, move(tree));
+            auto finished = chrono::steady_clock::now();
+
+            auto seconds = chrono::duration<double>(finished - start).count();
+            state.SetIterationTime(seconds);
+            latencies.push_back(seconds * 1000000);
+        }
     }
+    epoch_reclaim_all();
+    background_reclamation_wait();
+
+    sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) { return latencies[(size_t) (p * (latencies.size() - 1))]; };
+    state.counters["p50_us"] = percentile(0.5);
+    state.counters["p99_us"] = percentile(0.99);
+    state.counters["p999_us"] = percentile(0.999);
+    background_reclamation_set_enabled(true);
 }
+#endif
 
+#if PARALLEL_TO_MUTEX
 /**
- * シングルスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * 深さ state.range(0) の木構造オブジェクトを mutex なオブジェクトのフィールドへ set_object で挿入(公開)する時間を計測するベンチマーク用関数
+ * 挿入する木構造オブジェクト以下の全てのオブジェクトの is_mutex の伝搬を含む
+ * state.range(1) はワーカースレッドの数(0 の場合は挿入したスレッドで全て辿る)
  * メモリ管理方法 : 動的切り替え参照カウント
  */
-static void benchmark_single_thread_dynamic_rc(benchmark::State& state) {
-    for (auto _ : state) {
-        create_tree<DynamicRC>(0, 10);
+static void benchmark_parallel_to_mutex(benchmark::State& state) {
+    parallel_to_mutex_set_worker_count(state.range(1));
+    {
+        DynamicRC holder(alloc_heap_object(OBJECT_FIELD_LENGTH), true); //予め mutex としてマーク
+        auto tree = create_tree<DynamicRC>(0, state.range(0));
+
+        for (auto _ : state) {
+            holder.set_object(0, tree);
+
+            //取り除いて is_mutex を元に戻す時間は計測しない
+            state.PauseTiming();
+            holder.set_object(0, nullopt);
+            epoch_reclaim_all();
+            reset_mutex(tree.get_heap_object());
+            state.ResumeTiming();
+        }
     }
-}
+    epoch_reclaim_all();
 
+    state.SetItemsProcessed(state.iterations() * ((((size_t) 1) << (state.range(0) + 1)) - 1));
+    parallel_to_mutex_set_worker_count(PARALLEL_TO_MUTEX_WORKER_COUNT);
+}
+#endif
 
+#if LAZY_MUTEX_PROMOTION
 /**
- * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
- * メモリ管理方法 : スレッドセーフな参照カウント
+ * 巨大な木構造オブジェクトをグローバル変数へ挿入(公開)し、複数のスレッドが根に近い部分だけを読むベンチマーク用関数
+ * 公開にかかった時間(publish_ms)と、全てのスレッドが読み終えるまでの時間を計測する
+ * state.range(0) が 0 の場合は set_object でその場で is_mutex を伝搬させ、1 の場合は publish_object で遅延して伝搬させる
+ * メモリ管理方法 : 動的切り替え参照カウント
  */
-static void benchmark_multi_thread_thread_safe_rc(benchmark::State& state) {
-    for (auto _ : state) {
-        auto func = []() {
-            for (size_t i = 0; i < 5; i++) {
-                //木構造オブジェクトを作成
-                auto tree = create_tree<ThreadSafeRC>(0, 20);
-                //グローバル変数へ渡す
-                global_variable_with_thread_safe_rc.set_object(0, tree);
+static void benchmark_lazy_publish(benchmark::State& state) {
+    //根から LAZY_PUBLISH_READ_DEPTH 段だけを、操作ごとに異なる経路で辿る
+    auto func = []() {
+        for (size_t i = 0; i < LAZY_PUBLISH_READ_COUNT; i++) {
+            auto node = global_variable_with_dynamic_rc.get_object(0);
+            for (size_t depth = 0; depth < LAZY_PUBLISH_READ_DEPTH && node.has_value(); depth++) {
+                node = node.value().get_object((i >> depth) % OBJECT_FIELD_LENGTH);
             }
-        };
+            benchmark::DoNotOptimize(node);
+        }
+    };
+
+    double publish_seconds = 0;
+    for (auto _ : state) {
+        //作成にかかる時間は計測しない
+        auto tree = create_tree<DynamicRC>(0, LAZY_PUBLISH_TREE_DEPTH);
+
+        auto start = chrono::steady_clock::now();
+        if (state.range(0) == 0) {
+            global_variable_with_dynamic_rc.set_object(0, move(tree));
+        } else {
+            global_variable_with_dynamic_rc.publish_object(0, move(tree));
+        }
+        auto published = chrono::steady_clock::now();
 
         vector<thread> threads;
         //スレッド起動
         for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
             threads.push_back(thread(func));
         }
-
         //スレッド終了待機
         for (auto it = threads.begin(); it != threads.end(); ++it) {
             it->join();
         }
+        auto finished = chrono::steady_clock::now();
 
-        //グローバル変数へ挿入されているオブジェクトを削除
-        global_variable_with_thread_safe_rc.set_object(0, nullopt);
+        state.SetIterationTime(chrono::duration<double>(finished - start).count());
+        publish_seconds += chrono::duration<double>(published - start).count();
+
+        //解放にかかる時間は計測しない
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        epoch_reclaim_all();
     }
+
+    state.counters["publish_ms"] = publish_seconds * 1000 / state.iterations();
 }
+#endif
 
+#if MUTEX_DEMOTION
 /**
- * マルチスレッドで木構造オブジェクトを作成するベンチマーク用関数
+ * 木構造オブジェクトをグローバル変数へ挿入(公開)してから取り除き、その後作成したスレッドが根から辿って葉を書き換え続けるベンチマーク用関数
+ * state.range(0) が 1 の場合は取り除いた後に try_demote() で降格させ、0 の場合は is_mutex が true のまま書き換える
  * メモリ管理方法 : 動的切り替え参照カウント
  */
-static void benchmark_multi_thread_dynamic_rc(benchmark::State& state) {
-    for (auto _ : state) {
-        auto func = []() {
-            for (size_t i = 0; i < 5; i++) {
-                //木構造オブジェクトを作成
-                auto tree = create_tree<DynamicRC>(0, 20);
-                //グローバル変数へ渡す
-                //この時mutex化が起こる
-                //詳細については"dynamic_rc.hpp"を参照
-                global_variable_with_dynamic_rc.set_object(0, tree);
+static void benchmark_mutex_demotion(benchmark::State& state) {
+    {
+        auto tree = create_tree<DynamicRC>(0, MUTEX_DEMOTION_TREE_DEPTH);
+        //公開してから取り除く
+        global_variable_with_dynamic_rc.set_object(0, tree);
+        global_variable_with_dynamic_rc.set_object(0, nullopt);
+
+        if (state.range(0) == 1 && !tree.try_demote()) {
+            state.SkipWithError("try_demote() failed");
+        }
+
+        size_t operation_count = 0;
+        for (auto _ : state) {
+            //根から葉の一つ上のオブジェクトまで、操作ごとに異なる経路で辿る
+            auto node = tree;
+            for (size_t depth = 0; depth < MUTEX_DEMOTION_TREE_DEPTH - 1; depth++) {
+                node = node.get_object((operation_count >> depth) % OBJECT_FIELD_LENGTH).value();
             }
-        };
+            //葉を新しいオブジェクトに置き換える
+            node.set_object(operation_count % OBJECT_FIELD_LENGTH, DynamicRC(alloc_heap_object(OBJECT_FIELD_LENGTH)));
 
-        vector<thread> threads;
-        //スレッド起動
-        for (size_t i = 0; i < NUMBER_OF_THREADS; i++) {
-            threads.push_back(thread(func));
+            operation_count++;
         }
+    }
+    epoch_reclaim_all();
 
-        //スレッド終了待機
-        for (auto it = threads.begin(); it != threads.end(); ++it) {
-            it->join();
+    state.SetItemsProcessed(state.iterations());
+}
+#endif
+
+#if ARENA_ALLOCATION
+/**
+ * 木構造オブジェクトを作成して破棄し続けるベンチマーク用関数
+ * 破棄にかかった時間(teardown_ms)も計測する
+ * state.range(0) が 1 の場合は Arena のスコープ内で作成し、破棄した後にスコープを抜ける(0 の場合は malloc/free)
+ * メモリ管理方法 : T
+ */
+template<typename T> static void benchmark_arena(benchmark::State& state) {
+    bool is_arena = state.range(0) == 1;
+
+    double teardown_seconds = 0;
+    for (auto _ : state) {
+        optional<Arena> arena;
+        if (is_arena) {
+            arena.emplace();
         }
+        optional<T> tree = create_tree<T>(0, ARENA_TREE_DEPTH);
+        benchmark::DoNotOptimize(tree);
 
-        //グローバル変数へ挿入されているオブジェクトを削除
-        global_variable_with_dynamic_rc.set_object(0, nullopt);
+        auto start = chrono::steady_clock::now();
+        //スコープを抜ける前に破棄する
+        tree = nullopt;
+        arena = nullopt;
+        auto finished = chrono::steady_clock::now();
+
+        teardown_seconds += chrono::duration<double>(finished - start).count();
     }
-}
\ No newline at end of file
+
+    state.counters["teardown_ms"] = teardown_seconds * 1000 / state.iterations();
+    state.SetItemsProcessed(state.iterations() * ((((size_t) 1) << (ARENA_TREE_DEPTH + 1)) - 1));
+}
+#endif
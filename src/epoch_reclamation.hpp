@@ -0,0 +1,394 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include "heap_object.hpp"
+
+using namespace std;
+
+
+/**
+ * エポックベースの遅延デクリメント
+ *
+ * 複数のスレッドからアクセスされうるオブジェクト(is_mutex が true のオブジェクト)のフィールドの読み書きを、
+ * スピンロックを使わずに行うための仕組み。
+ *
+ * ロックを使わずにフィールドを読む場合に問題となるのは、
+ *  1. フィールドからオブジェクトへのポインタをロードする
+ *  2. ロードしたオブジェクトの参照カウントを一つ増やす
+ * の間に他のスレッドがフィールドを書き換え、古いオブジェクトの参照カウントを0にして解放してしまうことである。
+ * そこで、フィールドから取り除いたオブジェクトの参照カウントはすぐには減らさず、
+ * その時点で 1. と 2. の間にいる可能性のある全てのスレッドがそこから抜けるまで減らすのを遅らせる。
+ * こうすると、1. でロードしたオブジェクトの参照カウントは 2. の時点で少なくとも1(フィールドが持っていた分)残っているため、
+ * 単純な atomic な加算だけで安全に参照カウントを増やすことができる。
+ *
+ * 1. と 2. の間(クリティカルセクション)にいるスレッドの判定には、エポックベースの手法を用いる。
+ *  + グローバルなエポック(epoch_global_counter)を用意し、各スレッドはクリティカルセクションに入る際に
+ *    その時点のエポックを自身の EpochRecord に書き込み(アナウンス)、抜ける際に消す
+ *  + フィールドから取り除いたオブジェクトは、取り除いた時点のエポックと共にスレッドローカルなリスト(リンボ)へ入れる
+ *  + クリティカルセクションにいる全てのスレッドが現在のエポックをアナウンスしていれば、エポックを一つ進められる
+ *  + エポック e で取り除いたオブジェクトは、エポックが e + 2 以上になれば、取り除く前にロードした可能性のある
+ *    全てのスレッドがクリティカルセクションを抜けていることが保証されるため、参照カウントを減らしても良い
+ * クリティカルセクションに入るスレッドはスレッドごとの EpochRecord に書き込むだけなので、
+ * 同じオブジェクトのフィールドを多数のスレッドが同時に読んでもロックのように互いを待たせることはない。
+ *
+ * 参考
+ *  + Keir Fraser, "Practical lock-freedom" (2004)
+ *  + Hart et al., "Performance of memory reclamation for lockless synchronization" (2007)
+ */
+
+
+//エポックを進めるのに必要な、オブジェクトを取り除いた時点からのエポックの差
+#define EPOCH_GRACE_PERIOD 2
+
+//スレッドローカルなリンボの数(EPOCH_GRACE_PERIOD + 1 個あれば、まだ減らせないものと減らせるものを分けられる)
+#define EPOCH_LIMBO_COUNT (EPOCH_GRACE_PERIOD + 1)
+
+
+/**
+ * スレッドごとのクリティカルセクションの状態
+ * 他のスレッドからエポックを進める際に走査される
+ *
+ * スレッドの終了後も走査され続けるため破棄せず、新しく起動したスレッドが再利用する。
+ */
+struct alignas(64) EpochRecord {
+    //クリティカルセクションにいる場合は (エポック << 1) | 1、そうでなければ0
+    atomic_size_t announced_epoch = 0;
+    //いずれかのスレッドが使用しているかどうか
+    atomic_bool is_in_use = true;
+    //全ての EpochRecord のリスト(一度追加されたら変更されない)
+    EpochRecord* next_record = nullptr;
+};
+
+
+/**
+ * 参照カウントを減らすのを遅らせているオブジェクト
+ */
+struct RetiredReference {
+    HeapObject* object;
+    //参照カウントを一つ減らす関数(ハンドルの種類ごとに異なる)
+    void (*release)(HeapObject*);
+};
+
+
+/**
+ * 同じエポックにフィールドから取り除かれたオブジェクトのリスト
+ */
+struct EpochLimbo {
+    size_t epoch = 0;
+    vector<RetiredReference> references;
+};
+
+
+/**
+ * グローバルなエポック
+ */
+inline atomic_size_t epoch_global_counter = 0;
+
+/**
+ * 全ての EpochRecord のリスト
+ */
+inline atomic<EpochRecord*> epoch_records = nullptr;
+
+/**
+ * このスレッドの EpochRecord
+ * 定数初期化されるため、アクセスの度に初期化済みかどうかの確認は行われない
+ */
+inline thread_local EpochRecord* epoch_thread_record = nullptr;
+
+
+/**
+ * 終了したスレッドから引き継いだ、まだ参照カウントを減らせないオブジェクトのリンボ
+ * スレッドの終了時に他のスレッドがクリティカルセクションを抜けるのを待つと、
+ * そのスレッドの終了を待っているスレッドがクリティカルセクションにいる場合に終わらなくなるため、待たずに引き継ぐ
+ */
+inline mutex epoch_orphan_mutex;
+inline vector<EpochLimbo> epoch_orphan_limbos;
+inline atomic_bool epoch_has_orphans = false;
+
+
+/**
+ * リンボ内の全てのオブジェクトの参照カウントを一つ減らす
+ */
+inline void epoch_release_limbo(EpochLimbo& limbo) {
+    for (auto& reference : limbo.references) {
+        reference.release(reference.object);
+    }
+    limbo.references.clear();
+}
+
+/**
+ * クリティカルセクションにいる全てのスレッドが現在のエポックをアナウンスしていれば、エポックを一つ進める
+ * エポックが進んだ(他のスレッドが進めた場合を含む)場合は true を返す
+ */
+inline bool epoch_try_advance() {
+    auto epoch = epoch_global_counter.load(memory_order_seq_cst);
+
+    for (auto* record = epoch_records.load(memory_order_acquire); record != nullptr; record = record->next_record) {
+        auto announced_epoch = record->announced_epoch.load(memory_order_seq_cst);
+        if (announced_epoch != 0 && (announced_epoch >> 1) != epoch) {
+            //古いエポックのままクリティカルセクションにいるスレッドがある
+            return false;
+        }
+    }
+
+    //失敗した場合は他のスレッドが既に進めている
+    epoch_global_counter.compare_exchange_strong(epoch, epoch + 1, memory_order_seq_cst);
+    return true;
+}
+
+
+/**
+ * クリティカルセクションにいるスレッドが一つもなければ true を返す
+ * フィールドを atomic に入れ替えた後で true を返した場合、入れ替える前の値をロードしたまま参照カウントを増やしていないスレッドはない
+ * (クリティカルセクションに入る側のアナウンス後のフェンスと、ここでのフェンスにより、
+ *  どちらかが必ずもう一方の書き込みを観測する)
+ * 呼び出し元はクリティカルセクションにいてはならない
+ */
+inline bool epoch_is_quiescent() {
+    atomic_thread_fence(memory_order_seq_cst);
+    for (auto* record = epoch_records.load(memory_order_acquire); record != nullptr; record = record->next_record) {
+        if (record->announced_epoch.load(memory_order_seq_cst) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * 終了したスレッドから引き継いだリンボのうち、エポックが EPOCH_GRACE_PERIOD 以上進んだものの参照カウントを減らす
+ */
+inline void epoch_collect_orphans() {
+    if (!epoch_has_orphans.load(memory_order_relaxed)) {
+        return;
+    }
+
+    vector<EpochLimbo> ready_limbos;
+    {
+        lock_guard<mutex> guard(epoch_orphan_mutex);
+        auto epoch = epoch_global_counter.load(memory_order_seq_cst);
+
+        for (size_t i = 0; i < epoch_orphan_limbos.size();) {
+            if (epoch_orphan_limbos[i].epoch + EPOCH_GRACE_PERIOD <= epoch) {
+                ready_limbos.push_back(move(epoch_orphan_limbos[i]));
+                epoch_orphan_limbos[i] = move(epoch_orphan_limbos.back());
+                epoch_orphan_limbos.pop_back();
+            } else {
+                i++;
+            }
+        }
+        epoch_has_orphans.store(!epoch_orphan_limbos.empty(), memory_order_relaxed);
+    }
+
+    //参照カウントを減らす処理から再びリンボへ入れられることがあるため、ロックの外で行う
+    for (auto& limbo : ready_limbos) {
+        epoch_release_limbo(limbo);
+    }
+}
+
+
+/**
+ * スレッドごとのリンボ
+ * スレッドの終了時には、まだ参照カウントを減らせないオブジェクトを他のスレッドへ引き継いでから EpochRecord を手放す
+ */
+struct EpochThreadState {
+    EpochLimbo limbo[EPOCH_LIMBO_COUNT];
+
+    /**
+     * エポックが EPOCH_GRACE_PERIOD 以上進んだリンボ内のオブジェクトの参照カウントを減らす
+     */
+    inline void collect() {
+        auto epoch = epoch_global_counter.load(memory_order_seq_cst);
+
+        for (auto& limbo : this->limbo) {
+            if (!limbo.references.empty() && limbo.epoch + EPOCH_GRACE_PERIOD <= epoch) {
+                epoch_release_limbo(limbo);
+            }
+        }
+
+        epoch_collect_orphans();
+    }
+
+    /**
+     * 全てのリンボのオブジェクトの参照カウントを減らせるようになるまでエポックを進め、全て減らす
+     */
+    inline void collect_all() {
+        for (auto& limbo : this->limbo) {
+            if (limbo.references.empty()) {
+                continue;
+            }
+
+            //クリティカルセクションは短いため、他のスレッドが抜けるまで待つ
+            while (limbo.epoch + EPOCH_GRACE_PERIOD > epoch_global_counter.load(memory_order_seq_cst)) {
+                if (!epoch_try_advance()) {
+                    this_thread::yield();
+                }
+            }
+            epoch_release_limbo(limbo);
+        }
+
+        //終了したスレッドから引き継いだリンボも同様に待ってから減らす
+        while (epoch_has_orphans.load(memory_order_relaxed)) {
+            if (!epoch_try_advance()) {
+                this_thread::yield();
+            }
+            epoch_collect_orphans();
+        }
+    }
+
+    inline ~EpochThreadState() {
+        this->collect();
+
+        //まだ減らせないものは引き継ぐ
+        {
+            lock_guard<mutex> guard(epoch_orphan_mutex);
+            for (auto& limbo : this->limbo) {
+                if (!limbo.references.empty()) {
+                    epoch_orphan_limbos.push_back(move(limbo));
+                }
+            }
+            epoch_has_orphans.store(!epoch_orphan_limbos.empty(), memory_order_relaxed);
+        }
+
+        auto* record = epoch_thread_record;
+        if (record != nullptr) {
+            //EpochRecord を再利用できるようにする
+            epoch_thread_record = nullptr;
+            record->is_in_use.store(false, memory_order_release);
+        }
+    }
+};
+
+/**
+ * このスレッドのリンボを取得
+ */
+inline EpochThreadState& epoch_thread_state() {
+    static thread_local EpochThreadState state;
+    return state;
+}
+
+
+/**
+ * 使用されていない EpochRecord を取得する
+ * 終了したスレッドの EpochRecord があれば再利用し、なければ新しく作成する
+ * 使い終わったら is_in_use を false にして手放す
+ */
+inline EpochRecord* epoch_acquire_record() {
+    for (auto* record = epoch_records.load(memory_order_acquire); record != nullptr; record = record->next_record) {
+        bool is_in_use = false;
+        if (!record->is_in_use.load(memory_order_relaxed) && record->is_in_use.compare_exchange_strong(is_in_use, true, memory_order_acquire)) {
+            return record;
+        }
+    }
+
+    auto* record = new EpochRecord();
+    auto* head = epoch_records.load(memory_order_relaxed);
+    do {
+        record->next_record = head;
+    } while (!epoch_records.compare_exchange_weak(head, record, memory_order_release, memory_order_relaxed));
+
+    return record;
+}
+
+/**
+ * このスレッドの EpochRecord を設定する
+ */
+inline EpochRecord* epoch_register_thread() {
+    //スレッドの終了時に EpochRecord を手放すように、リンボを構築しておく
+    epoch_thread_state();
+
+    auto* record = epoch_acquire_record();
+    epoch_thread_record = record;
+    return record;
+}
+
+
+/**
+ * record を使用してクリティカルセクションに入る
+ */
+inline void epoch_enter_with(EpochRecord* record) {
+    //現在のエポックをアナウンスする
+    //古いエポックを読んだとしてもエポックを進めにくくなるだけで安全である
+    record->announced_epoch.store((epoch_global_counter.load(memory_order_relaxed) << 1) | 1, memory_order_relaxed);
+    //アナウンスがこの後のフィールドのロードより前に他のスレッドから見えるようにする
+    //この fence は mutex なオブジェクトの get_object の度に必要となる。1コアの x86 で benchmark_read_heavy(スレッド数1)を計測すると、
+    //fence を除いた場合(安全ではない)より処理量が約2割少ないが、以前のスピンロックによる実装とは計測の揺らぎ以上の差はない
+    //(ロックの atomic-read-modify-write も同じく完全なバリアであるため)。
+    //アナウンスを seq_cst の exchange で行っても速くならず、その後の acquire load との順序も C++ のメモリモデル上は保証されないため、fence を用いる。
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/**
+ * クリティカルセクションに入る
+ * 返した EpochRecord を epoch_exit に渡して抜ける
+ */
+inline EpochRecord* epoch_enter() {
+    auto* record = epoch_thread_record;
+    if (record == nullptr) {
+        record = epoch_register_thread();
+    }
+
+    epoch_enter_with(record);
+    return record;
+}
+
+/**
+ * クリティカルセクションから抜ける
+ */
+inline void epoch_exit(EpochRecord* record) {
+    record->announced_epoch.store(0, memory_order_release);
+}
+
+
+/**
+ * オブジェクトを現在のエポックのリンボへ入れる
+ * 参照カウントを減らすのは epoch_advance_and_collect 等でエポックが進んだ後である
+ */
+inline void epoch_push_retired(HeapObject* object, void (*release)(HeapObject*)) {
+    auto& state = epoch_thread_state();
+
+    auto epoch = epoch_global_counter.load(memory_order_seq_cst);
+    auto& limbo = state.limbo[epoch % EPOCH_LIMBO_COUNT];
+    if (limbo.epoch != epoch) {
+        //同じリンボに入っているのは EPOCH_LIMBO_COUNT 以上前のエポックのものなので、既に減らしても良い
+        epoch_release_limbo(limbo);
+        limbo.epoch = epoch;
+    }
+    limbo.references.push_back({ object, release });
+}
+
+/**
+ * エポックを進められるだけ(最大 EPOCH_GRACE_PERIOD 回)進め、減らせるようになったリンボ内のオブジェクトの参照カウントを減らす
+ */
+inline void epoch_advance_and_collect() {
+    //クリティカルセクションにいるスレッドがなければエポックは EPOCH_GRACE_PERIOD 回進み、
+    //取り除いたオブジェクトはこの場ですぐに解放される
+    for (size_t i = 0; i < EPOCH_GRACE_PERIOD; i++) {
+        if (!epoch_try_advance()) {
+            break;
+        }
+    }
+    epoch_thread_state().collect();
+}
+
+/**
+ * フィールドから取り除いたオブジェクトの参照カウントを、クリティカルセクションにいる全てのスレッドが抜けた後で一つ減らす
+ * 呼び出し元はクリティカルセクションにいてはならない
+ */
+inline void epoch_retire(HeapObject* object, void (*release)(HeapObject*)) {
+    epoch_push_retired(object, release);
+    epoch_advance_and_collect();
+}
+
+
+/**
+ * このスレッドが参照カウントを減らすのを遅らせている全てのオブジェクトの参照カウントを減らす
+ * 全てのスレッドを終了させた後に、残っているオブジェクトを解放するために使用する
+ */
+inline void epoch_reclaim_all() {
+    epoch_thread_state().collect_all();
+}
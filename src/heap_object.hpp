@@ -1,9 +1,16 @@
 #pragma once
 
 #include <cstddef>
+#include <cstdint>
 #include <atomic>
 #include <optional>
 #include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <thread>
+#include <utility>
+#include "slab_allocator.hpp"
+#include "arena_allocator.hpp"
 
 using namespace std;
 
@@ -13,45 +20,820 @@ using namespace std;
 #endif
 
 
+#if COMPACT_HEAP_OBJECT_HEADER
+    //コンパクトなヘッダにおける、参照カウントに使用するビット
+    //参照カウントは 2^32 - 1 (弱参照を使用する場合は HEAP_OBJECT_DEAD_BIT 未満)までしか数えられない
+    //増やす処理はヘッダ全体への加算であるため、超えた分はペイロードの大きさとフィールドの長さのビットへ繰り上がりレイアウトを壊す
+    //RC_VALIDATION が true の場合は、増やす度に確かめて異常終了する
+    #define HEAP_OBJECT_REFERENCE_COUNT_MASK ((((size_t) 1) << 32) - 1)
+    #if WEAK_REFERENCE
+        #define HEAP_OBJECT_MAX_REFERENCE_COUNT (HEAP_OBJECT_DEAD_BIT - 1)
+    #else
+        #define HEAP_OBJECT_MAX_REFERENCE_COUNT HEAP_OBJECT_REFERENCE_COUNT_MASK
+    #endif
+    //コンパクトなヘッダにおける、ペイロードの大きさの開始ビット位置
+    #define HEAP_OBJECT_PAYLOAD_SIZE_SHIFT 32
+    #if ARENA_ALLOCATION
+        //アリーナから確保したオブジェクトであることを表すビットを空けるため、ペイロードの大きさは15ビットに収める
+        #define HEAP_OBJECT_MAX_PAYLOAD_SIZE ((((size_t) 1) << 15) - 1)
+        //コンパクトなヘッダにおける、アリーナ(arena_allocator.hpp)から確保したオブジェクトであることを表すビット
+        #define HEAP_OBJECT_ARENA_BIT (((size_t) 1) << 47)
+    #else
+        //コンパクトなヘッダに格納できるペイロードの大きさの最大値
+        #define HEAP_OBJECT_MAX_PAYLOAD_SIZE ((((size_t) 1) << 16) - 1)
+    #endif
+    //コンパクトなヘッダにおける、フィールドの長さの開始ビット位置
+    #define HEAP_OBJECT_FIELD_LENGTH_SHIFT 48
+    #if CYCLE_COLLECTION
+        //循環参照の回収(cycle_collector.hpp)で使用する状態に3ビットを空けるため、フィールドの長さは10ビットに収める
+        #define HEAP_OBJECT_MAX_FIELD_LENGTH ((((size_t) 1) << 10) - 1)
+        //コンパクトなヘッダにおける、循環参照の回収で使用する状態の開始ビット位置
+        #define HEAP_OBJECT_CYCLE_STATE_SHIFT 58
+        //コンパクトなヘッダにおける、循環参照の回収で使用する状態のマスク(シフト後)
+        #define HEAP_OBJECT_CYCLE_STATE_MASK ((size_t) 7)
+    #else
+        //コンパクトなヘッダに格納できるフィールドの長さの最大値
+        #define HEAP_OBJECT_MAX_FIELD_LENGTH ((((size_t) 1) << 13) - 1)
+    #endif
+    //コンパクトなヘッダにおける、スピンロックの解放を待機しているスレッドがあることを表すビット
+    #define HEAP_OBJECT_WAITER_BIT (((size_t) 1) << 61)
+    //コンパクトなヘッダにおける、スピンロックに使用するビット
+    #define HEAP_OBJECT_LOCK_BIT (((size_t) 1) << 62)
+    //コンパクトなヘッダにおける、is_mutex を表すビット
+    #define HEAP_OBJECT_MUTEX_BIT (((size_t) 1) << 63)
+#endif
+
+#if WEAK_REFERENCE
+    //参照カウントが0になったオブジェクトであることを表すビット
+    //解放中のオブジェクトの参照カウントの領域は作業用に使用されるため、弱参照の upgrade() が0以外の値を読んでも失敗するようにする
+    #if COMPACT_HEAP_OBJECT_HEADER
+        #define HEAP_OBJECT_DEAD_BIT (((size_t) 1) << 31)
+    #else
+        #define HEAP_OBJECT_DEAD_BIT (((size_t) 1) << 63)
+    #endif
+#else
+    //弱参照を使用しない場合は、参照カウントが0になったオブジェクトを参照する手段は無いため印を付けない
+    #define HEAP_OBJECT_DEAD_BIT ((size_t) 0)
+#endif
+
+
+/**
+ * オブジェクトのレイアウト
+ *
+ * オブジェクトはヘッダ(HeapObject)に続けて、field_length 個の HeapObject* のフィールドと、
+ * payload_size バイトのペイロードを持つ。
+ *
+ *   | HeapObject | HeapObject* x field_length | payload_size バイト |
+ *
+ * ペイロードには整数や浮動小数点数などのポインタでない値をそのまま格納する。
+ * 参照カウントの増減や to_mutex() はフィールドだけを辿り、ペイロードは辿らない。
+ * これにより、スカラー値を一つずつ参照カウントを持つオブジェクトに包む(ボックス化する)必要がなくなる。
+ */
+struct ObjectLayout {
+    //HeapObject* のフィールドの数
+    size_t field_length;
+    //ポインタでない値を格納する領域の大きさ(バイト)
+    size_t payload_size;
+};
+
+
+//スピンロックの取得に失敗した後、一回の待機で pause 命令を実行する回数の上限
+//待機する度に1から倍々に増やしていく(指数バックオフ)
+#define SPIN_LOCK_MAX_BACKOFF 64
+
+//スピンロックの取得を pause 命令で待機する回数
+//これを超えた場合は this_thread::yield() で他のスレッドに実行を譲る
+#define SPIN_LOCK_SPIN_LIMIT 16
+
+//スピンロックの取得を this_thread::yield() で待機する回数
+//これを超えた場合は atomic::wait で解放されるまで眠る
+#define SPIN_LOCK_YIELD_LIMIT 4
+
+
+/**
+ * スピンロックの待機中であることを CPU へ伝える
+ * 同じ物理コアの他のハードウェアスレッドへ実行資源を譲り、ループを抜ける際のパイプラインのフラッシュを避ける
+ */
+inline void spin_lock_pause() {
+    #if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+    #elif defined(__aarch64__)
+        asm volatile("yield");
+    #endif
+}
+
+
+#if PARALLEL_TO_MUTEX
+//to_mutex() でその場で辿るオブジェクト数の上限
+//これを超えた場合は残りをワーカースレッドと並列に辿る("parallel_mark.hpp"を参照)
+#define PARALLEL_TO_MUTEX_INLINE_BUDGET 4096
+
+class HeapObject;
+inline void parallel_to_mutex_remaining(const vector<HeapObject*>& objects);
+inline size_t parallel_to_mutex_get_worker_count();
+#endif
+
+
 /**
  * オブジェクトのヘッダ部分
+ *
+ * COMPACT_HEAP_OBJECT_HEADER が true の場合は、以下を一つの8バイトのワードに詰めて格納する。
+ *  + 0 ~ 31 bit  : 参照カウント
+ *  + 32 ~ 47 bit : ペイロードの大きさ(最大 HEAP_OBJECT_MAX_PAYLOAD_SIZE)
+ *                  ARENA_ALLOCATION が true の場合は 32 ~ 46 bit で、47 bit はアリーナから確保したオブジェクトであるかどうか
+ *  + 48 ~ 60 bit : フィールドの長さ(最大 HEAP_OBJECT_MAX_FIELD_LENGTH)
+ *                  CYCLE_COLLECTION が true の場合は 48 ~ 57 bit で、58 ~ 60 bit は循環参照の回収で使用する状態
+ *  + 61 bit      : スピンロックの解放を待機しているスレッドがあるかどうか
+ *  + 62 bit      : スピンロックのフラグ
+ *  + 63 bit      : is_mutex
+ * 参照カウントは下位ビットにあるため、ワード全体への加算、減算がそのまま参照カウントの増減になる。
+ * スピンロックのフラグは参照カウントの増減と同じワードを atomic-read-modify-write で書き換えるため互いに壊し合うことはないが、
+ * is_mutex の読み込みも atomic な load(relaxed) で行う必要がある。
+ *
+ * WEAK_REFERENCE が true の場合は、どちらのレイアウトでもヘッダの後ろに弱参照の数(8バイト)を追加する。
+ *
+ * ヘッダの各値へは、どちらのレイアウトでも以下のメンバ関数を通してアクセスする。
  */
 class HeapObject{
 
+#if COMPACT_HEAP_OBJECT_HEADER
+
+private:
+    //参照カウント、ペイロードの大きさ、フィールドの長さ、スピンロックのフラグ、is_mutex
+    size_t header_word;
+
+    inline atomic_size_t* atomic_header_word() {
+        return (atomic_size_t*) &this->header_word;
+    }
+
+    //スピンロックに使用するワードとビット
+    static constexpr size_t spin_lock_bit = HEAP_OBJECT_LOCK_BIT;
+    static constexpr size_t spin_waiter_bit = HEAP_OBJECT_WAITER_BIT;
+
+    inline atomic_size_t* spin_lock_word() {
+        return this->atomic_header_word();
+    }
+
 public:
+    inline void init_header(ObjectLayout layout) {
+        this->header_word = (layout.field_length << HEAP_OBJECT_FIELD_LENGTH_SHIFT) | (layout.payload_size << HEAP_OBJECT_PAYLOAD_SIZE_SHIFT) | 1;
+#if WEAK_REFERENCE
+        this->weak_count = 1;
+#endif
+    }
+
+    inline size_t get_reference_count() {
+        return this->header_word & HEAP_OBJECT_REFERENCE_COUNT_MASK;
+    }
+
+    inline void set_reference_count(size_t reference_count) {
+        this->header_word = (this->header_word & ~HEAP_OBJECT_REFERENCE_COUNT_MASK) | reference_count;
+    }
+
+    inline size_t get_field_length() {
+        return (this->header_word >> HEAP_OBJECT_FIELD_LENGTH_SHIFT) & HEAP_OBJECT_MAX_FIELD_LENGTH;
+    }
+
+    inline size_t get_payload_size() {
+        return (this->header_word >> HEAP_OBJECT_PAYLOAD_SIZE_SHIFT) & HEAP_OBJECT_MAX_PAYLOAD_SIZE;
+    }
+
+#if ARENA_ALLOCATION
+    /**
+     * アリーナ(arena_allocator.hpp)から確保したオブジェクトであるかどうか
+     */
+    inline bool get_is_arena() {
+        return (this->header_word & HEAP_OBJECT_ARENA_BIT) != 0;
+    }
+
+    /**
+     * アリーナから確保したオブジェクトとしてマークする(確保時にのみ使用する)
+     */
+    inline void set_is_arena() {
+        this->header_word |= HEAP_OBJECT_ARENA_BIT;
+    }
+#endif
+
+    inline bool get_is_mutex() {
+        return (this->atomic_header_word()->load(memory_order_relaxed) & HEAP_OBJECT_MUTEX_BIT) != 0;
+    }
+
+    inline void set_is_mutex(bool is_mutex) {
+        if (is_mutex) {
+            this->header_word |= HEAP_OBJECT_MUTEX_BIT;
+        } else {
+            this->header_word &= ~HEAP_OBJECT_MUTEX_BIT;
+        }
+    }
+
+    /**
+     * is_mutex を atomic に true にし、false から true にした場合に true を返す
+     * 複数のスレッドが同時に is_mutex を伝搬させる場合に使用する("parallel_mark.hpp"を参照)
+     */
+    inline bool try_set_is_mutex() {
+        return (this->atomic_header_word()->fetch_or(HEAP_OBJECT_MUTEX_BIT, memory_order_relaxed) & HEAP_OBJECT_MUTEX_BIT) == 0;
+    }
+
+#if CYCLE_COLLECTION
+    /**
+     * 循環参照の回収で使用する状態を読み込む("cycle_collector.hpp"を参照)
+     */
+    inline uint8_t load_cycle_state(memory_order order = memory_order_seq_cst) {
+        return (uint8_t) ((this->atomic_header_word()->load(order) >> HEAP_OBJECT_CYCLE_STATE_SHIFT) & HEAP_OBJECT_CYCLE_STATE_MASK);
+    }
+
+    /**
+     * 通常の命令で循環参照の回収で使用する状態を書き込む
+     * is_mutex が false のオブジェクトにのみ使用できる
+     */
+    inline void store_cycle_state(uint8_t state) {
+        this->header_word = (this->header_word & ~(HEAP_OBJECT_CYCLE_STATE_MASK << HEAP_OBJECT_CYCLE_STATE_SHIFT))
+            | ((size_t) state << HEAP_OBJECT_CYCLE_STATE_SHIFT);
+    }
+
+    /**
+     * 循環参照の回収で使用する状態が expected であれば desired に書き換える
+     * 参照カウントと同じワードにあるため、参照カウントの増減で失敗した場合は状態を確認してやり直す
+     */
+    inline bool compare_exchange_cycle_state(uint8_t& expected, uint8_t desired) {
+        auto word = this->atomic_header_word()->load(memory_order_seq_cst);
+        while (true) {
+            auto state = (uint8_t) ((word >> HEAP_OBJECT_CYCLE_STATE_SHIFT) & HEAP_OBJECT_CYCLE_STATE_MASK);
+            if (state != expected) {
+                expected = state;
+                return false;
+            }
+
+            auto desired_word = (word & ~(HEAP_OBJECT_CYCLE_STATE_MASK << HEAP_OBJECT_CYCLE_STATE_SHIFT))
+                | ((size_t) desired << HEAP_OBJECT_CYCLE_STATE_SHIFT);
+            if (this->atomic_header_word()->compare_exchange_weak(word, desired_word, memory_order_seq_cst)) {
+                return true;
+            }
+        }
+    }
+#endif
+
+#if RC_VALIDATION
+    /**
+     * 増やす前のヘッダ header_word の参照カウントに count を足すと桁あふれするのであれば異常終了する
+     */
+    static inline void check_reference_count_overflow(size_t header_word, size_t count) {
+        if ((header_word & HEAP_OBJECT_REFERENCE_COUNT_MASK) + count > HEAP_OBJECT_MAX_REFERENCE_COUNT) {
+            abort();
+        }
+    }
+#endif
+
+    /**
+     * 通常の命令で参照カウントを一つ増やす
+     */
+    inline void increment_reference_count() {
+#if RC_VALIDATION
+        check_reference_count_overflow(this->header_word, 1);
+#endif
+        this->header_word++;
+    }
+
+    /**
+     * 通常の命令で参照カウントを一つ減らし、減らす前の参照カウントを返す
+     */
+    inline size_t decrement_reference_count() {
+        return (this->header_word--) & HEAP_OBJECT_REFERENCE_COUNT_MASK;
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ増やす
+     */
+    inline void atomic_increment_reference_count(memory_order order = memory_order_relaxed) {
+#if RC_VALIDATION
+        check_reference_count_overflow(this->atomic_header_word()->fetch_add(1, order), 1);
+#else
+        this->atomic_header_word()->fetch_add(1, order);
+#endif
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを count 増やす
+     */
+    inline void atomic_add_reference_count(size_t count, memory_order order = memory_order_relaxed) {
+#if RC_VALIDATION
+        check_reference_count_overflow(this->atomic_header_word()->fetch_add(count, order), count);
+#else
+        this->atomic_header_word()->fetch_add(count, order);
+#endif
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ減らし、減らす前の参照カウントを返す
+     */
+    inline size_t atomic_decrement_reference_count() {
+        return this->atomic_header_word()->fetch_sub(1, memory_order_release) & HEAP_OBJECT_REFERENCE_COUNT_MASK;
+    }
+
+    /**
+     * 参照カウントを atomic に読み込む
+     */
+    inline size_t atomic_load_reference_count(memory_order order = memory_order_seq_cst) {
+        return this->atomic_header_word()->load(order) & HEAP_OBJECT_REFERENCE_COUNT_MASK;
+    }
+
+#if WEAK_REFERENCE
+    /**
+     * 参照カウントが0になっていなければ compare-and-swap で一つ増やし、増やせた場合は true を返す
+     * 弱参照の upgrade() で使用する
+     */
+    inline bool atomic_increment_reference_count_if_alive() {
+        auto word = this->atomic_header_word()->load(memory_order_relaxed);
+        while (is_alive_reference_count(word & HEAP_OBJECT_REFERENCE_COUNT_MASK)) {
+            if (this->atomic_header_word()->compare_exchange_weak(word, word + 1, memory_order_acquire, memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+#else
+
+private:
     //参照カウント
     size_t reference_count;
     //フィールドの長さ
-    size_t field_length;
+    uint32_t field_length;
+    //ペイロードの大きさ(バイト)
+    //フィールドの長さと合わせて8バイトに収まるため、ヘッダの大きさは変わらない
+    //ARENA_ALLOCATION が true の場合、最上位ビットはアリーナから確保したオブジェクトであるかどうか
+    uint32_t payload_size;
     //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
     //詳細は"dynamic_rc_hpp"を参照
     bool is_mutex;
+    //循環参照の回収(CYCLE_COLLECTION)で使用する、オブジェクトの色と候補のバッファに入っているかどうか
+    //詳細は"cycle_collector.hpp"を参照
+    //is_mutex の後ろのパディングに収まるため、ヘッダの大きさは変わらない
+    atomic<uint8_t> cycle_state;
+    //偏り参照カウント(BiasedRC)で、このオブジェクトの所有者であるスレッドの番号
+    //詳細は"biased_rc.hpp"を参照
+    //is_mutex の後ろのパディングに収まるため、ヘッダの大きさは変わらない
+    atomic<uint16_t> biased_owner;
     //スピンロックに使用するためのフラグ
-    atomic_flag spin_lock_flag;
+    //0 bit : スピンロックのフラグ
+    //1 bit : スピンロックの解放を待機しているスレッドがあるかどうか
+    //is_mutex の後ろのパディングに収まるため、ヘッダの大きさは変わらない
+    //32bit にすることで、取得と解放をそれぞれ一命令(x86 では lock bts と lock xadd)で行え、atomic::wait も futex を直接使用できる
+    atomic<uint32_t> spin_lock_state;
+
+    //スピンロックに使用するワードとビット
+    static constexpr uint32_t spin_lock_bit = 1;
+    static constexpr uint32_t spin_waiter_bit = 2;
+
+    inline atomic<uint32_t>* spin_lock_word() {
+        return &this->spin_lock_state;
+    }
+
+public:
+    inline void init_header(ObjectLayout layout) {
+        this->is_mutex = false;
+        this->cycle_state.store(0, memory_order_relaxed);
+        this->biased_owner.store(0, memory_order_relaxed);
+        this->reference_count = 1;
+        this->field_length = (uint32_t) layout.field_length;
+        this->payload_size = (uint32_t) layout.payload_size;
+        this->spin_lock_state.store(0, memory_order_relaxed);
+#if WEAK_REFERENCE
+        this->weak_count = 1;
+#endif
+    }
+
+    inline size_t get_reference_count() {
+        return this->reference_count;
+    }
+
+    inline void set_reference_count(size_t reference_count) {
+        this->reference_count = reference_count;
+    }
+
+    inline size_t get_field_length() {
+        return this->field_length;
+    }
+
+    inline size_t get_payload_size() {
+#if ARENA_ALLOCATION
+        return this->payload_size & ~payload_arena_bit;
+#else
+        return this->payload_size;
+#endif
+    }
+
+#if ARENA_ALLOCATION
+private:
+    //payload_size の、アリーナ(arena_allocator.hpp)から確保したオブジェクトであることを表すビット
+    static constexpr uint32_t payload_arena_bit = ((uint32_t) 1) << 31;
+
+public:
+    /**
+     * アリーナから確保したオブジェクトであるかどうか
+     */
+    inline bool get_is_arena() {
+        return (this->payload_size & payload_arena_bit) != 0;
+    }
+
+    /**
+     * アリーナから確保したオブジェクトとしてマークする(確保時にのみ使用する)
+     */
+    inline void set_is_arena() {
+        this->payload_size |= payload_arena_bit;
+    }
+#endif
+
+    inline bool get_is_mutex() {
+        //昇格や並列伝搬で他のスレッドが atomic に書き込む場合があるため、atomic に読み込む(x86 では通常の load と同じ)
+        return ((atomic_bool*) &this->is_mutex)->load(memory_order_relaxed);
+    }
+
+    inline void set_is_mutex(bool is_mutex) {
+        this->is_mutex = is_mutex;
+    }
+
+    /**
+     * is_mutex を atomic に true にし、false から true にした場合に true を返す
+     * 複数のスレッドが同時に is_mutex を伝搬させる場合に使用する("parallel_mark.hpp"を参照)
+     */
+    inline bool try_set_is_mutex() {
+        return !((atomic_bool*) &this->is_mutex)->exchange(true, memory_order_relaxed);
+    }
+
+#if CYCLE_COLLECTION
+    /**
+     * 循環参照の回収で使用する状態を読み込む("cycle_collector.hpp"を参照)
+     */
+    inline uint8_t load_cycle_state(memory_order order = memory_order_seq_cst) {
+        return this->cycle_state.load(order);
+    }
+
+    /**
+     * 通常の命令で循環参照の回収で使用する状態を書き込む
+     * is_mutex が false のオブジェクトにのみ使用できる
+     */
+    inline void store_cycle_state(uint8_t state) {
+        this->cycle_state.store(state, memory_order_relaxed);
+    }
+
+    /**
+     * 循環参照の回収で使用する状態が expected であれば desired に書き換える
+     */
+    inline bool compare_exchange_cycle_state(uint8_t& expected, uint8_t desired) {
+        return this->cycle_state.compare_exchange_strong(expected, desired, memory_order_seq_cst);
+    }
+#endif
+
+    /**
+     * 通常の命令で参照カウントを一つ増やす
+     */
+    inline void increment_reference_count() {
+        this->reference_count++;
+    }
+
+    /**
+     * 通常の命令で参照カウントを一つ減らし、減らす前の参照カウントを返す
+     */
+    inline size_t decrement_reference_count() {
+        return this->reference_count--;
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ増やす
+     * オブジェクト作成時の参照カウントの設定は atomic_size_t で行っていないが、恐らく上手く動作する(?)
+     * 少なくとも AArch64 では上手く動作しているように見える
+     */
+    inline void atomic_increment_reference_count(memory_order order = memory_order_relaxed) {
+        ((atomic_size_t*) &this->reference_count)->fetch_add(1, order);
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを count 増やす
+     */
+    inline void atomic_add_reference_count(size_t count, memory_order order = memory_order_relaxed) {
+        ((atomic_size_t*) &this->reference_count)->fetch_add(count, order);
+    }
+
+    /**
+     * atomic-read-modify-write により参照カウントを一つ減らし、減らす前の参照カウントを返す
+     */
+    inline size_t atomic_decrement_reference_count() {
+        return ((atomic_size_t*) &this->reference_count)->fetch_sub(1, memory_order_release);
+    }
+
+    /**
+     * 参照カウントを atomic に読み込む
+     */
+    inline size_t atomic_load_reference_count(memory_order order = memory_order_seq_cst) {
+        return ((atomic_size_t*) &this->reference_count)->load(order);
+    }
+
+#if WEAK_REFERENCE
+    /**
+     * 参照カウントが0になっていなければ compare-and-swap で一つ増やし、増やせた場合は true を返す
+     * 弱参照の upgrade() で使用する
+     */
+    inline bool atomic_increment_reference_count_if_alive() {
+        auto reference_count = ((atomic_size_t*) &this->reference_count)->load(memory_order_relaxed);
+        while (is_alive_reference_count(reference_count)) {
+            if (((atomic_size_t*) &this->reference_count)->compare_exchange_weak(reference_count, reference_count + 1, memory_order_acquire, memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+#endif
+
+    /**
+     * 偏り参照カウント(BiasedRC)では、参照カウントのワードを二つに分けて使用する("biased_rc.hpp"を参照)
+     * 所有者のスレッドだけが通常の命令で読み書きする biased カウンタ
+     */
+    inline uint32_t* biased_reference_count() {
+        return (uint32_t*) &this->reference_count;
+    }
+
+    /**
+     * 所有者以外のスレッドが atomic-read-modify-write で書き換える shared カウンタ
+     */
+    inline atomic<uint32_t>* shared_reference_word() {
+        return (atomic<uint32_t>*) &this->reference_count + 1;
+    }
+
+    /**
+     * 所有者のスレッドの番号
+     */
+    inline atomic<uint16_t>* biased_owner_index() {
+        return &this->biased_owner;
+    }
+
+#endif
+
+#if WEAK_REFERENCE
+private:
+    //弱参照の数("weak_rc.hpp"を参照)
+    //参照カウントが0でない間は、全ての強参照をまとめて一つと数える
+    size_t weak_count;
+
+public:
+    /**
+     * 参照カウントの値が、生存しているオブジェクトのものであるかどうか
+     * 0 と、解放中であることを表す HEAP_OBJECT_DEAD_BIT が立った値は生存していない
+     */
+    static inline bool is_alive_reference_count(size_t reference_count) {
+        return reference_count - 1 < HEAP_OBJECT_DEAD_BIT - 1;
+    }
+
+    /**
+     * 通常の命令で弱参照の数を一つ増やす
+     */
+    inline void increment_weak_count() {
+        this->weak_count++;
+    }
+
+    /**
+     * 通常の命令で弱参照の数を一つ減らし、減らす前の数を返す
+     */
+    inline size_t decrement_weak_count() {
+        return this->weak_count--;
+    }
+
+    /**
+     * atomic-read-modify-write により弱参照の数を一つ増やす
+     */
+    inline void atomic_increment_weak_count() {
+        ((atomic_size_t*) &this->weak_count)->fetch_add(1, memory_order_relaxed);
+    }
+
+    /**
+     * atomic-read-modify-write により弱参照の数を一つ減らし、減らす前の数を返す
+     */
+    inline size_t atomic_decrement_weak_count() {
+        return ((atomic_size_t*) &this->weak_count)->fetch_sub(1, memory_order_release);
+    }
+
+    /**
+     * 弱参照の数を atomic に読み込む
+     */
+    inline size_t atomic_load_weak_count(memory_order order = memory_order_seq_cst) {
+        return ((atomic_size_t*) &this->weak_count)->load(order);
+    }
+#endif
+
+    /**
+     * ペイロードの開始ポインタ
+     * フィールドの直後に置かれ、8バイト境界に揃っている
+     */
+    inline void* get_payload() {
+        return (void*) ((HeapObject**) (this + 1) + this->get_field_length());
+    }
+
+    /**
+     * スピンロックのフラグを立てる
+     * 既に立っていた場合は false を返す
+     */
+    inline bool try_spin_lock() {
+        auto lock_bit = this->spin_lock_bit;
+        return (this->spin_lock_word()->fetch_or(lock_bit, memory_order_acquire) & lock_bit) == 0;
+    }
+
+    /**
+     * スピンロックのフラグが立っているかどうか
+     */
+    inline bool is_spin_locked() {
+        return (this->spin_lock_word()->load(memory_order_relaxed) & this->spin_lock_bit) != 0;
+    }
+
+    /**
+     * スピンロックを取得するまで待機する
+     * 競合していなければ一回の atomic-read-modify-write で取得する
+     */
+    inline void spin_lock() {
+        if (!this->try_spin_lock()) {
+            this->spin_lock_slow();
+        }
+    }
+
+    /**
+     * スピンロックの取得に失敗した場合の待機処理
+     *
+     * 以下の順に段階的に待機方法を変える
+     *  1. 指数バックオフしながら pause 命令で待機する
+     *  2. this_thread::yield() で他のスレッドに実行を譲る
+     *  3. 待機しているスレッドがあることを示すビットを立て、atomic::wait で解放されるまで眠る
+     * いずれの段階でも、フラグが下りたことを通常の load で確認してから atomic-read-modify-write を行う(test-and-test-and-set)。
+     * これにより、待機しているスレッドがキャッシュラインを奪い合って、ロックを保持しているスレッドの書き込みを遅らせることを避ける。
+     */
+    __attribute__((noinline)) void spin_lock_slow() {
+        auto* word = this->spin_lock_word();
+        auto lock_bit = this->spin_lock_bit;
+        auto waiter_bit = this->spin_waiter_bit;
+
+        size_t backoff = 1;
+        for (size_t round = 0; ; round++) {
+            if (!this->is_spin_locked() && this->try_spin_lock()) {
+                return;
+            }
+
+            if (round < SPIN_LOCK_SPIN_LIMIT) {
+                for (size_t i = 0; i < backoff; i++) {
+                    spin_lock_pause();
+                }
+                if (backoff < SPIN_LOCK_MAX_BACKOFF) {
+                    backoff *= 2;
+                }
+            } else if (round < SPIN_LOCK_SPIN_LIMIT + SPIN_LOCK_YIELD_LIMIT) {
+                this_thread::yield();
+            } else {
+                break;
+            }
+        }
+
+        while (true) {
+            //待機しているスレッドがあることを示してから取得を試みる
+            //他の待機しているスレッドがいるかどうかは分からないため、取得できた場合もビットは残しておく
+            auto previous = word->fetch_or(lock_bit | waiter_bit, memory_order_acquire);
+            if ((previous & lock_bit) == 0) {
+                return;
+            }
+
+            //フラグが立っている間は眠る
+            //コンパクトなヘッダでは参照カウントの増減でもワードが変化するため、起きた後はもう一度確認する
+            word->wait(previous | lock_bit | waiter_bit, memory_order_relaxed);
+        }
+    }
+
+    /**
+     * スピンロックのフラグを下ろす
+     * 眠っているスレッドがあれば起こす
+     */
+    inline void spin_unlock() {
+        auto* word = this->spin_lock_word();
+
+        //フラグが立っていることは分かっているため、fetch_and ではなく一命令で済む fetch_sub で下ろす
+        auto previous = word->fetch_sub(this->spin_lock_bit, memory_order_release);
+        if ((previous & this->spin_waiter_bit) != 0) {
+            this->spin_wake_waiters();
+        }
+    }
+
+    /**
+     * 待機しているスレッドがあることを示すビットを下ろし、眠っているスレッドを全て起こす
+     * 起きたスレッドは眠る前に再びビットを立てるため、取り残されるスレッドはない
+     */
+    __attribute__((noinline)) void spin_wake_waiters() {
+        auto* word = this->spin_lock_word();
+        word->fetch_and(~this->spin_waiter_bit, memory_order_relaxed);
+        word->notify_all();
+    }
 
 
     /**
      * このオブジェクト以下のオブジェクト(フィールドに間接的に連なる全てのオブジェクトを含む)の is_mutex を true に伝搬させる
      * 詳細は"dynamic_rc_hpp"を参照
+     * 
+     * 連結リストのような深いオブジェクトでもスタックが溢れないように、再帰呼び出しではなく明示的なスタックを用いて辿る。
+     * また、スタックから取り出したオブジェクトはすぐには処理せず、プリフェッチしてから小さなリングバッファに入れ、
+     * prefetch_distance 個後に処理する。これにより、ヘッダを読み込む間に他のオブジェクトの処理を進めることができる。
+     * 
+     * FIELD_LENGTH_HINT に0以外を指定した場合、フィールドの長さがそれと等しいオブジェクトのフィールドを積む処理は
+     * コンパイル時に展開される(TypedObject から使用される。"typed_object.hpp"を参照)。
+     *
+     * PARALLEL_TO_MUTEX が true の場合、PARALLEL_TO_MUTEX_INLINE_BUDGET 個を辿っても終わらなければ
+     * 残りをワーカースレッドと並列に辿り、全て終わってから戻る("parallel_mark.hpp"を参照)。
      */
+    template<size_t FIELD_LENGTH_HINT = 0>
     inline void to_mutex() {
-        //is_mutex が false である場合
-        if (!this->is_mutex) {
-            this->is_mutex = true;
+        //is_mutex が既に true である場合は何もしない
+        //このオブジェクト以下は既に全て true になっている
+        if (this->get_is_mutex()) {
+            return;
+        }
+
+        //プリフェッチしてから処理するまでに挟むオブジェクトの数
+        constexpr size_t prefetch_distance = 8;
+
+        //まだ辿っていないオブジェクトを積むスタック
+        //スレッドごとに使い回すことで、呼び出しの度にメモリを確保しないようにする
+        static thread_local vector<HeapObject*> mark_stack;
+        mark_stack.push_back(this);
+
+        //プリフェッチ済みで処理を待っているオブジェクト
+        HeapObject* prefetch_queue[prefetch_distance];
+        size_t queue_head = 0;
+        size_t queue_length = 0;
+
+#if PARALLEL_TO_MUTEX
+        size_t budget = parallel_to_mutex_get_worker_count() == 0 ? SIZE_MAX : PARALLEL_TO_MUTEX_INLINE_BUDGET;
+#endif
+
+        while (true) {
+#if PARALLEL_TO_MUTEX
+            if (budget == 0 && (queue_length != 0 || !mark_stack.empty())) {
+                //プリフェッチ済みのオブジェクトもスタックへ戻し、残りを全てワーカーと並列に辿る
+                for (size_t i = 0; i < queue_length; i++) {
+                    mark_stack.push_back(prefetch_queue[(queue_head + i) % prefetch_distance]);
+                }
+                parallel_to_mutex_remaining(mark_stack);
+                mark_stack.clear();
+                return;
+            }
+#endif
+
+            //スタックから取り出したオブジェクトをプリフェッチしてキューへ入れる
+            while (queue_length < prefetch_distance && !mark_stack.empty()) {
+                auto* object = mark_stack.back();
+                mark_stack.pop_back();
+
+                __builtin_prefetch(object, 1);
+                prefetch_queue[(queue_head + queue_length) % prefetch_distance] = object;
+                queue_length++;
+            }
+
+            if (queue_length == 0) {
+                //辿るオブジェクトが無くなったら終了
+                return;
+            }
+
+            //最も前にプリフェッチしたオブジェクトを処理する
+            auto* object = prefetch_queue[queue_head];
+            queue_head = (queue_head + 1) % prefetch_distance;
+            queue_length--;
 
-            auto field_length = this->field_length;
+            //is_mutex が既に true である場合は、それ以下も全て true になっているので辿らない
+            //(複数のフィールドから参照されているオブジェクトは複数回積まれることがある)
+            if (object->get_is_mutex()) {
+                continue;
+            }
+            object->set_is_mutex(true);
+#if PARALLEL_TO_MUTEX
+            budget--;
+#endif
+
+            auto field_length = object->get_field_length();
             //フィールドの開始ポインタ
-            auto** field_start_ptr = (HeapObject**) (this + 1);
+            auto** field_start_ptr = (HeapObject**) (object + 1);
+
+            if (FIELD_LENGTH_HINT != 0 && field_length == FIELD_LENGTH_HINT) {
+                //フィールドの長さがコンパイル時に分かっている場合はループを展開する
+                //(後ろのフィールドから積む)
+                [&]<size_t... I>(index_sequence<I...>) {
+                    ((*(field_start_ptr + (FIELD_LENGTH_HINT - 1 - I)) != nullptr
+                        ? mark_stack.push_back(*(field_start_ptr + (FIELD_LENGTH_HINT - 1 - I))) : void()), ...);
+                }(make_index_sequence<FIELD_LENGTH_HINT>());
+                continue;
+            }
 
-            for (size_t field_index = 0; field_index < field_length; field_index++) {
-                //対象となるフィールドのポインタ
-                auto** field_ptr = field_start_ptr + field_index;
+            //後ろのフィールドから積むことで、前のフィールドのオブジェクトから先にスタックから取り出す
+            //ただし、キューには最大 prefetch_distance 個をまとめて取り出すため、兄弟のオブジェクトが最初の子以下より先に処理されることがあり、
+            //再帰呼び出しと同じ順序にはならない(is_mutex を true にする結果は辿る順序に依存しない)
+            for (size_t field_index = field_length; field_index-- > 0;) {
                 //フィールドの内容をロード
-                auto* field_object = *field_ptr;
+                auto* field_object = *(field_start_ptr + field_index);
 
                 if (field_object != nullptr) {
-                    //再帰的に呼び出し
-                    field_object->to_mutex();
+                    mark_stack.push_back(field_object);
                 }
             }
         }
@@ -60,14 +842,67 @@ public:
 
 
 /**
- * オブジェクトをヒープ領域に割り当て
+ * フィールドの長さが field_length で、ペイロードの大きさが payload_size であるオブジェクトの大きさ
  */
-inline HeapObject* alloc_heap_object(size_t field_length) {
+inline size_t heap_object_size(size_t field_length, size_t payload_size = 0) {
+    return sizeof(HeapObject) + sizeof(HeapObject*) * field_length + payload_size;
+}
+
+
+/**
+ * オブジェクトのメモリを malloc かスラブアロケータから確保
+ */
+inline void* alloc_heap_object_memory(size_t allocate_size) {
+    #if USE_SLAB_ALLOCATOR
+        //スレッドごとのスラブアロケータから確保
+        return slab_alloc(allocate_size);
+    #else
+        return malloc(allocate_size);
+    #endif
+}
+
+/**
+ * alloc_heap_object_memory で確保したオブジェクトのメモリを解放
+ */
+inline void free_heap_object_memory(HeapObject* object_ptr) {
+    #if USE_SLAB_ALLOCATOR
+        //確保時と同じ大きさを渡してスラブアロケータへ返す
+        slab_free(object_ptr, heap_object_size(object_ptr->get_field_length(), object_ptr->get_payload_size()));
+    #else
+        free(object_ptr);
+    #endif
+}
+
+
+/**
+ * layout で指定されたレイアウトのオブジェクトをヒープ領域に割り当て
+ * ペイロードは0で初期化される
+ */
+inline HeapObject* alloc_heap_object(ObjectLayout layout) {
+    auto field_length = layout.field_length;
+
     //確保するサイズ
-    //HeapObject をヘッダとしてそれに連なる形でフィールドの領域も合わせて確保
-    auto allocate_size = sizeof(HeapObject) + sizeof(HeapObject*) * field_length;
-    auto* object_ptr = (HeapObject*) malloc(allocate_size);
-    
+    //HeapObject をヘッダとしてそれに連なる形でフィールドとペイロードの領域も合わせて確保
+    auto allocate_size = heap_object_size(field_length, layout.payload_size);
+
+    #if COMPACT_HEAP_OBJECT_HEADER
+        //コンパクトなヘッダに格納できない大きさのオブジェクトは作成できない
+        if (field_length > HEAP_OBJECT_MAX_FIELD_LENGTH || layout.payload_size > HEAP_OBJECT_MAX_PAYLOAD_SIZE) {
+            abort();
+        }
+    #endif
+
+    #if ARENA_ALLOCATION
+        //アリーナのスコープ内であれば、アリーナのチャンクから切り出す
+        auto* object_ptr = (HeapObject*) arena_alloc(allocate_size);
+        auto is_arena = object_ptr != nullptr;
+        if (!is_arena) {
+            object_ptr = (HeapObject*) alloc_heap_object_memory(allocate_size);
+        }
+    #else
+        auto* object_ptr = (HeapObject*) alloc_heap_object_memory(allocate_size);
+    #endif
+
     //各フィールドを初期化
     //フィールドの開始ポインタ
     auto** field_start_ptr = (HeapObject**) (object_ptr + 1);
@@ -75,11 +910,18 @@ inline HeapObject* alloc_heap_object(size_t field_length) {
         *(field_start_ptr + i) = nullptr;
     }
 
+    //ペイロードを初期化
+    if (layout.payload_size != 0) {
+        memset(field_start_ptr + field_length, 0, layout.payload_size);
+    }
+
     //ヘッダの各フィールドを初期化
-    object_ptr->is_mutex = false;
-    object_ptr->reference_count = 1;
-    object_ptr->field_length = field_length;
-    *((bool*) &object_ptr->spin_lock_flag) = false;
+    object_ptr->init_header(layout);
+    #if ARENA_ALLOCATION
+        if (is_arena) {
+            object_ptr->set_is_arena();
+        }
+    #endif
 
     #if RC_VALIDATION
         //生存しているオブジェクト数を一つ増やす
@@ -88,3 +930,203 @@ inline HeapObject* alloc_heap_object(size_t field_length) {
 
     return object_ptr;
 }
+
+/**
+ * HeapObject* のフィールドだけを持つオブジェクトをヒープ領域に割り当て
+ */
+inline HeapObject* alloc_heap_object(size_t field_length) {
+    return alloc_heap_object(ObjectLayout { field_length, 0 });
+}
+
+
+
+/**
+ * オブジェクトのメモリを解放
+ */
+inline void free_heap_object(HeapObject* object_ptr) {
+    #if ARENA_ALLOCATION
+        if (object_ptr->get_is_arena()) {
+            //個別には解放せず、チャンクごとにまとめて解放する
+            arena_free(object_ptr);
+        } else {
+            free_heap_object_memory(object_ptr);
+        }
+    #else
+        free_heap_object_memory(object_ptr);
+    #endif
+
+    #if RC_VALIDATION
+        //生存しているオブジェクト数を一つ減らす
+        global_object_count.fetch_sub(1, memory_order_relaxed);
+    #endif
+}
+
+
+/**
+ * 参照カウントが0になり、フィールドを処理し終えたオブジェクトを解放
+ * WEAK_REFERENCE が true の場合、弱参照が残っていればメモリの解放は最後の弱参照の破棄まで遅らせる("weak_rc.hpp"を参照)
+ */
+inline void free_dead_heap_object(HeapObject* object_ptr) {
+    #if WEAK_REFERENCE
+        //弱参照の数が1(強参照の分のみ)であれば、弱参照は存在せず新しく作られることもないため、そのまま解放する
+        if (object_ptr->atomic_load_weak_count(memory_order_acquire) != 1) {
+            //強参照の分を減らし、最後であれば解放する
+            if (object_ptr->atomic_decrement_weak_count() != 1) {
+                return;
+            }
+            //他のスレッドでの弱参照の破棄を取得
+            atomic_thread_fence(memory_order_acquire);
+        }
+    #endif
+
+    free_heap_object(object_ptr);
+}
+
+
+/**
+ * 参照カウントが0になったオブジェクトと、それによって参照カウントが0になるフィールド以下のオブジェクトを全て解放する
+ * 
+ * release_field はフィールドに格納されていたオブジェクトの参照カウントを一つ減らし、0になった場合に true を返す関数である。
+ * 
+ * 再帰呼び出しを用いると連結リストのような深いオブジェクトでスタックが溢れるため、
+ * 解放するオブジェクト自身の領域を作業リストとして再利用することで、追加のメモリ確保なしに一定のスタック使用量で解放する。
+ *  + 処理しているオブジェクトの処理済みのフィールドの数(カーソル)はレジスタに置き、子へ降りる時だけ
+ *    そのオブジェクトの reference_count へ書き込んでおく
+ *    (既に0であり、もう参照カウントとしては使用されないため。弱参照がこれを生存しているオブジェクトの参照カウントと
+ *    見誤らないように、HEAP_OBJECT_DEAD_BIT を足しておく)
+ *  + フィールドのオブジェクトの参照カウントが0になり、そのオブジェクトへ降りる場合は、
+ *    読み出し済みのフィールドのスロットに親のオブジェクトへのポインタを書き込んでおき、戻る際にそこから親を復元する
+ *    (Deutsch–Schorr–Waite のポインタ反転と同様の考え方)
+ * 参照カウントが0になったオブジェクトは他のどのスレッドからも参照されていないため、これらの書き込みに同期処理は必要ない。
+ *
+ * 目的は深いオブジェクトでスタックを溢れさせないことであり、再帰呼び出しより速くなるわけではない。
+ * 木構造の解放では大部分を free が占め、走査そのものの時間は再帰呼び出しの場合とほぼ同じである。
+ */
+template<typename ReleaseFunction>
+inline void free_heap_object_graph(HeapObject* dead_object, ReleaseFunction release_field) {
+    //現在処理しているオブジェクト
+    auto* current_object = dead_object;
+    //現在処理しているオブジェクトの親(処理し終えたら戻る先)
+    HeapObject* parent_object = nullptr;
+    //現在処理しているオブジェクトの処理済みのフィールドの数
+    size_t field_index = 0;
+
+    while (true) {
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (current_object + 1);
+        auto field_length = current_object->get_field_length();
+        //参照カウントが0になり、次に降りるフィールドのオブジェクト
+        HeapObject* next_object = nullptr;
+
+        //前のフィールドから順に処理する(確保された順に辿るためキャッシュに優しい)
+        while (field_index < field_length) {
+            //フィールドの内容をロード
+            auto* field_object = *(field_start_ptr + field_index);
+            field_index++;
+
+            if (field_object != nullptr && release_field(field_object)) {
+                next_object = field_object;
+                break;
+            }
+        }
+
+        if (next_object != nullptr) {
+            //フィールドのオブジェクトの参照カウントが0になった場合
+            //カーソルと、読み出し済みのスロットに親を記録してから、そのオブジェクトへ降りる
+            current_object->set_reference_count(HEAP_OBJECT_DEAD_BIT + field_index);
+            *(field_start_ptr + field_index - 1) = parent_object;
+            parent_object = current_object;
+            current_object = next_object;
+            field_index = 0;
+            continue;
+        }
+
+        //全てのフィールドを処理し終えたので解放する
+        free_dead_heap_object(current_object);
+
+        if (parent_object == nullptr) {
+            //最初のオブジェクトまで戻ったら終了
+            return;
+        }
+
+        //親へ戻り、カーソルと、親のスロット(最後に読み出したフィールド)に記録しておいた更にその親を復元する
+        current_object = parent_object;
+        field_index = current_object->get_reference_count() - HEAP_OBJECT_DEAD_BIT;
+        parent_object = *((HeapObject**) (current_object + 1) + field_index - 1);
+    }
+}
+
+
+/**
+ * free_heap_object_graph を、フィールドの長さが FIELD_LENGTH であるオブジェクトに特殊化したもの
+ * TypedObject のデストラクタから使用される("typed_object.hpp"を参照)
+ * 
+ * ポインタ反転による解放はフィールドを一つずつ処理しながら降りていくため、フィールドの長さが分かっていてもループを展開できない。
+ * そこで、to_mutex と同じくスレッドごとに使い回すスタックを用い、オブジェクトのフィールドを一度に全て処理してから解放する。
+ *  + フィールドの長さが FIELD_LENGTH であるオブジェクトは、フィールドを処理するループがコンパイル時に展開される
+ *  + それ以外の長さのオブジェクトは、通常のループで処理する
+ * スタックには参照カウントが0になったオブジェクトのみが積まれ、最初に見つかったものはスタックを介さずに次に処理する。
+ * そのため、連結リストではスタックは伸びず、木構造では深さ * (FIELD_LENGTH - 1) 程度に収まる。
+ */
+template<size_t FIELD_LENGTH, typename ReleaseFunction>
+inline void free_heap_object_graph_shaped(HeapObject* dead_object, ReleaseFunction release_field) {
+    static_assert(FIELD_LENGTH != 0, "FIELD_LENGTH must not be 0");
+
+    //参照カウントが0になり、まだフィールドを処理していないオブジェクトを積むスタック
+    static thread_local vector<HeapObject*> free_stack;
+    //呼び出し時点のスタックの長さ
+    //release_field の中から再び呼び出された場合でも、外側の呼び出しが積んだものには触れない
+    auto stack_base = free_stack.size();
+
+    auto* current_object = dead_object;
+
+    while (true) {
+        //フィールドの開始ポインタ
+        auto** field_start_ptr = (HeapObject**) (current_object + 1);
+        //次に処理するオブジェクト
+        HeapObject* next_object = nullptr;
+
+        //後ろのフィールドから処理することで、前のフィールドのオブジェクトから(確保された順に)解放する
+        //展開したループの中で関数呼び出しにならないように、必ずインライン化する
+        auto release = [&](size_t field_index) __attribute__((always_inline)) {
+            auto* field_object = *(field_start_ptr + field_index);
+
+            if (field_object != nullptr && release_field(field_object)) {
+                if (next_object != nullptr) {
+                    free_stack.push_back(next_object);
+                }
+                next_object = field_object;
+            }
+        };
+
+        auto field_length = current_object->get_field_length();
+        if (field_length == FIELD_LENGTH) {
+            //ループを展開する
+            [&]<size_t... I>(index_sequence<I...>) {
+                (release(FIELD_LENGTH - 1 - I), ...);
+            }(make_index_sequence<FIELD_LENGTH>());
+        } else {
+            for (size_t field_index = field_length; field_index-- > 0;) {
+                release(field_index);
+            }
+        }
+
+        //全てのフィールドを読み終えたので解放する
+        free_dead_heap_object(current_object);
+
+        if (next_object == nullptr) {
+            if (free_stack.size() == stack_base) {
+                return;
+            }
+            next_object = free_stack.back();
+            free_stack.pop_back();
+        }
+        current_object = next_object;
+    }
+}
+
+
+#if PARALLEL_TO_MUTEX
+//to_mutex() から使用する並列伝搬の実装
+#include "parallel_mark.hpp"
+#endif
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <vector>
+#include <unordered_map>
+#include "heap_object.hpp"
+
+using namespace std;
+
+
+/**
+ * is_mutex の遅延伝搬(LAZY_MUTEX_PROMOTION が true の場合に DynamicRC が使用する)
+ *
+ * set_object で mutex なオブジェクトのフィールドへ挿入する場合、挿入するオブジェクト以下の全てのオブジェクトの is_mutex を
+ * その場で true にする(アプローチ2.)。巨大なオブジェクトを公開しても他のスレッドが根の近くしか読まない場合、
+ * この伝搬のほとんどは無駄になる。
+ * そこで DynamicRC::publish_object() では挿入時に伝搬させず、他のスレッドが mutex なオブジェクトのフィールドから
+ * get_object で初めて取り出した時に、そのオブジェクトだけを昇格させる(is_mutex を true にする)。
+ *
+ * >>> 三つの状態
+ * オブジェクトは以下のいずれかの状態にある。
+ *  + ローカル : is_mutex が false で、一つのスレッドのハンドル若しくはローカルなオブジェクトのフィールドから参照されている
+ *  + 公開中   : is_mutex が false で、共有か公開中のオブジェクトのフィールドからのみ参照されている
+ *               (どのスレッドもハンドルを持っておらず、ローカルなオブジェクトからも参照されていない)
+ *  + 共有     : is_mutex が true
+ * ヘッダに持つのは is_mutex のみで、ローカルと公開中は辿ってきた経路で区別する。
+ * 公開中のオブジェクトには、共有か公開中のオブジェクトのフィールドを辿る以外に到達する手段がなく(不変条件2.)、
+ * そのような経路を辿る処理は後述の通り全て atomic に参照カウントを増減するため、公開中であることをヘッダに書き込む必要はない。
+ * (書き込む場合も昇格と競合するため atomic-read-modify-write が必要となり、公開時に子を全て辿るのと変わらなくなる)
+ *
+ * >>> 不変条件
+ *  1. 共有か公開中のオブジェクトのフィールドは、共有か公開中のオブジェクトのみを指す
+ *  2. 公開中のオブジェクトを指すハンドルと、ローカルなオブジェクトのフィールドは存在しない
+ *  3. ローカルなオブジェクトは一つのスレッドからのみアクセスされる(元の前提と同じ)
+ * 不変条件1.は元のアプローチ2.の「mutex なオブジェクト以下は全て mutex」を、公開中を含めて緩めたものである。
+ *
+ * >>> 各操作が不変条件を保つこと
+ *  1. publish_object(A, B) (A は共有)
+ *     事前条件として、B のハンドルは一意であること、つまり B 以下のローカルなオブジェクトは B 以下のオブジェクトの
+ *     フィールドと B のハンドル以外から参照されていないことを要求する(RC_VALIDATION が true の場合は検査する)。
+ *     B のハンドルはフィールドへムーブされて消えるため、挿入後の B 以下のローカルなオブジェクトは全て公開中となる。
+ *     B 以下の共有のオブジェクトはそのまま共有である。よって不変条件1.2.が成り立つ。
+ *     公開中のオブジェクトへの書き込み(作成時の参照カウント等)は、挿入の exchange の release により
+ *     フィールドを acquire でロードするスレッドへ公開される。
+ *
+ *  2. get_object(A, i) (A は共有)
+ *     ロードした C は不変条件1.より共有か公開中である。is_mutex が false であれば公開中であるため、
+ *     ハンドルを作る前に atomic-read-modify-write で is_mutex を true にして共有へ昇格させる。
+ *     C のフィールドは共有か公開中であるため、昇格後も不変条件1.が成り立ち、C のハンドルは共有のオブジェクトを指すため不変条件2.も成り立つ。
+ *     複数のスレッドが同時に昇格させても、どれも true を書き込むだけであり結果は変わらない。
+ *     昇格したオブジェクトのハンドルは以降 atomic に参照カウントを増減する。
+ *
+ *  3. 公開中のオブジェクトの参照カウントの増減
+ *     不変条件2.より、公開中のオブジェクトの参照カウントはフィールドからの出し入れでのみ変化し、それは以下に限られる。
+ *      + get_object による増加 : 2.の通り、昇格させてから atomic に増やす
+ *      + 共有のオブジェクトへの set_object で取り除かれた場合 : is_mutex に関わらず atomic に減らす
+ *      + 共有か公開中のオブジェクトの解放でフィールドが解放される場合 : is_mutex に関わらず atomic に減らし、
+ *        0になった場合はその下も同様に atomic に減らしながら解放する
+ *     ローカルなオブジェクトの解放で公開中のオブジェクトに到達することはない(不変条件2.)。
+ *     ローカルなオブジェクトから辿った共有のオブジェクトの参照カウントが0になった場合は、そこから先を3.の方法で解放する。
+ *     よって、公開中のオブジェクトの参照カウントを通常の命令で書き換えるスレッドはなく、昇格と増減が競合しても壊れない。
+ *     (コンパクトなヘッダでは is_mutex と参照カウントが同じワードにあるが、どちらも atomic-read-modify-write で書き換える)
+ *
+ *  4. set_object(A, i, B) (A は共有) と to_mutex()
+ *     従来通り B 以下の is_mutex をその場で伝搬させる。B はローカルであり、ローカルなオブジェクトのフィールドは
+ *     ローカルか共有のオブジェクトのみを指すため(不変条件2.)、伝搬は公開中のオブジェクトに触れずに共有のオブジェクトで止まる。
+ *
+ *  5. ローカルなオブジェクトの操作
+ *     不変条件2.よりハンドルを持つオブジェクトはローカルか共有であり、is_mutex による切り替えは従来通り正しい。
+ *
+ * 遅延参照カウント、循環参照の回収、弱参照は is_mutex が false のオブジェクトを通常の命令で扱う箇所があり、
+ * 公開中のオブジェクトの扱いを定めていないため、同時には使用できない。
+ */
+
+
+#if LAZY_MUTEX_PROMOTION
+
+#if DEFERRED_REFERENCE_COUNT
+#error "LAZY_MUTEX_PROMOTION cannot be combined with DEFERRED_REFERENCE_COUNT."
+#endif
+
+#if CYCLE_COLLECTION
+#error "LAZY_MUTEX_PROMOTION cannot be combined with CYCLE_COLLECTION."
+#endif
+
+#if WEAK_REFERENCE
+#error "LAZY_MUTEX_PROMOTION cannot be combined with WEAK_REFERENCE."
+#endif
+
+
+#if RC_VALIDATION
+
+/**
+ * publish_object の事前条件を検査する
+ * root 以下の is_mutex が false のオブジェクトの参照カウントが、root 以下のオブジェクトのフィールドからの参照の数
+ * (root はそれにハンドルの分の1を足した数)と一致しなければ、外部からも参照されているため不正
+ */
+inline void lazy_publish_check_unique(HeapObject* root) {
+    if (root->get_is_mutex()) {
+        return;
+    }
+
+    //各オブジェクトを指すフィールドの数
+    unordered_map<HeapObject*, size_t> incoming_count;
+    incoming_count[root] = 1;
+
+    vector<HeapObject*> stack = { root };
+    while (!stack.empty()) {
+        auto* object = stack.back();
+        stack.pop_back();
+
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        for (size_t i = 0; i < object->get_field_length(); i++) {
+            auto* field_object = *(field_start_ptr + i);
+            //共有のオブジェクトより先は辿らない
+            if (field_object == nullptr || field_object->get_is_mutex()) {
+                continue;
+            }
+            if (incoming_count[field_object]++ == 0) {
+                stack.push_back(field_object);
+            }
+        }
+    }
+
+    for (auto& [object, count] : incoming_count) {
+        if (object->get_reference_count() != count) {
+            abort();
+        }
+    }
+}
+
+#endif
+
+#endif
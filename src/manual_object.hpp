@@ -56,31 +56,19 @@ public:
     }
 
     /**
-     * このオブジェクトとそのフィールドのオブジェクトを再帰的に削除
+     * このオブジェクトとそのフィールドに連なるオブジェクトを全て削除
+     * 再帰呼び出しを行わないため、深いオブジェクトでもスタックは溢れない
      */
     inline void detele_object() {
-        auto field_length = this->object_ref->field_length;
-        //フィールドの開始ポインタ
-        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
-
-        //フィールドに格納されている全オブジェクトを削除
-        for (size_t field_index = 0; field_index < field_length; field_index++) {
-            auto** field_ptr = field_start_ptr + field_index;
-            auto* field_object = *field_ptr;
-
-            if (field_object != nullptr) {
-                ManualObject manual_object(field_object);
-                manual_object.detele_object();
-            }
-        }
-
-        free(this->object_ref);
-
+        //手動メモリ管理では参照カウントを持たないため、フィールドのオブジェクトは全て削除する
+        free_heap_object_graph(this->object_ref, [](HeapObject*) { return true; });
+    }
 
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+    /**
+     * オブジェクトのペイロード(ポインタでない値を格納する領域)の開始ポインタを取得
+     */
+    inline void* get_payload() {
+        return this->object_ref->get_payload();
     }
 
 };
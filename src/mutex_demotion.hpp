@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+
+using namespace std;
+
+
+/**
+ * is_mutex の降格(MUTEX_DEMOTION が true の場合に DynamicRC::try_demote() が使用する)
+ *
+ * アプローチ4.により、一度 is_mutex を true にしたオブジェクトは寿命が尽きるまでスレッドセーフモードのままである。
+ * グローバル変数へ一時的に公開した後に取り除き、再び一つのスレッドだけで操作し続ける場合でも、
+ * その後の操作は全て atomic-read-modify-write とエポックを経由することになる。
+ * そこで、呼び出したスレッドのハンドルからしか到達できなくなったことを確かめられたオブジェクトについて、
+ * is_mutex を false に戻す(降格させる)。
+ *
+ * >>> 降格できる条件
+ * is_mutex が true のオブジェクトに他のスレッドが到達するには、そのオブジェクトのハンドルか、
+ * そのオブジェクトを指すフィールドを経由する必要がある(自明な事柄2.)。そのため、
+ *  + 根 : 参照カウントが1である(呼び出したスレッドのハンドルの分だけ)
+ *  + 根以外 : 降格させたオブジェクトのフィールドから参照されており、参照カウントが1である(そのフィールドの分だけ)
+ * であれば、他のスレッドはハンドルを持っておらず、新しく取得する手段もない。
+ * 参照カウントは acquire で読み込むため、他のスレッドがハンドルを破棄する前に行った書き込みは全て観測できる
+ * (参照カウントを減らす atomic-read-modify-write は release である)。
+ *
+ * 他のスレッドが get_object でフィールドからロードしたまま参照カウントを増やしていない場合も、
+ * 取り除かれたフィールドの分の参照カウントはそのスレッドがクリティカルセクションを抜けるまで減らされないため、1にはならない
+ * (詳細は"epoch_reclamation.hpp"を参照)。
+ * 逆に、set_object で取り除いた直後はリンボに入っている分だけ参照カウントが残っているため、降格できるのはエポックが進んだ後である。
+ * try_demote() は失敗した場合にこのスレッドのリンボを回収してからもう一度確かめるが、
+ * 他のスレッドが取り除いた場合はそのスレッドのリンボが回収されるまで失敗する。
+ *
+ * 弱参照を使用する場合は、他のスレッドが弱参照から強参照を得られないように、弱参照の数も1(強参照の分だけ)であることを確かめる。
+ *
+ * >>> 不変条件
+ * 降格させるオブジェクトを指すのは呼び出したスレッドのハンドルか、降格させたオブジェクトのフィールドだけであるため、
+ * 降格後も「is_mutex が true のオブジェクト以下は全て is_mutex が true」(アプローチ2.)は成り立つ。
+ * 参照カウントが2以上のオブジェクトは is_mutex が true のまま残り、それより先も辿らない。
+ * ローカルなオブジェクトのフィールドが is_mutex が true のオブジェクトを指すのは通常の状態である。
+ *
+ * 降格させたオブジェクトは一つのスレッドからしか触れられないため、is_mutex の書き込みは通常の命令で行う。
+ * 再び mutex なオブジェクトへ挿入する場合は、通常通り to_mutex() と exchange の release により公開される。
+ *
+ * 遅延参照カウントでは他のスレッドのバッファに反映されていない増減が残りうるため、参照カウントが1であっても
+ * 他のスレッドがハンドルを持っていないとは言えない。
+ * 循環参照の回収では、回収中のスレッドが候補から辿ったオブジェクトの参照カウントを一時的に書き換えるため、
+ * 参照カウントを読んで判定できない。そのため、どちらとも同時には使用できない。
+ * 遅延伝搬("lazy_promotion.hpp")では、降格させたオブジェクトのフィールドに is_mutex が false の公開中のオブジェクトがありうる。
+ * 公開中のオブジェクトは他の共有、公開中のオブジェクトのフィールドからも参照されている可能性があり、
+ * 他のスレッドが get_object で到達しうるため、is_mutex が true のオブジェクトと同じく参照カウントで判定する。
+ *  + 参照カウントが1であれば、そのままローカルとなり、それより先(公開中のオブジェクトを含む)も辿る
+ *  + そうでなければ、ローカルとなったオブジェクトのフィールドが公開中のオブジェクトを指さないように(不変条件2.)、
+ *    get_object と同じく try_set_is_mutex() で共有へ昇格させ、それより先は辿らない
+ * 根が元からローカルであった場合、そのフィールドに公開中のオブジェクトはない。
+ */
+
+
+#if MUTEX_DEMOTION
+
+#if DEFERRED_REFERENCE_COUNT
+#error "MUTEX_DEMOTION cannot be combined with DEFERRED_REFERENCE_COUNT."
+#endif
+
+#if CYCLE_COLLECTION
+#error "MUTEX_DEMOTION cannot be combined with CYCLE_COLLECTION."
+#endif
+
+
+/**
+ * is_mutex が true のオブジェクトへの参照が、呼び出したスレッドが持っている一つだけであるかどうか
+ */
+inline bool demotion_is_unique(HeapObject* object) {
+    if (object->atomic_load_reference_count(memory_order_acquire) != 1) {
+        return false;
+    }
+#if WEAK_REFERENCE
+    //弱参照の数は、強参照をまとめた一つだけでなければならない
+    if (object->atomic_load_weak_count(memory_order_acquire) != 1) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+
+/**
+ * root とそれ以下の、呼び出したスレッドのハンドル(root への参照)からしか到達できない is_mutex が true のオブジェクトを降格させる
+ * root が is_mutex が false のまま(若しくは false に戻せた)場合は true を返す
+ * 呼び出し元はクリティカルセクションにいてはならない
+ */
+inline bool demote_heap_object_graph(HeapObject* root) {
+    auto root_was_mutex = root->get_is_mutex();
+    if (root_was_mutex) {
+        if (!demotion_is_unique(root)) {
+            //このスレッドが取り除いたばかりであれば、リンボに入っている分を減らしてからもう一度確かめる
+            epoch_advance_and_collect();
+            if (!demotion_is_unique(root)) {
+                return false;
+            }
+        }
+        root->set_is_mutex(false);
+    }
+
+#if LAZY_MUTEX_PROMOTION
+    //元からローカルであった根(そのフィールドに公開中のオブジェクトはない)
+    auto* local_root = root_was_mutex ? nullptr : root;
+#endif
+
+    //降格させたオブジェクトのうち、まだフィールドを辿っていないものを積むスタック
+    static thread_local vector<HeapObject*> demote_stack;
+    demote_stack.push_back(root);
+
+    while (!demote_stack.empty()) {
+        auto* object = demote_stack.back();
+        demote_stack.pop_back();
+
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        for (size_t field_index = 0; field_index < object->get_field_length(); field_index++) {
+            auto* field_object = *(field_start_ptr + field_index);
+            if (field_object == nullptr) {
+                continue;
+            }
+#if LAZY_MUTEX_PROMOTION
+            if (!field_object->get_is_mutex()) {
+                //元からローカルであった根のフィールドにある、is_mutex が false のオブジェクトより先はローカルであるため辿らない
+                if (object == local_root) {
+                    continue;
+                }
+                //降格させたオブジェクトのフィールドにある is_mutex が false のオブジェクトは公開中である
+                if (demotion_is_unique(field_object)) {
+                    //このフィールドからしか参照されていなければ、そのままローカルとなる
+                    demote_stack.push_back(field_object);
+                } else {
+                    //他からも参照されていれば、get_object と同じく共有へ昇格させる
+                    field_object->try_set_is_mutex();
+                }
+                continue;
+            }
+#else
+            //is_mutex が false のオブジェクトより先は元からローカルであるため辿らない
+            if (!field_object->get_is_mutex()) {
+                continue;
+            }
+#endif
+            //他からも参照されていれば is_mutex が true のまま残す
+            if (!demotion_is_unique(field_object)) {
+                continue;
+            }
+            field_object->set_is_mutex(false);
+            demote_stack.push_back(field_object);
+        }
+    }
+    return true;
+}
+
+#endif
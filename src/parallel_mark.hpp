@@ -0,0 +1,158 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include "heap_object.hpp"
+#include "work_stealing_pool.hpp"
+
+using namespace std;
+
+
+/**
+ * 巨大なオブジェクトの is_mutex の並列伝搬(PARALLEL_TO_MUTEX が true の場合に HeapObject::to_mutex() が使用する)
+ *
+ * mutex なオブジェクトへの set_object は、挿入するオブジェクト以下の全てのオブジェクトの is_mutex を true にしてから公開する。
+ * 数百万オブジェクトの木構造をグローバル変数へ挿入すると、挿入したスレッドはその全てを辿る間止まってしまう。
+ * そこで、to_mutex() は PARALLEL_TO_MUTEX_INLINE_BUDGET 個までは従来通りその場で辿り、それを超えた場合は
+ * 残りの(まだ辿っていない)オブジェクトをワーカースレッドのプールへ渡し、呼び出したスレッドも加わって並列に辿る。
+ *
+ * >>> ワークスティーリング
+ * 並列解放("parallel_teardown.hpp")と同じく、ワークスティーリングを行うプール("work_stealing_pool.hpp")でタスクを処理する。
+ * タスクの処理中に見つかったオブジェクトはワーカー内のスタックで処理し、
+ * PARALLEL_TO_MUTEX_SHARE_INTERVAL 個辿る度に、キューが全て空であればスタックの最も古いオブジェクトを分け与える。
+ *
+ * >>> 複数のワーカーが同じオブジェクトに到達する場合
+ * 複数のフィールドから参照されているオブジェクトには複数のワーカーが同時に到達しうるため、
+ * ワーカーは is_mutex を atomic-read-modify-write で立て、自身が false から true にした場合にのみフィールドを辿る。
+ * is_mutex が false のオブジェクトは呼び出したスレッドからしか触れられず、そのスレッドは to_mutex() の中で待っているため、
+ * 他に is_mutex や参照カウントを書き換えるスレッドはない。
+ *
+ * >>> 公開の順序
+ * 呼び出したスレッドは、自身が渡したタスク(一つの WorkStealingJob で数える)が全て終わるまで to_mutex() から戻らない。
+ * ワーカーはタスクを終える度に残りのタスク数を acq_rel で減らし、呼び出したスレッドは0になったことを acquire で読むため、
+ * ワーカーによる is_mutex の書き込みは呼び出したスレッドの以降の操作より前に起こる。
+ * set_object はその後に exchange(seq_cst) でフィールドへ挿入するため、get_object 側が acquire でロードすれば
+ * 全てのオブジェクトの is_mutex が true であることを観測できる(アプローチ2.の前提はそのまま成り立つ)。
+ */
+
+
+#if PARALLEL_TO_MUTEX
+
+//ワーカースレッドの数(parallel_to_mutex_set_worker_count で変更できる)
+#ifndef PARALLEL_TO_MUTEX_WORKER_COUNT
+#define PARALLEL_TO_MUTEX_WORKER_COUNT 4
+#endif
+
+//ワーカーがこの数のオブジェクトを辿る度に、他のワーカーへ作業を分け与えるかどうかを確認する
+#define PARALLEL_TO_MUTEX_SHARE_INTERVAL 256
+
+
+/**
+ * まだ辿っていないオブジェクト
+ * job は一回の to_mutex() の呼び出しで渡したタスクをまとめて数える
+ */
+struct MarkTask {
+    HeapObject* object;
+    WorkStealingJob* job;
+};
+
+
+/**
+ * is_mutex を伝搬させるワーカースレッドのプール
+ * ワーカーは最初にタスクが渡された時に起動する
+ */
+class MarkPool : public WorkStealingPool<MarkPool, MarkTask> {
+
+    friend class WorkStealingPool<MarkPool, MarkTask>;
+
+public:
+    inline MarkPool() : WorkStealingPool(PARALLEL_TO_MUTEX_WORKER_COUNT) {}
+
+    inline ~MarkPool() {
+        this->stop();
+    }
+
+    /**
+     * objects 以下のオブジェクトを全て辿り終えるまで、呼び出したスレッドも加わって並列に is_mutex を伝搬させる
+     */
+    inline void mark(const vector<HeapObject*>& objects) {
+        WorkStealingJob job;
+        for (auto* object : objects) {
+            this->submit({ object, &job });
+        }
+        this->help_until_finished(job);
+    }
+
+private:
+    /**
+     * タスクのオブジェクト以下の is_mutex を true にする
+     */
+    inline void run_task(size_t queue_index, MarkTask task) {
+        //まだ辿っていないオブジェクト
+        //末尾から取り出して深さ優先で辿り、分け与える際は先頭(最も古いもの)を渡す
+        deque<HeapObject*> stack;
+        stack.push_back(task.object);
+
+        size_t marked_count = 0;
+        while (!stack.empty()) {
+            auto* object = stack.back();
+            stack.pop_back();
+
+            //他のワーカーが先に true にした場合は、そのワーカーが辿る
+            if (!object->try_set_is_mutex()) {
+                continue;
+            }
+
+            auto** field_start_ptr = (HeapObject**) (object + 1);
+            auto field_length = object->get_field_length();
+            for (size_t field_index = field_length; field_index-- > 0;) {
+                auto* field_object = *(field_start_ptr + field_index);
+                if (field_object != nullptr) {
+                    stack.push_back(field_object);
+                }
+            }
+
+            marked_count++;
+            if (marked_count % PARALLEL_TO_MUTEX_SHARE_INTERVAL == 0 && stack.size() > 1 && !this->has_queued_task()) {
+                //他のワーカーが待機している可能性があるため、根に近い部分を分け与える
+                this->push(queue_index, { stack.front(), task.job });
+                stack.pop_front();
+            }
+        }
+    }
+
+};
+
+
+/**
+ * 全てのスレッドで共有するプール
+ * グローバル変数のハンドルの構築時にも使用できるように、それらより先に構築されるヘッダ内で定義する
+ */
+inline MarkPool parallel_mark_pool;
+
+
+/**
+ * HeapObject::to_mutex() がその場で辿る上限を超えた場合に、残りのオブジェクトをワーカーと並列に辿る
+ * 全て辿り終えるまで戻らない
+ */
+inline void parallel_to_mutex_remaining(const vector<HeapObject*>& objects) {
+    parallel_mark_pool.mark(objects);
+}
+
+/**
+ * ワーカーの数を変更する(0 の場合は並列に辿らない)
+ * 他のスレッドが to_mutex() を呼び出していない時に呼び出す必要がある
+ */
+inline void parallel_to_mutex_set_worker_count(size_t worker_count) {
+    parallel_mark_pool.set_worker_count(worker_count);
+}
+
+/**
+ * ワーカーの数を取得
+ */
+inline size_t parallel_to_mutex_get_worker_count() {
+    return parallel_mark_pool.get_worker_count();
+}
+
+#endif
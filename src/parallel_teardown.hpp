@@ -0,0 +1,231 @@
+#pragma once
+
+#include <cstddef>
+#include <vector>
+#include <deque>
+#include "heap_object.hpp"
+#include "work_stealing_pool.hpp"
+
+using namespace std;
+
+
+/**
+ * 大きなオブジェクトの並列解放(PARALLEL_TEARDOWN が true の場合に DynamicRC と ThreadSafeRC が使用する)
+ *
+ * 巨大な木構造オブジェクトへの最後の参照を手放すと、フィールド以下の全てのオブジェクトの解放がその場で連鎖し、
+ * 手放したスレッドはその間止まってしまう。
+ * そこで、参照カウントが0になったオブジェクトを呼び出したスレッドで解放するのは PARALLEL_TEARDOWN_INLINE_BUDGET 個までとし、
+ * それを超えた場合は残りの(まだフィールドを処理していない)オブジェクトをワーカースレッドのプールへ渡して並列に解放する。
+ * 小さなオブジェクトは従来通りその場で全て解放される。
+ *
+ * >>> ワークスティーリング
+ * タスク(参照カウントが0になり、フィールドを処理していないオブジェクト)はワークスティーリングを行うプール("work_stealing_pool.hpp")で処理する。
+ * タスクの処理中に見つかったオブジェクトはワーカー内のスタックで処理し、キューには入れない。
+ * PARALLEL_TEARDOWN_SHARE_INTERVAL 個解放する度に、キューが全て空であれば(待機しているワーカーがいれば)
+ * スタックの最も古い(根に近く、大きい可能性が高い)オブジェクトを自身のキューへ移して分け与える。
+ *
+ * >>> 対象となるオブジェクト
+ * ワーカーは別のスレッドで参照カウントを減らすため、参照カウントを atomic に増減するオブジェクトのみが対象となる。
+ * DynamicRC では is_mutex が true のオブジェクトのみを渡す(is_mutex が true のオブジェクトのフィールドは全て is_mutex が true である)。
+ * is_mutex が false のオブジェクトのフィールドは、手放したスレッド上の他のオブジェクトからも通常の命令で参照カウントを
+ * 増減されうるため、別のスレッドでは減らせない。
+ *
+ * 解放は非同期に行われるため、全ての解放を待つ場合は parallel_teardown_wait() を呼び出す。
+ */
+
+
+#if PARALLEL_TEARDOWN
+
+//ワーカースレッドの数(parallel_teardown_set_worker_count で変更できる)
+#ifndef PARALLEL_TEARDOWN_WORKER_COUNT
+#define PARALLEL_TEARDOWN_WORKER_COUNT 4
+#endif
+
+//呼び出したスレッドでそのまま解放するオブジェクト数の上限
+#define PARALLEL_TEARDOWN_INLINE_BUDGET 4096
+
+//ワーカーがこの数のオブジェクトを解放する度に、他のワーカーへ作業を分け与えるかどうかを確認する
+#define PARALLEL_TEARDOWN_SHARE_INTERVAL 256
+
+
+/**
+ * フィールドのオブジェクトの参照カウントを一つ減らし、0になった場合に true を返す関数
+ * atomic に減らす関数でなければならない
+ */
+typedef bool (*TeardownReleaseFunction)(HeapObject*);
+
+
+/**
+ * 参照カウントが0になり、まだフィールドを処理していないオブジェクト
+ */
+struct TeardownTask {
+    HeapObject* object;
+    TeardownReleaseFunction release_field;
+    WorkStealingJob* job;
+};
+
+
+/**
+ * 解放を行うワーカースレッドのプール
+ * ワーカーは最初にタスクが渡された時に起動する
+ */
+class TeardownPool : public WorkStealingPool<TeardownPool, TeardownTask> {
+
+    friend class WorkStealingPool<TeardownPool, TeardownTask>;
+
+private:
+    //渡された全てのタスク
+    WorkStealingJob job;
+
+public:
+    inline TeardownPool() : WorkStealingPool(PARALLEL_TEARDOWN_WORKER_COUNT) {}
+
+    inline ~TeardownPool() {
+        this->stop();
+    }
+
+    /**
+     * object 以下の解放を渡す
+     */
+    inline void submit_object(HeapObject* object, TeardownReleaseFunction release_field) {
+        this->submit({ object, release_field, &this->job });
+    }
+
+    /**
+     * 渡された全てのタスクの処理が終わるまで待機する
+     */
+    inline void wait_all() {
+        this->wait(this->job);
+    }
+
+private:
+    /**
+     * タスクのオブジェクトとそれによって参照カウントが0になるフィールド以下のオブジェクトを全て解放する
+     */
+    inline void run_task(size_t queue_index, TeardownTask task) {
+        //参照カウントが0になり、まだフィールドを処理していないオブジェクト
+        //末尾から取り出して深さ優先で処理し、分け与える際は先頭(最も古いもの)を渡す
+        deque<HeapObject*> stack;
+        stack.push_back(task.object);
+
+        size_t freed_count = 0;
+        while (!stack.empty()) {
+            auto* object = stack.back();
+            stack.pop_back();
+
+            auto** field_start_ptr = (HeapObject**) (object + 1);
+            auto field_length = object->get_field_length();
+            for (size_t field_index = 0; field_index < field_length; field_index++) {
+                auto* field_object = *(field_start_ptr + field_index);
+                if (field_object != nullptr && task.release_field(field_object)) {
+                    stack.push_back(field_object);
+                }
+            }
+            free_dead_heap_object(object);
+
+            freed_count++;
+            if (freed_count % PARALLEL_TEARDOWN_SHARE_INTERVAL == 0 && stack.size() > 1 && !this->has_queued_task()) {
+                //他のワーカーが待機している可能性があるため、根に近い部分を分け与える
+                this->push(queue_index, { stack.front(), task.release_field, task.job });
+                stack.pop_front();
+            }
+        }
+    }
+
+};
+
+
+/**
+ * 全てのスレッドで共有するプール
+ * グローバル変数のハンドルの破棄時にも使用できるように、それらより先に構築されるヘッダ内で定義する
+ */
+inline TeardownPool parallel_teardown_pool;
+
+
+/**
+ * このスレッドのスタックが既に破棄されたかどうか
+ * スレッドの終了時に他のスレッドローカルな変数の破棄(遅延参照カウントのバッファの反映等)から解放される場合に使用する
+ */
+inline thread_local bool teardown_stack_is_destroyed = false;
+
+/**
+ * 呼び出したスレッドで解放する際に、参照カウントが0になり、まだフィールドを処理していないオブジェクトを積むスタック
+ */
+struct TeardownStack {
+    vector<HeapObject*> objects;
+
+    inline ~TeardownStack() {
+        teardown_stack_is_destroyed = true;
+    }
+};
+
+
+/**
+ * 参照カウントが0になったオブジェクトと、それによって参照カウントが0になるフィールド以下のオブジェクトを全て解放する
+ * PARALLEL_TEARDOWN_INLINE_BUDGET 個を超えた分はワーカーへ渡して並列に解放する
+ * release_field は atomic に参照カウントを減らす関数でなければならない
+ */
+inline void free_heap_object_graph_parallel(HeapObject* dead_object, TeardownReleaseFunction release_field) {
+    if (parallel_teardown_pool.get_worker_count() == 0 || teardown_stack_is_destroyed) {
+        free_heap_object_graph(dead_object, release_field);
+        return;
+    }
+
+    static thread_local TeardownStack stack;
+    auto& teardown_stack = stack.objects;
+    //release_field の中から再び呼び出された場合でも、外側の呼び出しが積んだものには触れない
+    auto stack_base = teardown_stack.size();
+    teardown_stack.push_back(dead_object);
+
+    size_t budget = PARALLEL_TEARDOWN_INLINE_BUDGET;
+    while (teardown_stack.size() != stack_base) {
+        if (budget == 0) {
+            //残りは大きな部分グラフの根である可能性が高いため、ワーカーへ渡して呼び出し元へ戻る
+            for (auto i = stack_base; i < teardown_stack.size(); i++) {
+                parallel_teardown_pool.submit_object(teardown_stack[i], release_field);
+            }
+            teardown_stack.resize(stack_base);
+            return;
+        }
+        budget--;
+
+        auto* object = teardown_stack.back();
+        teardown_stack.pop_back();
+
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        auto field_length = object->get_field_length();
+        for (size_t field_index = 0; field_index < field_length; field_index++) {
+            auto* field_object = *(field_start_ptr + field_index);
+            if (field_object != nullptr && release_field(field_object)) {
+                teardown_stack.push_back(field_object);
+            }
+        }
+        free_dead_heap_object(object);
+    }
+}
+
+
+/**
+ * ワーカーの数を変更する(0 の場合は並列に解放しない)
+ * 処理中の解放は全て終えてから変更する
+ * 他のスレッドがオブジェクトを解放していない時に呼び出す必要がある
+ */
+inline void parallel_teardown_set_worker_count(size_t worker_count) {
+    parallel_teardown_pool.set_worker_count(worker_count);
+}
+
+/**
+ * ワーカーへ渡した全ての解放が終わるまで待機する
+ */
+inline void parallel_teardown_wait() {
+    parallel_teardown_pool.wait_all();
+}
+
+#else
+
+/**
+ * 並列に解放しない場合は何もしない
+ */
+inline void parallel_teardown_wait() {}
+
+#endif
@@ -0,0 +1,585 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <algorithm>
+#include <atomic>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include "heap_object.hpp"
+#include "dynamic_rc.hpp"
+#include "thread_safe_rc.hpp"
+
+using namespace std;
+
+
+/**
+ * ハンドルの API(set_object / get_object / lock / unlock)の上に構築したコンテナ
+ *  + SharedQueue  : 複数の生産者と消費者から使用できるキュー
+ *  + ShardedMap   : キーで分割したシャードごとにロックするハッシュマップ
+ *  + SharedVector : 末尾に追加できる配列
+ *
+ * コンテナ自体も HeapObject のグラフであり、要素はハンドル RC のオブジェクトである。
+ * コンテナのハンドル(handle())は通常のハンドルと同じく他のオブジェクトのフィールドへ挿入できる。
+ *
+ * >>> モードの切り替え
+ * RC が DynamicRC の場合、コンテナを構成するオブジェクトは通常のオブジェクトと同じく is_mutex を持ち、
+ * mutex なオブジェクトのフィールドへ挿入(公開)されるまでは set_object / get_object が通常の命令で行われる。
+ * 書き込みを保護するロックも、コンテナの根のオブジェクトの is_mutex が false であれば取得しない。
+ * is_mutex が false のオブジェクトは一つのスレッドからしか触れられず、公開したスレッドは自身が true にしたことを必ず観測し、
+ * 他のスレッドは公開後にしかコンテナに到達できないため、ロックを取得するかどうかの判定に同期処理は必要ない。
+ * RC が ThreadSafeRC の場合は常にロックを取得する(比較用)。
+ * LAZY_MUTEX_PROMOTION が true の場合、publish_object で公開したコンテナは is_mutex が false のまま共有されるため、
+ * コンテナは set_object で挿入して公開する必要がある。
+ *
+ * >>> 読み込み
+ * 読み込み(SharedVector::get、ShardedMap::find)はロックを取得せず、get_object でフィールドを辿る。
+ * 書き込みはロックの内側で行い、辿っている途中のオブジェクトを書き換えずに新しいオブジェクトを作成して入れ替える
+ * (配列の拡張、ハッシュ表の再構築)か、一つのフィールドの入れ替えで済ませる(要素の挿入、削除)ため、
+ * 読み込み側は常に一貫した状態を辿る。取り除かれたオブジェクトは辿っているスレッドがハンドルを持つ間は解放されない。
+ *
+ * >>> 制限
+ * COMPACT_HEAP_OBJECT_HEADER が true の場合、オブジェクトのフィールドの長さは HEAP_OBJECT_MAX_FIELD_LENGTH までである。
+ * ShardedMap はシャードごとのバケット数をそれ以上に増やさず、連結リストを長くする。
+ * SharedVector はストレージをそれ以上に拡張せず、超えた分の要素を同じ長さのセグメントの列(二段の配列)へ格納する。
+ * セグメントの列もその長さまでであるため、HEAP_OBJECT_MAX_FIELD_LENGTH * (HEAP_OBJECT_MAX_FIELD_LENGTH + 1) 個を超える要素は
+ * 追加できない(push_back は false を返す)。
+ */
+
+
+//SharedVector の最初の容量
+#define SHARED_VECTOR_INITIAL_CAPACITY 8
+
+//ShardedMap のシャードの数(2の累乗)
+#define SHARDED_MAP_SHARD_COUNT 16
+
+//ShardedMap のシャードごとの最初のバケット数(2の累乗)
+#define SHARDED_MAP_INITIAL_BUCKET_COUNT 8
+
+static_assert((SHARDED_MAP_SHARD_COUNT & (SHARDED_MAP_SHARD_COUNT - 1)) == 0, "SHARDED_MAP_SHARD_COUNT must be a power of two");
+static_assert((SHARDED_MAP_INITIAL_BUCKET_COUNT & (SHARDED_MAP_INITIAL_BUCKET_COUNT - 1)) == 0, "SHARDED_MAP_INITIAL_BUCKET_COUNT must be a power of two");
+
+
+/**
+ * コンテナのオブジェクトが複数のスレッドからアクセスされうるかどうか
+ */
+template<typename RC>
+inline bool container_is_shared(const RC& rc) {
+    if constexpr (is_same_v<RC, DynamicRC>) {
+        return rc.get_heap_object()->get_is_mutex();
+    } else {
+        return true;
+    }
+}
+
+/**
+ * ペイロードの先頭の size_t を atomic に読み書きする
+ * ロックの内側で書き換え、ロックを取得しない読み込みからも読まれる
+ */
+template<typename RC>
+inline atomic_size_t* container_counter(RC& rc) {
+    return (atomic_size_t*) rc.get_payload();
+}
+
+
+/**
+ * コンテナのオブジェクトが複数のスレッドからアクセスされうる場合にのみ、ヘッダのスピンロックを取得する
+ * 取得したかどうかを覚えておき、同じ判定で解放する
+ */
+template<typename RC>
+class ContainerLockGuard {
+
+private:
+    RC& rc;
+    bool is_locked;
+
+public:
+    inline explicit ContainerLockGuard(RC& rc) : rc(rc), is_locked(container_is_shared(rc)) {
+        if (this->is_locked) {
+            this->rc.lock();
+        }
+    }
+
+    inline ~ContainerLockGuard() {
+        if (this->is_locked) {
+            this->rc.unlock();
+        }
+    }
+
+    ContainerLockGuard(const ContainerLockGuard&) = delete;
+    ContainerLockGuard& operator=(const ContainerLockGuard&) = delete;
+
+};
+
+
+/**
+ * 複数の生産者と消費者から使用できるキュー
+ * 先頭と末尾を別々のロックで保護する二つのロックのキュー(Michael and Scott, 1996)であり、
+ * 先頭には常に値を持たない番兵の要素がある。
+ *
+ * 根のオブジェクト : 0番目のフィールドが先頭(番兵)の要素、1番目のフィールドが末尾の要素、2番目のフィールドが末尾のロック用のオブジェクト
+ *                    先頭のロックには根のオブジェクトのスピンロックを使用する
+ * 要素            : 0番目のフィールドが値、1番目のフィールドが次の要素
+ *
+ * 参考
+ *  + Maged M. Michael and Michael L. Scott, "Simple, Fast, and Practical Non-Blocking and Blocking Concurrent Queue Algorithms" (1996)
+ */
+template<typename RC = DynamicRC>
+class SharedQueue {
+
+private:
+    //根のオブジェクト
+    RC rc;
+    //末尾のロック用のオブジェクト(根の2番目のフィールドと同じ)
+    RC tail_lock;
+
+    static inline RC create_root() {
+        RC root(alloc_heap_object(3));
+        RC sentinel(alloc_heap_object(2));
+        root.set_object(0, sentinel);
+        root.set_object(1, move(sentinel));
+        root.set_object(2, RC(alloc_heap_object(0)));
+        return root;
+    }
+
+public:
+    /**
+     * 空のキューを作成
+     */
+    inline SharedQueue() : rc(create_root()), tail_lock(this->rc.get_object(2).value()) {}
+
+    /**
+     * 既存のキューのハンドルを包む
+     */
+    inline explicit SharedQueue(RC rc) : rc(move(rc)), tail_lock(this->rc.get_object(2).value()) {}
+
+    /**
+     * 末尾へ値を追加する
+     */
+    inline void push(optional<RC> value) {
+        RC node(alloc_heap_object(2));
+        node.set_object(0, move(value));
+
+        //末尾のロックは根のオブジェクトと同じモードで取得する
+        bool is_shared = container_is_shared(this->rc);
+        if (is_shared) {
+            this->tail_lock.lock();
+        }
+        auto tail = this->rc.get_object(1).value();
+        //末尾の要素が mutex であれば、挿入時に node 以下の is_mutex が伝搬される
+        tail.set_object(1, node);
+        this->rc.set_object(1, move(node));
+        if (is_shared) {
+            this->tail_lock.unlock();
+        }
+    }
+
+    /**
+     * 先頭から値を取り出す
+     * キューが空であれば false を返す(値が nullopt の要素を取り出した場合は true を返して value に nullopt を書き込む)
+     */
+    inline bool pop(optional<RC>& value) {
+        ContainerLockGuard<RC> guard(this->rc);
+
+        auto head = this->rc.get_object(0).value();
+        auto next = head.get_object(1);
+        if (!next.has_value()) {
+            return false;
+        }
+        //次の要素が新しい番兵となるため、値を取り出してから先頭を進める
+        value = next.value().get_object(0);
+        next.value().set_object(0, nullopt);
+        this->rc.set_object(0, move(next));
+        return true;
+    }
+
+    /**
+     * 包んでいるハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+};
+
+
+/**
+ * キーで分割したシャードごとにロックするハッシュマップ
+ * キーは uint64_t、値はハンドル RC のオブジェクト若しくは nullopt である。
+ *
+ * 根のオブジェクト : SHARDED_MAP_SHARD_COUNT 個のフィールドがそれぞれシャードを指す
+ * シャード        : 0番目のフィールドがバケットの配列、ペイロードが要素数
+ * バケットの配列  : バケットの数のフィールドがそれぞれ要素の連結リストの先頭を指す
+ * 要素            : 0番目のフィールドが値、1番目のフィールドが次の要素、ペイロードがキー
+ *
+ * 書き込みはシャードのスピンロックの内側で行う。
+ * 要素数がバケットの数を超えた場合は、2倍の大きさのバケットの配列と新しい要素を作成して入れ替えるため、
+ * 古い配列を辿っている読み込みは入れ替える前の状態を最後まで辿れる。
+ */
+template<typename RC = DynamicRC>
+class ShardedMap {
+
+private:
+    //根のオブジェクト
+    RC rc;
+
+    static inline size_t hash(uint64_t key) {
+        return (size_t) ((key ^ (key >> 29)) * 0x9E3779B97F4A7C15ull);
+    }
+
+    static inline uint64_t get_key(RC& entry) {
+        return *(uint64_t*) entry.get_payload();
+    }
+
+    static inline RC create_entry(uint64_t key, optional<RC> value, optional<RC> next) {
+        RC entry(alloc_heap_object(ObjectLayout { 2, sizeof(uint64_t) }));
+        *(uint64_t*) entry.get_payload() = key;
+        entry.set_object(0, move(value));
+        entry.set_object(1, move(next));
+        return entry;
+    }
+
+    static inline RC create_root() {
+        RC root(alloc_heap_object(SHARDED_MAP_SHARD_COUNT));
+        for (size_t i = 0; i < SHARDED_MAP_SHARD_COUNT; i++) {
+            RC shard(alloc_heap_object(ObjectLayout { 1, sizeof(size_t) }));
+            shard.set_object(0, RC(alloc_heap_object(SHARDED_MAP_INITIAL_BUCKET_COUNT)));
+            root.set_object(i, move(shard));
+        }
+        return root;
+    }
+
+    inline RC get_shard(size_t key_hash) {
+        //上位ビットでシャードを、下位ビットでバケットを選ぶ
+        return this->rc.get_object(key_hash >> (64 - __builtin_ctzll(SHARDED_MAP_SHARD_COUNT))).value();
+    }
+
+    /**
+     * バケットの数を2倍にしたバケットの配列を作成して入れ替える
+     * シャードのロックの内側で呼び出す
+     */
+    static inline void grow(RC& shard, RC& buckets) {
+        auto bucket_count = buckets.get_heap_object()->get_field_length();
+        RC new_buckets(alloc_heap_object(bucket_count * 2));
+
+        for (size_t i = 0; i < bucket_count; i++) {
+            for (auto entry = buckets.get_object(i); entry.has_value(); entry = entry.value().get_object(1)) {
+                auto key = get_key(entry.value());
+                auto new_index = hash(key) & (bucket_count * 2 - 1);
+                //新しい要素は公開前であるため、ローカルなまま組み立てる
+                new_buckets.set_object(new_index, create_entry(key, entry.value().get_object(0), new_buckets.get_object(new_index)));
+            }
+        }
+
+        //この set_object により、組み立てた配列以下の is_mutex が伝搬されてから公開される
+        shard.set_object(0, move(new_buckets));
+    }
+
+public:
+    /**
+     * 空のハッシュマップを作成
+     */
+    inline ShardedMap() : rc(create_root()) {}
+
+    /**
+     * 既存のハッシュマップのハンドルを包む
+     */
+    inline explicit ShardedMap(RC rc) : rc(move(rc)) {}
+
+    /**
+     * key の値を取得する
+     * 見つからなければ false を返す(値が nullopt の場合は true を返して value に nullopt を書き込む)
+     * ロックは取得しない
+     */
+    inline bool find(uint64_t key, optional<RC>& value) {
+        auto key_hash = hash(key);
+        auto buckets = this->get_shard(key_hash).get_object(0).value();
+        auto bucket_index = key_hash & (buckets.get_heap_object()->get_field_length() - 1);
+
+        for (auto entry = buckets.get_object(bucket_index); entry.has_value(); entry = entry.value().get_object(1)) {
+            if (get_key(entry.value()) == key) {
+                value = entry.value().get_object(0);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * key の値を value にする(無ければ追加する)
+     */
+    inline void insert_or_assign(uint64_t key, optional<RC> value) {
+        auto key_hash = hash(key);
+        auto shard = this->get_shard(key_hash);
+        ContainerLockGuard<RC> guard(shard);
+
+        auto buckets = shard.get_object(0).value();
+        auto bucket_count = buckets.get_heap_object()->get_field_length();
+        auto bucket_index = key_hash & (bucket_count - 1);
+
+        for (auto entry = buckets.get_object(bucket_index); entry.has_value(); entry = entry.value().get_object(1)) {
+            if (get_key(entry.value()) == key) {
+                entry.value().set_object(0, move(value));
+                return;
+            }
+        }
+
+        //連結リストの先頭へ追加する
+        buckets.set_object(bucket_index, create_entry(key, move(value), buckets.get_object(bucket_index)));
+
+        auto count = container_counter(shard)->load(memory_order_relaxed) + 1;
+        container_counter(shard)->store(count, memory_order_relaxed);
+        if (count > bucket_count) {
+            #if COMPACT_HEAP_OBJECT_HEADER
+                //ヘッダに格納できない大きさには拡張せず、連結リストを長くする
+                if (bucket_count * 2 > HEAP_OBJECT_MAX_FIELD_LENGTH) {
+                    return;
+                }
+            #endif
+            grow(shard, buckets);
+        }
+    }
+
+    /**
+     * key の要素を削除し、削除した場合は true を返す
+     */
+    inline bool erase(uint64_t key) {
+        auto key_hash = hash(key);
+        auto shard = this->get_shard(key_hash);
+        ContainerLockGuard<RC> guard(shard);
+
+        auto buckets = shard.get_object(0).value();
+        auto bucket_index = key_hash & (buckets.get_heap_object()->get_field_length() - 1);
+
+        optional<RC> previous;
+        auto entry = buckets.get_object(bucket_index);
+        while (entry.has_value()) {
+            auto next = entry.value().get_object(1);
+            if (get_key(entry.value()) == key) {
+                //一つ前のフィールドを次の要素に入れ替えて切り離す
+                //取り除いた要素の次の要素は変更しないため、辿っている途中の読み込みはそのまま進める
+                if (previous.has_value()) {
+                    previous.value().set_object(1, move(next));
+                } else {
+                    buckets.set_object(bucket_index, move(next));
+                }
+                container_counter(shard)->store(container_counter(shard)->load(memory_order_relaxed) - 1, memory_order_relaxed);
+                return true;
+            }
+            previous = move(entry);
+            entry = move(next);
+        }
+        return false;
+    }
+
+    /**
+     * 要素数を取得
+     * 他のスレッドが書き換えている間は、その時点のおおよその値となる
+     */
+    inline size_t size() {
+        size_t count = 0;
+        for (size_t i = 0; i < SHARDED_MAP_SHARD_COUNT; i++) {
+            auto shard = this->rc.get_object(i).value();
+            count += container_counter(shard)->load(memory_order_relaxed);
+        }
+        return count;
+    }
+
+    /**
+     * 包んでいるハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+};
+
+
+/**
+ * 末尾に追加できる配列
+ *
+ * 根のオブジェクト : 0番目のフィールドが要素を格納するオブジェクト(ストレージ)、1番目のフィールドがセグメントの列、ペイロードが要素数
+ * ストレージ      : 容量の数のフィールドがそれぞれ要素を指す
+ * セグメントの列  : それぞれのフィールドがセグメントを指す(COMPACT_HEAP_OBJECT_HEADER が true の場合のみ使用する)
+ * セグメント      : HEAP_OBJECT_MAX_FIELD_LENGTH 個のフィールドがそれぞれ要素を指す
+ *
+ * 書き込みは根のオブジェクトのスピンロックの内側で行う。
+ * 容量が足りない場合は、2倍の容量のストレージへ要素をコピーしてから入れ替える。
+ * COMPACT_HEAP_OBJECT_HEADER が true の場合、ストレージは HEAP_OBJECT_MAX_FIELD_LENGTH までしか拡張せず、
+ * それ以降の要素はセグメントへ格納する(ShardedMap がバケット数を増やすのを止めるのと同じ制限による)。
+ * セグメントは一度作成すれば入れ替えず、セグメントの列のみをストレージと同じく2倍の長さにコピーして入れ替える。
+ * 要素数はストレージへ書き込んだ後に release で増やし、読み込み側は acquire で読むため、
+ * 要素数の範囲内の要素は必ず書き込まれている。
+ */
+template<typename RC = DynamicRC>
+class SharedVector {
+
+private:
+    //根のオブジェクト
+    RC rc;
+
+    static inline RC create_root() {
+        RC root(alloc_heap_object(ObjectLayout { 2, sizeof(size_t) }));
+        root.set_object(0, RC(alloc_heap_object(SHARED_VECTOR_INITIAL_CAPACITY)));
+        return root;
+    }
+
+    /**
+     * index 番目の要素を格納しているオブジェクトを取得し、index をその中のフィールドの番号に書き換える
+     * index は要素数の範囲内である必要がある
+     */
+    inline RC get_storage(size_t& index) {
+        #if COMPACT_HEAP_OBJECT_HEADER
+            if (index >= HEAP_OBJECT_MAX_FIELD_LENGTH) {
+                index -= HEAP_OBJECT_MAX_FIELD_LENGTH;
+                auto segments = this->rc.get_object(1).value();
+                auto segment = segments.get_object(index / HEAP_OBJECT_MAX_FIELD_LENGTH).value();
+                index %= HEAP_OBJECT_MAX_FIELD_LENGTH;
+                return segment;
+            }
+        #endif
+        return this->rc.get_object(0).value();
+    }
+
+#if COMPACT_HEAP_OBJECT_HEADER
+    /**
+     * ストレージに収まらない length 番目の要素として value を追加する
+     * セグメントの列が最大の長さに達していれば、何もせずに false を返す
+     * 根のオブジェクトのロックの内側で呼び出す
+     */
+    inline bool push_back_segment(size_t length, optional<RC>&& value) {
+        auto offset = length - HEAP_OBJECT_MAX_FIELD_LENGTH;
+        auto segment_index = offset / HEAP_OBJECT_MAX_FIELD_LENGTH;
+        auto field_index = offset % HEAP_OBJECT_MAX_FIELD_LENGTH;
+        auto segments = this->rc.get_object(1);
+
+        if (field_index != 0) {
+            //作成済みのセグメントの空いているフィールドへ挿入する
+            segments.value().get_object(segment_index).value().set_object(field_index, move(value));
+            return true;
+        }
+
+        //新しいセグメントは公開前であるため、ローカルなまま要素を挿入する
+        RC segment(alloc_heap_object(HEAP_OBJECT_MAX_FIELD_LENGTH));
+        segment.set_object(0, move(value));
+
+        size_t segment_count = segments.has_value() ? segments.value().get_heap_object()->get_field_length() : 0;
+        if (segment_index < segment_count) {
+            segments.value().set_object(segment_index, move(segment));
+            return true;
+        }
+        if (segment_count == HEAP_OBJECT_MAX_FIELD_LENGTH) {
+            return false;
+        }
+
+        //セグメントの列を拡張する(セグメント自体はコピーせず、参照を移すだけである)
+        auto new_segment_count = segment_count == 0 ? (size_t) SHARED_VECTOR_INITIAL_CAPACITY : min(segment_count * 2, (size_t) HEAP_OBJECT_MAX_FIELD_LENGTH);
+        RC new_segments(alloc_heap_object(new_segment_count));
+        for (size_t i = 0; i < segment_count; i++) {
+            new_segments.set_object(i, segments.value().get_object(i));
+        }
+        new_segments.set_object(segment_index, move(segment));
+        //この set_object により、新しいセグメントの列以下の is_mutex が伝搬されてから公開される
+        this->rc.set_object(1, move(new_segments));
+        return true;
+    }
+#endif
+
+public:
+    /**
+     * 空の配列を作成
+     */
+    inline SharedVector() : rc(create_root()) {}
+
+    /**
+     * 既存の配列のハンドルを包む
+     */
+    inline explicit SharedVector(RC rc) : rc(move(rc)) {}
+
+    /**
+     * 要素数を取得
+     */
+    inline size_t size() {
+        return container_counter(this->rc)->load(memory_order_acquire);
+    }
+
+    /**
+     * index 番目の要素を取得する
+     * 要素数の範囲外であれば nullopt を返す
+     * ロックは取得しない
+     */
+    inline optional<RC> get(size_t index) {
+        //要素数を先に読むことで、読み込んだストレージには要素数の範囲の要素が必ず含まれる
+        if (index >= this->size()) {
+            return nullopt;
+        }
+        auto storage = this->get_storage(index);
+        return storage.get_object(index);
+    }
+
+    /**
+     * index 番目の要素を value にする
+     * 要素数の範囲外であれば何もせずに false を返す
+     */
+    inline bool set(size_t index, optional<RC> value) {
+        ContainerLockGuard<RC> guard(this->rc);
+
+        if (index >= container_counter(this->rc)->load(memory_order_relaxed)) {
+            return false;
+        }
+        this->get_storage(index).set_object(index, move(value));
+        return true;
+    }
+
+    /**
+     * 末尾へ要素を追加する
+     * 追加できる要素数の上限(COMPACT_HEAP_OBJECT_HEADER が true の場合のみ存在する)に達していれば、何もせずに false を返す
+     */
+    inline bool push_back(optional<RC> value) {
+        ContainerLockGuard<RC> guard(this->rc);
+
+        auto length = container_counter(this->rc)->load(memory_order_relaxed);
+        #if COMPACT_HEAP_OBJECT_HEADER
+            //ストレージがヘッダに格納できる最大の容量に達していれば、セグメントへ追加する
+            if (length >= HEAP_OBJECT_MAX_FIELD_LENGTH) {
+                if (!this->push_back_segment(length, move(value))) {
+                    return false;
+                }
+                container_counter(this->rc)->store(length + 1, memory_order_release);
+                return true;
+            }
+        #endif
+        auto storage = this->rc.get_object(0).value();
+        auto capacity = storage.get_heap_object()->get_field_length();
+
+        if (length == capacity) {
+            auto new_capacity = capacity * 2;
+            #if COMPACT_HEAP_OBJECT_HEADER
+                //ヘッダに格納できる最大の容量までは拡張する
+                new_capacity = min(new_capacity, (size_t) HEAP_OBJECT_MAX_FIELD_LENGTH);
+            #endif
+            //新しいストレージは公開前であるため、ローカルなまま要素をコピーする
+            RC new_storage(alloc_heap_object(new_capacity));
+            for (size_t i = 0; i < length; i++) {
+                new_storage.set_object(i, storage.get_object(i));
+            }
+            new_storage.set_object(length, move(value));
+            //この set_object により、新しいストレージの is_mutex が伝搬されてから公開される
+            this->rc.set_object(0, move(new_storage));
+        } else {
+            storage.set_object(length, move(value));
+        }
+
+        container_counter(this->rc)->store(length + 1, memory_order_release);
+        return true;
+    }
+
+    /**
+     * 包んでいるハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+};
@@ -23,8 +23,45 @@ public:
      */
     inline SingleThreadRC(const SingleThreadRC& rc) {
         auto* object_ref = rc.object_ref;
-        object_ref->reference_count++;
         this->object_ref = object_ref;
+        //ムーブ済みであれば空のハンドルとなる
+        if (object_ref == nullptr) {
+            return;
+        }
+        object_ref->increment_reference_count();
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空のハンドルとなり、以降はコピー、代入、破棄のみ行える(get_object、set_object、get_payload 等は呼び出してはならない)
+     */
+    inline SingleThreadRC(SingleThreadRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     * 代入するオブジェクトの参照カウントを一つ増やし、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline SingleThreadRC& operator=(const SingleThreadRC& rc) {
+        SingleThreadRC copied(rc);
+        swap(this->object_ref, copied.object_ref);
+        //元のオブジェクトは copied のデストラクタで参照カウントが一つ減らされる
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * 代入するオブジェクトの参照カウントは変更せず、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline SingleThreadRC& operator=(SingleThreadRC&& rc) noexcept {
+        SingleThreadRC moved(move(rc));
+        swap(this->object_ref, moved.object_ref);
+        //元のオブジェクトは moved のデストラクタで参照カウントが一つ減らされる
+        return *this;
     }
 
     /**
@@ -32,41 +69,33 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~SingleThreadRC() {
-        //参照カウントを一つ減らす
-        size_t previous_ref_count = this->object_ref->reference_count--;
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
 
         //減らした結果が0であれば削除処理を実行
-        if (previous_ref_count == 1) {
-            auto field_length = this->object_ref->field_length;
-            //フィールドの開始ポインタ
-            auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
-
-            //フィールドに格納されている全オブジェクトの参照カウントを一つ減らす
-            for (size_t field_index = 0; field_index < field_length; field_index++) {
-                //対象となるフィールドのポインタ
-                auto** field_ptr = field_start_ptr + field_index;
-                //フィールドの内容をロード
-                auto* field_object = *field_ptr;
-
-                if (field_object != nullptr) {
-                    //デストラクタを呼び出し、参照カウントを一つ減らす
-                    SingleThreadRC rc(field_object);
-                }
-            }
-
-            free(this->object_ref);
-
-
-            #if RC_VALIDATION
-                //生存しているオブジェクト数を一つ減らす
-                global_object_count.fetch_sub(1, memory_order_relaxed);
-            #endif
+        if (release_reference(this->object_ref)) {
+            //フィールド以下のオブジェクトの参照カウントを減らしながら解放する
+            //再帰呼び出しを行わないため、深いオブジェクトでもスタックは溢れない
+            free_heap_object_graph(this->object_ref, release_reference);
         }
     }
 
 
+    /**
+     * オブジェクトの参照カウントを一つ減らし、減らした後の参照カウントが0であれば true を返す
+     */
+    static inline bool release_reference(HeapObject* object_ref) {
+        //参照カウントを一つ減らす
+        size_t previous_ref_count = object_ref->decrement_reference_count();
+        return previous_ref_count == 1;
+    }
+
+
     /**
      * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc の所有権はフィールドへ移る(ムーブして渡せば参照カウントの増減は発生しない)
      */
     inline void set_object(size_t field_index, optional<SingleThreadRC> rc) {
         //rc が nullopt であれば nullptr
@@ -74,6 +103,9 @@ public:
         HeapObject* object = nullptr;
         if (rc.has_value()) {
             object = rc.value().object_ref;
+            //rc から所有権を受け取る
+            //参照カウントは rc の作成時(コピー時)に既に増えているため、ここでは変更しない
+            rc.value().object_ref = nullptr;
         }
 
         //フィールドの開始ポインタ
@@ -81,11 +113,6 @@ public:
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //参照カウントを一つ増やす
-            object->reference_count++;
-        }
-        
         //フィールド内へ既に挿入されているオブジェクトを取得
         auto* field_old_object = *field_ptr;
         //フィールドへ挿入
@@ -111,7 +138,7 @@ public:
         auto* field_object = *field_ptr;
         if (field_object != nullptr) {
             //参照カウントを一つ増やす
-            field_object->reference_count++;
+            field_object->increment_reference_count();
         }
 
         if (field_object == nullptr) {
@@ -121,5 +148,29 @@ public:
         }
     }
 
+    /**
+     * オブジェクトのペイロード(ポインタでない値を格納する領域)の開始ポインタを取得
+     */
+    inline void* get_payload() {
+        return this->object_ref->get_payload();
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+    /**
+     * 参照カウントを変更せずに所有権を手放し、オブジェクト本体へのポインタを返す
+     * 返したポインタの参照カウントは呼び出し元が責任を持って減らす必要がある
+     */
+    inline HeapObject* release_heap_object() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
+
 };
 
@@ -0,0 +1,630 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <atomic>
+#include <mutex>
+
+using namespace std;
+
+
+//スラブ(まとめて確保してから切り分けるメモリ領域)一つあたりの大きさ
+//スラブはこの大きさでアラインして確保するため、オブジェクトのアドレスからスラブの先頭(ヘッダ)を求めることができる
+#define SLAB_SIZE (64 * 1024)
+
+//スラブアロケータで扱う最大のオブジェクトの大きさ
+//これより大きいオブジェクトは malloc/free で確保、解放する
+#define SLAB_MAX_OBJECT_SIZE 1024
+
+//サイズクラスの数(8バイト単位)
+#define SLAB_SIZE_CLASS_COUNT (SLAB_MAX_OBJECT_SIZE / 8 + 1)
+
+//スレッドローカルなフリーリストに保持するオブジェクト数の上限
+//これを超えた場合は SLAB_TRANSFER_BATCH_SIZE 個をグローバルなフリーリストへ返す
+#define SLAB_LOCAL_FREE_LIST_LIMIT 1024
+
+//スラブから一度に切り出すオブジェクト数、及びスレッドローカルなフリーリストからグローバルなフリーリストへ一度に返すオブジェクト数
+#define SLAB_TRANSFER_BATCH_SIZE 256
+
+//他のスレッドが所有するオブジェクトを解放する際に、リモート解放キューへまとめて追加するオブジェクト数の上限
+#define SLAB_REMOTE_FREE_BATCH_SIZE 64
+
+
+/**
+ * 解放された領域に書き込むフリーリストのノード
+ * 解放済みのオブジェクト自身の領域を使ってリストを繋ぐため、追加のメモリは必要ない
+ *
+ * オブジェクトはまとまり(バッチ)単位でスレッド間を移動する。
+ * バッチは next で繋がったリストであり、その先頭のノードだけが batch_count と batch_tail を持つ。
+ * バッチの末尾の next は次のバッチの先頭を指すため、複数のバッチを繋いだものもそのまま一つのリストとして扱える上に、
+ * 全てのノードを辿らずにバッチの先頭だけを辿って個数と末尾を求めることができる。
+ */
+struct SlabFreeNode {
+    SlabFreeNode* next;
+    //(バッチの先頭のみ)バッチに含まれるノードの数
+    size_t batch_count;
+    //(バッチの先頭のみ)バッチの末尾のノード
+    SlabFreeNode* batch_tail;
+};
+
+
+//所有者のスレッドが終了しており、リモート解放キューが閉じられていることを表す値
+#define SLAB_REMOTE_FREE_CLOSED ((SlabFreeNode*) 1)
+
+
+/**
+ * スラブを所有するスレッドの情報
+ *
+ * 他のスレッドで解放されたオブジェクトを所有者のスレッドへ返すためのキュー(リモート解放キュー)をサイズクラスごとに持つ。
+ * キューは複数のスレッドが追加し所有者のスレッドだけが取り出す lock-free な MPSC キューで、
+ * 追加はバッチを先頭へ CAS で繋げ、取り出しは先頭の exchange により全てのバッチをまとめて取得する。
+ * 取り出す側は一つであり、リスト全体を一度に取得するため ABA 問題は発生しない。
+ *
+ * スレッドの終了後も他のスレッドから参照され続けるため破棄せず、新しく起動したスレッドが再利用する。
+ */
+struct SlabOwner {
+    //サイズクラスごとのリモート解放キューの先頭
+    //所有者のスレッドが終了している場合は SLAB_REMOTE_FREE_CLOSED
+    atomic<SlabFreeNode*> remote_free_head[SLAB_SIZE_CLASS_COUNT] = {};
+    //サイズクラスごとの、現在切り出しているスラブの未使用領域
+    //スレッドの終了後は再利用したスレッドが引き続き切り出す
+    char* slab_cursor[SLAB_SIZE_CLASS_COUNT] = {};
+    char* slab_end[SLAB_SIZE_CLASS_COUNT] = {};
+    //再利用を待っている SlabOwner のリスト
+    SlabOwner* next_free_owner = nullptr;
+};
+
+
+/**
+ * スラブの先頭に置くヘッダ
+ * スラブはサイズクラスごとに分かれており、一つのスラブからは同じ大きさのオブジェクトだけが切り出される
+ */
+struct alignas(64) SlabHeader {
+    //このスラブを所有するスレッド
+    //nullptr の場合はどのスレッドにも所有されておらず、解放したスレッドのフリーリストへ入れる
+    SlabOwner* owner;
+    //このスラブのサイズクラス
+    size_t size_class;
+};
+
+
+/**
+ * サイズクラスごとのグローバルなフリーリスト
+ *
+ * 全てのスレッドで共有され、mutex で保護される。
+ * スレッドローカルなフリーリストが空になった場合はここからバッチを一つ取得し、溢れた場合はここへバッチとして返す。
+ * 終了したスレッドのフリーリストもここへ返される。
+ * また、終了処理後のスレッドのために、どのスレッドにも所有されないスラブからの切り出しもここで行う。
+ */
+struct SlabGlobalPool {
+    mutex pool_mutex;
+    //解放済みのオブジェクトのバッチのリスト
+    SlabFreeNode* batches = nullptr;
+    //現在切り出している、どのスレッドにも所有されないスラブの未使用領域
+    char* slab_cursor = nullptr;
+    char* slab_end = nullptr;
+};
+
+
+/**
+ * スレッドごとのキャッシュ
+ *
+ * 確保と解放の大部分はここで同期処理なしに完結する。
+ * 自明なデストラクタしか持たない型にすることで、スレッドの終了処理の順序に関わらず最後まで参照できるようにしている。
+ * (例えば、メインスレッドではグローバル変数のデストラクタが thread_local のデストラクタより後に呼ばれる)
+ */
+struct SlabThreadCache {
+    //サイズクラスごとの解放済みのオブジェクトのリスト
+    SlabFreeNode* free_list[SLAB_SIZE_CLASS_COUNT] = {};
+    //サイズクラスごとの free_list の末尾(free_list が空の場合は不定)
+    //先頭からしか追加、取得しないため、空でない間は変わらない
+    SlabFreeNode* free_tail[SLAB_SIZE_CLASS_COUNT] = {};
+    //サイズクラスごとの free_list に入っているオブジェクト数
+    size_t free_count[SLAB_SIZE_CLASS_COUNT] = {};
+    //free_count がこれを超えたら slab_free_slow を呼び出す
+    //初期値を0にしておくことで、最初の解放時に終了処理の登録を行う
+    size_t free_limit = 0;
+    //このスレッドの所有者情報(終了処理の登録時に設定される)
+    SlabOwner* owner = nullptr;
+    //他のスレッドが所有する、まだリモート解放キューへ追加していないオブジェクトのバッチ
+    //同じ所有者の同じ大きさのオブジェクトが続けて解放されることが多いため、まとめて一度の CAS で追加する
+    SlabOwner* remote_batch_owner = nullptr;
+    size_t remote_batch_size_class = 0;
+    SlabFreeNode* remote_batch_head = nullptr;
+    SlabFreeNode* remote_batch_tail = nullptr;
+    size_t remote_batch_count = 0;
+    //スレッドの終了処理によってグローバルなフリーリストへ全て返却されたかどうか
+    //返却後はグローバルなフリーリストを直接使用する
+    bool is_retired = false;
+};
+
+
+/**
+ * サイズクラスごとのグローバルなフリーリストを取得
+ * グローバル変数の初期化時やプロセス終了時の解放からも使用されるため、初めて使用された時にヒープ上に確保し、破棄しない
+ */
+inline SlabGlobalPool* slab_global_pools() {
+    static auto* pools = new SlabGlobalPool[SLAB_SIZE_CLASS_COUNT];
+    return pools;
+}
+
+/**
+ * 再利用を待っている SlabOwner のリストを保護する mutex
+ */
+inline mutex& slab_free_owners_mutex() {
+    static auto* owners_mutex = new mutex();
+    return *owners_mutex;
+}
+
+/**
+ * 再利用を待っている SlabOwner のリスト
+ */
+inline SlabOwner* slab_free_owners = nullptr;
+
+/**
+ * スレッドごとのキャッシュ
+ * 定数初期化されるため、アクセスの度に初期化済みかどうかの確認は行われない
+ */
+inline thread_local SlabThreadCache slab_thread_cache;
+
+
+/**
+ * size バイトのオブジェクトのサイズクラス
+ * フリーリストのノードを書き込めるように、最小でも SlabFreeNode の大きさとする
+ */
+inline size_t slab_size_class(size_t size) {
+    if (size < sizeof(SlabFreeNode)) {
+        size = sizeof(SlabFreeNode);
+    }
+    //8バイト単位で切り上げたものをサイズクラスとする
+    return (size + 7) / 8;
+}
+
+/**
+ * オブジェクトが属するスラブのヘッダを取得
+ */
+inline SlabHeader* slab_header_of(void* ptr) {
+    return (SlabHeader*) ((uintptr_t) ptr & ~((uintptr_t) SLAB_SIZE - 1));
+}
+
+/**
+ * 新しいスラブを確保し、cursor と end に未使用領域を設定する
+ * スラブは OS へ返却せず、切り出したオブジェクトはフリーリストを介して再利用し続ける
+ */
+inline void slab_new(SlabOwner* owner, size_t size_class, char*& cursor, char*& end) {
+    auto* header = (SlabHeader*) aligned_alloc(SLAB_SIZE, SLAB_SIZE);
+    header->owner = owner;
+    header->size_class = size_class;
+
+    cursor = (char*) (header + 1);
+    end = (char*) header + SLAB_SIZE;
+}
+
+/**
+ * スラブの未使用領域から最大 count 個のオブジェクトを切り出してリストとして返す
+ * 未使用領域が足りなければ新しいスラブを確保する
+ * 切り出したオブジェクト数は carved_count に、リストの末尾は carved_tail に格納される
+ */
+inline SlabFreeNode* slab_carve(SlabOwner* owner, size_t size_class, char*& cursor, char*& end, size_t count, size_t& carved_count, SlabFreeNode*& carved_tail) {
+    auto object_size = size_class * 8;
+
+    if ((size_t) (end - cursor) < object_size) {
+        slab_new(owner, size_class, cursor, end);
+    }
+
+    //最初に切り出したオブジェクトが末尾になる
+    carved_tail = (SlabFreeNode*) cursor;
+
+    SlabFreeNode* head = nullptr;
+    carved_count = 0;
+    while (carved_count < count && (size_t) (end - cursor) >= object_size) {
+        auto* node = (SlabFreeNode*) cursor;
+        cursor += object_size;
+        node->next = head;
+        head = node;
+        carved_count++;
+    }
+
+    return head;
+}
+
+
+/**
+ * first から last までの count 個のオブジェクトをスレッドローカルなフリーリストの先頭へ繋げる
+ */
+inline void slab_splice_local(SlabThreadCache& cache, size_t size_class, SlabFreeNode* first, SlabFreeNode* last, size_t count) {
+    if (cache.free_list[size_class] == nullptr) {
+        cache.free_tail[size_class] = last;
+    }
+    last->next = cache.free_list[size_class];
+    cache.free_list[size_class] = first;
+    cache.free_count[size_class] += count;
+}
+
+
+/**
+ * グローバルなフリーリストからバッチを一つ取得して返す
+ * 取得したオブジェクト数は taken_count に、バッチの末尾は taken_tail に格納される
+ * 空であれば nullptr を返す
+ */
+inline SlabFreeNode* slab_take_from_global(size_t size_class, size_t& taken_count, SlabFreeNode*& taken_tail) {
+    auto& pool = slab_global_pools()[size_class];
+
+    lock_guard<mutex> guard(pool.pool_mutex);
+
+    auto* batch = pool.batches;
+    if (batch == nullptr) {
+        return nullptr;
+    }
+
+    //末尾の next は次のバッチの先頭を指しているので、それを残りのリストとする
+    taken_count = batch->batch_count;
+    taken_tail = batch->batch_tail;
+    pool.batches = taken_tail->next;
+
+    return batch;
+}
+
+/**
+ * グローバルなフリーリストからオブジェクトを一つ取得する
+ * 空であればどのスレッドにも所有されないスラブから切り出す
+ */
+inline SlabFreeNode* slab_take_one_from_global(size_t size_class) {
+    auto& pool = slab_global_pools()[size_class];
+
+    lock_guard<mutex> guard(pool.pool_mutex);
+
+    auto* node = pool.batches;
+    if (node == nullptr) {
+        size_t carved_count;
+        SlabFreeNode* carved_tail;
+        return slab_carve(nullptr, size_class, pool.slab_cursor, pool.slab_end, 1, carved_count, carved_tail);
+    }
+
+    //先頭のバッチから一つ取り出す
+    //バッチに残りがあれば、次のノードを新しいバッチの先頭とする
+    if (node->batch_count > 1) {
+        node->next->batch_count = node->batch_count - 1;
+        node->next->batch_tail = node->batch_tail;
+    }
+    pool.batches = node->next;
+
+    return node;
+}
+
+/**
+ * first から last までの count 個のオブジェクトをバッチとしてグローバルなフリーリストへ返す
+ */
+inline void slab_give_to_global(size_t size_class, SlabFreeNode* first, SlabFreeNode* last, size_t count) {
+    auto& pool = slab_global_pools()[size_class];
+
+    first->batch_count = count;
+    first->batch_tail = last;
+
+    lock_guard<mutex> guard(pool.pool_mutex);
+    last->next = pool.batches;
+    pool.batches = first;
+}
+
+
+/**
+ * 所有者のリモート解放キューへ first から last までの count 個のオブジェクトをバッチとして追加
+ * キューが閉じられている(所有者のスレッドが終了している)場合は何もせずに false を返す
+ */
+inline bool slab_push_remote(SlabOwner* owner, size_t size_class, SlabFreeNode* first, SlabFreeNode* last, size_t count) {
+    auto& remote_free_head = owner->remote_free_head[size_class];
+    auto* head = remote_free_head.load(memory_order_relaxed);
+
+    first->batch_count = count;
+    first->batch_tail = last;
+
+    while (true) {
+        if (head == SLAB_REMOTE_FREE_CLOSED) {
+            return false;
+        }
+
+        last->next = head;
+        //release によりバッチの書き込みを取り出す側へ公開する
+        if (remote_free_head.compare_exchange_weak(head, first, memory_order_release, memory_order_relaxed)) {
+            return true;
+        }
+    }
+}
+
+/**
+ * まだリモート解放キューへ追加していないオブジェクトを所有者のキューへ追加する
+ * 所有者のスレッドが既に終了している場合は、このスレッドのフリーリストへ入れて再利用する
+ */
+inline void slab_flush_remote_batch(SlabThreadCache& cache) {
+    if (cache.remote_batch_head == nullptr) {
+        return;
+    }
+
+    auto size_class = cache.remote_batch_size_class;
+    if (!slab_push_remote(cache.remote_batch_owner, size_class, cache.remote_batch_head, cache.remote_batch_tail, cache.remote_batch_count)) {
+        slab_splice_local(cache, size_class, cache.remote_batch_head, cache.remote_batch_tail, cache.remote_batch_count);
+    }
+
+    cache.remote_batch_owner = nullptr;
+    cache.remote_batch_head = nullptr;
+    cache.remote_batch_tail = nullptr;
+    cache.remote_batch_count = 0;
+}
+
+/**
+ * リモート解放キューから取り出したバッチのリストをスレッドローカルなフリーリストへ繋げる
+ * バッチの先頭だけを辿って個数と末尾を求めるため、全てのノードを辿る必要はない
+ */
+inline void slab_splice_remote_batches(SlabThreadCache& cache, size_t size_class, SlabFreeNode* batches) {
+    if (batches == nullptr || batches == SLAB_REMOTE_FREE_CLOSED) {
+        return;
+    }
+
+    auto* first = batches;
+    SlabFreeNode* last = nullptr;
+    size_t total_count = 0;
+    while (batches != nullptr) {
+        total_count += batches->batch_count;
+        last = batches->batch_tail;
+        batches = last->next;
+    }
+
+    slab_splice_local(cache, size_class, first, last, total_count);
+}
+
+/**
+ * リモート解放キューに溜まっているオブジェクトをまとめて取り出し、スレッドローカルなフリーリストへ入れる
+ */
+inline void slab_drain_remote(SlabThreadCache& cache, size_t size_class) {
+    auto& remote_free_head = cache.owner->remote_free_head[size_class];
+
+    //空であれば RMW を行わない
+    if (remote_free_head.load(memory_order_relaxed) == nullptr) {
+        return;
+    }
+
+    //acquire により追加した側のバッチの書き込みを取得する
+    slab_splice_remote_batches(cache, size_class, remote_free_head.exchange(nullptr, memory_order_acquire));
+}
+
+
+/**
+ * スレッドの終了時にスレッドローカルなフリーリストを全てグローバルなフリーリストへ返し、SlabOwner を再利用できるようにする
+ */
+struct SlabThreadCacheFlusher {
+    inline ~SlabThreadCacheFlusher() {
+        auto& cache = slab_thread_cache;
+        auto* owner = cache.owner;
+
+        //他のスレッドが所有するオブジェクトを所有者へ返す
+        slab_flush_remote_batch(cache);
+
+        for (size_t size_class = 0; size_class < SLAB_SIZE_CLASS_COUNT; size_class++) {
+            //リモート解放キューを閉じ、それまでに追加されていたオブジェクトを取り出す
+            //閉じた後に他のスレッドで解放されたオブジェクトは、解放したスレッドのフリーリストへ入れられる
+            slab_splice_remote_batches(cache, size_class, owner->remote_free_head[size_class].exchange(SLAB_REMOTE_FREE_CLOSED, memory_order_acquire));
+
+            if (cache.free_list[size_class] == nullptr) {
+                continue;
+            }
+
+            //末尾を保持しているため、リスト全体を一つのバッチとして返せる
+            slab_give_to_global(size_class, cache.free_list[size_class], cache.free_tail[size_class], cache.free_count[size_class]);
+
+            cache.free_list[size_class] = nullptr;
+            cache.free_count[size_class] = 0;
+        }
+
+        //以降の解放は全て slab_free_slow を経由してグローバルなフリーリストへ返す
+        cache.is_retired = true;
+        cache.free_limit = 0;
+        cache.owner = nullptr;
+
+        //SlabOwner を再利用できるようにする
+        //スラブの未使用領域は再利用したスレッドが引き続き切り出す
+        lock_guard<mutex> guard(slab_free_owners_mutex());
+        owner->next_free_owner = slab_free_owners;
+        slab_free_owners = owner;
+    }
+};
+
+/**
+ * スレッドの終了処理を登録し、このスレッドの SlabOwner を設定する
+ */
+inline void slab_register_thread_cache(SlabThreadCache& cache) {
+    //thread_local の変数は初めて使用された時に構築され、スレッドの終了時に破棄される
+    static thread_local SlabThreadCacheFlusher flusher;
+    (void) flusher;
+
+    SlabOwner* owner;
+    {
+        //終了したスレッドの SlabOwner があれば再利用する
+        lock_guard<mutex> guard(slab_free_owners_mutex());
+        owner = slab_free_owners;
+        if (owner != nullptr) {
+            slab_free_owners = owner->next_free_owner;
+        }
+    }
+
+    if (owner == nullptr) {
+        owner = new SlabOwner();
+    } else {
+        //リモート解放キューを開き直す
+        //閉じている間に解放されたオブジェクトは、解放したスレッドのフリーリストへ入れられている
+        for (size_t size_class = 0; size_class < SLAB_SIZE_CLASS_COUNT; size_class++) {
+            owner->remote_free_head[size_class].store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    cache.owner = owner;
+    cache.free_limit = SLAB_LOCAL_FREE_LIST_LIMIT;
+}
+
+
+/**
+ * スレッドローカルなフリーリストが空の場合の確保処理
+ * 以下の順に確保を試みる
+ *  1. リモート解放キュー(他のスレッドで解放された、このスレッドが所有するオブジェクト)
+ *  2. グローバルなフリーリスト
+ *  3. このスレッドが所有するスラブから切り出す
+ */
+inline void* slab_alloc_slow(SlabThreadCache& cache, size_t size_class) {
+    if (cache.is_retired) {
+        //スレッドの終了処理後はグローバルなフリーリストから直接取得する
+        return slab_take_one_from_global(size_class);
+    }
+
+    if (cache.owner == nullptr) {
+        slab_register_thread_cache(cache);
+    }
+
+    slab_drain_remote(cache, size_class);
+
+    if (cache.free_list[size_class] == nullptr) {
+        size_t taken_count;
+        SlabFreeNode* taken_tail;
+        auto* list = slab_take_from_global(size_class, taken_count, taken_tail);
+
+        if (list == nullptr) {
+            //自身のスラブからまとめて切り出す
+            auto* owner = cache.owner;
+            list = slab_carve(owner, size_class, owner->slab_cursor[size_class], owner->slab_end[size_class], SLAB_TRANSFER_BATCH_SIZE, taken_count, taken_tail);
+        }
+
+        slab_splice_local(cache, size_class, list, taken_tail, taken_count);
+    }
+
+    //一つを返して残りはスレッドローカルなフリーリストに残す
+    auto* node = cache.free_list[size_class];
+    cache.free_list[size_class] = node->next;
+    cache.free_count[size_class]--;
+
+    return node;
+}
+
+/**
+ * スレッドローカルなフリーリストが free_limit を超えた場合の解放処理
+ */
+inline void slab_free_slow(SlabThreadCache& cache, size_t size_class) {
+    if (cache.owner == nullptr && !cache.is_retired) {
+        //このスレッドで最初の解放であれば終了処理を登録するだけ
+        slab_register_thread_cache(cache);
+        return;
+    }
+
+    auto* first = cache.free_list[size_class];
+    SlabFreeNode* last;
+    size_t count;
+    if (cache.is_retired) {
+        //終了処理後は全てをグローバルなフリーリストへ返す
+        last = cache.free_tail[size_class];
+        count = cache.free_count[size_class];
+    } else {
+        //先頭から SLAB_TRANSFER_BATCH_SIZE 個をグローバルなフリーリストへ返す
+        last = first;
+        for (size_t i = 1; i < SLAB_TRANSFER_BATCH_SIZE; i++) {
+            last = last->next;
+        }
+        count = SLAB_TRANSFER_BATCH_SIZE;
+    }
+    cache.free_list[size_class] = last->next;
+    cache.free_count[size_class] -= count;
+
+    slab_give_to_global(size_class, first, last, count);
+}
+
+
+/**
+ * 他のスレッドが所有するオブジェクトの解放処理
+ * 同じ所有者の同じ大きさのオブジェクトをまとめてから、所有者のリモート解放キューへ追加する
+ */
+inline void slab_free_remote(SlabThreadCache& cache, SlabOwner* owner, size_t size_class, SlabFreeNode* node) {
+    if (cache.is_retired) {
+        //スレッドの終了処理後はまとめずに直接追加する
+        //所有者のスレッドも終了している場合はグローバルなフリーリストへ返す
+        if (!slab_push_remote(owner, size_class, node, node, 1)) {
+            slab_give_to_global(size_class, node, node, 1);
+        }
+        return;
+    }
+
+    if (cache.owner == nullptr) {
+        //まとめたオブジェクトがスレッドの終了時に返されるように、終了処理を登録する
+        slab_register_thread_cache(cache);
+    }
+
+    if (owner != cache.remote_batch_owner || size_class != cache.remote_batch_size_class) {
+        //所有者か大きさが変わったら、それまでにまとめたオブジェクトを追加する
+        slab_flush_remote_batch(cache);
+        cache.remote_batch_owner = owner;
+        cache.remote_batch_size_class = size_class;
+    }
+
+    if (cache.remote_batch_head == nullptr) {
+        cache.remote_batch_tail = node;
+    }
+    node->next = cache.remote_batch_head;
+    cache.remote_batch_head = node;
+
+    if (++cache.remote_batch_count == SLAB_REMOTE_FREE_BATCH_SIZE) {
+        slab_flush_remote_batch(cache);
+    }
+}
+
+
+/**
+ * size バイトの領域を確保
+ */
+inline void* slab_alloc(size_t size) {
+    if (size > SLAB_MAX_OBJECT_SIZE) {
+        return malloc(size);
+    }
+
+    auto size_class = slab_size_class(size);
+    auto& cache = slab_thread_cache;
+
+    //スレッドローカルなフリーリストから取得
+    auto* node = cache.free_list[size_class];
+    if (node == nullptr) {
+        return slab_alloc_slow(cache, size_class);
+    }
+    cache.free_list[size_class] = node->next;
+    cache.free_count[size_class]--;
+
+    return node;
+}
+
+/**
+ * slab_alloc で確保した size バイトの領域を解放
+ * 確保したスレッドとは異なるスレッドから解放しても良い
+ */
+inline void slab_free(void* ptr, size_t size) {
+    if (size > SLAB_MAX_OBJECT_SIZE) {
+        free(ptr);
+        return;
+    }
+
+    auto size_class = slab_size_class(size);
+    auto& cache = slab_thread_cache;
+    auto* node = (SlabFreeNode*) ptr;
+
+    //スラブの所有者が他のスレッドであれば、所有者のリモート解放キューへ返す
+    //所有者のスレッドは次にフリーリストが空になった時にまとめて取り出して再利用する
+    auto* owner = slab_header_of(ptr)->owner;
+    if (owner != cache.owner && owner != nullptr) {
+        slab_free_remote(cache, owner, size_class, node);
+        return;
+    }
+
+    //スレッドローカルなフリーリストへ入れる
+    if (cache.free_list[size_class] == nullptr) {
+        cache.free_tail[size_class] = node;
+    }
+    node->next = cache.free_list[size_class];
+    cache.free_list[size_class] = node;
+
+    if (++cache.free_count[size_class] > cache.free_limit) {
+        slab_free_slow(cache, size_class);
+    }
+}
@@ -1,6 +1,10 @@
 #pragma once
 
 #include "heap_object.hpp"
+#include "epoch_reclamation.hpp"
+#include "deferred_rc.hpp"
+#include "parallel_teardown.hpp"
+#include "background_reclamation.hpp"
 
 
 /**
@@ -8,7 +12,8 @@
  * 
  * 基本的には『ガベージコレクション 自動的メモリ管理を構成する理論と実装』の18章「並行参照カウント法」にて取り上げられている
  * ロックを用いた単純な並行即時参照カウント法を参考に実装した。
- * ロックは単純なスピンロックを実装した。
+ * ロックはオブジェクトのヘッダを使用したスピンロック(HeapObject::spin_lock)を実装した。
+ * ただし、フィールドの読み書きはロックを使わず、エポックベースの遅延デクリメント(epoch_reclamation.hpp)を用いて行う。
  * 加えて、カウンタの増減時のメモリバリアについては以下も参考にした。
  *  + https://github.com/rust-lang/rust/blob/master/library/alloc/src/sync.rs
  *  + https://www.boost.org/doc/libs/1_55_0/doc/html/atomic/usage_examples.html
@@ -30,11 +35,51 @@ public:
      */
     inline ThreadSafeRC(const ThreadSafeRC& rc) {
         auto* object_ref = rc.object_ref;
-        //atomic_size_t として参照カウントを一つ増やす
-        //オブジェクト作成時の参照カウントの設定は atomic_size_t で行っていないが、恐らく上手く動作する(?)
-        //少なくとも AArch64 では上手く動作しているように見える
-        ((atomic_size_t*) &object_ref->reference_count)->fetch_add(1, memory_order_relaxed);
         this->object_ref = object_ref;
+        //ムーブ済みであれば空のハンドルとなる
+        if (object_ref == nullptr) {
+            return;
+        }
+#if DEFERRED_REFERENCE_COUNT
+        //バッファへ記録して増やすのを遅らせる("deferred_rc.hpp"を参照)
+        deferred_buffer_record(object_ref, 1, release_retired_reference);
+#else
+        //atomic_size_t として参照カウントを一つ増やす
+        object_ref->atomic_increment_reference_count();
+#endif
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので参照カウントは変更しない
+     * ムーブ元は空のハンドルとなり、以降はコピー、代入、破棄のみ行える(get_object、set_object、get_payload 等は呼び出してはならない)
+     */
+    inline ThreadSafeRC(ThreadSafeRC&& rc) noexcept {
+        this->object_ref = rc.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        rc.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     * 代入するオブジェクトの参照カウントを一つ増やし、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline ThreadSafeRC& operator=(const ThreadSafeRC& rc) {
+        ThreadSafeRC copied(rc);
+        swap(this->object_ref, copied.object_ref);
+        //元のオブジェクトは copied のデストラクタで参照カウントが一つ減らされる
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     * 代入するオブジェクトの参照カウントは変更せず、元のオブジェクトの参照カウントを一つ減らす
+     */
+    inline ThreadSafeRC& operator=(ThreadSafeRC&& rc) noexcept {
+        ThreadSafeRC moved(move(rc));
+        swap(this->object_ref, moved.object_ref);
+        //元のオブジェクトは moved のデストラクタで参照カウントが一つ減らされる
+        return *this;
     }
 
     /**
@@ -42,66 +87,92 @@ public:
      * 呼び出される度に参照カウントを一つ減らす
      */
     inline ~ThreadSafeRC() {
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
+#if DEFERRED_REFERENCE_COUNT
+        //バッファへ記録して減らすのを遅らせる
+        deferred_buffer_record(this->object_ref, -1, release_retired_reference);
+#else
+        release_retired_reference(this->object_ref);
+#endif
+    }
+
+
+    /**
+     * オブジェクトの参照カウントを一つ減らし、減らした後の参照カウントが0であれば true を返す
+     */
+    static inline bool release_reference(HeapObject* object_ref) {
         //参照カウントを一つ減らす
         //安全性の詳細については以下を参照
         // + https://github.com/rust-lang/rust/blob/master/library/alloc/src/sync.rs
         // + https://www.boost.org/doc/libs/1_55_0/doc/html/atomic/usage_examples.html
-        size_t previous_ref_count = ((atomic_size_t*) &this->object_ref->reference_count)->fetch_sub(1, memory_order_release);
+        size_t previous_ref_count = object_ref->atomic_decrement_reference_count();
         if (previous_ref_count != 1) {
             //減らした後の参照カウントが0でない場合は何もしない
-            return;
+            return false;
         }
 
         //他のスレッドでの変更を取得
         atomic_thread_fence(memory_order_acquire);
+        return true;
+    }
 
-        auto field_length = this->object_ref->field_length;
-        //フィールドの開始ポインタ
-        auto** field_start_ptr = (HeapObject**) (this->object_ref + 1);
-
-        //フィールドに格納されている全オブジェクトの参照カウントを一つ減らす
-        for (size_t field_index = 0; field_index < field_length; field_index++) {
-            //対象となるフィールドのポインタ
-            auto** field_ptr = field_start_ptr + field_index;
-            //フィールドの内容をロード
-            auto* field_object = *field_ptr;
 
-            if (field_object != nullptr) {
-                //デストラクタを呼び出し、参照カウントを一つ減らす
-                ThreadSafeRC rc(field_object);
+    /**
+     * フィールドから取り除かれた後、参照カウントを減らすのを遅らせていたオブジェクトの参照カウントを一つ減らす
+     * 遅延参照カウントのバッファを経由せずにその場で減らす
+     */
+    static inline void release_retired_reference(HeapObject* object_ref) {
+        if (release_reference(object_ref)) {
+#if BACKGROUND_RECLAMATION
+            //回収スレッドへ渡し、キューが一杯の場合はここで解放する("background_reclamation.hpp"を参照)
+            if (background_reclaim(object_ref, release_reference)) {
+                return;
             }
+#endif
+#if PARALLEL_TEARDOWN
+            //大きい場合はワーカーで並列に解放する("parallel_teardown.hpp"を参照)
+            free_heap_object_graph_parallel(object_ref, release_reference);
+#else
+            //減らした後の参照カウントが0である場合は、フィールド以下のオブジェクトの参照カウントを減らしながら解放する
+            //再帰呼び出しを行わないため、深いオブジェクトでもスタックは溢れない
+            free_heap_object_graph(object_ref, release_reference);
+#endif
         }
+    }
 
-        free(this->object_ref);
-
-
-        #if RC_VALIDATION
-            //生存しているオブジェクト数を一つ減らす
-            global_object_count.fetch_sub(1, memory_order_relaxed);
-        #endif
+    /**
+     * オブジェクトの参照カウントの増減を遅らせるかどうか
+     * 遅らせる場合、参照カウントはハンドルを通してのみ減らさなければならない
+     */
+    static inline bool is_deferred(HeapObject*) {
+        return DEFERRED_REFERENCE_COUNT;
     }
 
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(lock)
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(lock)
+     * 競合時の待機方法については HeapObject::spin_lock_slow を参照
      */
     inline void lock() {
-        while (this->object_ref->spin_lock_flag.test_and_set(memory_order_acquire)) {
-            //spin
-        }
+        this->object_ref->spin_lock();
     }
 
     /**
-     * オブジェクトの spin_lock_flag を使用してスピンロック(unlock)
+     * オブジェクトのヘッダのスピンロックを使用してスピンロック(unlock)
      */
     inline void unlock() {
-        this->object_ref->spin_lock_flag.clear(memory_order_release);
+        this->object_ref->spin_unlock();
     }
 
 
 
     /**
      * 指定された番号のフィールドにオブジェクト若くは nullptr を挿入
+     * rc の所有権はフィールドへ移る(ムーブして渡せば参照カウントの増減は発生しない)
      */
     inline void set_object(size_t field_index, optional<ThreadSafeRC> rc) {
         //rc が nullopt であれば nullptr
@@ -109,6 +180,9 @@ public:
         HeapObject* object = nullptr;
         if (rc.has_value()) {
             object = rc.value().object_ref;
+            //rc から所有権を受け取る
+            //参照カウントは rc の作成時(コピー時)に既に増えているため、ここでは変更しない
+            rc.value().object_ref = nullptr;
         }
 
         //フィールドの開始ポインタ
@@ -116,20 +190,13 @@ public:
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        if (object != nullptr) {
-            //参照カウントを一つ増やす
-            ((atomic_size_t*) &object->reference_count)->fetch_add(1, memory_order_relaxed);
-        }
-        
-        //スピンロックを使用してフィールドのオブジェクトを不可分的に入れ替える
-        this->lock();
-        auto* field_old_object = *field_ptr;
-        *field_ptr = object;
-        this->unlock();
+        //exchange によりフィールドのオブジェクトを不可分的に入れ替える
+        auto* field_old_object = ((atomic<HeapObject*>*) field_ptr)->exchange(object, memory_order_seq_cst);
 
         if (field_old_object != nullptr) {
-            //デストラクタを呼び出し、既に挿入されていたオブジェクトの参照カウントを一つ減らす
-            ThreadSafeRC rc(field_old_object);
+            //他のスレッドが get_object でロードしたまま参照カウントを増やしていない可能性があるため、
+            //既に挿入されていたオブジェクトの参照カウントはそのスレッドが抜けた後で減らす
+            epoch_retire(field_old_object, release_retired_reference);
         }
     }
 
@@ -143,15 +210,26 @@ public:
         //対象となるフィールドのポインタ
         auto** field_ptr = field_start_ptr + field_index;
 
-        //スピンロックを使用して以下の操作を不可分的に行う
+        //エポックのクリティカルセクション内で以下の操作を行う
         // 1. フィールドからロード
         // 2. ロードしたオブジェクトの参照カウントを一つ増やす
-        this->lock();
-        auto* field_object = *field_ptr;
+        //他のスレッドの set_object で取り除かれたとしても、参照カウントはこのスレッドが抜けるまで減らされない
+#if DEFERRED_REFERENCE_COUNT
+        //遅延区間はそのままクリティカルセクションとなる
+        auto* record = deferred_window_enter();
+        auto* field_object = ((atomic<HeapObject*>*) field_ptr)->load(memory_order_acquire);
+        if (field_object != nullptr) {
+            deferred_buffer_record(field_object, 1, release_retired_reference);
+        }
+        deferred_window_exit(record);
+#else
+        auto* record = epoch_enter();
+        auto* field_object = ((atomic<HeapObject*>*) field_ptr)->load(memory_order_acquire);
         if (field_object != nullptr) {
-            ((atomic_size_t*) &field_object->reference_count)->fetch_add(1, memory_order_relaxed);
+            field_object->atomic_increment_reference_count();
         }
-        this->unlock();
+        epoch_exit(record);
+#endif
 
         if (field_object == nullptr) {
             return nullopt;
@@ -160,4 +238,29 @@ public:
         }
     }
 
+    /**
+     * オブジェクトのペイロード(ポインタでない値を格納する領域)の開始ポインタを取得
+     * ペイロードへの読み書きは同期されないため、複数のスレッドから書き換える場合は lock() 等で保護する必要がある
+     */
+    inline void* get_payload() {
+        return this->object_ref->get_payload();
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+    /**
+     * 参照カウントを変更せずに所有権を手放し、オブジェクト本体へのポインタを返す
+     * 返したポインタの参照カウントは呼び出し元が責任を持って減らす必要がある
+     */
+    inline HeapObject* release_heap_object() {
+        auto* object_ref = this->object_ref;
+        this->object_ref = nullptr;
+        return object_ref;
+    }
+
 };
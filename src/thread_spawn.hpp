@@ -0,0 +1,204 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "heap_object.hpp"
+#include "dynamic_rc.hpp"
+#include "thread_safe_rc.hpp"
+#include "typed_object.hpp"
+#include "unique_transfer.hpp"
+
+using namespace std;
+
+
+/**
+ * スレッドの起動、グローバル変数、所有権の受け渡しで is_mutex を true にする処理をまとめたもの
+ *
+ * "dynamic_rc.hpp"の自明な事柄1.の通り、オブジェクトが複数のスレッドから"直接"アクセスされうるのは
+ * グローバル変数オブジェクトとスレッドの起動時に渡す引数だけであり、処理系はそこへ is_mutex を true にするコードを挿入する(アプローチ1.)。
+ * この実装にはコンパイラがないため、ベンチマーク等では to_mutex() や DynamicRC(..., true) を手で呼び出していた。
+ * ここではその箇所を以下の三つにまとめる。
+ *
+ *  + spawn(func, args...)
+ *    args をこのスレッドでコピー若しくはムーブしてから、DynamicRC(optional、TypedObject、reference_wrapper を含む)の引数以下の
+ *    is_mutex を true にし、その後でスレッドを起動して func(args...) を呼び出す。
+ *    is_mutex の書き込みはスレッドの起動より前に行われるため、起動したスレッドは通常の load で true を読める。
+ *    ラムダ式のキャプチャは検査できないため、他のスレッドへ渡すオブジェクトは引数として渡す必要がある。
+ *
+ *  + SharedGlobal<RC>
+ *    グローバル変数オブジェクト(前提条件3.)。作成時に is_mutex を true にし、フィールドへの挿入は set_object により伝搬させる。
+ *    他のスレッドを起動する前に作成する必要がある(静的変数の初期化やスレッドの起動前の main 等)。
+ *
+ *  + send(rc) と Sendable<RC>
+ *    ハンドルをムーブして他のスレッドへ渡す場合、送るオブジェクト以下を送ったスレッドが参照していなければ、
+ *    受け取ったスレッドだけがアクセスするため is_mutex を true にする必要はない。
+ *    send は rc 以下の is_mutex が false のオブジェクトを辿り、辿ってきたフィールドか rc のハンドルからしか参照されていないものは
+ *    ローカルのまま残し、それ以外から参照されているものだけをその場で to_mutex() する(条件は"unique_transfer.hpp"を参照)。
+ *    送った後は rc のハンドルが消えるため、ローカルのまま残したオブジェクトには受け取ったスレッドしか到達できない。
+ *    Sendable はムーブのみ可能であり、スレッド間の受け渡し(キューへの挿入等)は受け渡し側の同期処理(mutex 等)の release/acquire に依存する。
+ *    mutex なオブジェクトのフィールドを経由して受け渡す場合は、DynamicRC::transfer_object を使用する。
+ */
+
+
+/**
+ * send で他のスレッドへ送るハンドル
+ * ムーブのみ可能であり、受け取ったスレッドは into_handle() でハンドルを取り出す
+ */
+template<typename RC = DynamicRC>
+class Sendable {
+
+private:
+    //送るハンドル
+    RC rc;
+
+    inline explicit Sendable(RC&& rc) : rc(move(rc)) {}
+
+    friend Sendable<DynamicRC> send(DynamicRC&& rc);
+    friend Sendable<ThreadSafeRC> send(ThreadSafeRC&& rc);
+
+public:
+    Sendable(const Sendable&) = delete;
+    Sendable& operator=(const Sendable&) = delete;
+    Sendable(Sendable&&) noexcept = default;
+    Sendable& operator=(Sendable&&) noexcept = default;
+
+    /**
+     * 送られたハンドルを取り出す(このオブジェクトはムーブ済みとなる)
+     */
+    inline RC into_handle() && {
+        return move(this->rc);
+    }
+
+};
+
+/**
+ * rc を他のスレッドへ送れる状態にして Sendable に包む
+ * rc 以下で送るスレッドから参照されていない部分は is_mutex を false のまま送る
+ */
+inline Sendable<DynamicRC> send(DynamicRC&& rc) {
+    transfer_prepare_heap_object_graph(rc.get_heap_object());
+    return Sendable<DynamicRC>(move(rc));
+}
+
+/**
+ * rc を Sendable に包む(スレッドセーフな参照カウントでは常にそのまま送れる)
+ */
+inline Sendable<ThreadSafeRC> send(ThreadSafeRC&& rc) {
+    return Sendable<ThreadSafeRC>(move(rc));
+}
+
+
+/**
+ * spawn に渡された引数を、起動するスレッドからアクセスされうるものとしてマークする
+ * DynamicRC 以外の引数(スレッドセーフな参照カウントや Sendable を含む)は何もしない
+ */
+template<typename T>
+inline void spawn_mark_argument(T&) {}
+
+inline void spawn_mark_argument(DynamicRC& rc) {
+    rc.to_mutex();
+}
+
+inline void spawn_mark_argument(optional<DynamicRC>& rc) {
+    if (rc.has_value()) {
+        rc.value().to_mutex();
+    }
+}
+
+template<size_t FIELD_LENGTH, typename Payload>
+inline void spawn_mark_argument(TypedObject<FIELD_LENGTH, Payload, DynamicRC>& object) {
+    object.to_mutex();
+}
+
+template<typename T>
+inline void spawn_mark_argument(reference_wrapper<T>& reference) {
+    spawn_mark_argument(reference.get());
+}
+
+/**
+ * スレッドを起動して func(args...) を呼び出す
+ * 引数のオブジェクト以下の is_mutex は起動前に true にする(アプローチ1.)
+ */
+template<typename F, typename... Args>
+inline thread spawn(F&& func, Args&&... args) {
+    //引数はこのスレッドでコピー若しくはムーブしてからマークする
+    auto arguments = make_tuple(decay_t<Args>(forward<Args>(args))...);
+    apply([](auto&... argument) { (spawn_mark_argument(argument), ...); }, arguments);
+
+    return thread([func = forward<F>(func), arguments = move(arguments)]() mutable {
+        apply(func, move(arguments));
+    });
+}
+
+
+/**
+ * グローバル変数オブジェクト(複数のスレッドから直接アクセス可能な変数)
+ * field_length 個の変数をフィールドとして持ち、作成時から複数のスレッドからアクセスされうるものとしてマークする
+ */
+template<typename RC = DynamicRC>
+class SharedGlobal {
+
+private:
+    //変数オブジェクト
+    RC rc;
+
+    static inline RC create(size_t field_length) {
+        if constexpr (is_same_v<RC, DynamicRC>) {
+            return RC(alloc_heap_object(field_length), true);
+        } else {
+            return RC(alloc_heap_object(field_length));
+        }
+    }
+
+public:
+    /**
+     * field_length 個の変数を持つグローバル変数オブジェクトを作成
+     */
+    inline explicit SharedGlobal(size_t field_length = 1) : rc(create(field_length)) {}
+
+    SharedGlobal(const SharedGlobal&) = delete;
+    SharedGlobal& operator=(const SharedGlobal&) = delete;
+
+    /**
+     * 指定された番号の変数にオブジェクト若くは nullopt を代入
+     * オブジェクト以下の is_mutex は代入前に true に伝搬される
+     */
+    inline void set_object(size_t field_index, optional<RC> rc) {
+        this->rc.set_object(field_index, move(rc));
+    }
+
+    /**
+     * 指定された番号の変数のオブジェクトを取得
+     */
+    inline optional<RC> get_object(size_t field_index) {
+        return this->rc.get_object(field_index);
+    }
+
+    /**
+     * 変数オブジェクトのスピンロックを取得
+     */
+    inline void lock() {
+        this->rc.lock();
+    }
+
+    /**
+     * 変数オブジェクトのスピンロックを解放
+     */
+    inline void unlock() {
+        this->rc.unlock();
+    }
+
+    /**
+     * 変数オブジェクトのハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+};
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <optional>
+#include "heap_object.hpp"
+#include "dynamic_rc.hpp"
+
+using namespace std;
+
+
+/**
+ * フィールドの数とペイロードの型をコンパイル時に固定したオブジェクトのハンドル
+ * 
+ * 通常のハンドル(DynamicRC 等)はフィールドの長さをヘッダから実行時に読み取るため、
+ * フィールドの番号の範囲チェックはできず、解放や is_mutex の伝搬のループも展開されない。
+ * TypedObject はハンドル RC を包み、オブジェクトの形(フィールドの数 FIELD_LENGTH とペイロードの型 Payload)を型として持つことで
+ *  + get<I>() / set<I>() のフィールドの番号をコンパイル時にチェックする
+ *  + ペイロードのオフセットを定数にし、ヘッダを読まずにアクセスする
+ *  + デストラクタと to_mutex() のフィールドを処理するループを展開する
+ * を行う。オブジェクトのヘッダやメモリ上の配置は通常のハンドルで作成したものと全く同じであり、
+ * フィールドには形の異なるオブジェクトも格納できる(その場合、そのオブジェクトは通常のループで処理される)。
+ * 
+ * Payload が void の場合はペイロードを持たない。
+ * ペイロードは0で初期化されるため、Payload はトリビアルにコピー可能な型である必要がある。
+ */
+template<size_t FIELD_LENGTH, typename Payload = void, typename RC = DynamicRC>
+class TypedObject {
+
+    static_assert(FIELD_LENGTH != 0, "TypedObject must have at least one field");
+    static_assert(is_void_v<Payload> || is_trivially_copyable_v<Payload>, "Payload must be trivially copyable");
+
+public:
+    //フィールドの数
+    static constexpr size_t field_length = FIELD_LENGTH;
+    //ペイロードの大きさ
+    static constexpr size_t payload_size = []() -> size_t {
+        if constexpr (is_void_v<Payload>) {
+            return 0;
+        } else {
+            return sizeof(Payload);
+        }
+    }();
+
+private:
+    //包んでいるハンドル
+    RC rc;
+
+    /**
+     * ペイロードの開始ポインタ
+     * フィールドの長さが定数であるため、ヘッダを読まずに求められる
+     */
+    inline void* payload_ptr() const {
+        return (HeapObject**) (this->rc.get_heap_object() + 1) + FIELD_LENGTH;
+    }
+
+public:
+    /**
+     * この形のオブジェクトを新しく割り当てて初期化
+     */
+    inline TypedObject() : rc(alloc_heap_object(ObjectLayout { FIELD_LENGTH, payload_size })) {}
+
+    /**
+     * 既存のハンドルを包む
+     * ハンドルのオブジェクトはこの形で割り当てられている必要がある
+     */
+    inline explicit TypedObject(RC rc) : rc(move(rc)) {
+        #if RC_VALIDATION
+            //形が一致しない場合は不正
+            auto* object = this->rc.get_heap_object();
+            if (object->get_field_length() != FIELD_LENGTH || object->get_payload_size() != payload_size) {
+                abort();
+            }
+        #endif
+    }
+
+    TypedObject(const TypedObject&) = default;
+    TypedObject(TypedObject&&) noexcept = default;
+    TypedObject& operator=(const TypedObject&) = default;
+    TypedObject& operator=(TypedObject&&) noexcept = default;
+
+    /**
+     * デストラクタ
+     * 参照カウントが0になった場合は、この形に特殊化した処理でフィールド以下のオブジェクトを解放する
+     */
+    inline ~TypedObject() {
+        auto* object = this->rc.release_heap_object();
+
+        //ムーブ済みであれば何もしない
+        if (object == nullptr) {
+            return;
+        }
+
+        if constexpr (requires { RC::is_deferred(object); }) {
+            if (RC::is_deferred(object)) {
+                //参照カウントの増減を遅らせている場合は、ハンドルのデストラクタで減らす("deferred_rc.hpp"を参照)
+                RC rc(object);
+                return;
+            }
+        }
+
+        if (RC::release_reference(object)) {
+            //関数ポインタではなくラムダ式で渡すことで、展開したループ内で参照カウントを減らす処理がインライン化されるようにする
+            free_heap_object_graph_shaped<FIELD_LENGTH>(object, [](HeapObject* field_object) {
+                return RC::release_reference(field_object);
+            });
+        }
+    }
+
+
+    /**
+     * I 番目のフィールドにあるオブジェクトを取得
+     * フィールドのオブジェクトの形は分からないため、通常のハンドルとして返す
+     */
+    template<size_t I>
+    inline optional<RC> get() {
+        static_assert(I < FIELD_LENGTH, "field index out of range");
+        return this->rc.get_object(I);
+    }
+
+    /**
+     * I 番目のフィールドにオブジェクト若くは nullopt を挿入
+     */
+    template<size_t I>
+    inline void set(optional<RC> object) {
+        static_assert(I < FIELD_LENGTH, "field index out of range");
+        this->rc.set_object(I, move(object));
+    }
+
+    /**
+     * I 番目のフィールドに形の分かっているオブジェクトを挿入
+     * このオブジェクトが mutex である場合は、挿入するオブジェクトの形に特殊化した処理で is_mutex を伝搬させる
+     */
+    template<size_t I, size_t CHILD_FIELD_LENGTH, typename ChildPayload>
+    inline void set(TypedObject<CHILD_FIELD_LENGTH, ChildPayload, RC> object) {
+        static_assert(I < FIELD_LENGTH, "field index out of range");
+        if constexpr (is_same_v<RC, DynamicRC>) {
+            if (this->rc.get_heap_object()->get_is_mutex()) {
+                object.to_mutex();
+            }
+        }
+        this->rc.set_object(I, move(object).into_handle());
+    }
+
+    /**
+     * ペイロードへの参照を取得
+     * ペイロードへの読み書きは同期されないため、複数のスレッドから書き換える場合は lock() 等で保護する必要がある
+     */
+    template<typename P = Payload> requires (!is_void_v<P>)
+    inline P& payload() {
+        return *(P*) this->payload_ptr();
+    }
+
+    /**
+     * このオブジェクト以下の is_mutex を true に伝搬させる
+     * フィールドの長さが FIELD_LENGTH であるオブジェクトは展開されたループで処理される
+     */
+    inline void to_mutex() {
+        this->rc.get_heap_object()->template to_mutex<FIELD_LENGTH>();
+    }
+
+    /**
+     * 包んでいるハンドルを取得
+     */
+    inline RC& handle() {
+        return this->rc;
+    }
+
+    /**
+     * 包んでいるハンドルを取り出す(このオブジェクトはムーブ済みとなる)
+     */
+    inline RC into_handle() && {
+        return move(this->rc);
+    }
+
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include "heap_object.hpp"
+
+using namespace std;
+
+
+/**
+ * 一意な所有権の受け渡し(DynamicRC::transfer_object / take_transferred_object と send が使用する)
+ *
+ * mutex なオブジェクトのフィールドへ set_object で挿入すると、挿入するオブジェクト以下は全て is_mutex が true になる(アプローチ2.)。
+ * 生産者が作成したオブジェクトをキュー等を経由して一つの消費者へ渡すだけの場合、受け取った消費者以外はそのオブジェクトに触れないにも関わらず、
+ * 消費者はその後の全ての操作を atomic-read-modify-write で行うことになる。
+ * そこで、渡すスレッドが唯一の参照を手放す場合に限り、is_mutex を false のまま一つのスレッドへ受け渡す。
+ *
+ * >>> ローカルのまま渡せる条件
+ * is_mutex が false のオブジェクトは一つのスレッドからしか参照されていない(アプローチ3.)ため、参照カウントは渡すスレッドの
+ * ハンドルとローカルなオブジェクトのフィールドからの参照の合計である。根の参照カウントが1であれば渡すハンドル以外に参照はなく、
+ * 参照カウントが1のオブジェクトのフィールドから参照されている参照カウントが1のオブジェクトも同様に、そのフィールド以外から参照されていない。
+ * 二つ以上の経路から参照されているオブジェクト(渡すオブジェクト以下で共有された部分や、渡すスレッドの他のハンドルから参照されている部分)は
+ * 渡した後も渡したスレッドから到達できる可能性があるため、その場で to_mutex() する。
+ * is_mutex が true のオブジェクトより先は元から複数のスレッドからアクセスできるため辿らない。
+ * 弱参照を使用する場合は、弱参照の数も1(強参照の分だけ)であることを確かめる。
+ * 遅延参照カウントではローカルなオブジェクトの参照カウントは遅らせないため、そのまま読める。
+ * 遅延伝搬("lazy_promotion.hpp")の不変条件2.より、ローカルなオブジェクトのフィールドは公開中のオブジェクトを指さないため、辿る途中で触れることはない。
+ *
+ * >>> 受け渡し中のフィールド
+ * transfer_object は mutex なオブジェクトのフィールドへ、is_mutex が false のオブジェクトを挿入する。
+ * これはアプローチ2.の「mutex なオブジェクト以下は全て mutex」の例外であり、以下を呼び出し元が守る必要がある。
+ *  + 受け渡し中のフィールドは take_transferred_object でのみ取り出し、get_object 等で読み込まない
+ *  + 一つの受け渡しにつき取り出すのは一つのスレッドだけである(exchange で取り出すため、同時に呼び出しても一つのスレッドだけが受け取る)
+ * 挿入の exchange の release と取り出しの exchange の acquire により、渡したスレッドの書き込みは受け取ったスレッドから見える。
+ * 取り出したスレッドはフィールドの参照をそのままハンドルとして受け取るため、参照カウントは変更しない。
+ * 他のスレッドは受け渡し中のオブジェクトのハンドルを作らないため、エポックを経由せずに受け取れる。
+ * 受け渡し中のまま mutex なオブジェクトが解放された場合や、フィールドが上書きされた場合は、解放するスレッドがフィールドの唯一の参照を
+ * is_mutex に従って減らすため、通常の命令でも競合しない。
+ *
+ * 循環参照の回収では、回収中のスレッドが候補から辿ったオブジェクトの参照カウントを一時的に書き換えるため、
+ * 受け渡し中のオブジェクトに触れると受け取ったスレッドと競合する。そのため CYCLE_COLLECTION が true の場合、
+ * transfer_object は set_object と、take_transferred_object は take_object と同じ動作となる。
+ * (候補のバッファに入っているオブジェクトは、バッファが持つ参照の分だけ参照カウントが2以上となるため、send でも to_mutex() される。
+ *  ローカルのまま送りたい場合は、送る前に collect_cycles() で候補を取り除いておく)
+ */
+
+
+/**
+ * 受け渡すローカルなオブジェクトが、辿ってきた経路以外から参照されていないかどうか
+ */
+inline bool transfer_is_unique(HeapObject* object) {
+    if (object->get_reference_count() != 1) {
+        return false;
+    }
+#if WEAK_REFERENCE
+    //弱参照の数は、強参照をまとめた一つだけでなければならない
+    if (object->atomic_load_weak_count(memory_order_relaxed) != 1) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+/**
+ * root 以下を、root への唯一の参照を手放して他のスレッドへ受け渡せる状態にする
+ * 辿ってきた経路以外からも参照されているローカルなオブジェクト以下のみを to_mutex() する
+ */
+inline void transfer_prepare_heap_object_graph(HeapObject* root) {
+    if (root->get_is_mutex()) {
+        return;
+    }
+    if (!transfer_is_unique(root)) {
+        root->to_mutex();
+        return;
+    }
+
+    //ローカルのまま残すオブジェクトのうち、まだフィールドを辿っていないものを積むスタック
+    static thread_local vector<HeapObject*> transfer_stack;
+    transfer_stack.push_back(root);
+
+    while (!transfer_stack.empty()) {
+        auto* object = transfer_stack.back();
+        transfer_stack.pop_back();
+
+        auto** field_start_ptr = (HeapObject**) (object + 1);
+        for (size_t field_index = 0; field_index < object->get_field_length(); field_index++) {
+            auto* field_object = *(field_start_ptr + field_index);
+            if (field_object == nullptr || field_object->get_is_mutex()) {
+                continue;
+            }
+            if (transfer_is_unique(field_object)) {
+                transfer_stack.push_back(field_object);
+            } else {
+                field_object->to_mutex();
+            }
+        }
+    }
+}
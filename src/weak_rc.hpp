@@ -0,0 +1,288 @@
+#pragma once
+
+#include "heap_object.hpp"
+#include "dynamic_rc.hpp"
+#include "thread_safe_rc.hpp"
+
+
+/**
+ * 弱参照(WEAK_REFERENCE が true の場合に使用できる)
+ *
+ * 弱参照はオブジェクトを所有せず、参照カウントを増やさない。そのため、キャッシュや木構造の親への参照のように
+ * 強参照にすると循環参照になったり、不要になったオブジェクトを生存させ続けてしまう参照に使用する。
+ * upgrade() により、オブジェクトがまだ生存していれば強参照(ハンドル)を得られる。
+ *
+ * >>> 弱参照の数
+ * 弱参照は解放されたオブジェクトのヘッダを読むため、ヘッダのメモリは最後の弱参照が破棄されるまで解放できない。
+ * そこで、ヘッダに参照カウントとは別に弱参照の数を持たせ、
+ *  + 参照カウントが0になった時点でフィールド以下のオブジェクトを解放する(フィールドの参照カウントを減らす)
+ *  + 弱参照の数が0になった時点でオブジェクトのメモリを解放する
+ * とする。弱参照の数は、参照カウントが0でない間は全ての強参照をまとめて一つと数え、参照カウントが0になった時にその分を減らす。
+ * 弱参照の数がその時点で1であれば、弱参照は存在せず新しく作られることもないため、atomic-read-modify-write なしにそのまま解放できる。
+ * (詳細は"heap_object.hpp"の free_dead_heap_object を参照)
+ *
+ * >>> upgrade()
+ * 参照カウントが0になった後に増やしてはならないため、
+ *  + is_mutex が true のオブジェクト(と ThreadSafeRC)は、compare-and-swap により0でない場合にのみ増やす
+ *  + is_mutex が false のオブジェクトは他のスレッドから触れられないため、通常の命令で読み込んで0でなければ増やす
+ * 解放中のオブジェクトの参照カウントの領域は作業用に使用されるため、HEAP_OBJECT_DEAD_BIT が立っている値も0と同様に扱う。
+ *
+ * 弱参照の数の増減も参照カウントと同じく、is_mutex が false のオブジェクトでは通常の命令で行う。
+ * ヘッダが8バイト大きくなるため、WEAK_REFERENCE が false の場合はヘッダに弱参照の数を持たず、弱参照も使用できない。
+ *
+ * 参考
+ *  + https://github.com/rust-lang/rust/blob/master/library/alloc/src/sync.rs (Arc と Weak)
+ */
+
+
+#if WEAK_REFERENCE
+
+/**
+ * DynamicRC のオブジェクトへの弱参照
+ */
+class WeakDynamicRC {
+
+private:
+    //オブジェクト本体へのポインタ
+    HeapObject* object_ref;
+
+public:
+    /**
+     * 強参照から弱参照を作成
+     */
+    inline explicit WeakDynamicRC(const DynamicRC& rc) {
+        auto* object_ref = rc.get_heap_object();
+        increment_weak_count(object_ref);
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * コピーコンストラクタ
+     * コピー時に弱参照の数を一つ増やす
+     */
+    inline WeakDynamicRC(const WeakDynamicRC& weak) {
+        auto* object_ref = weak.object_ref;
+        increment_weak_count(object_ref);
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので弱参照の数は変更しない
+     */
+    inline WeakDynamicRC(WeakDynamicRC&& weak) noexcept {
+        this->object_ref = weak.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        weak.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline WeakDynamicRC& operator=(const WeakDynamicRC& weak) {
+        WeakDynamicRC copied(weak);
+        swap(this->object_ref, copied.object_ref);
+        //元のオブジェクトは copied のデストラクタで弱参照の数が一つ減らされる
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     */
+    inline WeakDynamicRC& operator=(WeakDynamicRC&& weak) noexcept {
+        WeakDynamicRC moved(move(weak));
+        swap(this->object_ref, moved.object_ref);
+        //元のオブジェクトは moved のデストラクタで弱参照の数が一つ減らされる
+        return *this;
+    }
+
+    /**
+     * デストラクタ
+     * 弱参照の数を一つ減らし、0になった場合はオブジェクトのメモリを解放する
+     */
+    inline ~WeakDynamicRC() {
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
+        size_t previous_weak_count;
+
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (this->object_ref->get_is_mutex()) {
+            previous_weak_count = this->object_ref->atomic_decrement_weak_count();
+            if (previous_weak_count == 1) {
+                //他のスレッドでの変更を取得
+                atomic_thread_fence(memory_order_acquire);
+            }
+        } else {
+            previous_weak_count = this->object_ref->decrement_weak_count();
+        }
+
+        if (previous_weak_count == 1) {
+            //参照カウントは既に0であり、フィールド以下のオブジェクトも解放されているため、メモリだけを解放する
+            free_heap_object(this->object_ref);
+        }
+    }
+
+
+    /**
+     * オブジェクトが生存していれば、その強参照を返す
+     */
+    inline optional<DynamicRC> upgrade() const {
+        auto* object_ref = this->object_ref;
+
+        //このオブジェクトが複数のスレッドからアクセスされる可能性があるかどうか
+        if (object_ref->get_is_mutex()) {
+            //可能性がある場合、他のスレッドが参照カウントを0にするのと競合するため compare-and-swap で増やす
+            if (!object_ref->atomic_increment_reference_count_if_alive()) {
+                return nullopt;
+            }
+        } else {
+            //そうでない場合は、通常の命令で読み込んで増やす
+            if (!HeapObject::is_alive_reference_count(object_ref->get_reference_count())) {
+                return nullopt;
+            }
+            object_ref->increment_reference_count();
+        }
+
+        return DynamicRC(object_ref);
+    }
+
+    /**
+     * オブジェクトが既に解放された(参照カウントが0になった)かどうか
+     * false を返した場合でも、直後に他のスレッドが解放する可能性がある
+     */
+    inline bool expired() const {
+        return !HeapObject::is_alive_reference_count(this->object_ref->atomic_load_reference_count(memory_order_relaxed));
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+private:
+    /**
+     * 弱参照の数を一つ増やす
+     */
+    static inline void increment_weak_count(HeapObject* object_ref) {
+        if (object_ref->get_is_mutex()) {
+            object_ref->atomic_increment_weak_count();
+        } else {
+            object_ref->increment_weak_count();
+        }
+    }
+
+};
+
+
+/**
+ * ThreadSafeRC のオブジェクトへの弱参照
+ * 弱参照の数の増減と upgrade() は常に atomic に行う
+ */
+class WeakThreadSafeRC {
+
+private:
+    //オブジェクト本体へのポインタ
+    HeapObject* object_ref;
+
+public:
+    /**
+     * 強参照から弱参照を作成
+     */
+    inline explicit WeakThreadSafeRC(const ThreadSafeRC& rc) {
+        auto* object_ref = rc.get_heap_object();
+        object_ref->atomic_increment_weak_count();
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * コピーコンストラクタ
+     * コピー時に弱参照の数を一つ増やす
+     */
+    inline WeakThreadSafeRC(const WeakThreadSafeRC& weak) {
+        auto* object_ref = weak.object_ref;
+        object_ref->atomic_increment_weak_count();
+        this->object_ref = object_ref;
+    }
+
+    /**
+     * ムーブコンストラクタ
+     * 所有権を移すだけなので弱参照の数は変更しない
+     */
+    inline WeakThreadSafeRC(WeakThreadSafeRC&& weak) noexcept {
+        this->object_ref = weak.object_ref;
+        //ムーブ元はデストラクタで何もしないようにする
+        weak.object_ref = nullptr;
+    }
+
+    /**
+     * コピー代入演算子
+     */
+    inline WeakThreadSafeRC& operator=(const WeakThreadSafeRC& weak) {
+        WeakThreadSafeRC copied(weak);
+        swap(this->object_ref, copied.object_ref);
+        //元のオブジェクトは copied のデストラクタで弱参照の数が一つ減らされる
+        return *this;
+    }
+
+    /**
+     * ムーブ代入演算子
+     */
+    inline WeakThreadSafeRC& operator=(WeakThreadSafeRC&& weak) noexcept {
+        WeakThreadSafeRC moved(move(weak));
+        swap(this->object_ref, moved.object_ref);
+        //元のオブジェクトは moved のデストラクタで弱参照の数が一つ減らされる
+        return *this;
+    }
+
+    /**
+     * デストラクタ
+     * 弱参照の数を一つ減らし、0になった場合はオブジェクトのメモリを解放する
+     */
+    inline ~WeakThreadSafeRC() {
+        //ムーブ済みであれば何もしない
+        if (this->object_ref == nullptr) {
+            return;
+        }
+
+        if (this->object_ref->atomic_decrement_weak_count() == 1) {
+            //他のスレッドでの変更を取得
+            atomic_thread_fence(memory_order_acquire);
+            //参照カウントは既に0であり、フィールド以下のオブジェクトも解放されているため、メモリだけを解放する
+            free_heap_object(this->object_ref);
+        }
+    }
+
+
+    /**
+     * オブジェクトが生存していれば、その強参照を返す
+     */
+    inline optional<ThreadSafeRC> upgrade() const {
+        if (!this->object_ref->atomic_increment_reference_count_if_alive()) {
+            return nullopt;
+        }
+        return ThreadSafeRC(this->object_ref);
+    }
+
+    /**
+     * オブジェクトが既に解放された(参照カウントが0になった)かどうか
+     * false を返した場合でも、直後に他のスレッドが解放する可能性がある
+     */
+    inline bool expired() const {
+        return !HeapObject::is_alive_reference_count(this->object_ref->atomic_load_reference_count(memory_order_relaxed));
+    }
+
+    /**
+     * オブジェクト本体へのポインタを取得(参照カウントは変更しない)
+     */
+    inline HeapObject* get_heap_object() const {
+        return this->object_ref;
+    }
+
+};
+
+#endif
@@ -0,0 +1,263 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+using namespace std;
+
+
+/**
+ * ワークスティーリングを行うワーカースレッドのプール
+ * 並列解放("parallel_teardown.hpp")と is_mutex の並列伝搬("parallel_mark.hpp")が共通して使用する
+ *
+ * ワーカーはそれぞれタスクのキューを持ち、
+ *  + 自身のキューの末尾から取り出す
+ *  + 自身のキューが空であれば、他のワーカーのキューの先頭から盗む
+ * タスクの処理は派生クラスの run_task(queue_index, task) が行う(CRTP)。
+ * run_task の中で見つかった作業は、has_queued_task() が false であれば(待機しているワーカーがいる可能性があるため)
+ * push(queue_index, task) で自身のキューへ移して分け与える。
+ *
+ * タスクはそれぞれ WorkStealingJob を指し(Task は WorkStealingJob* job をメンバとして持つ)、
+ * キューへ入れてから run_task を終えるまでの間、その outstanding_count に数えられる。
+ * ワーカーはタスクを終える度に outstanding_count を acq_rel で減らし、wait(job) は0になったことを acquire で読むため、
+ * タスクの中での書き込みは wait(job) から戻った後の操作より前に起こる。
+ *
+ * ワーカーは最初にタスクが渡された時に起動する。
+ * ワーカーが派生クラスの run_task を呼び出さなくなるように、派生クラスのデストラクタで stop() を呼び出す必要がある。
+ */
+
+
+/**
+ * 一まとまりのタスクのうち、まだ終わっていないものの数
+ */
+struct WorkStealingJob {
+    atomic_size_t outstanding_count = 0;
+};
+
+
+/**
+ * ワーカーごとのタスクのキュー
+ * 所有者は末尾から、他のワーカーは先頭から取り出す
+ */
+template<typename Task>
+struct alignas(64) WorkStealingQueue {
+    mutex queue_mutex;
+    deque<Task> tasks;
+};
+
+
+template<typename Derived, typename Task>
+class WorkStealingPool {
+
+private:
+    //ワーカーの起動と停止を保護する
+    mutex control_mutex;
+    //ワーカーの数
+    size_t worker_count;
+    //ワーカーが起動しているかどうか
+    atomic_bool is_started = false;
+    vector<unique_ptr<WorkStealingQueue<Task>>> queues;
+    vector<thread> workers;
+
+    //待機しているワーカーと、タスクの終わりを待つスレッドを起こすために使用する
+    mutex sleep_mutex;
+    condition_variable work_available;
+    condition_variable work_finished;
+    bool is_stopping = false;
+
+    //キューに入っているタスクの数
+    atomic_size_t queued_count = 0;
+    //外部からタスクを渡すキューの番号(順番に割り振る)
+    atomic_size_t next_queue_index = 0;
+
+public:
+    inline explicit WorkStealingPool(size_t worker_count) : worker_count(worker_count) {}
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    /**
+     * ワーカーの数を取得
+     * 0 の場合はタスクを渡してはならない
+     */
+    inline size_t get_worker_count() {
+        return this->worker_count;
+    }
+
+    /**
+     * ワーカーの数を変更する
+     * 処理中のタスクを全て終えてからワーカーを停止し、次にタスクが渡された時に新しい数で起動する
+     * 他のスレッドがタスクを渡していない時に呼び出す必要がある
+     */
+    inline void set_worker_count(size_t worker_count) {
+        this->stop();
+        lock_guard<mutex> guard(this->control_mutex);
+        this->worker_count = worker_count;
+    }
+
+    /**
+     * タスクを渡す
+     */
+    inline void submit(Task task) {
+        if (!this->is_started.load(memory_order_acquire)) {
+            this->start();
+        }
+        auto queue_index = this->next_queue_index.fetch_add(1, memory_order_relaxed) % this->queues.size();
+        this->push(queue_index, task);
+    }
+
+    /**
+     * job のタスクが全て終わるまで待機する
+     */
+    inline void wait(WorkStealingJob& job) {
+        unique_lock<mutex> lock(this->sleep_mutex);
+        this->work_finished.wait(lock, [&]() { return job.outstanding_count.load(memory_order_acquire) == 0; });
+    }
+
+    /**
+     * job のタスクが全て終わるまで、呼び出したスレッドも他のワーカーのキューから盗んで処理する
+     */
+    inline void help_until_finished(WorkStealingJob& job) {
+        auto queue_index = this->next_queue_index.load(memory_order_relaxed) % this->queues.size();
+        while (job.outstanding_count.load(memory_order_acquire) != 0) {
+            Task task;
+            if (this->pop(queue_index, task)) {
+                this->run(queue_index, task);
+                continue;
+            }
+
+            //残りは他のワーカーが処理中であるため、終わるまで待つ
+            this->wait(job);
+        }
+    }
+
+protected:
+    /**
+     * 処理中のタスクを全て終えてからワーカーを停止する
+     * ワーカーはキューが全て空になるまで取り出し続けるため、処理中のタスクが分け与えたタスクも含めて全て終わる
+     */
+    inline void stop() {
+        lock_guard<mutex> guard(this->control_mutex);
+        if (!this->is_started.load(memory_order_relaxed)) {
+            return;
+        }
+
+        {
+            lock_guard<mutex> lock(this->sleep_mutex);
+            this->is_stopping = true;
+        }
+        this->work_available.notify_all();
+        for (auto& worker : this->workers) {
+            worker.join();
+        }
+        this->workers.clear();
+        this->queues.clear();
+        this->is_started.store(false, memory_order_relaxed);
+    }
+
+    /**
+     * queue_index 番目のキューの末尾へタスクを追加し、待機しているワーカーを起こす
+     */
+    inline void push(size_t queue_index, Task task) {
+        task.job->outstanding_count.fetch_add(1, memory_order_relaxed);
+        {
+            //待機し始める前のワーカーが増えたことを見逃さないように、ロックを取得してから増やす
+            //取り出したワーカーが減らすより先に増やしておく(キューに入っている数を下回らないようにする)
+            lock_guard<mutex> lock(this->sleep_mutex);
+            this->queued_count.fetch_add(1, memory_order_relaxed);
+        }
+        {
+            auto& queue = *this->queues[queue_index];
+            lock_guard<mutex> guard(queue.queue_mutex);
+            queue.tasks.push_back(task);
+        }
+        this->work_available.notify_one();
+    }
+
+    /**
+     * キューに入っているタスクがあるかどうか
+     * false であれば、待機しているワーカーがいる可能性がある
+     */
+    inline bool has_queued_task() {
+        return this->queued_count.load(memory_order_relaxed) != 0;
+    }
+
+private:
+    inline void start() {
+        lock_guard<mutex> guard(this->control_mutex);
+        if (this->is_started.load(memory_order_relaxed)) {
+            return;
+        }
+
+        this->is_stopping = false;
+        for (size_t i = 0; i < this->worker_count; i++) {
+            this->queues.push_back(make_unique<WorkStealingQueue<Task>>());
+        }
+        for (size_t i = 0; i < this->worker_count; i++) {
+            this->workers.push_back(thread([this, i]() { this->run_worker(i); }));
+        }
+        this->is_started.store(true, memory_order_release);
+    }
+
+    /**
+     * queue_index 番目のキューの末尾から、空であれば他のキューの先頭からタスクを取り出す
+     */
+    inline bool pop(size_t queue_index, Task& task) {
+        auto queue_count = this->queues.size();
+        for (size_t i = 0; i < queue_count; i++) {
+            auto& queue = *this->queues[(queue_index + i) % queue_count];
+            lock_guard<mutex> guard(queue.queue_mutex);
+            if (queue.tasks.empty()) {
+                continue;
+            }
+            if (i == 0) {
+                task = queue.tasks.back();
+                queue.tasks.pop_back();
+            } else {
+                task = queue.tasks.front();
+                queue.tasks.pop_front();
+            }
+            this->queued_count.fetch_sub(1, memory_order_relaxed);
+            return true;
+        }
+        return false;
+    }
+
+    /**
+     * タスクを処理し、終わったことを job の終わりを待つスレッドへ伝える
+     */
+    inline void run(size_t queue_index, Task task) {
+        auto* job = task.job;
+        static_cast<Derived*>(this)->run_task(queue_index, task);
+
+        if (job->outstanding_count.fetch_sub(1, memory_order_acq_rel) == 1) {
+            lock_guard<mutex> lock(this->sleep_mutex);
+            this->work_finished.notify_all();
+        }
+    }
+
+    inline void run_worker(size_t worker_index) {
+        while (true) {
+            Task task;
+            if (this->pop(worker_index, task)) {
+                this->run(worker_index, task);
+                continue;
+            }
+
+            unique_lock<mutex> lock(this->sleep_mutex);
+            this->work_available.wait(lock, [this]() {
+                return this->is_stopping || this->queued_count.load(memory_order_relaxed) != 0;
+            });
+            if (this->is_stopping && this->queued_count.load(memory_order_relaxed) == 0) {
+                return;
+            }
+        }
+    }
+
+};